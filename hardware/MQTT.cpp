@@ -98,7 +98,10 @@ void MQTT::on_connect(int rc)
 			_log.Log(LOG_STATUS, "MQTT: connected to: %s:%d", m_szIPAddress.c_str(), m_usIPPort);
 			m_IsConnected = true;
 			sOnConnected(this);
-			m_sDeviceReceivedConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&MQTT::SendDeviceInfo, this, _1, _2, _3, _4));
+			//messages are built from the current state of the device, a pending update is enough
+			m_deviceSubscription = m_mainworker.m_deviceEventBus.Subscribe("MQTT_" + std::to_string(m_HwdID), [this](const CDeviceEventBus::_tDeviceEvent &event) {
+				SendDeviceInfo(event.HardwareID, event.DeviceRowIdx, event.DeviceName, NULL);
+			}, CDeviceEventBus::OVERFLOW_COALESCE);
 			m_sSwitchSceneConnection = m_mainworker.sOnSwitchScene.connect(boost::bind(&MQTT::SendSceneInfo, this, _1, _2));
 		}
 		subscribe(NULL, m_TopicIn.c_str());
@@ -556,8 +559,7 @@ void MQTT::Do_Work()
 			}
 		}
 	}
-	if (m_sDeviceReceivedConnection.connected())
-		m_sDeviceReceivedConnection.disconnect();
+	m_mainworker.m_deviceEventBus.Unsubscribe(m_deviceSubscription);
 	if (m_sSwitchSceneConnection.connected())
 		m_sSwitchSceneConnection.disconnect();
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "MySensorsBase.h"
+#include "../main/DeviceEventBus.h"
 #ifdef BUILTIN_MQTT
 #include "../MQTT/mosquittopp.h"
 #else
@@ -50,7 +51,7 @@ protected:
 	virtual void SendHeartbeat();
 	void WriteInt(const std::string &sendStr) override;
 	std::shared_ptr<std::thread> m_thread;
-	boost::signals2::connection m_sDeviceReceivedConnection;
+	CDeviceEventBus::subscription m_deviceSubscription;
 	boost::signals2::connection m_sSwitchSceneConnection;
 	enum _ePublishTopics {
 		PT_none 	  = 0x00,
@@ -412,6 +412,7 @@ void CSBFSpot::ImportOldMonthData(const uint64_t DevID, const int Year, const in
 		}
 	}
 	infile.close();
+	m_sql.RebuildMeterRollups(DevID);
 }
 
 int CSBFSpot::getSunRiseSunSetMinutes(const bool bGetSunRise)
@@ -66,8 +66,7 @@ namespace Plugins {
     // PyMODINIT_FUNC PyInit_DomoticzEvents(void);
 #endif // ENABLE_PYTHON
 
-	std::mutex PluginMutex;	// controls accessto the message queue and m_pPlugins map
-	std::queue<CPluginMessageBase*>	PluginMessageQueue;
+	std::mutex PluginMutex;	// controls access to the m_pPlugins map
 	boost::asio::io_service ios;
 
 	std::map<int, CDomoticzHardwareBase*>	CPluginSystem::m_pPlugins;
@@ -77,6 +76,7 @@ namespace Plugins {
 	{
 		m_bEnabled = false;
 		m_bAllPluginsStarted = false;
+		m_bDispatching = false;
 		m_iPollInterval = 10;
 		m_InitialPythonThread = NULL;
 	}
@@ -87,13 +87,7 @@ namespace Plugins {
 
 	bool CPluginSystem::StartPluginSystem()
 	{
-		// Flush the message queue (should already be empty)
 		std::lock_guard<std::mutex> l(PluginMutex);
-		while (!PluginMessageQueue.empty())
-		{
-			PluginMessageQueue.pop();
-		}
-
 		m_pPlugins.clear();
 
 		if (!Py_LoadLibrary())
@@ -171,19 +165,8 @@ namespace Plugins {
 			m_thread.reset();
 		}
 
-		// Hardware should already be stopped so just flush the queue (should already be empty)
+		// Hardware should already be stopped, the plugins flushed their own queues
 		std::lock_guard<std::mutex> l(PluginMutex);
-		while (!PluginMessageQueue.empty())
-		{
-			CPluginMessageBase* Message = PluginMessageQueue.front();
-			const CPlugin* pPlugin = Message->Plugin();
-			if (pPlugin)
-			{
-				_log.Log(LOG_NORM, "(" + pPlugin->m_Name + ") ' flushing " + std::string(Message->Name()) + "' queue entry");
-			}
-			PluginMessageQueue.pop();
-		}
-
 		m_pPlugins.clear();
 
 		if (Py_LoadLibrary() && m_InitialPythonThread)
@@ -288,6 +271,8 @@ namespace Plugins {
 			std::lock_guard<std::mutex> l(PluginMutex);
 			pPlugin = new CPlugin(HwdID, Name, PluginKey);
 			m_pPlugins.insert(std::pair<int, CPlugin*>(HwdID, pPlugin));
+			if (m_bDispatching)
+				pPlugin->StartDispatcher();
 		}
 		else
 		{
@@ -321,65 +306,42 @@ namespace Plugins {
 		boost::thread bt(boost::bind(&boost::asio::io_service::run, &ios));
 		SetThreadName(bt.native_handle(), "PluginMgr_IO");
 
-		while (!IsStopRequested(50))
+		// Every plugin processes its own queue from now on, plugins registered later start straight away
 		{
-			time_t	Now = time(0);
-			bool	bProcessed = true;
-			while (bProcessed)
+			std::lock_guard<std::mutex> l(PluginMutex);
+			m_bDispatching = true;
+			for (const auto &itt : m_pPlugins)
 			{
-				CPluginMessageBase* Message = NULL;
-				bProcessed = false;
+				if (itt.second)
+					reinterpret_cast<CPlugin*>(itt.second)->StartDispatcher();
+			}
+		}
 
-				// Cycle once through the queue looking for the 1st message that is ready to process
-				{
-					std::lock_guard<std::mutex> l(PluginMutex);
-					for (size_t i = 0; i < PluginMessageQueue.size(); i++)
-					{
-						CPluginMessageBase* FrontMessage = PluginMessageQueue.front();
-						PluginMessageQueue.pop();
-						if (!FrontMessage->m_Delay || FrontMessage->m_When <= Now)
-						{
-							// Message is ready now or was already ready (this is the case for almost all messages)
-							Message = FrontMessage;
-							break;
-						}
-						// Message is for sometime in the future so requeue it (this happens when the 'Delay' parameter is used on a Send)
-						PluginMessageQueue.push(FrontMessage);
-					}
-				}
+		// Nothing to poll, but the IO service work above must live until the plugin system stops
+		WaitForStopRequest();
 
-				if (Message)
-				{
-					bProcessed = true;
-					try
-					{
-						const CPlugin* pPlugin = Message->Plugin();
-						if (pPlugin && (pPlugin->m_bDebug & PDM_QUEUE))
-						{
-							_log.Log(LOG_NORM, "(" + pPlugin->m_Name + ") Processing '" + std::string(Message->Name()) + "' message");
-						}
-						Message->Process();
-					}
-					catch(...)
-					{
-						_log.Log(LOG_ERROR, "PluginSystem: Exception processing message.");
-					}
-				}
-				// Free the memory for the message
-				if (Message)
-				{
-					std::lock_guard<std::mutex> l(PythonMutex); // Take mutex to guard access to CPluginTransport::m_pConnection inside the message
-					CPlugin* pPlugin = (CPlugin*)Message->Plugin();
-					pPlugin->RestoreThread();
-					delete Message;
-					pPlugin->ReleaseThread();
-				}
-			}
+		{
+			std::lock_guard<std::mutex> l(PluginMutex);
+			m_bDispatching = false;
 		}
 
 		_log.Log(LOG_STATUS, "PluginSystem: Exiting work loop.");
 	}
 
+	void CPluginSystem::GetStatistics(std::vector<_tPluginQueueStats> &stats)
+	{
+		stats.clear();
+		std::lock_guard<std::mutex> l(PluginMutex);
+		for (const auto &itt : m_pPlugins)
+		{
+			if (!itt.second)
+				continue;
+			_tPluginQueueStats pstats;
+			reinterpret_cast<CPlugin*>(itt.second)->GetQueueStatistics(pstats);
+			stats.push_back(pstats);
+		}
+	}
+
 	void CPluginSystem::DeviceModified(uint64_t ID)
 	{
 		std::vector<std::vector<std::string> > result;
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "../../main/StoppableTask.h"
+#include <string>
+#include <vector>
+#include <cstdint>
 
 //
 //	Domoticz Plugin System - Dnpwwo, 2016
@@ -10,11 +13,26 @@ class CDomoticzHardwareBase;
 
 namespace Plugins {
 
+	struct _tPluginQueueStats
+	{
+		int HwdID;
+		std::string Name;
+		size_t Depth;				// messages waiting in the queue of the plugin
+		size_t MaxDepth;
+		uint64_t Processed;
+		double LastLatency;			// ms from queueing until the message was processed (not for delayed messages)
+		double MaxLatency;
+		double LastRunTime;			// ms the message (Python callback) took
+		double MaxRunTime;
+		std::string SlowestMessage;	// message that took MaxRunTime
+	};
+
 	class CPluginSystem : public StoppableTask
 	{
 	private:
 		bool	m_bEnabled;
 		bool	m_bAllPluginsStarted;
+		bool	m_bDispatching;		// plugins process their messages, set under PluginMutex
 		int		m_iPollInterval;
 
 		void*	m_InitialPythonThread;
@@ -41,6 +59,7 @@ namespace Plugins {
 		static void LoadSettings();
 		void	DeviceModified(uint64_t ID);
 		void*	PythonThread() { return m_InitialPythonThread; };
+		void	GetStatistics(std::vector<_tPluginQueueStats> &stats);
 	};
 };
 
@@ -2,6 +2,7 @@
 
 #include "DelayedLink.h"
 #include "Plugins.h"
+#include <chrono>
 
 #ifndef byte
 typedef unsigned char byte;
@@ -9,7 +10,25 @@ typedef unsigned char byte;
 
 namespace Plugins {
 
-	extern std::mutex PythonMutex;			// controls access to Python
+	extern std::mutex PythonMutex;			// controls access to the transports and the interpreters from other threads
+
+	// Threads other than the plugin dispatcher (transport IO, work loop, stop) hold PythonMutex and enter
+	// the plugin interpreter on a thread state of their own before they touch Python objects
+	class CPluginPythonLock
+	{
+	public:
+		CPluginPythonLock(CPlugin* pPlugin) : m_Lock(PythonMutex), m_pPlugin(pPlugin)
+		{
+			if (m_pPlugin) m_pPlugin->RestoreForeignThread();
+		};
+		~CPluginPythonLock()
+		{
+			if (m_pPlugin) m_pPlugin->ReleaseForeignThread();
+		};
+	private:
+		std::lock_guard<std::mutex>	m_Lock;
+		CPlugin*	m_pPlugin;
+	};
 
 	class CPluginMessageBase
 	{
@@ -22,20 +41,23 @@ namespace Plugins {
 		int			m_Unit;
 		bool		m_Delay;
 		time_t		m_When;
+		std::chrono::steady_clock::time_point	m_Queued;
 
 	protected:
 		CPluginMessageBase(CPlugin* pPlugin) : m_pPlugin(pPlugin), m_HwdID(pPlugin->m_HwdID), m_Unit(-1), m_Delay(false)
 		{
 			m_Name = __func__;
 			m_When = time(0);
+			m_Queued = std::chrono::steady_clock::now();
 		};
 		virtual void ProcessLocked() = 0;
 	public:
 		virtual const char* Name() { return m_Name.c_str(); };
 		virtual const CPlugin*	Plugin() { return m_pPlugin; };
+		// Callbacks only hold the GIL of their own interpreter, so Python code of other plugins
+		// runs whenever this one waits or its time slice is up
 		virtual void Process()
 		{
-			std::lock_guard<std::mutex> l(PythonMutex);
 			m_pPlugin->RestoreThread();
 			ProcessLocked();
 			m_pPlugin->ReleaseThread();
@@ -63,6 +85,7 @@ namespace Plugins {
 		InitializeMessage(CPlugin* pPlugin) : CPluginMessageBase(pPlugin) { m_Name = __func__; };
 		virtual void Process()
 		{
+			// Interpreters are created from the shared main thread state, one at a time
 			std::lock_guard<std::mutex> l(PythonMutex);
 			m_pPlugin->Initialise();
 		};
@@ -367,6 +390,7 @@ static std::string get_utf8_from_ansi(const std::string &utf8, int codepage)
 		virtual void ProcessLocked() = 0;
 	public:
 		CDirectiveBase(CPlugin* pPlugin) : CPluginMessageBase(pPlugin) {};
+		// Directives change the transports that the IO threads use
 		virtual void Process() {
 			std::lock_guard<std::mutex> l(PythonMutex);
 			m_pPlugin->RestoreThread();
@@ -458,6 +482,13 @@ static std::string get_utf8_from_ansi(const std::string &utf8, int codepage)
 		virtual void ProcessLocked() = 0;
 	public:
 		CEventBase(CPlugin* pPlugin) : CPluginMessageBase(pPlugin) {};
+		// Events are handled next to the transports that the IO threads use
+		virtual void Process() {
+			std::lock_guard<std::mutex> l(PythonMutex);
+			m_pPlugin->RestoreThread();
+			ProcessLocked();
+			m_pPlugin->ReleaseThread();
+		};
 	};
 
 	class ReadEvent : public CEventBase, public CHasConnection
@@ -40,9 +40,6 @@ extern MainWorker m_mainworker;
 
 namespace Plugins {
 
-	extern std::mutex PluginMutex;	// controls access to the message queue
-	extern std::queue<CPluginMessageBase*>	PluginMessageQueue;
-
 	std::mutex PythonMutex;			// controls access to Python
 
 	//
@@ -562,6 +559,7 @@ namespace Plugins {
 		m_Notifier(NULL),
 		m_bDebug(PDM_NONE),
 		m_PyInterpreter(NULL),
+		m_PyForeignThread(NULL),
 		m_PyModule(NULL),
 		m_DeviceDict(NULL),
 		m_ImageDict(NULL),
@@ -572,10 +570,23 @@ namespace Plugins {
 		m_bIsStarted = false;
 		m_bIsStarting = false;
 		m_bTracing = false;
+		m_bDispatchStop = false;
+
+		m_QueueStats.HwdID = HwdID;
+		m_QueueStats.Name = sName;
+		m_QueueStats.Depth = 0;
+		m_QueueStats.MaxDepth = 0;
+		m_QueueStats.Processed = 0;
+		m_QueueStats.LastLatency = 0;
+		m_QueueStats.MaxLatency = 0;
+		m_QueueStats.LastRunTime = 0;
+		m_QueueStats.MaxRunTime = 0;
 	}
 
 	CPlugin::~CPlugin(void)
 	{
+		StopDispatcher();
+		ClearMessageQueue();
 		m_bIsStarted = false;
 	}
 
@@ -832,34 +843,132 @@ namespace Plugins {
 
 	void CPlugin::ClearMessageQueue()
 	{
-		// Copy the event queue to a temporary one, then copy back the events for other plugins
-		std::lock_guard<std::mutex> l(PluginMutex);
-		std::queue<CPluginMessageBase*>	TempMessageQueue(PluginMessageQueue);
-		while (!PluginMessageQueue.empty())
-			PluginMessageQueue.pop();
-
-		while (!TempMessageQueue.empty())
-		{
-			CPluginMessageBase* FrontMessage = TempMessageQueue.front();
-			TempMessageQueue.pop();
-			if (FrontMessage->m_pPlugin == this)
-			{
-				// log events that will not be processed
-				CCallbackBase* pCallback = dynamic_cast<CCallbackBase*>(FrontMessage);
-				if (pCallback)
-					_log.Log(LOG_ERROR, "(%s) Callback event '%s' (Python call '%s') discarded.", m_Name.c_str(), FrontMessage->Name(), pCallback->PythonName());
+		std::lock_guard<std::mutex> l(m_QueueMutex);
+		for (const auto &FrontMessage : m_MessageQueue)
+		{
+			// log events that will not be processed
+			CCallbackBase* pCallback = dynamic_cast<CCallbackBase*>(FrontMessage);
+			if (pCallback)
+				_log.Log(LOG_ERROR, "(%s) Callback event '%s' (Python call '%s') discarded.", m_Name.c_str(), FrontMessage->Name(), pCallback->PythonName());
+			else
+				_log.Log(LOG_ERROR, "(%s) Non-callback event '%s' discarded.", m_Name.c_str(), FrontMessage->Name());
+		}
+		m_MessageQueue.clear();
+	}
+
+	void CPlugin::StartDispatcher()
+	{
+		std::lock_guard<std::mutex> l(m_QueueMutex);
+		if (m_DispatchThread)
+			return;
+		m_bDispatchStop = false;
+		m_DispatchThread = std::make_shared<std::thread>(&CPlugin::Do_Dispatch, this);
+		std::string dispatch_name = "PluginMsg_" + m_PluginKey;
+		SetThreadName(m_DispatchThread->native_handle(), dispatch_name.c_str());
+	}
+
+	void CPlugin::StopDispatcher()
+	{
+		{
+			std::lock_guard<std::mutex> l(m_QueueMutex);
+			m_bDispatchStop = true;
+		}
+		m_QueueCondition.notify_all();
+		if (m_DispatchThread)
+		{
+			m_DispatchThread->join();
+			m_DispatchThread.reset();
+		}
+	}
+
+	void CPlugin::Do_Dispatch()
+	{
+		std::unique_lock<std::mutex> lock(m_QueueMutex);
+		while (!m_bDispatchStop)
+		{
+			// Take the 1st message that is ready, messages sent with a 'Delay' keep their place until it has passed
+			time_t	Now = time(0);
+			time_t	NextWhen = 0;
+			CPluginMessageBase* Message = NULL;
+			for (std::deque<CPluginMessageBase*>::iterator itt = m_MessageQueue.begin(); itt != m_MessageQueue.end(); ++itt)
+			{
+				if (!(*itt)->m_Delay || (*itt)->m_When <= Now)
+				{
+					Message = *itt;
+					m_MessageQueue.erase(itt);
+					break;
+				}
+				if (!NextWhen || ((*itt)->m_When < NextWhen))
+					NextWhen = (*itt)->m_When;
+			}
+			if (!Message)
+			{
+				// Sleep until a message is queued or a delayed one is due
+				if (NextWhen)
+					m_QueueCondition.wait_until(lock, std::chrono::system_clock::from_time_t(NextWhen));
 				else
-					_log.Log(LOG_ERROR, "(%s) Non-callback event '%s' discarded.", m_Name.c_str(), FrontMessage->Name());
+					m_QueueCondition.wait(lock);
+				continue;
 			}
-			else
+			lock.unlock();
+			ProcessMessage(Message);
+			lock.lock();
+		}
+	}
+
+	void CPlugin::ProcessMessage(CPluginMessageBase *pMessage)
+	{
+		std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+		bool bDelayed = pMessage->m_Delay;
+		std::string sName = pMessage->Name();
+		try
+		{
+			if (m_bDebug & PDM_QUEUE)
 			{
-				// Message is for a different plugin so requeue it
-				_log.Log(LOG_NORM, "(%s) requeuing '%s' message for '%s'", m_Name.c_str(), FrontMessage->Name(), FrontMessage->Plugin()->m_Name.c_str());
-				PluginMessageQueue.push(FrontMessage);
+				_log.Log(LOG_NORM, "(" + m_Name + ") Processing '" + sName + "' message");
 			}
+			pMessage->Process();
+		}
+		catch (...)
+		{
+			_log.Log(LOG_ERROR, "(%s) Exception processing '%s' message.", m_Name.c_str(), sName.c_str());
+		}
+		std::chrono::steady_clock::time_point tend = std::chrono::steady_clock::now();
+		double latency = std::chrono::duration<double, std::milli>(tstart - pMessage->m_Queued).count();
+
+		// Free the memory for the message
+		{
+			std::lock_guard<std::mutex> l(PythonMutex); // Take mutex to guard access to CPluginTransport::m_pConnection inside the message
+			RestoreThread();
+			delete pMessage;
+			ReleaseThread();
+		}
+
+		double runtime = std::chrono::duration<double, std::milli>(tend - tstart).count();
+		std::lock_guard<std::mutex> l(m_QueueMutex);
+		m_QueueStats.Processed++;
+		if (!bDelayed)
+		{
+			m_QueueStats.LastLatency = latency;
+			if (latency > m_QueueStats.MaxLatency)
+				m_QueueStats.MaxLatency = latency;
+		}
+		m_QueueStats.LastRunTime = runtime;
+		if (runtime > m_QueueStats.MaxRunTime)
+		{
+			m_QueueStats.MaxRunTime = runtime;
+			m_QueueStats.SlowestMessage = sName;
 		}
 	}
 
+	void CPlugin::GetQueueStatistics(_tPluginQueueStats &stats)
+	{
+		std::lock_guard<std::mutex> l(m_QueueMutex);
+		stats = m_QueueStats;
+		stats.Name = m_Name;
+		stats.Depth = m_MessageQueue.size();
+	}
+
 	bool CPlugin::StopHardware()
 	{
 		try
@@ -879,8 +988,8 @@ namespace Plugins {
 				// If we have connections queue disconnects
 				if (m_Transports.size())
 				{
-					std::lock_guard<std::mutex> lPython(PythonMutex); // Take mutex to guard access to CPluginTransport::m_pConnection
-					                                                  // TODO: Must take before m_TransportsMutex to avoid deadlock, try to improve to allow only taking when needed
+					CPluginPythonLock lPython(this); // Take mutex to guard access to CPluginTransport::m_pConnection
+					                                 // TODO: Must take before m_TransportsMutex to avoid deadlock, try to improve to allow only taking when needed
 					std::lock_guard<std::mutex> lTransports(m_TransportsMutex);
 					for (std::vector<CPluginTransport*>::iterator itt = m_Transports.begin(); itt != m_Transports.end(); itt++)
 					{
@@ -948,8 +1057,8 @@ namespace Plugins {
 			// Check all connections are still valid, vector could be affected by a disconnect on another thread
 			try
 			{
-				std::lock_guard<std::mutex> lPython(PythonMutex); // Take mutex to guard access to CPluginTransport::m_pConnection
-				                                                  // TODO: Must take before m_TransportsMutex to avoid deadlock, try to improve to allow only taking when needed
+				CPluginPythonLock lPython(this); // Take mutex to guard access to CPluginTransport::m_pConnection
+				                                 // TODO: Must take before m_TransportsMutex to avoid deadlock, try to improve to allow only taking when needed
 				std::lock_guard<std::mutex> lTransports(m_TransportsMutex);
 				if (m_Transports.size())
 				{
@@ -983,6 +1092,7 @@ namespace Plugins {
 				_log.Log(LOG_ERROR, "(%s) failed to create interpreter.", m_PluginKey.c_str());
 				goto Error;
 			}
+			m_PyForeignThread = PyThreadState_New(((PyThreadState*)m_PyInterpreter)->interp);
 
 			// Prepend plugin directory to path so that python will search it early when importing
 	#ifdef WIN32
@@ -1548,9 +1658,14 @@ Error:
 			_log.Log(LOG_NORM, "(" + m_Name + ") Pushing '" + std::string(pMessage->Name()) + "' on to queue");
 		}
 
-		// Add message to queue
-		std::lock_guard<std::mutex> l(PluginMutex);
-		PluginMessageQueue.push(pMessage);
+		// Add message to the queue of this plugin and wake up its dispatcher
+		{
+			std::lock_guard<std::mutex> l(m_QueueMutex);
+			m_MessageQueue.push_back(pMessage);
+			if (m_MessageQueue.size() > m_QueueStats.MaxDepth)
+				m_QueueStats.MaxDepth = m_MessageQueue.size();
+		}
+		m_QueueCondition.notify_one();
 	}
 
 	void CPlugin::DeviceAdded(int Unit)
@@ -1618,6 +1733,19 @@ Error:
 			PyEval_SaveThread();
 	}
 
+	// Callers hold PythonMutex, that keeps the foreign thread state to one thread at a time
+	void CPlugin::RestoreForeignThread()
+	{
+		if (m_PyForeignThread)
+			PyEval_RestoreThread((PyThreadState*)m_PyForeignThread);
+	}
+
+	void CPlugin::ReleaseForeignThread()
+	{
+		if (m_PyForeignThread)
+			PyEval_SaveThread();
+	}
+
 	void CPlugin::Callback(std::string sHandler, void * pParams)
 	{
 		try
@@ -1655,6 +1783,10 @@ Error:
 
 	void CPlugin::Stop()
 	{
+		// Keep the IO threads out of the interpreter while it is torn down, PythonMutex is taken before the GIL
+		ReleaseThread();
+		std::lock_guard<std::mutex> l(PythonMutex);
+		RestoreThread();
 		try
 		{
 			PyErr_Clear();
@@ -1663,6 +1795,12 @@ Error:
 			if (m_DeviceDict) Py_XDECREF(m_DeviceDict);
 			if (m_ImageDict) Py_XDECREF(m_ImageDict);
 			if (m_SettingsDict) Py_XDECREF(m_SettingsDict);
+			if (m_PyForeignThread)
+			{
+				PyThreadState_Clear((PyThreadState*)m_PyForeignThread);
+				PyThreadState_Delete((PyThreadState*)m_PyForeignThread);
+				m_PyForeignThread = NULL;
+			}
 			if (m_PyInterpreter) Py_EndInterpreter((PyThreadState*)m_PyInterpreter);
 			Py_XDECREF(m_PyModule);
 			PyEval_ReleaseLock();
@@ -3,6 +3,9 @@
 #include "../DomoticzHardware.h"
 #include "../hardwaretypes.h"
 #include "../../notifications/NotificationBase.h"
+#include "PluginManager.h"
+#include <deque>
+#include <condition_variable>
 
 #ifndef byte
 typedef unsigned char byte;
@@ -36,6 +39,7 @@ namespace Plugins {
 		int				m_iPollInterval;
 
 		void*			m_PyInterpreter;
+		void*			m_PyForeignThread;	// thread state of the interpreter for threads holding PythonMutex
 		void*			m_PyModule;
 
 		std::string		m_Version;
@@ -48,8 +52,18 @@ namespace Plugins {
 
 		std::shared_ptr<std::thread> m_thread;
 
+		// Messages are processed in order on a dispatcher thread of the plugin itself
+		std::mutex		m_QueueMutex;
+		std::condition_variable	m_QueueCondition;
+		std::deque<CPluginMessageBase*>	m_MessageQueue;
+		std::shared_ptr<std::thread> m_DispatchThread;
+		bool			m_bDispatchStop;
+		_tPluginQueueStats	m_QueueStats;
+
 		bool StartHardware() override;
 		void Do_Work();
+		void Do_Dispatch();
+		void ProcessMessage(CPluginMessageBase *pMessage);
 		bool StopHardware() override;
 		void ClearMessageQueue();
 
@@ -78,6 +92,8 @@ namespace Plugins {
 		void	Callback(std::string sHandler, void* pParams);
 		void	RestoreThread();
 		void	ReleaseThread();
+		void	RestoreForeignThread();
+		void	ReleaseForeignThread();
 		void	Stop();
 
 		void	WriteDebugBuffer(const std::vector<byte>& Buffer, bool Incoming);
@@ -90,6 +106,9 @@ namespace Plugins {
 		void	onDeviceModified(int Unit);
 		void	onDeviceRemoved(int Unit);
 		void	MessagePlugin(CPluginMessageBase *pMessage);
+		void	StartDispatcher();
+		void	StopDispatcher();
+		void	GetQueueStatistics(_tPluginQueueStats &stats);
 		void	DeviceAdded(int Unit);
 		void	DeviceModified(int Unit);
 		void	DeviceRemoved(int Unit);
@@ -2,15 +2,24 @@
 #include "HTTPClient.h"
 #include <curl/curl.h>
 #include "../main/Logger.h"
+#include "../main/Helper.h"
 
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <set>
 
 #ifndef O_LARGEFILE
 	#define O_LARGEFILE 0
 #endif
 
+#define HTTP_MAX_IDLE_HANDLES 8			// easy handles kept for reuse, with their open connections
+#define HTTP_MAX_ASYNC_TRANSFERS 16		// asynchronous requests performed at the same time
+
 extern std::string szUserDataFolder;
 
 bool		HTTPClient::m_bCurlGlobalInitialized = false;
@@ -20,6 +29,39 @@ long		HTTPClient::m_iConnectionTimeout = 10;
 long		HTTPClient::m_iTimeout = 90; //max, time that a download has to be finished?
 std::string	HTTPClient::m_sUserAgent = "domoticz/1.0";
 
+static std::mutex g_globalInitMutex;
+
+//DNS cache and TLS sessions are shared between all handles, libcurl can not share
+//connections between handles that run at the same time on different threads,
+//every pooled handle keeps its own connections
+static CURLSH *g_curlShare = NULL;
+static std::mutex g_curlShareLocks[CURL_LOCK_DATA_LAST];
+
+struct _tIdleHandle
+{
+	std::string host;	// scheme://host:port of the last request
+	CURL *curl;
+};
+static std::mutex g_idleHandlesMutex;
+static std::vector<_tIdleHandle> g_idleHandles;
+
+struct _tAsyncTransfer
+{
+	CURL *curl;
+	struct curl_slist *headers;
+	std::string url;
+	std::string postdata;
+	std::vector<unsigned char> response;
+	std::vector<std::string> vHeaderData;
+	HTTPClient::AsyncCallback callback;
+};
+static std::mutex g_asyncMutex;
+static std::condition_variable g_asyncCondition;	// wakes the idle async thread
+static CURLM *g_curlMulti = NULL;
+static std::shared_ptr<std::thread> g_asyncThread;
+static std::deque<_tAsyncTransfer*> g_asyncPending;
+static bool g_bAsyncStop = false;
+
 
 /************************************************************************
  *									*
@@ -68,6 +110,17 @@ size_t write_curl_data_single_line(void *contents, size_t size, size_t nmemb, vo
 }
 
 
+static void lock_curl_share(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	g_curlShareLocks[data].lock();
+}
+
+static void unlock_curl_share(CURL *handle, curl_lock_data data, void *userptr)
+{
+	g_curlShareLocks[data].unlock();
+}
+
+
 /************************************************************************
  *									*
  * Private functions							*
@@ -76,11 +129,20 @@ size_t write_curl_data_single_line(void *contents, size_t size, size_t nmemb, vo
 
 bool HTTPClient::CheckIfGlobalInitDone()
 {
+	std::lock_guard<std::mutex> l(g_globalInitMutex);
 	if (!m_bCurlGlobalInitialized)
 	{
 		CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
 		if (res != CURLE_OK)
 			return false;
+		g_curlShare = curl_share_init();
+		if (g_curlShare)
+		{
+			curl_share_setopt(g_curlShare, CURLSHOPT_LOCKFUNC, lock_curl_share);
+			curl_share_setopt(g_curlShare, CURLSHOPT_UNLOCKFUNC, unlock_curl_share);
+			curl_share_setopt(g_curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(g_curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		}
 		m_bCurlGlobalInitialized = true;
 	}
 	return true;
@@ -88,9 +150,206 @@ bool HTTPClient::CheckIfGlobalInitDone()
 
 void HTTPClient::Cleanup()
 {
-	if (m_bCurlGlobalInitialized)
+	//stop the asynchronous requests first, their callbacks might still use the HTTPClient
+	std::shared_ptr<std::thread> asyncThread;
+	{
+		std::lock_guard<std::mutex> l(g_asyncMutex);
+		g_bAsyncStop = true;
+		asyncThread = g_asyncThread;
+		g_asyncThread.reset();
+#if LIBCURL_VERSION_NUM >= 0x074400
+		if (g_curlMulti)
+			curl_multi_wakeup(g_curlMulti);
+#endif
+	}
+	g_asyncCondition.notify_all();
+	if (asyncThread)
+		asyncThread->join();
+
+	std::lock_guard<std::mutex> l(g_globalInitMutex);
+	if (!m_bCurlGlobalInitialized)
+		return;
+	{
+		std::lock_guard<std::mutex> l2(g_asyncMutex);
+		if (g_curlMulti)
+		{
+			curl_multi_cleanup(g_curlMulti);
+			g_curlMulti = NULL;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> l2(g_idleHandlesMutex);
+		for (const auto &itt : g_idleHandles)
+			curl_easy_cleanup(itt.curl);
+		g_idleHandles.clear();
+	}
+	if (g_curlShare)
+	{
+		curl_share_cleanup(g_curlShare);
+		g_curlShare = NULL;
+	}
+	curl_global_cleanup();
+	m_bCurlGlobalInitialized = false;
+}
+
+//Connections are kept per scheme://host:port
+static std::string GetConnectionKey(const std::string &url)
+{
+	size_t pos = url.find("://");
+	pos = (pos == std::string::npos) ? 0 : pos + 3;
+	return url.substr(0, url.find_first_of("/?#", pos));
+}
+
+void *HTTPClient::AcquireHandle(const std::string &url)
+{
+	std::string host = GetConnectionKey(url);
 	{
-		curl_global_cleanup();
+		std::lock_guard<std::mutex> l(g_idleHandlesMutex);
+		if (!g_idleHandles.empty())
+		{
+			//prefer a handle that was used for the same host, it might still be connected
+			size_t idx = g_idleHandles.size() - 1;
+			for (size_t ii = 0; ii < g_idleHandles.size(); ii++)
+			{
+				if (g_idleHandles[ii].host == host)
+				{
+					idx = ii;
+					break;
+				}
+			}
+			CURL *curl = g_idleHandles[idx].curl;
+			g_idleHandles.erase(g_idleHandles.begin() + idx);
+			return curl;
+		}
+	}
+	CURL *curl = curl_easy_init();
+	if ((curl) && (g_curlShare))
+		curl_easy_setopt(curl, CURLOPT_SHARE, g_curlShare);
+	return curl;
+}
+
+void HTTPClient::ReleaseHandle(void *curlobj, const std::string &url)
+{
+	CURL *curl = (CURL *)curlobj;
+	//the cookie jar is otherwise only written when the handle is cleaned up
+	curl_easy_setopt(curl, CURLOPT_COOKIELIST, "FLUSH");
+	//curl_easy_reset keeps the cookies, the next request may be for someone else
+	curl_easy_setopt(curl, CURLOPT_COOKIELIST, "ALL");
+	//keeps the open connections and the share
+	curl_easy_reset(curl);
+	{
+		std::lock_guard<std::mutex> l(g_idleHandlesMutex);
+		if (g_idleHandles.size() < HTTP_MAX_IDLE_HANDLES)
+		{
+			_tIdleHandle handle;
+			handle.host = GetConnectionKey(url);
+			handle.curl = curl;
+			g_idleHandles.push_back(handle);
+			return;
+		}
+	}
+	curl_easy_cleanup(curl);
+}
+
+void HTTPClient::Do_AsyncWork()
+{
+	std::set<_tAsyncTransfer*> active;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> l(g_asyncMutex);
+			//nothing to do, sleep until AsyncRequest or Cleanup wakes us
+			g_asyncCondition.wait(l, [&active] { return (!active.empty()) || (!g_asyncPending.empty()) || (g_bAsyncStop); });
+			if (g_bAsyncStop)
+				break;
+			while ((active.size() < HTTP_MAX_ASYNC_TRANSFERS) && (!g_asyncPending.empty()))
+			{
+				_tAsyncTransfer *pTransfer = g_asyncPending.front();
+				g_asyncPending.pop_front();
+				curl_multi_add_handle(g_curlMulti, pTransfer->curl);
+				active.insert(pTransfer);
+			}
+		}
+
+		int nRunning = 0;
+		curl_multi_perform(g_curlMulti, &nRunning);
+
+		CURLMsg *msg;
+		int nQueued = 0;
+		while ((msg = curl_multi_info_read(g_curlMulti, &nQueued)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			CURL *curl = msg->easy_handle;
+			CURLcode res = msg->data.result;
+			char *pPrivate = NULL;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, &pPrivate);
+			_tAsyncTransfer *pTransfer = (_tAsyncTransfer *)pPrivate;
+			curl_multi_remove_handle(g_curlMulti, curl);
+			active.erase(pTransfer);
+
+			if (res != CURLE_OK)
+			{
+				// Push response/error code to end of vHeaderData vector
+				std::stringstream ss;
+				if (res == CURLE_HTTP_RETURNED_ERROR)
+				{
+					long responseCode;
+					curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+					ss << responseCode;
+					LogError(responseCode);
+				}
+				else
+					ss << res;
+				pTransfer->vHeaderData.push_back(ss.str());
+			}
+			ReleaseHandle(curl, pTransfer->url);
+			if (pTransfer->headers != NULL)
+				curl_slist_free_all(pTransfer->headers);
+			try
+			{
+				pTransfer->callback(res == CURLE_OK, pTransfer->response, pTransfer->vHeaderData);
+			}
+			catch (...)
+			{
+				_log.Log(LOG_ERROR, "HTTPClient: exception in the callback of %s", pTransfer->url.c_str());
+			}
+			delete pTransfer;
+		}
+
+		if (active.empty())
+			continue;
+#if LIBCURL_VERSION_NUM >= 0x074400
+		//curl_multi_wakeup interrupts it for new requests
+		curl_multi_poll(g_curlMulti, NULL, 0, 1000, NULL);
+#elif LIBCURL_VERSION_NUM >= 0x074200
+		//no curl_multi_wakeup yet, keep the delay of new requests short
+		curl_multi_poll(g_curlMulti, NULL, 0, 100, NULL);
+#else
+		//curl_multi_wait returns at once when there is nothing to wait on (yet), do not spin
+		int numfds = 0;
+		curl_multi_wait(g_curlMulti, NULL, 0, 100, &numfds);
+		if (numfds == 0)
+		{
+			std::unique_lock<std::mutex> l(g_asyncMutex);
+			g_asyncCondition.wait_for(l, std::chrono::milliseconds(100), [] { return (!g_asyncPending.empty()) || (g_bAsyncStop); });
+		}
+#endif
+	}
+
+	//cancel what is left
+	std::lock_guard<std::mutex> l(g_asyncMutex);
+	for (const auto &itt : g_asyncPending)
+		active.insert(itt);
+	g_asyncPending.clear();
+	for (const auto &itt : active)
+	{
+		curl_multi_remove_handle(g_curlMulti, itt->curl);
+		curl_easy_cleanup(itt->curl);
+		if (itt->headers != NULL)
+			curl_slist_free_all(itt->headers);
+		delete itt;
 	}
 }
 
@@ -182,7 +441,7 @@ bool HTTPClient::GETBinary(const std::string &url, const std::vector<std::string
 	{
 		if (!CheckIfGlobalInitDone())
 			return false;
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -225,7 +484,7 @@ bool HTTPClient::GETBinary(const std::string &url, const std::vector<std::string
 			vHeaderData.push_back(ss.str());
 		}
 
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		if (headers != NULL) {
 			curl_slist_free_all(headers); /* free the header list */
@@ -247,7 +506,7 @@ bool HTTPClient::POSTBinary(const std::string &url, const std::string &postdata,
 	{
 		if (!CheckIfGlobalInitDone())
 			return false;
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -276,6 +535,7 @@ bool HTTPClient::POSTBinary(const std::string &url, const std::string &postdata,
 		}
 
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata.c_str());
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(postdata.size()));
 		res = curl_easy_perform(curl);
 
 		if (res != CURLE_OK)
@@ -294,7 +554,7 @@ bool HTTPClient::POSTBinary(const std::string &url, const std::string &postdata,
 			vHeaderData.push_back(ss.str());
 		}
 
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		if (headers != NULL)
 		{
@@ -316,7 +576,7 @@ std::vector<std::string> &vHeaderData, const long TimeOut)
 	{
 		if (!CheckIfGlobalInitDone())
 			return false;
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -360,7 +620,7 @@ std::vector<std::string> &vHeaderData, const long TimeOut)
 			vHeaderData.push_back(ss.str());
 		}
 
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		if (headers != NULL)
 		{
@@ -382,7 +642,7 @@ std::vector<std::string> &vHeaderData, const long TimeOut)
 	{
 		if (!CheckIfGlobalInitDone())
 			return false;
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -426,7 +686,7 @@ std::vector<std::string> &vHeaderData, const long TimeOut)
 			vHeaderData.push_back(ss.str());
 		}
 
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		if (headers != NULL)
 		{
@@ -460,7 +720,7 @@ bool HTTPClient::GETBinarySingleLine(const std::string &url, const std::vector<s
 	{
 		if (!CheckIfGlobalInitDone())
 			return false;
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -495,7 +755,7 @@ bool HTTPClient::GETBinarySingleLine(const std::string &url, const std::vector<s
 			LogError(responseCode);
 		}
 
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		if (headers != NULL) {
 			curl_slist_free_all(headers); /* free the header list */
@@ -619,6 +879,88 @@ bool HTTPClient::Delete(const std::string &url, const std::string &putdata, cons
 }
 
 
+/************************************************************************
+ *									*
+ * asynchronous requests						*
+ *									*
+ ************************************************************************/
+
+bool HTTPClient::AsyncRequest(const _eHTTPmethod method, const std::string &url, const std::string &postdata, const std::vector<std::string> &ExtraHeaders, const AsyncCallback &callback, const long TimeOut)
+{
+	if (!CheckIfGlobalInitDone())
+		return false;
+	CURL *curl = (CURL *)AcquireHandle(url);
+	if (!curl)
+		return false;
+
+	_tAsyncTransfer *pTransfer = new _tAsyncTransfer();
+	pTransfer->curl = curl;
+	pTransfer->headers = NULL;
+	pTransfer->url = url;
+	pTransfer->postdata = postdata;
+	pTransfer->callback = callback;
+
+	SetGlobalOptions(curl);
+	if (TimeOut != -1)
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT, TimeOut);
+
+	std::vector<std::string>::const_iterator itt;
+	for (itt = ExtraHeaders.begin(); itt != ExtraHeaders.end(); ++itt)
+	{
+		pTransfer->headers = curl_slist_append(pTransfer->headers, (*itt).c_str());
+	}
+	if (pTransfer->headers != NULL)
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, pTransfer->headers);
+
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_curl_headerdata);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &pTransfer->vHeaderData);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&pTransfer->response);
+	curl_easy_setopt(curl, CURLOPT_URL, pTransfer->url.c_str());
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)pTransfer);
+	//same options as the synchronous calls, so is the result: only GET fails on an HTTP error code
+	if (method == HTTP_METHOD_POST)
+	{
+		curl_easy_setopt(curl, CURLOPT_POST, 1);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, pTransfer->postdata.c_str());
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(pTransfer->postdata.size()));
+	}
+	else if (method == HTTP_METHOD_PUT)
+	{
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, pTransfer->postdata.c_str());
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(pTransfer->postdata.size()));
+	}
+	else
+		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
+
+	{
+		std::lock_guard<std::mutex> l(g_asyncMutex);
+		if (!g_curlMulti)
+			g_curlMulti = curl_multi_init();
+		if ((!g_curlMulti) || (g_bAsyncStop))
+		{
+			curl_easy_cleanup(curl);
+			if (pTransfer->headers != NULL)
+				curl_slist_free_all(pTransfer->headers);
+			delete pTransfer;
+			return false;
+		}
+		g_asyncPending.push_back(pTransfer);
+		if (!g_asyncThread)
+		{
+			g_asyncThread = std::make_shared<std::thread>(&HTTPClient::Do_AsyncWork);
+			SetThreadName(g_asyncThread->native_handle(), "HTTPClient");
+		}
+		//under the lock, Cleanup frees g_curlMulti
+#if LIBCURL_VERSION_NUM >= 0x074400
+		curl_multi_wakeup(g_curlMulti);
+#endif
+	}
+	g_asyncCondition.notify_one();
+	return true;
+}
+
+
 /************************************************************************
  *									*
  * simple access methods						*
@@ -657,7 +999,7 @@ bool HTTPClient::GETBinaryToFile(const std::string &url, const std::string &outp
 		if (!outfile.is_open())
 			return false;
 
-		CURL *curl = curl_easy_init();
+		CURL *curl = (CURL *)AcquireHandle(url);
 		if (!curl)
 			return false;
 
@@ -667,7 +1009,7 @@ bool HTTPClient::GETBinaryToFile(const std::string &url, const std::string &outp
 		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&outfile);
 		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
 		res = curl_easy_perform(curl);
-		curl_easy_cleanup(curl);
+		ReleaseHandle(curl, url);
 
 		outfile.close();
 
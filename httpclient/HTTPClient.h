@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+
 class HTTPClient
 {
 	// give MainWorker acces to the protected Cleanup() function
@@ -10,7 +12,8 @@ public:
 	enum _eHTTPmethod
 	{
 		HTTP_METHOD_GET,
-		HTTP_METHOD_POST
+		HTTP_METHOD_POST,
+		HTTP_METHOD_PUT
 	};
 
 
@@ -106,8 +109,25 @@ std::vector<std::string> &vHeaderData, const long TimeOut = -1);
 std::vector<std::string> &vHeaderData, const long TimeOut = -1);
 
 
+	/************************************************************************
+	 *									*
+	 * asynchronous requests						*
+	 *   - the request is performed on the shared HTTP thread, together	*
+	 *     with the other pending requests					*
+	 *   - the callback is called on that thread, keep it short		*
+	 *   - requests still pending on Cleanup() are cancelled without	*
+	 *     calling their callback						*
+	 *									*
+	 ************************************************************************/
+
+	typedef std::function<void(const bool bSuccess, std::vector<unsigned char> &response, std::vector<std::string> &vHeaderData)> AsyncCallback;
+	static bool AsyncRequest(const _eHTTPmethod method, const std::string &url, const std::string &postdata, const std::vector<std::string> &ExtraHeaders, const AsyncCallback &callback, const long TimeOut = -1);
+
 
 private:
+	static void *AcquireHandle(const std::string &url);
+	static void ReleaseHandle(void *curlobj, const std::string &url);
+	static void Do_AsyncWork();
 	static void SetGlobalOptions(void *curlobj);
 	static bool CheckIfGlobalInitDone();
 	static void LogError(const long response_code);
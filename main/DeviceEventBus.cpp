@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include "DeviceEventBus.h"
+#include "Helper.h"
+#include "Logger.h"
+#include "SQLHelper.h"
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <deque>
+
+class CDeviceEventBus::CSubscriber : public std::enable_shared_from_this<CDeviceEventBus::CSubscriber>
+{
+public:
+	CSubscriber(const std::string &Name, const event_handler &handler, const _eOverflowPolicy policy, const size_t capacity) :
+		m_Name(Name),
+		m_handler(handler),
+		m_policy(policy),
+		m_ring((capacity > 0) ? capacity : 1),
+		m_head(0),
+		m_count(0),
+		m_bStop(false),
+		m_nHandled(0),
+		m_nDropped(0),
+		m_nCoalesced(0),
+		m_nBlocked(0),
+		m_nSpilled(0),
+		m_LastLag(0),
+		m_MaxLag(0)
+	{
+	}
+	~CSubscriber()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		//the thread keeps the subscriber alive, also when it is unsubscribed from its own handler
+		std::shared_ptr<CSubscriber> self = shared_from_this();
+		m_thread = std::make_shared<std::thread>([self]() { self->Do_Work(); });
+		m_threadId = m_thread->get_id();
+		SetThreadName(m_thread->native_handle(), m_Name.c_str());
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_bStop = true;
+		}
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+		if (!m_thread)
+			return;
+		if (m_threadId == std::this_thread::get_id())
+			m_thread->detach();
+		else
+			m_thread->join();
+		m_thread.reset();
+	}
+
+	void Push(const _tDeviceEvent &event)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_bStop)
+			return;
+		if (m_policy == OVERFLOW_COALESCE)
+		{
+			auto itt = m_pendingDevices.find(event.DeviceRowIdx);
+			if (itt != m_pendingDevices.end())
+			{
+				//keep the publish time of the pending event, that is how long the device is waiting
+				_tDeviceEvent &pending = m_ring[itt->second];
+				pending.HardwareID = event.HardwareID;
+				pending.DeviceName = event.DeviceName;
+				pending.nValue = event.nValue;
+				pending.sValue = event.sValue;
+				pending.Updated = event.Updated;
+				m_nCoalesced++;
+				return;
+			}
+		}
+		if (m_policy == OVERFLOW_BLOCK)
+		{
+			if ((m_count == m_ring.size()) || (!m_overflow.empty()))
+			{
+				if ((!m_overflow.empty()) || (!CanWait()))
+				{
+					Spill(event);
+					return;
+				}
+				m_nBlocked++;
+				m_notFull.wait(lock, [this] { return ((m_count < m_ring.size()) && (m_overflow.empty())) || (m_bStop); });
+				if (m_bStop)
+					return;
+			}
+		}
+		else if (m_count == m_ring.size())
+		{
+			PopFront();
+			m_nDropped++;
+		}
+		PushBack(event);
+		lock.unlock();
+		m_notEmpty.notify_one();
+	}
+
+	void GetStatistics(_tSubscriberStats &stats)
+	{
+		std::lock_guard<std::mutex> l(m_mutex);
+		stats.Name = m_Name;
+		stats.Pending = m_count + m_overflow.size();
+		stats.Capacity = m_ring.size();
+		stats.Handled = m_nHandled;
+		stats.Dropped = m_nDropped;
+		stats.Coalesced = m_nCoalesced;
+		stats.Blocked = m_nBlocked;
+		stats.Spilled = m_nSpilled;
+		stats.LastLag = m_LastLag;
+		stats.MaxLag = m_MaxLag;
+	}
+private:
+	//A handler that publishes itself can not wait for its own thread, and the owner of the database
+	//transaction would hold up every other connection (and maybe the handler) while it waits
+	bool CanWait()
+	{
+		return (std::this_thread::get_id() != m_threadId) && (!m_sql.IsTransactionOwner());
+	}
+
+	//m_mutex should be locked, keeps the order of the events
+	void Spill(const _tDeviceEvent &event)
+	{
+		m_overflow.push_back(event);
+		m_nSpilled++;
+	}
+
+	//m_mutex should be locked
+	void PushBack(const _tDeviceEvent &event)
+	{
+		size_t slot = (m_head + m_count) % m_ring.size();
+		m_ring[slot] = event;
+		m_count++;
+		if (m_policy == OVERFLOW_COALESCE)
+			m_pendingDevices[event.DeviceRowIdx] = slot;
+	}
+
+	//m_mutex should be locked
+	void PopFront()
+	{
+		if (m_policy == OVERFLOW_COALESCE)
+			m_pendingDevices.erase(m_ring[m_head].DeviceRowIdx);
+		m_head = (m_head + 1) % m_ring.size();
+		m_count--;
+	}
+
+	void Do_Work()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_notEmpty.wait(lock, [this] { return (m_count != 0) || (m_bStop); });
+			if (m_bStop)
+				break;
+			_tDeviceEvent event = m_ring[m_head];
+			PopFront();
+			if (!m_overflow.empty())
+			{
+				PushBack(m_overflow.front());
+				m_overflow.pop_front();
+			}
+			lock.unlock();
+			m_notFull.notify_one();
+
+			double lag = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - event.Published).count();
+			try
+			{
+				m_handler(event);
+			}
+			catch (std::exception& e)
+			{
+				_log.Log(LOG_ERROR, "DeviceEventBus: %s: exception: %s", m_Name.c_str(), e.what());
+			}
+			catch (...)
+			{
+				_log.Log(LOG_ERROR, "DeviceEventBus: %s: unknown exception", m_Name.c_str());
+			}
+
+			lock.lock();
+			m_nHandled++;
+			m_LastLag = lag;
+			if (lag > m_MaxLag)
+				m_MaxLag = lag;
+		}
+	}
+
+	std::string m_Name;
+	event_handler m_handler;
+	_eOverflowPolicy m_policy;
+
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+	std::vector<_tDeviceEvent> m_ring;
+	size_t m_head;
+	size_t m_count;
+	std::unordered_map<uint64_t, size_t> m_pendingDevices;	// ring slot per device, coalesce only
+	std::deque<_tDeviceEvent> m_overflow;					// after the ring, block only
+	bool m_bStop;
+	std::shared_ptr<std::thread> m_thread;
+	std::thread::id m_threadId;
+
+	uint64_t m_nHandled;
+	uint64_t m_nDropped;
+	uint64_t m_nCoalesced;
+	uint64_t m_nBlocked;
+	uint64_t m_nSpilled;
+	double m_LastLag;
+	double m_MaxLag;
+};
+
+CDeviceEventBus::CDeviceEventBus() :
+	m_subscribers(std::make_shared<const std::vector<subscription> >())
+{
+}
+
+CDeviceEventBus::~CDeviceEventBus()
+{
+	std::shared_ptr<const std::vector<subscription> > subscribers;
+	{
+		std::lock_guard<std::mutex> l(m_subscribersMutex);
+		subscribers = m_subscribers;
+		m_subscribers = std::make_shared<const std::vector<subscription> >();
+	}
+	for (const auto &itt : *subscribers)
+		itt->Stop();
+}
+
+CDeviceEventBus::subscription CDeviceEventBus::Subscribe(const std::string &Name, const event_handler &handler, const _eOverflowPolicy policy, const size_t capacity)
+{
+	subscription sub = std::make_shared<CSubscriber>(Name, handler, policy, capacity);
+	sub->Start();
+	std::lock_guard<std::mutex> l(m_subscribersMutex);
+	std::shared_ptr<std::vector<subscription> > subscribers = std::make_shared<std::vector<subscription> >(*m_subscribers);
+	subscribers->push_back(sub);
+	m_subscribers = subscribers;
+	return sub;
+}
+
+void CDeviceEventBus::Unsubscribe(subscription &sub)
+{
+	if (!sub)
+		return;
+	{
+		std::lock_guard<std::mutex> l(m_subscribersMutex);
+		std::shared_ptr<std::vector<subscription> > subscribers = std::make_shared<std::vector<subscription> >(*m_subscribers);
+		subscribers->erase(std::remove(subscribers->begin(), subscribers->end(), sub), subscribers->end());
+		m_subscribers = subscribers;
+	}
+	sub->Stop();
+	sub.reset();
+}
+
+void CDeviceEventBus::Publish(const int HardwareID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const int nValue, const std::string &sValue, const time_t Updated)
+{
+	std::shared_ptr<const std::vector<subscription> > subscribers;
+	{
+		std::lock_guard<std::mutex> l(m_subscribersMutex);
+		subscribers = m_subscribers;
+	}
+	if (subscribers->empty())
+		return;
+	_tDeviceEvent event;
+	event.HardwareID = HardwareID;
+	event.DeviceRowIdx = DeviceRowIdx;
+	event.DeviceName = DeviceName;
+	event.nValue = nValue;
+	event.sValue = sValue;
+	event.Updated = Updated;
+	event.Published = std::chrono::steady_clock::now();
+	for (const auto &itt : *subscribers)
+		itt->Push(event);
+}
+
+void CDeviceEventBus::GetStatistics(std::vector<_tSubscriberStats> &stats)
+{
+	std::shared_ptr<const std::vector<subscription> > subscribers;
+	{
+		std::lock_guard<std::mutex> l(m_subscribersMutex);
+		subscribers = m_subscribers;
+	}
+	stats.clear();
+	for (const auto &itt : *subscribers)
+	{
+		_tSubscriberStats sstats;
+		itt->GetStatistics(sstats);
+		stats.push_back(sstats);
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+//Hands device updates from the thread that processed them to the subscribers (push links, MQTT, ...).
+//Every subscriber has a bounded ring of pending events and handles them on its own thread,
+//so a slow subscriber does not hold up the processing of received data
+class CDeviceEventBus
+{
+public:
+	enum _eOverflowPolicy
+	{
+		OVERFLOW_DROP_OLDEST = 0,	// forget the oldest pending event
+		OVERFLOW_BLOCK,				// the publisher waits until there is room, or queues beyond the ring when it can not wait
+		OVERFLOW_COALESCE,			// one pending event per device, drop the oldest when still full
+	};
+	struct _tDeviceEvent
+	{
+		int HardwareID;
+		uint64_t DeviceRowIdx;
+		std::string DeviceName;
+		//state of the device when the update was processed, the handler may run a lot later
+		int nValue;
+		std::string sValue;
+		time_t Updated;
+		std::chrono::steady_clock::time_point Published;
+	};
+	typedef std::function<void(const _tDeviceEvent &event)> event_handler;
+
+	struct _tSubscriberStats
+	{
+		std::string Name;
+		size_t Pending;
+		size_t Capacity;
+		uint64_t Handled;
+		uint64_t Dropped;
+		uint64_t Coalesced;				// merged with a pending event of the same device
+		uint64_t Blocked;				// times a publisher had to wait
+		uint64_t Spilled;				// queued beyond the ring because the publisher could not wait
+		double LastLag;					// ms from publishing until the handler was called
+		double MaxLag;
+	};
+
+	class CSubscriber;
+	typedef std::shared_ptr<CSubscriber> subscription;
+
+	CDeviceEventBus();
+	~CDeviceEventBus();
+
+	subscription Subscribe(const std::string &Name, const event_handler &handler, const _eOverflowPolicy policy, const size_t capacity = 1024);
+	//Stops the thread of the subscriber, events still pending are discarded
+	void Unsubscribe(subscription &sub);
+	//nValue, sValue and Updated are the state of the device when the update was processed
+	void Publish(const int HardwareID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const int nValue, const std::string &sValue, const time_t Updated);
+	void GetStatistics(std::vector<_tSubscriberStats> &stats);
+private:
+	std::mutex m_subscribersMutex;
+	//replaced on (un)subscribe, so publishing only needs the lock to take a reference
+	std::shared_ptr<const std::vector<subscription> > m_subscribers;
+};
@@ -0,0 +1,397 @@
+#include "stdafx.h"
+#include "DeviceStateCache.h"
+#include "SQLHelper.h"
+#include "Logger.h"
+#include "localtime_r.h"
+
+#define DEVICE_CACHE_COLUMNS "ID, HardwareID, DeviceID, Unit, Type, SubType, Name, Used, SwitchType, SignalLevel, BatteryLevel, nValue, sValue, LastUpdate, LastLevel, Options, AddjValue, AddjMulti, AddjValue2, AddjMulti2"
+
+//Rows reloaded with one query, larger dirty sets are split
+#define DEVICE_CACHE_REFRESH_CHUNK 200
+
+CDeviceStateCache::CDeviceStateCache(CSQLHelper &sql) :
+	m_sql(sql)
+{
+	m_bLoaded = false;
+	m_bPendingStructure = false;
+	m_bAllDirty = false;
+	m_sequence = 0;
+	m_structureSequence = 0;
+	m_epoch = mytime(NULL);
+}
+
+CDeviceStateCache::~CDeviceStateCache(void)
+{
+}
+
+static void ReadCacheItem(CSQLStatement &stmt, _tDeviceCacheItem &item)
+{
+	item.ID = stmt.GetUInt64(0);
+	item.HardwareID = stmt.GetInt(1);
+	item.DeviceID = stmt.GetString(2);
+	item.Unit = stmt.GetInt(3);
+	item.Type = stmt.GetInt(4);
+	item.SubType = stmt.GetInt(5);
+	item.Name = stmt.GetString(6);
+	item.Used = (stmt.GetInt(7) != 0);
+	item.SwitchType = stmt.GetInt(8);
+	item.SignalLevel = stmt.GetInt(9);
+	item.BatteryLevel = stmt.GetInt(10);
+	item.nValue = stmt.GetInt(11);
+	item.sValue = stmt.GetString(12);
+	item.LastUpdate = stmt.GetString(13);
+	item.LastLevel = stmt.GetInt(14);
+	item.Options = stmt.GetString(15);
+	item.AddjValue = (float)stmt.GetDouble(16);
+	item.AddjMulti = (float)stmt.GetDouble(17);
+	item.AddjValue2 = (float)stmt.GetDouble(18);
+	item.AddjMulti2 = (float)stmt.GetDouble(19);
+	item.ChangeSequence = 0;
+}
+
+void CDeviceStateCache::Load()
+{
+	size_t nDevices = 0;
+	std::vector<std::function<void()> > listeners;
+	{
+		//Committed rows only, changes committed after the read started are dirty again
+		CSQLStatement stmt(m_sql, "SELECT " DEVICE_CACHE_COLUMNS " FROM DeviceStatus");
+		if (stmt.IsNestedRead())
+			return;
+		std::lock_guard<std::mutex> r(m_refreshMutex);
+		{
+			//Anything could have changed, clients have to reload everything
+			std::lock_guard<std::mutex> l(m_dirtyMutex);
+			m_dirty.clear();
+			m_bAllDirty = false;
+			m_structureSequence = ++m_sequence;
+			TakeListeners(listeners);
+		}
+		std::vector<_tDeviceCacheItem> items;
+		while (stmt.Step())
+		{
+			_tDeviceCacheItem item;
+			ReadCacheItem(stmt, item);
+			items.push_back(item);
+		}
+		std::lock_guard<std::mutex> l(m_cacheMutex);
+		m_devices.clear();
+		m_keyindex.clear();
+		for (const auto & itt : items)
+			StoreItem(itt);
+		m_bLoaded = true;
+		nDevices = items.size();
+	}
+	CallListeners(listeners);
+	_log.Log(LOG_STATUS, "DeviceStateCache: %d devices loaded", (int)nDevices);
+}
+
+void CDeviceStateCache::Clear()
+{
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		m_pendingRows.clear();
+		m_pendingScenes.clear();
+		m_pendingDeletedRows.clear();
+		m_pendingDeletedScenes.clear();
+		m_bPendingStructure = false;
+		m_dirty.clear();
+		m_bAllDirty = false;
+	}
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	m_devices.clear();
+	m_keyindex.clear();
+	m_bLoaded = false;
+}
+
+void CDeviceStateCache::OnRowChanged(const uint64_t ID)
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	//a deleted row ID can be used again within the same transaction
+	m_pendingDeletedRows.erase(ID);
+	m_pendingRows.insert(ID);
+}
+
+void CDeviceStateCache::OnRowDeleted(const uint64_t ID)
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	m_pendingRows.erase(ID);
+	m_pendingDeletedRows.insert(ID);
+	m_bPendingStructure = true;
+}
+
+void CDeviceStateCache::OnSceneChanged(const uint64_t ID)
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	m_pendingDeletedScenes.erase(ID);
+	m_pendingScenes.insert(ID);
+}
+
+void CDeviceStateCache::OnSceneDeleted(const uint64_t ID)
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	m_pendingScenes.erase(ID);
+	m_pendingDeletedScenes.insert(ID);
+	m_bPendingStructure = true;
+}
+
+void CDeviceStateCache::OnStructureChanged()
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	m_bPendingStructure = true;
+}
+
+void CDeviceStateCache::OnRollback()
+{
+	std::vector<std::function<void()> > listeners;
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		//the transaction owner may have read its own rows into the cache
+		m_pendingRows.clear();
+		m_pendingScenes.clear();
+		m_pendingDeletedRows.clear();
+		m_pendingDeletedScenes.clear();
+		m_bPendingStructure = false;
+		m_bAllDirty = true;
+		m_sequence++;
+		TakeListeners(listeners);
+	}
+	CallListeners(listeners);
+}
+
+void CDeviceStateCache::OnCommit()
+{
+	std::vector<std::function<void()> > listeners;
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		for (const auto & ID : m_pendingRows)
+		{
+			m_dirty.insert(ID);
+			m_changed[ID] = ++m_sequence;
+		}
+		for (const auto & ID : m_pendingScenes)
+			m_changedScenes[ID] = ++m_sequence;
+		//the reload drops a deleted row from the cache, clients reload the full list after a deletion
+		for (const auto & ID : m_pendingDeletedRows)
+		{
+			m_dirty.insert(ID);
+			m_changed.erase(ID);
+		}
+		for (const auto & ID : m_pendingDeletedScenes)
+			m_changedScenes.erase(ID);
+		if (m_bPendingStructure)
+			m_structureSequence = ++m_sequence;
+		m_pendingRows.clear();
+		m_pendingScenes.clear();
+		m_pendingDeletedRows.clear();
+		m_pendingDeletedScenes.clear();
+		m_bPendingStructure = false;
+		TakeListeners(listeners);
+	}
+	CallListeners(listeners);
+}
+
+void CDeviceStateCache::TakeListeners(std::vector<std::function<void()> > &listeners)
+{
+	auto itt = m_listeners.begin();
+	while (itt != m_listeners.end())
+	{
+		if (itt->first < m_sequence)
+		{
+			listeners.push_back(itt->second);
+			itt = m_listeners.erase(itt);
+		}
+		else
+			++itt;
+	}
+}
+
+void CDeviceStateCache::CallListeners(const std::vector<std::function<void()> > &listeners)
+{
+	for (const auto & itt : listeners)
+		itt();
+}
+
+void CDeviceStateCache::NotifyChange(const uint64_t sequence, const std::function<void()> &callback)
+{
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		if (sequence >= m_sequence)
+		{
+			m_listeners.push_back(std::make_pair(sequence, callback));
+			return;
+		}
+	}
+	callback();
+}
+
+void CDeviceStateCache::RefreshDirty()
+{
+	bool bAllDirty;
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		if ((m_dirty.empty()) && (!m_bAllDirty))
+			return;
+		bAllDirty = m_bAllDirty;
+	}
+	if (bAllDirty)
+	{
+		Load();
+		return;
+	}
+
+	//The connection is taken first, nobody waits for the database while holding the refresh lock
+	CSQLStatement stmt(m_sql, "SELECT " DEVICE_CACHE_COLUMNS " FROM DeviceStatus WHERE (ID==?)");
+	//A nested read still sees the snapshot of the outer statement, leave the rows dirty for the next reader
+	if (stmt.IsNestedRead())
+		return;
+	std::lock_guard<std::mutex> r(m_refreshMutex);
+	std::set<uint64_t> dirty;
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		dirty.swap(m_dirty);
+	}
+	std::vector<_tDeviceCacheItem> items;
+	for (const auto & ID : dirty)
+	{
+		stmt.Reset();
+		stmt.Bind(ID);
+		if (stmt.Step())
+		{
+			_tDeviceCacheItem item;
+			ReadCacheItem(stmt, item);
+			items.push_back(item);
+		}
+	}
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	for (const auto & ID : dirty)
+		RemoveItem(ID);
+	for (const auto & item : items)
+		StoreItem(item);
+}
+
+bool CDeviceStateCache::IsPending(const uint64_t ID)
+{
+	if (!m_sql.IsTransactionOwner())
+		return false;
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	if (ID == 0)
+		return ((!m_pendingRows.empty()) || (!m_pendingDeletedRows.empty()));
+	return ((m_pendingRows.find(ID) != m_pendingRows.end()) || (m_pendingDeletedRows.find(ID) != m_pendingDeletedRows.end()));
+}
+
+void CDeviceStateCache::StoreItem(const _tDeviceCacheItem &item)
+{
+	RemoveItem(item.ID);
+	_tDeviceCacheItem &newitem = m_devices[item.ID];
+	newitem = item;
+	{
+		std::lock_guard<std::mutex> l(m_dirtyMutex);
+		std::map<uint64_t, uint64_t>::const_iterator itt = m_changed.find(item.ID);
+		if (itt != m_changed.end())
+			newitem.ChangeSequence = itt->second;
+	}
+	m_keyindex[std::make_tuple(item.HardwareID, item.DeviceID, item.Unit, item.Type, item.SubType)] = item.ID;
+}
+
+void CDeviceStateCache::RemoveItem(const uint64_t ID)
+{
+	std::map<uint64_t, _tDeviceCacheItem>::iterator itt = m_devices.find(ID);
+	if (itt == m_devices.end())
+		return;
+	_tDeviceKey key = std::make_tuple(itt->second.HardwareID, itt->second.DeviceID, itt->second.Unit, itt->second.Type, itt->second.SubType);
+	std::map<_tDeviceKey, uint64_t>::iterator ittKey = m_keyindex.find(key);
+	if ((ittKey != m_keyindex.end()) && (ittKey->second == ID))
+		m_keyindex.erase(ittKey);
+	m_devices.erase(itt);
+}
+
+bool CDeviceStateCache::GetDevice(const uint64_t ID, _tDeviceCacheItem &item)
+{
+	if (IsPending(ID))
+	{
+		CSQLStatement stmt(m_sql, "SELECT " DEVICE_CACHE_COLUMNS " FROM DeviceStatus WHERE (ID==?)");
+		stmt.Bind(ID);
+		if (!stmt.Step())
+			return false;
+		ReadCacheItem(stmt, item);
+		return true;
+	}
+	RefreshDirty();
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	std::map<uint64_t, _tDeviceCacheItem>::const_iterator itt = m_devices.find(ID);
+	if (itt == m_devices.end())
+		return false;
+	item = itt->second;
+	return true;
+}
+
+bool CDeviceStateCache::FindDevice(const int HardwareID, const std::string &DeviceID, const int Unit, const int Type, const int SubType, _tDeviceCacheItem &item)
+{
+	//any uncommitted row of our own could be the one
+	if (IsPending(0))
+	{
+		CSQLStatement stmt(m_sql, "SELECT " DEVICE_CACHE_COLUMNS " FROM DeviceStatus WHERE (HardwareID==?) AND (DeviceID==?) AND (Unit==?) AND (Type==?) AND (SubType==?)");
+		stmt.Bind(HardwareID).Bind(DeviceID).Bind(Unit).Bind(Type).Bind(SubType);
+		if (!stmt.Step())
+			return false;
+		ReadCacheItem(stmt, item);
+		return true;
+	}
+	RefreshDirty();
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	std::map<_tDeviceKey, uint64_t>::const_iterator ittKey = m_keyindex.find(std::make_tuple(HardwareID, DeviceID, Unit, Type, SubType));
+	if (ittKey == m_keyindex.end())
+		return false;
+	std::map<uint64_t, _tDeviceCacheItem>::const_iterator itt = m_devices.find(ittKey->second);
+	if (itt == m_devices.end())
+		return false;
+	item = itt->second;
+	return true;
+}
+
+uint64_t CDeviceStateCache::GetChangeSequence()
+{
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	return m_sequence;
+}
+
+void CDeviceStateCache::GetChangedSince(const uint64_t sequence, std::vector<uint64_t> &changedIDs)
+{
+	changedIDs.clear();
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	for (const auto & itt : m_changed)
+	{
+		if (itt.second > sequence)
+			changedIDs.push_back(itt.first);
+	}
+}
+
+uint64_t CDeviceStateCache::Synchronize()
+{
+	//The sequence only moves on commits, take it before the reload so the rows are at least as new
+	uint64_t sequence = GetChangeSequence();
+	RefreshDirty();
+	return sequence;
+}
+
+void CDeviceStateCache::GetChangesSince(const uint64_t sequence, _tDeviceChangeSet &changes)
+{
+	changes.Devices.clear();
+	changes.Scenes.clear();
+	std::lock_guard<std::mutex> l(m_dirtyMutex);
+	changes.Sequence = m_sequence;
+	changes.bIncremental = ((sequence >= m_structureSequence) && (sequence <= m_sequence));
+	if (!changes.bIncremental)
+		return;
+	for (const auto & itt : m_changed)
+	{
+		if (itt.second > sequence)
+			changes.Devices.insert(itt.first);
+	}
+	for (const auto & itt : m_changedScenes)
+	{
+		if (itt.second > sequence)
+			changes.Scenes.insert(itt.first);
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <ctime>
+
+class CSQLHelper;
+
+struct _tDeviceCacheItem
+{
+	uint64_t ID;
+	int HardwareID;
+	std::string DeviceID;
+	int Unit;
+	int Type;
+	int SubType;
+	std::string Name;
+	bool Used;
+	int SwitchType;
+	int SignalLevel;
+	int BatteryLevel;
+	int nValue;
+	std::string sValue;
+	std::string LastUpdate;
+	int LastLevel;
+	std::string Options;
+	float AddjValue;
+	float AddjMulti;
+	float AddjValue2;
+	float AddjMulti2;
+	uint64_t ChangeSequence;
+};
+
+//Rows changed after a client's change sequence
+struct _tDeviceChangeSet
+{
+	uint64_t Sequence;
+	bool bIncremental;		//false when the client has to reload the full list
+	std::set<uint64_t> Devices;
+	std::set<uint64_t> Scenes;
+};
+
+//In-memory copy of the DeviceStatus table, indexed by row ID and by (HardwareID, DeviceID, Unit, Type, SubType)
+//Changes are picked up through the SQLite update hook on the writer connection and become dirty when they are committed,
+//dirty rows are reloaded on the next read (from a read-only connection) so writers never have to know about the cache
+class CDeviceStateCache
+{
+public:
+	explicit CDeviceStateCache(CSQLHelper &sql);
+	~CDeviceStateCache(void);
+
+	void Load();
+	void Clear();
+
+	//Called from the SQLite hooks, these do not touch the database
+	void OnRowChanged(const uint64_t ID);
+	void OnRowDeleted(const uint64_t ID);
+	void OnSceneChanged(const uint64_t ID);
+	void OnSceneDeleted(const uint64_t ID);
+	void OnStructureChanged();
+	void OnRollback();
+	//Called by the writer when its changes are committed, before it releases the connection
+	void OnCommit();
+
+	bool GetDevice(const uint64_t ID, _tDeviceCacheItem &item);
+	bool FindDevice(const int HardwareID, const std::string &DeviceID, const int Unit, const int Type, const int SubType, _tDeviceCacheItem &item);
+
+	//Monotonic counter, increased for every committed change to the DeviceStatus and Scenes tables
+	uint64_t GetChangeSequence();
+	//Returns the rows changed after the given sequence (deleted rows included)
+	void GetChangedSince(const uint64_t sequence, std::vector<uint64_t> &changedIDs);
+
+	//Change sequence covering committed data only, reloads the dirty rows without waiting for the writer
+	uint64_t Synchronize();
+	//Fills the devices and scenes changed after the given sequence
+	void GetChangesSince(const uint64_t sequence, _tDeviceChangeSet &changes);
+	//Calls the callback once when the change sequence moves past the given sequence (right away when it already did)
+	//The callback runs on the committing thread and must not block or use the database
+	void NotifyChange(const uint64_t sequence, const std::function<void()> &callback);
+	//Set once per run, sequences of another run are meaningless
+	time_t GetEpoch() const { return m_epoch; }
+private:
+	typedef std::tuple<int, std::string, int, int, int> _tDeviceKey;
+
+	void RefreshDirty();
+	//The transaction owner reads its own uncommitted rows straight from the database, ID 0 checks for any row
+	bool IsPending(const uint64_t ID);
+	void StoreItem(const _tDeviceCacheItem &item);
+	void RemoveItem(const uint64_t ID);
+	//Takes the callbacks waiting for the current sequence, called with m_dirtyMutex held
+	void TakeListeners(std::vector<std::function<void()> > &listeners);
+	static void CallListeners(const std::vector<std::function<void()> > &listeners);
+
+	CSQLHelper &m_sql;
+	bool m_bLoaded;
+
+	//Serializes the reloads, so an older read never overwrites a newer one
+	//Lock order: database connection, m_refreshMutex, m_cacheMutex
+	std::mutex m_refreshMutex;
+	std::mutex m_cacheMutex;
+	std::map<uint64_t, _tDeviceCacheItem> m_devices;
+	std::map<_tDeviceKey, uint64_t> m_keyindex;
+
+	std::mutex m_dirtyMutex;
+	//changed by the writer but not committed yet
+	std::set<uint64_t> m_pendingRows;
+	std::set<uint64_t> m_pendingScenes;
+	//deleted by the writer, pruned from the change lists on commit (a deletion also changes the structure)
+	std::set<uint64_t> m_pendingDeletedRows;
+	std::set<uint64_t> m_pendingDeletedScenes;
+	bool m_bPendingStructure;
+	std::set<uint64_t> m_dirty;
+	bool m_bAllDirty;
+	uint64_t m_sequence;
+	uint64_t m_structureSequence;
+	std::map<uint64_t, uint64_t> m_changed;
+	std::map<uint64_t, uint64_t> m_changedScenes;
+	//waiting for the sequence to move past the given value
+	std::vector<std::pair<uint64_t, std::function<void()> > > m_listeners;
+	time_t m_epoch;
+};
@@ -126,6 +126,14 @@ const CEventSystem::_tJsonMap CEventSystem::JsonMap[] =
 CEventSystem::CEventSystem(void)
 {
 	m_bEnabled = false;
+	m_bExportReload = true;
+	m_deviceNamesVersion = 1;
+	m_tasksDone = 0;
+	m_tasksTimedOut = 0;
+	m_totalLatency = 0;
+	m_maxLatency = 0;
+	m_totalRunTime = 0;
+	m_maxRunTime = 0;
 }
 
 
@@ -154,6 +162,7 @@ void CEventSystem::StartEventSystem()
 	Plugins::PythonEventsInitialize(szUserDataFolder);
 #endif
 
+	StartEventWorkers();
 	m_thread = std::make_shared<std::thread>(&CEventSystem::Do_Work, this);
 	SetThreadName(m_thread->native_handle(), "EventSystem");
 	m_eventqueuethread = std::make_shared<std::thread>(&CEventSystem::EventQueueThread, this);
@@ -172,6 +181,7 @@ void CEventSystem::StopEventSystem()
 		m_eventqueuethread->join();
 		m_eventqueuethread.reset();
 	}
+	StopEventWorkers();
 	if (m_thread)
 	{
 		m_thread->join();
@@ -181,6 +191,8 @@ void CEventSystem::StopEventSystem()
 #ifdef ENABLE_PYTHON
 	Plugins::PythonEventsStop();
 #endif
+	ClearLuaStatePool();
+	m_luaScriptCache.Clear();
 }
 
 void CEventSystem::SetEnabled(const bool bEnabled)
@@ -290,6 +302,7 @@ void CEventSystem::LoadEvents()
 			}
 		}
 	}
+	BuildEventIndex();
 #ifdef _DEBUG
 	_log.Log(LOG_STATUS, "EventSystem: Events (re)loaded");
 #endif
@@ -436,6 +449,8 @@ void CEventSystem::GetCurrentStates()
 
 	_log.Log(LOG_STATUS, "EventSystem: reset all device statuses...");
 	m_devicestates.clear();
+	m_deviceNamesVersion++;
+	SetExportReload();
 
 	result = m_sql.safe_query("SELECT A.HardwareID, A.ID, A.Name, A.nValue, A.sValue, A.Type, A.SubType, A.SwitchType, A.LastUpdate, A.LastLevel, A.Options, A.Description, A.BatteryLevel, A.SignalLevel, A.Unit, A.DeviceID "
 		"FROM DeviceStatus AS A, Hardware AS B "
@@ -469,17 +484,14 @@ void CEventSystem::GetCurrentStates()
 				//special case for incremental counter, need to calculate the actual count value
 
 				uint64_t total_min, total_max, total_real;
-				std::vector<std::vector<std::string> > result2;
 
-				result2 = m_sql.safe_query("SELECT sValue FROM DeviceStatus WHERE (ID=%" PRIu64 ")", sitem.ID);
-				total_max = std::stoull(result2[0][0]);
+				total_max = std::strtoull(sd[4].c_str(), nullptr, 10);
 
 				//get value of today
-				std::string szDate = TimeToString(NULL, TF_Date);
-				result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID=%" PRIu64 " AND Date>='%q')", sitem.ID, szDate.c_str());
-				if (!result2.empty())
+				_tMeterToday meterToday;
+				if (m_sql.GetMeterToday(sitem.ID, meterToday))
 				{
-					total_min = std::stoull(result2[0][0]);
+					total_min = (uint64_t)meterToday.MinValue;
 					total_real = total_max - total_min;
 
 					sd[4] = std::to_string(total_real); //sitem.sValue = l_sValue.assign(sd[4]);
@@ -518,6 +530,7 @@ void CEventSystem::GetCurrentUserVariables()
 
 	//_log.Log(LOG_STATUS, "EventSystem: reset all user variables...");
 	m_uservariables.clear();
+	SetExportReload();
 
 	std::vector<std::vector<std::string> > result;
 	result = m_sql.safe_query("SELECT ID,Name,Value, ValueType, LastUpdate FROM UserVariables");
@@ -543,6 +556,7 @@ void CEventSystem::GetCurrentScenesGroups()
 	boost::unique_lock<boost::shared_mutex> scenesgroupsMutexLock(m_scenesgroupsMutex);
 
 	m_scenesgroups.clear();
+	SetExportReload();
 
 	std::vector<std::vector<std::string> > result;
 	result = m_sql.safe_query("SELECT ID, Name, nValue, SceneType, LastUpdate FROM Scenes");
@@ -912,18 +926,14 @@ void CEventSystem::GetCurrentMeasurementStates()
 				else if (sitem.subType == sTypeCounterIncremental)
 				{
 					uint64_t total_min, total_max, total_real;
-					std::vector<std::vector<std::string> > result2;
 
-					result2 = m_sql.safe_query("SELECT sValue FROM DeviceStatus WHERE (ID=%" PRIu64 ")", sitem.ID);
-					total_max = std::stoull(result2[0][0]);
-
-					//get value of today
-					std::string szDate = TimeToString(NULL, TF_Date);
-					result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID=%" PRIu64 " AND Date>='%q')",
-						sitem.ID, szDate.c_str());
-					if (!result2.empty())
+					//get value of today, sitem.sValue is already converted so take the raw counter from the device
+					_tDeviceCacheItem dev;
+					_tMeterToday meterToday;
+					if ((m_sql.m_devicecache.GetDevice(sitem.ID, dev)) && (m_sql.GetMeterToday(sitem.ID, meterToday)))
 					{
-						total_min = std::stoull(result2[0][0]);
+						total_max = std::strtoull(dev.sValue.c_str(), nullptr, 10);
+						total_min = (uint64_t)meterToday.MinValue;
 						total_real = total_max - total_min;
 
 						char szTmp[100];
@@ -1045,18 +1055,13 @@ void CEventSystem::GetCurrentMeasurementStates()
 		{
 			float GasDivider = 1000.0f;
 			//get lowest value of today
-			std::string szDate = TimeToString(NULL, TF_Date);
-			std::vector<std::vector<std::string> > result2;
-			result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID=%" PRIu64 " AND Date>='%q')",
-				sitem.ID, szDate.c_str());
-			if (!result2.empty())
+			_tMeterToday meterToday;
+			if (m_sql.GetMeterToday(sitem.ID, meterToday))
 			{
-				std::vector<std::string> sd2 = result2[0];
-
 				uint64_t total_min_gas, total_real_gas;
 				uint64_t gasactual;
 
-				total_min_gas = std::stoull(sd2[0]);
+				total_min_gas = (uint64_t)meterToday.MinValue;
 				gasactual = std::stoull(sitem.sValue);
 				total_real_gas = gasactual - total_min_gas;
 				utilityval = float(total_real_gas) / GasDivider;
@@ -1068,18 +1073,13 @@ void CEventSystem::GetCurrentMeasurementStates()
 			if (sitem.subType == sTypeRFXMeterCount)
 			{
 				//get value of today
-				std::string szDate = TimeToString(NULL, TF_Date);
-				std::vector<std::vector<std::string> > result2;
-				result2 = m_sql.safe_query("SELECT MIN(Value), MAX(Value) FROM Meter WHERE (DeviceRowID=%" PRIu64 " AND Date>='%q')",
-					sitem.ID, szDate.c_str());
-				if (!result2.empty())
+				_tMeterToday meterToday;
+				if (m_sql.GetMeterToday(sitem.ID, meterToday))
 				{
-					std::vector<std::string> sd2 = result2[0];
-
 					uint64_t total_min, total_max, total_real;
 
-					total_min = std::stoull(sd2[0]);
-					total_max = std::stoull(sd2[1]);
+					total_min = (uint64_t)meterToday.MinValue;
+					total_max = (uint64_t)meterToday.MaxValue;
 					total_real = total_max - total_min;
 
 					char szTmp[100];
@@ -1183,11 +1183,14 @@ void CEventSystem::RemoveSingleState(const uint64_t ulDevID, const _eReason reas
 	{
 		boost::unique_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
 		m_devicestates.erase(ulDevID);
+		m_deviceNamesVersion++;
+		SetExportReload();
 	}
 	else if (reason == REASON_SCENEGROUP)
 	{
 		boost::unique_lock<boost::shared_mutex> scenesgroupsMutexLock(m_scenesgroupsMutex);
 		m_scenesgroups.erase(ulDevID);
+		SetExportReload();
 	}
 }
 
@@ -1206,8 +1209,11 @@ void CEventSystem::WWWUpdateSingleState(const uint64_t ulDevID, const std::strin
 		if (itt != m_devicestates.end())
 		{
 			_tDeviceStatus replaceitem = itt->second;
+			if (replaceitem.deviceName != l_deviceName)
+				m_deviceNamesVersion++;
 			replaceitem.deviceName = l_deviceName;
 			itt->second = replaceitem;
+			SetExportChanged(reason, ulDevID);
 		}
 	}
 	else if (reason == REASON_SCENEGROUP)
@@ -1219,10 +1225,31 @@ void CEventSystem::WWWUpdateSingleState(const uint64_t ulDevID, const std::strin
 			_tScenesGroups replaceitem = itt->second;
 			replaceitem.scenesgroupName = l_deviceName;
 			itt->second = replaceitem;
+			SetExportChanged(reason, ulDevID);
 		}
 	}
 }
 
+void CEventSystem::SetExportChanged(const _eReason reason, const uint64_t ID)
+{
+	std::lock_guard<std::mutex> l(m_exportChangesMutex);
+	if (reason == REASON_DEVICE)
+		m_exportDevices.insert(ID);
+	else if (reason == REASON_SCENEGROUP)
+		m_exportScenesGroups.insert(ID);
+	else if (reason == REASON_USERVARIABLE)
+		m_exportUserVariables.insert(ID);
+}
+
+void CEventSystem::SetExportReload()
+{
+	std::lock_guard<std::mutex> l(m_exportChangesMutex);
+	m_bExportReload = true;
+	m_exportDevices.clear();
+	m_exportScenesGroups.clear();
+	m_exportUserVariables.clear();
+}
+
 void CEventSystem::WWWUpdateSecurityState(int securityStatus)
 {
 	if (!m_bEnabled)
@@ -1329,6 +1356,7 @@ bool CEventSystem::UpdateSceneGroup(const uint64_t ulDevID, const int nValue, co
 		}
 		replaceitem.lastUpdate = lastUpdate;
 		itt->second = replaceitem;
+		SetExportChanged(REASON_SCENEGROUP, ulDevID);
 	}
 	return bEventTrigger;
 }
@@ -1360,6 +1388,7 @@ void CEventSystem::UpdateUserVariable(const uint64_t ulDevID, const std::string
 	}
 	replaceitem.lastUpdate = lastUpdate;
 	itt->second = replaceitem;
+	SetExportChanged(REASON_USERVARIABLE, ulDevID);
 }
 
 std::string CEventSystem::UpdateSingleState(const uint64_t ulDevID, const std::string &devname, const int nValue, const char* sValue, const unsigned char devType, const unsigned char subType, const _eSwitchType switchType, const std::string &lastUpdate, const unsigned char lastLevel, const std::map<std::string, std::string> & options)
@@ -1380,6 +1409,8 @@ std::string CEventSystem::UpdateSingleState(const uint64_t ulDevID, const std::s
 	{
 		//_log.Log(LOG_STATUS,"EventSystem: update device %" PRIu64 "",ulDevID);
 		_tDeviceStatus replaceitem = itt->second;
+		if (replaceitem.deviceName != l_deviceName)
+			m_deviceNamesVersion++;
 		replaceitem.deviceName = l_deviceName;
 		if (nValue != -1)
 			replaceitem.nValue = nValue;
@@ -1397,6 +1428,7 @@ std::string CEventSystem::UpdateSingleState(const uint64_t ulDevID, const std::s
 			UpdateJsonMap(replaceitem, ulDevID);
 		}
 		itt->second = replaceitem;
+		SetExportChanged(REASON_DEVICE, ulDevID);
 	}
 	else
 	{
@@ -1418,6 +1450,8 @@ std::string CEventSystem::UpdateSingleState(const uint64_t ulDevID, const std::s
 			UpdateJsonMap(newitem, ulDevID);
 		}
 		m_devicestates[newitem.ID] = newitem;
+		m_deviceNamesVersion++;
+		SetExportChanged(REASON_DEVICE, ulDevID);
 	}
 	return nValueWording;
 }
@@ -1471,84 +1505,420 @@ void CEventSystem::EventQueueThread()
 	_log.Log(LOG_STATUS, "EventSystem: Queue thread stopped...");
 }
 
+#define EVENT_WORKER_THREADS 4
+
+void CEventSystem::StartEventWorkers()
+{
+	std::lock_guard<std::mutex> l(m_eventStatsMutex);
+	m_tasksDone = 0;
+	m_tasksTimedOut = 0;
+	m_totalLatency = 0;
+	m_maxLatency = 0;
+	m_totalRunTime = 0;
+	m_maxRunTime = 0;
+
+	for (int ii = 0; ii < EVENT_WORKER_THREADS; ii++)
+	{
+		std::shared_ptr<_tEventWorker> worker = std::make_shared<_tEventWorker>();
+		worker->thread = std::make_shared<std::thread>(&CEventSystem::EventWorkerThread, this, worker.get());
+		SetThreadName(worker->thread->native_handle(), "EventSystemWork");
+		m_eventworkers.push_back(worker);
+	}
+}
+
+void CEventSystem::StopEventWorkers()
+{
+	std::vector<std::shared_ptr<_tEventWorker> > workers;
+	{
+		std::lock_guard<std::mutex> l(m_eventStatsMutex);
+		workers.swap(m_eventworkers);
+	}
+	_tEventTask task;
+	task.type = TASK_STOP;
+	for (auto & itt : workers)
+		itt->tasks.push(task);
+	for (auto & itt : workers)
+	{
+		if (itt->thread)
+			itt->thread->join();
+	}
+}
+
+void CEventSystem::QueueEventTask(const std::string &key, _tEventTask &task)
+{
+	std::shared_ptr<_tEventWorker> worker;
+	{
+		std::lock_guard<std::mutex> l(m_eventStatsMutex);
+		if (m_eventworkers.empty())
+			return;
+		worker = m_eventworkers[std::hash<std::string>()(key) % m_eventworkers.size()];
+	}
+	task.queued = std::chrono::steady_clock::now();
+	worker->tasks.push(task);
+}
+
+void CEventSystem::EventWorkerThread(_tEventWorker *worker)
+{
+	_tEventTask task;
+	while (true)
+	{
+		if (!worker->tasks.timed_wait_and_pop<std::chrono::duration<int> >(task, std::chrono::duration<int>(5)))
+			continue;
+		if (task.type == TASK_STOP)
+			break;
+		if (m_TaskQueue.IsStopRequested(0))
+			continue;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		try
+		{
+			RunEventTask(task);
+		}
+		catch (...)
+		{
+			_log.Log(LOG_ERROR, "EventSystem: Exception evaluating %s", (task.type == TASK_DATABASE) ? "database events" : task.filename.c_str());
+		}
+		std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+
+		double latency = std::chrono::duration<double, std::milli>(started - task.queued).count();
+		double runtime = std::chrono::duration<double, std::milli>(finished - started).count();
+		std::lock_guard<std::mutex> l(m_eventStatsMutex);
+		m_tasksDone++;
+		m_totalLatency += latency;
+		m_maxLatency = std::max(m_maxLatency, latency);
+		m_totalRunTime += runtime;
+		m_maxRunTime = std::max(m_maxRunTime, runtime);
+	}
+}
+
+void CEventSystem::RunEventTask(const _tEventTask &task)
+{
+	switch (task.type)
+	{
+	case TASK_DZVENTS:
+		EvaluateLua(task.items, task.filename, "");
+		break;
+	case TASK_LUA:
+		EvaluateLua(task.items[0], task.filename, "");
+		break;
+	case TASK_PYTHON:
+#ifdef ENABLE_PYTHON
+		{
+			boost::unique_lock<boost::shared_mutex> uservariablesMutexLock(m_uservariablesMutex);
+			try
+			{
+				EvaluatePython(task.items[0], task.filename, "");
+			}
+			catch (...)
+			{
+			}
+		}
+#endif
+		break;
+	case TASK_DATABASE:
+#ifdef ENABLE_PYTHON
+		// Notify plugin system of security events if a plugin owns a Security Panel
+		if (task.items[0].reason == REASON_SECURITY)
+		{
+			std::vector<std::vector<std::string> > result;
+			result = m_sql.safe_query(
+				"SELECT DeviceStatus.HardwareID, DeviceStatus.ID, DeviceStatus.Unit FROM DeviceStatus INNER JOIN Hardware ON DeviceStatus.HardwareID=Hardware.ID WHERE (DeviceStatus.Type=%d AND DeviceStatus.SubType=%d  AND Hardware.Type=%d)",
+				pTypeSecurity1, sTypeDomoticzSecurity, HTYPE_PythonPlugin);
+
+			if (!result.empty())
+			{
+				std::vector<std::string> sd = result[0];
+				Plugins::CPlugin* pPlugin = (Plugins::CPlugin*)m_mainworker.GetHardware(atoi(sd[0].c_str()));
+				if (pPlugin)
+					pPlugin->MessagePlugin(new Plugins::onSecurityEventCallback(pPlugin, atoi(sd[2].c_str()), task.items[0].nValue, m_szSecStatus[task.items[0].nValue]));
+			}
+		}
+#endif
+		EvaluateDatabaseEvents(task.items[0]);
+		break;
+	default:
+		break;
+	}
+}
+
+void CEventSystem::GetStatistics(_tEventSystemStats &stats)
+{
+	stats.QueueDepth = m_eventqueue.size();
+	stats.WorkerDepth.clear();
+
+	std::lock_guard<std::mutex> l(m_eventStatsMutex);
+	for (const auto & itt : m_eventworkers)
+		stats.WorkerDepth.push_back(itt->tasks.size());
+	stats.TasksDone = m_tasksDone;
+	stats.TasksTimedOut = m_tasksTimedOut;
+	stats.AvgLatency = (m_tasksDone > 0) ? m_totalLatency / m_tasksDone : 0;
+	stats.MaxLatency = m_maxLatency;
+	stats.AvgRunTime = (m_tasksDone > 0) ? m_totalRunTime / m_tasksDone : 0;
+	stats.MaxRunTime = m_maxRunTime;
+}
+
 
 void CEventSystem::ProcessDevice(const int HardwareID, const uint64_t ulDevID, const unsigned char unit, const unsigned char devType, const unsigned char subType, const unsigned char signallevel, const unsigned char batterylevel, const int nValue, const char* sValue, const std::string &devname)
 {
 	if (!m_bEnabled)
 		return;
 
-	// query to get switchtype & LastUpdate, can't seem to get it from SQLHelper?
-	std::vector<std::vector<std::string> > result;
-	result = m_sql.safe_query("SELECT ID, SwitchType, LastUpdate, LastLevel, Options FROM DeviceStatus WHERE (Name == '%q')",
-		devname.c_str());
-	if (!result.empty())
+	_tDeviceCacheItem dev;
+	if (!m_sql.m_devicecache.GetDevice(ulDevID, dev))
 	{
-		std::vector<std::string> sd = result[0];
-		_eSwitchType switchType = (_eSwitchType)atoi(sd[1].c_str());
-		std::map<std::string, std::string> options = m_sql.BuildDeviceOptions(result[0][4].c_str());
+		_log.Log(LOG_ERROR, "EventSystem: Could not determine switch type for event device %s", devname.c_str());
+		return;
+	}
+	_eSwitchType switchType = (_eSwitchType)dev.SwitchType;
+	std::string sLastUpdate = dev.LastUpdate;
+	int lastLevel = dev.LastLevel;
+	std::map<std::string, std::string> options = m_sql.BuildDeviceOptions(dev.Options);
 
-		std::string osValue = sValue;
+	std::string osValue = sValue;
 
-		if ((devType == pTypeGeneral) && (subType == sTypeCounterIncremental))
+	if ((devType == pTypeGeneral) && (subType == sTypeCounterIncremental))
+	{
+		//special case for incremental counter, need to calculate the actual count value
+
+		//get value of today
+		_tMeterToday meterToday;
+		if (m_sql.GetMeterToday(ulDevID, meterToday))
 		{
-			//special case for incremental counter, need to calculate the actual count value
+			uint64_t total_max = std::strtoull(dev.sValue.c_str(), NULL, 10);
+			uint64_t total_real = total_max - (uint64_t)meterToday.MinValue;
 
-			//get value of today
-			std::string szDate = TimeToString(NULL, TF_Date);
-			std::vector<std::vector<std::string> > result2;
+			osValue = std::to_string(total_real); //sitem.sValue = l_sValue.assign(sd[4]);
+		}
+	}
+
+	//While a batch of received messages is stored the state is taken now, the scripts get it after the commit
+	m_sql.RunAfterCommit([=]() {
+		ProcessDeviceState(ulDevID, devType, subType, nValue, osValue, devname, switchType, sLastUpdate, lastLevel, options);
+	});
+}
+
+void CEventSystem::ProcessDeviceState(const uint64_t ulDevID, const unsigned char devType, const unsigned char subType, const int nValue, const std::string &sValue, const std::string &devname, const _eSwitchType switchType, const std::string &sLastUpdate, const int lastLevel, const std::map<std::string, std::string> &options)
+{
+	if (GetEventTrigger(ulDevID, REASON_DEVICE, true))
+	{
+		_tEventQueue item;
+		item.reason = REASON_DEVICE;
+		item.id = ulDevID;
+		item.devname = devname;
+		item.nValue = nValue;
+		item.sValue = sValue;
+		item.nValueWording = UpdateSingleState(ulDevID, devname, nValue, sValue.c_str(), devType, subType, switchType, "", 255, options);
+		item.trigger = NULL;
+		boost::unique_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
+		std::map<uint64_t, _tDeviceStatus>::iterator itt = m_devicestates.find(ulDevID);
+		if (itt != m_devicestates.end())
+		{
+			item.lastLevel = itt->second.lastLevel;
+			item.lastUpdate = itt->second.lastUpdate;
+			if (!m_sql.m_bDisableDzVentsSystem)
+			{
+				item.JsonMapString = itt->second.JsonMapString;
+				item.JsonMapInt = itt->second.JsonMapInt;
+				item.JsonMapFloat = itt->second.JsonMapFloat;
+				item.JsonMapBool = itt->second.JsonMapBool;
+			}
+			_tDeviceStatus replaceitem = itt->second;
+			replaceitem.lastUpdate = sLastUpdate;
+			replaceitem.lastLevel = lastLevel;
+			itt->second = replaceitem;
+			SetExportChanged(REASON_DEVICE, ulDevID);
+		}
+		m_eventqueue.push(item);
+	}
+	else
+		UpdateSingleState(ulDevID, devname, nValue, sValue.c_str(), devType, subType, switchType, sLastUpdate, lastLevel, options);
+}
+
+//IDs of the "[<id>]" references in a Blockly condition, optionally preceded by prefix
+static void GetConditionReferences(const std::string &conditions, const std::string &prefix, std::set<uint64_t> &IDs)
+{
+	std::string marker = prefix + "[";
+	size_t pos = conditions.find(marker);
+	while (pos != std::string::npos)
+	{
+		size_t spos = pos + marker.size();
+		size_t epos = conditions.find_first_not_of("0123456789", spos);
+		if ((epos != std::string::npos) && (epos > spos) && (conditions[epos] == ']'))
+		{
+			std::string number = conditions.substr(spos, epos - spos);
+			//the events were matched on the exact text "[<id>]"
+			if ((number.size() == 1) || (number[0] != '0'))
+				IDs.insert(std::stoull(number));
+		}
+		pos = conditions.find(marker, spos);
+	}
+}
 
-			uint64_t total_min, total_max, total_real;
+void CEventSystem::BuildEventIndex()
+{
+	for (int reason = 0; reason <= REASON_URL; reason++)
+		m_eventsByReason[reason].clear();
+	m_blocklyDeviceEvents.clear();
+	m_blocklyVariableEvents.clear();
 
-			result2 = m_sql.safe_query("SELECT sValue FROM DeviceStatus WHERE (ID=%" PRIu64 ")", ulDevID);
-			total_max = std::stoull(result2[0][0]);
+	for (size_t i = 0; i < m_events.size(); i++)
+	{
+		const _tEventItem &eitem = m_events[i];
+		if (eitem.EventStatus != 1)
+			continue;
 
-			result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID=%" PRIu64 " AND Date>='%q')", ulDevID, szDate.c_str());
-			if (!result2.empty())
+		for (int reason = 0; reason <= REASON_URL; reason++)
+		{
+			if ((eitem.Type != "all") && (eitem.Type != m_szReason[reason]))
+				continue;
+
+			if (eitem.Interpreter != "Blockly")
 			{
-				total_min = std::stoull(result2[0][0]);
-				total_real = total_max - total_min;
+				m_eventsByReason[reason].push_back(i);
+				continue;
+			}
 
-				osValue = std::to_string(total_real); //sitem.sValue = l_sValue.assign(sd[4]);
+			std::set<uint64_t> IDs;
+			if (reason == REASON_DEVICE)
+			{
+				GetConditionReferences(eitem.Conditions, "", IDs);
+				for (const auto & ID : IDs)
+					m_blocklyDeviceEvents.insert(std::make_pair(ID, i));
+			}
+			else if (reason == REASON_USERVARIABLE)
+			{
+				GetConditionReferences(eitem.Conditions, "variable", IDs);
+				for (const auto & ID : IDs)
+					m_blocklyVariableEvents.insert(std::make_pair(ID, i));
+			}
+			else if (reason == REASON_SECURITY)
+			{
+				// security status change
+				if (eitem.Conditions.find("securitystatus") != std::string::npos)
+					m_eventsByReason[reason].push_back(i);
+			}
+			else if (reason == REASON_TIME)
+			{
+				// time rules will only run when time or date based criteria are found
+				if ((eitem.Conditions.find("timeofday") != std::string::npos) ||
+					(eitem.Conditions.find("weekday") != std::string::npos))
+					m_eventsByReason[reason].push_back(i);
 			}
 		}
+	}
+}
+
+void CEventSystem::UpdateScriptIndex(_tScriptIndex &index, const std::string &dir, const std::string &extension, const bool bDeviceNames)
+{
+	std::vector<std::string> entries;
+	uint64_t listing = m_luaScriptCache.GetDirectoryListing(entries, dir, index.listing);
+
+	boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
+	if ((listing == index.listing) && ((!bDeviceNames) || (index.deviceNames == m_deviceNamesVersion)))
+		return;
 
-		if (GetEventTrigger(ulDevID, REASON_DEVICE, true))
+	if (listing != index.listing)
+	{
+		index.listing = listing;
+		index.files.clear();
+		std::string demo = "_demo" + extension;
+		std::vector<std::string>::const_iterator itt;
+		for (itt = entries.begin(); itt != entries.end(); ++itt)
 		{
-			_tEventQueue item;
-			item.reason = REASON_DEVICE;
-			item.id = ulDevID;
-			item.devname = devname;
-			item.nValue = nValue;
-			item.sValue = osValue;
-			item.nValueWording = UpdateSingleState(ulDevID, devname, nValue, osValue.c_str(), devType, subType, switchType, "", 255, options);
-			item.trigger = NULL;
-			boost::unique_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
-			std::map<uint64_t, _tDeviceStatus>::iterator itt = m_devicestates.find(ulDevID);
-			if (itt != m_devicestates.end())
+			const std::string &filename = *itt;
+			if (filename.length() > extension.length() &&
+				filename.compare(filename.length() - extension.length(), extension.length(), extension) == 0 &&
+				filename.find(demo) == std::string::npos)
+				index.files.push_back(filename);
+		}
+	}
+
+	//device scripts named after a device only run for that device, the others for every device
+	std::set<std::string> deviceNames;
+	if (bDeviceNames)
+	{
+		index.deviceNames = m_deviceNamesVersion;
+		std::map<uint64_t, _tDeviceStatus>::const_iterator itt;
+		for (itt = m_devicestates.begin(); itt != m_devicestates.end(); ++itt)
+			deviceNames.insert(SpaceToUnderscore(LowerCase(itt->second.deviceName)));
+	}
+	devicestatesMutexLock.unlock();
+
+	index.namedDeviceScripts.clear();
+	index.deviceScripts.clear();
+	index.timeScripts.clear();
+	index.securityScripts.clear();
+	index.variableScripts.clear();
+	for (size_t i = 0; i < index.files.size(); i++)
+	{
+		const std::string &filename = index.files[i];
+		size_t pos = filename.find("_device_");
+		if (pos != std::string::npos)
+		{
+			std::set<std::string> names;
+			while ((bDeviceNames) && (pos != std::string::npos))
 			{
-				item.lastLevel = itt->second.lastLevel;
-				item.lastUpdate = itt->second.lastUpdate;
-				if (!m_sql.m_bDisableDzVentsSystem)
+				size_t spos = pos + 8;
+				size_t epos = filename.find(extension, spos);
+				while (epos != std::string::npos)
 				{
-					item.JsonMapString = itt->second.JsonMapString;
-					item.JsonMapInt = itt->second.JsonMapInt;
-					item.JsonMapFloat = itt->second.JsonMapFloat;
-					item.JsonMapBool = itt->second.JsonMapBool;
+					std::string name = filename.substr(spos, epos - spos);
+					if (deviceNames.find(name) != deviceNames.end())
+						names.insert(name);
+					epos = filename.find(extension, epos + 1);
 				}
-				_tDeviceStatus replaceitem = itt->second;
-				replaceitem.lastUpdate = sd[2];
-				replaceitem.lastLevel = atoi(sd[3].c_str());
-				itt->second = replaceitem;
+				pos = filename.find("_device_", pos + 1);
 			}
-			m_eventqueue.push(item);
-		}
-		else
-			UpdateSingleState(ulDevID, devname, nValue, osValue.c_str(), devType, subType, switchType, sd[2], atoi(sd[3].c_str()), options);
+			if (names.empty())
+				index.deviceScripts.push_back(i);
+			for (const auto & name : names)
+				index.namedDeviceScripts[name].push_back(i);
+		}
+		if (filename.find("_time_") != std::string::npos)
+			index.timeScripts.push_back(i);
+		if (filename.find("_security_") != std::string::npos)
+			index.securityScripts.push_back(i);
+		if (filename.find("_variable_") != std::string::npos)
+			index.variableScripts.push_back(i);
 	}
-	else
+}
+
+void CEventSystem::GetIndexedScripts(_tScriptIndex &index, const std::string &dir, const std::string &extension, const bool bDeviceNames, const _tEventQueue &item, std::vector<std::string> &scripts)
+{
+	scripts.clear();
+	std::lock_guard<std::mutex> l(m_scriptIndexMutex);
+	UpdateScriptIndex(index, dir, extension, bDeviceNames);
+
+	std::vector<size_t> files;
+	switch (item.reason)
 	{
-		_log.Log(LOG_ERROR, "EventSystem: Could not determine switch type for event device %s", devname.c_str());
+	case REASON_DEVICE:
+		files = index.deviceScripts;
+		if (bDeviceNames)
+		{
+			std::map<std::string, std::vector<size_t> >::const_iterator itt = index.namedDeviceScripts.find(SpaceToUnderscore(LowerCase(item.devname)));
+			if (itt != index.namedDeviceScripts.end())
+			{
+				files.insert(files.end(), itt->second.begin(), itt->second.end());
+				//keep the order of the directory listing
+				std::sort(files.begin(), files.end());
+			}
+		}
+		break;
+	case REASON_TIME:
+		files = index.timeScripts;
+		break;
+	case REASON_SECURITY:
+		files = index.securityScripts;
+		break;
+	case REASON_USERVARIABLE:
+		files = index.variableScripts;
+		break;
+	default:
+		break;
 	}
+	for (const auto & i : files)
+		scripts.push_back(index.files[i]);
 }
 
 void CEventSystem::ProcessMinute()
@@ -1567,125 +1937,68 @@ void CEventSystem::EvaluateEvent(const std::vector<_tEventQueue> &items)
 	std::vector<std::string> FileEntries;
 	std::vector<std::string>::const_iterator itt2;
 	std::string filename;
-#ifdef ENABLE_PYTHON
-	std::vector<std::string> FileEntriesPython;
-	DirectoryListing(FileEntriesPython, m_python_Dir, false, true);
-#endif
+	_tEventTask task;
 
 	if (!m_sql.m_bDisableDzVentsSystem)
 	{
 		CdzVents* dzvents = CdzVents::GetInstance();
-		if (dzvents->m_bdzVentsExist)
-			EvaluateLua(items, dzvents->m_runtimeDir + "dzVents.lua", "");
-		else
+		bool bDzVents = dzvents->m_bdzVentsExist;
+		if (!bDzVents)
 		{
-			DirectoryListing(FileEntries, dzvents->m_scriptsDir, false, true);
+			m_luaScriptCache.GetDirectoryListing(FileEntries, dzvents->m_scriptsDir);
 			for (itt2 = FileEntries.begin(); itt2 != FileEntries.end(); ++itt2)
 			{
 				filename = *itt2;
 				if (filename.length() > 4 &&
 					filename.compare(filename.length() - 4, 4, ".lua") == 0)
 				{
-					EvaluateLua(items, dzvents->m_runtimeDir + "dzVents.lua", "");
+					bDzVents = true;
 					break;
 				}
 			}
 			FileEntries.clear();
 		}
+		if (bDzVents)
+		{
+			//dzVents keeps one state, so all its runs go to the same worker
+			task.type = TASK_DZVENTS;
+			task.items = items;
+			task.filename = dzvents->m_runtimeDir + "dzVents.lua";
+			QueueEventTask("dzVents", task);
+		}
 	}
 
-	bool bDeviceFileFound = false;
-	DirectoryListing(FileEntries, m_lua_Dir, false, true);
+	std::vector<std::string> Scripts;
 	std::vector<_tEventQueue>::const_iterator itt;
 	for (itt = items.begin(); itt != items.end(); ++itt)
 	{
-		for (itt2 = FileEntries.begin(); itt2 != FileEntries.end(); ++itt2)
-		{
-			filename = *itt2;
-			if (filename.length() > 4 &&
-				filename.compare(filename.length() - 4, 4, ".lua") == 0 &&
-				filename.find("_demo.lua") == std::string::npos)
-			{
-				if (itt->reason == REASON_DEVICE && filename.find("_device_") != std::string::npos)
-				{
-					bDeviceFileFound = false;
-					boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
-					std::map<uint64_t, _tDeviceStatus>::const_iterator itt3;
-					for (itt3 = m_devicestates.begin(); itt3 != m_devicestates.end(); ++itt3)
-					{
-						std::string deviceName = SpaceToUnderscore(LowerCase(itt3->second.deviceName));
-						if (filename.find("_device_" + deviceName + ".lua") != std::string::npos)
-						{
-							bDeviceFileFound = true;
-							if (deviceName == SpaceToUnderscore(LowerCase(itt->devname)))
-							{
-								devicestatesMutexLock.unlock();
-								EvaluateLua(*itt, m_lua_Dir + filename, "");
-								break;
-							}
-						}
-					}
-					if (!bDeviceFileFound)
-					{
-						devicestatesMutexLock.unlock();
-						EvaluateLua(*itt, m_lua_Dir + filename, "");
-					}
-				}
-				else if ((itt->reason == REASON_TIME && filename.find("_time_") != std::string::npos) ||
-					(itt->reason == REASON_SECURITY && filename.find("_security_") != std::string::npos) ||
-					(itt->reason == REASON_USERVARIABLE && filename.find("_variable_") != std::string::npos))
-				{
-					EvaluateLua(*itt, m_lua_Dir + filename, "");
-				}
-			}
-			// else _log.Log(LOG_STATUS,"EventSystem: ignore file not .lua or is demo file: %s", filename.c_str());
-		}
+		//device, scene and variable events keep their order per item, the other scripts per script
+		std::string itemKey;
+		if ((itt->reason == REASON_DEVICE) || (itt->reason == REASON_SCENEGROUP) || (itt->reason == REASON_USERVARIABLE))
+			itemKey = m_szReason[itt->reason] + "_" + std::to_string(itt->id);
+		task.items.assign(1, *itt);
 
-#ifdef ENABLE_PYTHON
-		boost::unique_lock<boost::shared_mutex> uservariablesMutexLock(m_uservariablesMutex);
-		try
-		{
-			for (itt2 = FileEntriesPython.begin(); itt2 != FileEntriesPython.end(); ++itt2)
-			{
-				filename = *itt2;
-				if (filename.length() > 3 &&
-					filename.compare(filename.length() - 3, 3, ".py") == 0 &&
-					filename.find("_demo.py") == std::string::npos)
-				{
-					if ((itt->reason == REASON_DEVICE && filename.find("_device_") != std::string::npos) ||
-						(itt->reason == REASON_TIME && filename.find("_time_") != std::string::npos) ||
-						(itt->reason == REASON_SECURITY && filename.find("_security_") != std::string::npos) ||
-						(itt->reason == REASON_USERVARIABLE && filename.find("_variable_") != std::string::npos))
-					{
-						EvaluatePython(*itt, m_python_Dir + filename, "");
-					}
-				}
-				// else _log.Log(LOG_STATUS,"EventSystem: ignore file not .py or is demo file: %s", filename.c_str());
-			}
-		}
-		catch (...)
+		GetIndexedScripts(m_luaScriptIndex, m_lua_Dir, ".lua", true, *itt, Scripts);
+		for (itt2 = Scripts.begin(); itt2 != Scripts.end(); ++itt2)
 		{
+			task.type = TASK_LUA;
+			task.filename = m_lua_Dir + *itt2;
+			QueueEventTask((itemKey.empty()) ? task.filename : itemKey, task);
 		}
-		uservariablesMutexLock.unlock();
 
-		// Notify plugin system of security events if a plugin owns a Security Panel
-		if (itt->reason == REASON_SECURITY)
+#ifdef ENABLE_PYTHON
+		//the Python interpreter runs one script at a time
+		GetIndexedScripts(m_pythonScriptIndex, m_python_Dir, ".py", false, *itt, Scripts);
+		for (itt2 = Scripts.begin(); itt2 != Scripts.end(); ++itt2)
 		{
-			std::vector<std::vector<std::string> > result;
-			result = m_sql.safe_query(
-				"SELECT DeviceStatus.HardwareID, DeviceStatus.ID, DeviceStatus.Unit FROM DeviceStatus INNER JOIN Hardware ON DeviceStatus.HardwareID=Hardware.ID WHERE (DeviceStatus.Type=%d AND DeviceStatus.SubType=%d  AND Hardware.Type=%d)",
-				pTypeSecurity1, sTypeDomoticzSecurity, HTYPE_PythonPlugin);
-
-			if (!result.empty())
-			{
-				std::vector<std::string> sd = result[0];
-				Plugins::CPlugin* pPlugin = (Plugins::CPlugin*)m_mainworker.GetHardware(atoi(sd[0].c_str()));
-				if (pPlugin)
-					pPlugin->MessagePlugin(new Plugins::onSecurityEventCallback(pPlugin, atoi(sd[2].c_str()), itt->nValue, m_szSecStatus[itt->nValue]));
-			}
+			task.type = TASK_PYTHON;
+			task.filename = m_python_Dir + *itt2;
+			QueueEventTask("Python", task);
 		}
 #endif
-		EvaluateDatabaseEvents(*itt);
+		task.type = TASK_DATABASE;
+		task.filename.clear();
+		QueueEventTask((itemKey.empty()) ? "database" : itemKey, task);
 	}
 }
 
@@ -1959,61 +2272,38 @@ void CEventSystem::EvaluateDatabaseEvents(const _tEventQueue &item)
 	lua_State *lua_state = NULL;
 
 	boost::shared_lock<boost::shared_mutex> eventsMutexLock(m_eventsMutex);
-	std::vector<_tEventItem>::const_iterator it;
+
+	std::vector<size_t> events = m_eventsByReason[item.reason];
+	if ((item.id > 0) && ((item.reason == REASON_DEVICE) || (item.reason == REASON_USERVARIABLE)))
+	{
+		const std::multimap<uint64_t, size_t> &blocklyEvents = (item.reason == REASON_DEVICE) ? m_blocklyDeviceEvents : m_blocklyVariableEvents;
+		auto range = blocklyEvents.equal_range(item.id);
+		for (auto itt = range.first; itt != range.second; ++itt)
+			events.push_back(itt->second);
+		//run in the order of the events table
+		std::sort(events.begin(), events.end());
+	}
+
 	try
 	{
-		for (it = m_events.begin(); it != m_events.end(); ++it)
+		std::vector<size_t>::const_iterator itt;
+		for (itt = events.begin(); itt != events.end(); ++itt)
 		{
-			bool eventInScope = ((it->Type == "all") || (it->Type == m_szReason[item.reason]));
-			bool eventActive = (it->EventStatus == 1);
+			const _tEventItem &eitem = m_events[*itt];
+			if (eitem.Interpreter == "Blockly")
+				lua_state = ParseBlocklyLua(lua_state, eitem);
 
-			if (eventInScope && eventActive)
-			{
-				if (it->Interpreter == "Blockly")
-				{
-					std::size_t found = std::string::npos;
-					if ((item.reason == REASON_DEVICE) && (item.id > 0))
-					{
-						std::stringstream sstr;
-						sstr << "[" << item.id << "]";
-						found = it->Conditions.find(sstr.str());
-					}
-					else if (item.reason == REASON_SECURITY)
-					{
-						// security status change
-						std::stringstream sstr;
-						sstr << "securitystatus";
-						found = it->Conditions.find(sstr.str());
-					}
-					else if (item.reason == REASON_TIME)
-					{
-						// time rules will only run when time or date based criteria are found
-						found = it->Conditions.find("timeofday");
-						if (found == std::string::npos)
-							found = it->Conditions.find("weekday");
-					}
-					else if ((item.reason == REASON_USERVARIABLE) && (item.id > 0))
-					{
-						std::stringstream sstr;
-						sstr << "variable[" << item.id << "]";
-						found = it->Conditions.find(sstr.str());
-					}
-
-					if (found != std::string::npos)
-						lua_state = ParseBlocklyLua(lua_state, *it);
-				}
-				else if (it->Interpreter == "Lua")
-					EvaluateLua(item, it->Name, it->Actions);
+			else if (eitem.Interpreter == "Lua")
+				EvaluateLua(item, eitem.Name, eitem.Actions);
 
-				else if (it->Interpreter == "Python")
-				{
+			else if (eitem.Interpreter == "Python")
+			{
 #ifdef ENABLE_PYTHON
-					boost::unique_lock<boost::shared_mutex> uservariablesMutexLock(m_uservariablesMutex);
-					EvaluatePython(item, it->Name, it->Actions);
+				boost::unique_lock<boost::shared_mutex> uservariablesMutexLock(m_uservariablesMutex);
+				EvaluatePython(item, eitem.Name, eitem.Actions);
 #else
-					_log.Log(LOG_ERROR, "EventSystem: Error processing database scripts, Python not enabled");
+				_log.Log(LOG_ERROR, "EventSystem: Error processing database scripts, Python not enabled");
 #endif
-				}
 			}
 		}
 	}
@@ -2740,11 +3030,7 @@ void CEventSystem::ExportDeviceStatesToLua(lua_State *lua_state, const _tEventQu
 
 void CEventSystem::EvaluateLuaClassic(lua_State *lua_state, const _tEventQueue &item, const int secStatus)
 {
-	// reroute print library to Domoticz logger
-	luaL_openlibs(lua_state);
-	lua_pushcfunction(lua_state, l_domoticz_print);
-	lua_setglobal(lua_state, "print");
-
+	//Libraries and print are set up once per pooled state, see GetPooledLuaState
 	{
 		std::lock_guard<std::mutex> measurementStatesMutexLock(m_measurementStatesMutex);
 		GetCurrentMeasurementStates();
@@ -3152,6 +3438,17 @@ void CEventSystem::EvaluateLuaClassic(lua_State *lua_state, const _tEventQueue &
 	lua_setglobal(lua_state, "globalvariables");
 }
 
+//A script is stopped after LUA_MAX_INSTRUCTIONS instructions or when it still runs LUA_SCRIPT_TIME_BUDGET seconds after it started,
+//blocking calls like os.execute are only interrupted when they return to Lua
+#define LUA_MAX_INSTRUCTIONS 10000000
+#define LUA_HOOK_INSTRUCTIONS 100000
+#define LUA_SCRIPT_TIME_BUDGET 10
+
+static lua_Number GetSteadyClockMs()
+{
+	return (lua_Number)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void CEventSystem::EvaluateLua(const _tEventQueue &item, const std::string &filename, const std::string &LuaString)
 {
 	std::vector<_tEventQueue> items;
@@ -3161,34 +3458,51 @@ void CEventSystem::EvaluateLua(const _tEventQueue &item, const std::string &file
 
 void CEventSystem::EvaluateLua(const std::vector<_tEventQueue> &items, const std::string &filename, const std::string &LuaString)
 {
-	std::lock_guard<std::mutex> l(luaMutex);
+	CdzVents* dzvents = CdzVents::GetInstance();
+	bool bIsDzVents = (!m_sql.m_bDisableDzVentsSystem && filename == dzvents->m_runtimeDir + "dzVents.lua");
 
 	lua_State *lua_state;
-	lua_state = luaL_newstate();
-
-	// load Lua libraries
-	static const luaL_Reg lualibs[] =
+	_eLuaStateType stateType;
+	if (!bIsDzVents)
 	{
-		{ "base", luaopen_base },
-		{ "io", luaopen_io },
-		{ "table", luaopen_table },
-		{ "string", luaopen_string },
-		{ "math", luaopen_math },
-		{ NULL, NULL }
-	};
-
-	const luaL_Reg *lib = lualibs;
-	for (; lib->func != NULL; lib++)
+		lua_state = GetPooledLuaState();
+		stateType = LUASTATE_POOLED;
+	}
+	else if ((lua_state = dzvents->AcquireLuaState()) != NULL)
 	{
-		lib->func(lua_state);
-		lua_settop(lua_state, 0);
+		//keeps the exported domoticz data between runs
+		stateType = LUASTATE_DZVENTS;
 	}
+	else
+	{
+		//a previous dzVents run still uses the long-lived state
+		lua_state = luaL_newstate();
+		stateType = LUASTATE_NEW;
+
+		// load Lua libraries
+		static const luaL_Reg lualibs[] =
+		{
+			{ "base", luaopen_base },
+			{ "io", luaopen_io },
+			{ "table", luaopen_table },
+			{ "string", luaopen_string },
+			{ "math", luaopen_math },
+			{ NULL, NULL }
+		};
+
+		const luaL_Reg *lib = lualibs;
+		for (; lib->func != NULL; lib++)
+		{
+			lib->func(lua_state);
+			lua_settop(lua_state, 0);
+		}
 
-	lua_pushcfunction(lua_state, l_domoticz_applyJsonPath);
-	lua_setglobal(lua_state, "domoticz_applyJsonPath");
+		lua_pushcfunction(lua_state, l_domoticz_applyJsonPath);
+		lua_setglobal(lua_state, "domoticz_applyJsonPath");
 
-	lua_pushcfunction(lua_state, l_domoticz_applyXPath);
-	lua_setglobal(lua_state, "domoticz_applyXPath");
+		lua_pushcfunction(lua_state, l_domoticz_applyXPath);
+		lua_setglobal(lua_state, "domoticz_applyXPath");
+	}
 
 #ifdef _DEBUG
 	_log.Log(LOG_STATUS, "EventSystem: script %s trigger (%s)", m_szReason[items[0].reason].c_str(), filename.c_str());
@@ -3278,28 +3592,34 @@ void CEventSystem::EvaluateLua(const std::vector<_tEventQueue> &items, const std
 
 	int secstatus = 0;
 	m_sql.GetPreferencesVar("SecStatus", secstatus);
-	CdzVents* dzvents = CdzVents::GetInstance();
-	if (!m_sql.m_bDisableDzVentsSystem && filename == dzvents->m_runtimeDir + "dzVents.lua")
+	if (bIsDzVents)
 		dzvents->EvaluateDzVents(lua_state, items, secstatus);
 	else
 		EvaluateLuaClassic(lua_state, items[0], secstatus);
 
 	int status = 0;
 	if (LuaString.length() == 0)
-		status = luaL_loadfile(lua_state, filename.c_str());
+		status = m_luaScriptCache.LoadFile(lua_state, filename);
 	else
-		status = luaL_loadstring(lua_state, LuaString.c_str());
+		status = m_luaScriptCache.LoadScriptString(lua_state, filename, LuaString);
 
 	if (status == 0)
 	{
-		lua_sethook(lua_state, luaStop, LUA_MASKCOUNT, 10000000);
-
-		boost::thread luaThread(boost::bind(&CEventSystem::luaThread, this, lua_state, filename));
+		//armed for luaStop, the counters live in the registry as pooled states are used by several workers
+		lua_pushnumber(lua_state, GetSteadyClockMs() + (LUA_SCRIPT_TIME_BUDGET * 1000));
+		lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_deadline");
+		lua_pushnumber(lua_state, 0);
+		lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_instructions");
+		lua_sethook(lua_state, luaStop, LUA_MASKCOUNT, LUA_HOOK_INSTRUCTIONS);
+
+		boost::thread luaThread(boost::bind(&CEventSystem::luaThread, this, lua_state, filename, stateType));
 		SetThreadName(luaThread.native_handle(), "luaThread");
 
-		if (!luaThread.timed_join(boost::posix_time::seconds(10)))
+		if (!luaThread.timed_join(boost::posix_time::seconds(LUA_SCRIPT_TIME_BUDGET)))
 		{
-			_log.Log(LOG_ERROR, "EventSystem: Warning!, lua script %s has been running for more than 10 seconds", filename.c_str());
+			_log.Log(LOG_ERROR, "EventSystem: Warning!, lua script %s has been running for more than %d seconds", filename.c_str(), LUA_SCRIPT_TIME_BUDGET);
+			std::lock_guard<std::mutex> l(m_eventStatsMutex);
+			m_tasksTimedOut++;
 		}
 		else
 		{
@@ -3309,7 +3629,7 @@ void CEventSystem::EvaluateLua(const std::vector<_tEventQueue> &items, const std
 	else
 	{
 		report_errors(lua_state, status, filename);
-		lua_close(lua_state);
+		ReleaseLuaState(lua_state, stateType);
 		return;
 	}
 
@@ -3346,7 +3666,7 @@ void CEventSystem::EvaluateLua(const std::vector<_tEventQueue> &items, const std
 	*/
 }
 
-void CEventSystem::luaThread(lua_State *lua_state, const std::string &filename)
+void CEventSystem::luaThread(lua_State *lua_state, const std::string &filename, const _eLuaStateType stateType)
 {
 	int status;
 	status = lua_pcall(lua_state, 0, LUA_MULTRET, 0);
@@ -3373,19 +3693,250 @@ void CEventSystem::luaThread(lua_State *lua_state, const std::string &filename)
 			_log.Log(LOG_STATUS, "EventSystem: Script event triggered: %s", filename.c_str());
 	}
 
-	lua_close(lua_state);
+	ReleaseLuaState(lua_state, stateType);
+}
+
+//Idle interpreters kept for classic Lua scripts
+#define LUA_STATE_POOL_SIZE 4
+
+//Reusable states keep their libraries between runs, every run gets an empty global table that falls back
+//to the library globals, so whatever a script leaves behind in its globals is gone after the run.
+//The library tables (string, math, table, os, ...) are copied for every run, so changing them does not last either
+void CEventSystem::InitReusableLuaState(lua_State *lua_state)
+{
+	//remember the library globals, loaded modules and search paths to restore them after every run
+	lua_rawgeti(lua_state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_globals");
+
+	lua_newtable(lua_state);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "_LOADED");
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, -2) != 0)
+	{
+		lua_pushvalue(lua_state, -2);
+		lua_insert(lua_state, -2);
+		lua_rawset(lua_state, -5);
+	}
+	lua_pop(lua_state, 1);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_loaded");
+
+	lua_getglobal(lua_state, "package");
+	lua_getfield(lua_state, -1, "path");
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_path");
+	lua_getfield(lua_state, -1, "cpath");
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "domoticz_cpath");
+	lua_pop(lua_state, 1);
+}
+
+void CEventSystem::BeginReusableLuaRun(lua_State *lua_state)
+{
+	//new global table for this run
+	lua_newtable(lua_state);
+	lua_newtable(lua_state);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_globals");
+	lua_setfield(lua_state, -2, "__index");
+	lua_setmetatable(lua_state, -2);
+	lua_pushvalue(lua_state, -1);
+	lua_setfield(lua_state, -2, "_G");
+	int globals = lua_gettop(lua_state);
+
+	//shallow copies of the library tables, also returned by require and used for string methods
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "_LOADED");
+	int loaded = lua_gettop(lua_state);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_globals");
+	int libraries = lua_gettop(lua_state);
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, libraries) != 0)
+	{
+		if ((lua_type(lua_state, -2) == LUA_TSTRING) && (lua_type(lua_state, -1) == LUA_TTABLE) && (!lua_rawequal(lua_state, -1, libraries)))
+		{
+			//package stays shared, the searchers of require only look at the original
+			std::string name = lua_tostring(lua_state, -2);
+			if (name != "package")
+			{
+				int original = lua_gettop(lua_state);
+				lua_newtable(lua_state);
+				int copy = lua_gettop(lua_state);
+				lua_pushnil(lua_state);
+				while (lua_next(lua_state, original) != 0)
+				{
+					lua_pushvalue(lua_state, -2);
+					lua_insert(lua_state, -2);
+					lua_rawset(lua_state, copy);
+				}
+				lua_getfield(lua_state, loaded, name.c_str());
+				if (lua_rawequal(lua_state, -1, original))
+				{
+					lua_pushvalue(lua_state, copy);
+					lua_setfield(lua_state, loaded, name.c_str());
+				}
+				lua_pop(lua_state, 1);
+				if (name == "string")
+				{
+					lua_pushliteral(lua_state, "");
+					if (lua_getmetatable(lua_state, -1))
+					{
+						lua_pushvalue(lua_state, copy);
+						lua_setfield(lua_state, -2, "__index");
+						lua_pop(lua_state, 1);
+					}
+					lua_pop(lua_state, 1);
+				}
+				lua_setfield(lua_state, globals, name.c_str());
+			}
+		}
+		lua_pop(lua_state, 1);
+	}
+	lua_pop(lua_state, 2);
 
+	lua_rawseti(lua_state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+}
+
+void CEventSystem::EndReusableLuaRun(lua_State *lua_state)
+{
+	lua_sethook(lua_state, NULL, 0, 0);
+	lua_settop(lua_state, 0);
+
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_globals");
+	lua_rawseti(lua_state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+
+	//modules required by the script are loaded again next time, as they would be with a new state
+	std::vector<std::string> modules;
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_loaded");
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, -3) != 0)
+	{
+		lua_pop(lua_state, 1);
+		if (lua_type(lua_state, -1) != LUA_TSTRING)
+			continue;
+		lua_pushvalue(lua_state, -1);
+		lua_rawget(lua_state, -3);
+		if (lua_isnil(lua_state, -1))
+			modules.push_back(lua_tostring(lua_state, -2));
+		lua_pop(lua_state, 1);
+	}
+	for (const auto & itt : modules)
+	{
+		lua_pushnil(lua_state);
+		lua_setfield(lua_state, -3, itt.c_str());
+	}
+	//and the libraries are the originals again
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, -2) != 0)
+	{
+		lua_pushvalue(lua_state, -2);
+		lua_insert(lua_state, -2);
+		lua_rawset(lua_state, -5);
+	}
+	lua_pop(lua_state, 2);
+
+	lua_pushliteral(lua_state, "");
+	if (lua_getmetatable(lua_state, -1))
+	{
+		lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_globals");
+		lua_getfield(lua_state, -1, "string");
+		lua_setfield(lua_state, -3, "__index");
+		lua_pop(lua_state, 2);
+	}
+	lua_pop(lua_state, 1);
+
+	lua_getglobal(lua_state, "package");
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_path");
+	lua_setfield(lua_state, -2, "path");
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "domoticz_cpath");
+	lua_setfield(lua_state, -2, "cpath");
+	lua_pop(lua_state, 1);
+
+	lua_gc(lua_state, LUA_GCCOLLECT, 0);
+}
+
+lua_State *CEventSystem::GetPooledLuaState()
+{
+	lua_State *lua_state = NULL;
+	{
+		std::lock_guard<std::mutex> l(m_luaStatePoolMutex);
+		if (!m_luaStatePool.empty())
+		{
+			lua_state = m_luaStatePool.back();
+			m_luaStatePool.pop_back();
+		}
+	}
+	if (lua_state == NULL)
+	{
+		lua_state = luaL_newstate();
+		luaL_openlibs(lua_state);
+
+		// reroute print library to Domoticz logger
+		lua_pushcfunction(lua_state, l_domoticz_print);
+		lua_setglobal(lua_state, "print");
+
+		lua_pushcfunction(lua_state, l_domoticz_applyJsonPath);
+		lua_setglobal(lua_state, "domoticz_applyJsonPath");
+
+		lua_pushcfunction(lua_state, l_domoticz_applyXPath);
+		lua_setglobal(lua_state, "domoticz_applyXPath");
+
+		InitReusableLuaState(lua_state);
+	}
+	BeginReusableLuaRun(lua_state);
+	return lua_state;
+}
+
+void CEventSystem::ReleaseLuaState(lua_State *lua_state, const _eLuaStateType stateType)
+{
+	if (stateType == LUASTATE_NEW)
+	{
+		lua_close(lua_state);
+		return;
+	}
+	EndReusableLuaRun(lua_state);
+	if (stateType == LUASTATE_DZVENTS)
+	{
+		CdzVents::GetInstance()->ReleaseLuaState(lua_state);
+		return;
+	}
+
+	std::lock_guard<std::mutex> l(m_luaStatePoolMutex);
+	if (m_luaStatePool.size() < LUA_STATE_POOL_SIZE)
+		m_luaStatePool.push_back(lua_state);
+	else
+		lua_close(lua_state);
+}
+
+void CEventSystem::ClearLuaStatePool()
+{
+	CdzVents::GetInstance()->CloseLuaState();
+	std::lock_guard<std::mutex> l(m_luaStatePoolMutex);
+	for (auto & itt : m_luaStatePool)
+		lua_close(itt);
+	m_luaStatePool.clear();
 }
 
 
 void CEventSystem::luaStop(lua_State *L, lua_Debug *ar)
 {
-	if (ar->event == LUA_HOOKCOUNT)
+	if (ar->event != LUA_HOOKCOUNT)
+		return;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "domoticz_instructions");
+	lua_Number instructions = lua_tonumber(L, -1) + LUA_HOOK_INSTRUCTIONS;
+	lua_pop(L, 1);
+	lua_pushnumber(L, instructions);
+	lua_setfield(L, LUA_REGISTRYINDEX, "domoticz_instructions");
+	if (instructions >= LUA_MAX_INSTRUCTIONS)
 	{
-		(void)ar;  /* unused arg. */
 		lua_sethook(L, NULL, 0, 0);
 		luaL_error(L, "Lua script execution exceeds maximum number of lines");
-		lua_close(L);
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "domoticz_deadline");
+	lua_Number deadline = lua_tonumber(L, -1);
+	lua_pop(L, 1);
+	if ((deadline > 0) && (GetSteadyClockMs() >= deadline))
+	{
+		lua_sethook(L, NULL, 0, 0);
+		luaL_error(L, "Lua script execution exceeds maximum time of %d seconds", LUA_SCRIPT_TIME_BUDGET);
 	}
 }
 
@@ -3812,21 +4363,25 @@ void CEventSystem::WriteToLog(const std::string &devNameNoQuotes, const std::str
 	else if (devNameNoQuotes == "WriteToLogDeviceVariable")
 	{
 		boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
-		int devIdx = atoi(doWhat.c_str());
+		std::map<uint64_t, _tDeviceStatus>::const_iterator itt = m_devicestates.find(atoi(doWhat.c_str()));
+		if (itt == m_devicestates.end())
+			return;
 		if (
-			(m_devicestates[devIdx].devType == pTypeHUM)
+			(itt->second.devType == pTypeHUM)
 			) {
 			//nValue devices
-			_log.Log(LOG_STATUS, "%d", m_devicestates[devIdx].nValue);
+			_log.Log(LOG_STATUS, "%d", itt->second.nValue);
 		}
 		else {
-			_log.Log(LOG_STATUS, "%s", m_devicestates[devIdx].sValue.c_str());
+			_log.Log(LOG_STATUS, "%s", itt->second.sValue.c_str());
 		}
 	}
 	else if (devNameNoQuotes == "WriteToLogSwitch")
 	{
 		boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
-		_log.Log(LOG_STATUS, "%s", m_devicestates[atoi(doWhat.c_str())].nValueWording.c_str());
+		std::map<uint64_t, _tDeviceStatus>::const_iterator itt = m_devicestates.find(atoi(doWhat.c_str()));
+		if (itt != m_devicestates.end())
+			_log.Log(LOG_STATUS, "%s", itt->second.nValueWording.c_str());
 	}
 }
 
@@ -3888,11 +4443,25 @@ bool CEventSystem::ScheduleEvent(std::string deviceName, const std::string &Acti
 
 bool CEventSystem::ScheduleEvent(int deviceID, const std::string &Action, bool isScene, const std::string &eventName, int sceneType)
 {
-	boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
-	std::string previousState = m_devicestates[deviceID].nValueWording;
-	int previousLevel = calculateDimLevel(deviceID, m_devicestates[deviceID].lastLevel);
+	std::string previousState;
+	int previousLastLevel = 0;
+	{
+		//operator[] would insert under the shared lock
+		boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_devicestatesMutex);
+		std::map<uint64_t, _tDeviceStatus>::const_iterator itt = m_devicestates.find(deviceID);
+		if (itt != m_devicestates.end())
+		{
+			previousState = itt->second.nValueWording;
+			previousLastLevel = itt->second.lastLevel;
+		}
+		else if (!isScene)
+		{
+			_log.Log(LOG_ERROR, "EventSystem: Device %d not found, event '%s' not scheduled", deviceID, eventName.c_str());
+			return false;
+		}
+	}
+	int previousLevel = calculateDimLevel(deviceID, previousLastLevel);
 	int level = 0;
-	devicestatesMutexLock.unlock();
 
 	struct _tActionParseResults oParseResults = { "", 0, 0, 0, 1, 0, true };
 	ParseActionString(Action, oParseResults);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <set>
+#include <map>
+#include <chrono>
 #include <boost/thread/shared_mutex.hpp>
 
 extern "C" {
@@ -17,6 +20,7 @@ extern "C" {
 #include "../httpclient/HTTPClient.h"
 
 #include "LuaCommon.h"
+#include "LuaScriptCache.h"
 #include "concurrent_queue.h"
 #include "StoppableTask.h"
 
@@ -136,6 +140,19 @@ public:
 
 	void TriggerURL(const std::string &result, const std::vector<std::string> &headerData, const std::string &callback);
 
+	struct _tEventSystemStats
+	{
+		size_t QueueDepth;					// items waiting to be dispatched
+		std::vector<size_t> WorkerDepth;	// scripts waiting per worker
+		uint64_t TasksDone;
+		uint64_t TasksTimedOut;				// ran longer than the time budget
+		double AvgLatency;					// ms from dispatch until the script started
+		double MaxLatency;
+		double AvgRunTime;					// ms
+		double MaxRunTime;
+	};
+	void GetStatistics(_tEventSystemStats &stats);
+
 private:
 	enum _eJsonType
 	{
@@ -178,6 +195,42 @@ private:
 	};
 	concurrent_queue<_tEventQueue> m_eventqueue;
 
+	//Scripts are evaluated by a pool of workers, the tasks of one device, scene or
+	//variable always go to the same worker so they keep their order
+	enum _eEventTaskType
+	{
+		TASK_DZVENTS,
+		TASK_LUA,
+		TASK_PYTHON,
+		TASK_DATABASE,
+		TASK_STOP
+	};
+	struct _tEventTask
+	{
+		_eEventTaskType type;
+		std::vector<_tEventQueue> items;
+		std::string filename;
+		std::chrono::steady_clock::time_point queued;
+	};
+	struct _tEventWorker
+	{
+		concurrent_queue<_tEventTask> tasks;
+		std::shared_ptr<std::thread> thread;
+	};
+	std::vector<std::shared_ptr<_tEventWorker> > m_eventworkers;
+	std::mutex m_eventStatsMutex;	// also guards m_eventworkers
+	uint64_t m_tasksDone;
+	uint64_t m_tasksTimedOut;
+	double m_totalLatency;
+	double m_maxLatency;
+	double m_totalRunTime;
+	double m_maxRunTime;
+	void StartEventWorkers();
+	void StopEventWorkers();
+	void EventWorkerThread(_tEventWorker *worker);
+	void QueueEventTask(const std::string &key, _tEventTask &task);
+	void RunEventTask(const _tEventTask &task);
+
 	std::vector<_tEventTrigger> m_eventtrigger;
 	bool m_bEnabled;
 	boost::shared_mutex m_devicestatesMutex;
@@ -186,7 +239,17 @@ private:
 	boost::shared_mutex m_scenesgroupsMutex;
 	boost::shared_mutex m_eventtriggerMutex;
 	std::mutex m_measurementStatesMutex;
-	std::mutex luaMutex;
+	CLuaScriptCache m_luaScriptCache;
+	//Items changed since the last incremental dzVents export, see CdzVents::UpdateDomoticzData
+	std::mutex m_exportChangesMutex;
+	std::set<uint64_t> m_exportDevices;
+	std::set<uint64_t> m_exportScenesGroups;
+	std::set<uint64_t> m_exportUserVariables;
+	bool m_bExportReload;
+	void SetExportChanged(const _eReason reason, const uint64_t ID);
+	void SetExportReload();
+	std::mutex m_luaStatePoolMutex;
+	std::vector<lua_State*> m_luaStatePool;
 	std::shared_ptr<std::thread> m_thread;
 	std::shared_ptr<std::thread> m_eventqueuethread;
 	StoppableTask m_TaskQueue;
@@ -202,6 +265,7 @@ private:
 	void ProcessMinute();
 	void GetCurrentMeasurementStates();
 	std::string UpdateSingleState(const uint64_t ulDevID, const std::string &devname, const int nValue, const char* sValue, const unsigned char devType, const unsigned char subType, const _eSwitchType switchType, const std::string &lastUpdate, const unsigned char lastLevel, const std::map<std::string, std::string> & options);
+	void ProcessDeviceState(const uint64_t ulDevID, const unsigned char devType, const unsigned char subType, const int nValue, const std::string &sValue, const std::string &devname, const _eSwitchType switchType, const std::string &sLastUpdate, const int lastLevel, const std::map<std::string, std::string> &options);
 	void EvaluateEvent(const std::vector<_tEventQueue> &items);
 	void EvaluateDatabaseEvents(const _tEventQueue &item);
 	lua_State *ParseBlocklyLua(lua_State *lua_state, const _tEventItem &item);
@@ -213,7 +277,19 @@ private:
 #endif
 	void EvaluateLua(const _tEventQueue &item, const std::string &filename, const std::string &LuaString);
 	void EvaluateLua(const std::vector<_tEventQueue> &items, const std::string &filename, const std::string &LuaString);
-	void luaThread(lua_State *lua_state, const std::string &filename);
+	enum _eLuaStateType
+	{
+		LUASTATE_NEW,		// closed after the run
+		LUASTATE_POOLED,	// classic scripts, back to the pool after the run
+		LUASTATE_DZVENTS	// long-lived dzVents state
+	};
+	void luaThread(lua_State *lua_state, const std::string &filename, const _eLuaStateType stateType);
+	static void InitReusableLuaState(lua_State *lua_state);
+	static void BeginReusableLuaRun(lua_State *lua_state);
+	static void EndReusableLuaRun(lua_State *lua_state);
+	lua_State *GetPooledLuaState();
+	void ReleaseLuaState(lua_State *lua_state, const _eLuaStateType stateType);
+	void ClearLuaStatePool();
 	static void luaStop(lua_State *L, lua_Debug *ar);
 	std::string nValueToWording(const uint8_t dType, const uint8_t dSubType, const _eSwitchType switchtype, const int nValue, const std::string &sValue, const std::map<std::string, std::string> & options);
 	static int l_domoticz_print(lua_State* lua_state);
@@ -233,6 +309,30 @@ private:
 
 	//std::string reciprocalAction (std::string Action);
 	std::vector<_tEventItem> m_events;
+	//Positions in m_events of the active events that can run for an item, built by LoadEvents
+	std::vector<size_t> m_eventsByReason[REASON_URL + 1];
+	std::multimap<uint64_t, size_t> m_blocklyDeviceEvents;
+	std::multimap<uint64_t, size_t> m_blocklyVariableEvents;
+	void BuildEventIndex();
+
+	//Script files of a directory by trigger, rebuilt when the listing or the device names change
+	struct _tScriptIndex
+	{
+		uint64_t listing = 0;
+		uint64_t deviceNames = 0;
+		std::vector<std::string> files;
+		std::map<std::string, std::vector<size_t> > namedDeviceScripts;
+		std::vector<size_t> deviceScripts;
+		std::vector<size_t> timeScripts;
+		std::vector<size_t> securityScripts;
+		std::vector<size_t> variableScripts;
+	};
+	std::mutex m_scriptIndexMutex;
+	_tScriptIndex m_luaScriptIndex;
+	_tScriptIndex m_pythonScriptIndex;
+	uint64_t m_deviceNamesVersion;
+	void UpdateScriptIndex(_tScriptIndex &index, const std::string &dir, const std::string &extension, const bool bDeviceNames);
+	void GetIndexedScripts(_tScriptIndex &index, const std::string &dir, const std::string &extension, const bool bDeviceNames, const _tEventQueue &item, std::vector<std::string> &scripts);
 
 
 	std::map<uint64_t, _tDeviceStatus> m_devicestates;
@@ -29,7 +29,16 @@ CLogger::_tLogLineStruct::_tLogLineStruct(const _eLogLevel nlevel, const std::st
 	logmessage = nlogmessage;
 }
 
-CLogger::CLogger(void)
+CLogger::CLogger(void) :
+	m_asyncQueueLines(0),
+	m_asyncOverflow(ASYNC_OVERFLOW_DROP),
+	m_bAsync(false),
+	m_bAsyncStop(false),
+	m_nAsyncWriters(0),
+	m_nAsyncDropped(0),
+	m_asyncMask(0),
+	m_asyncEnqueuePos(0),
+	m_asyncDequeuePos(0)
 {
 	m_bInSequenceMode = false;
 	m_bEnableLogThreadIDs = false;
@@ -42,6 +51,7 @@ CLogger::CLogger(void)
 
 CLogger::~CLogger(void)
 {
+	StopAsync();
 	if (m_outputfile.is_open())
 		m_outputfile.close();
 }
@@ -131,11 +141,13 @@ void CLogger::SetOutputFile(const char *OutputFile)
 	std::unique_lock<std::mutex> lock(m_mutex);
 	if (m_outputfile.is_open())
 		m_outputfile.close();
+	m_szOutputFile = "";
 
 	if (OutputFile == NULL)
 		return;
 	if (*OutputFile == 0)
 		return;
+	m_szOutputFile = OutputFile;
 
 	try
 	{
@@ -163,6 +175,15 @@ void CLogger::Log(const _eLogLevel level, const std::string& sLogline)
 	Log(level, "%s", sLogline.c_str());
 }
 
+static unsigned long long GetLogThreadID()
+{
+#ifdef WIN32
+	return ::GetCurrentThreadId();
+#else
+	return (unsigned long long)pthread_self();
+#endif
+}
+
 void CLogger::Log(const _eLogLevel level, const char* logline, ...)
 {
 	if (!(m_log_flags & level))
@@ -174,6 +195,18 @@ void CLogger::Log(const _eLogLevel level, const char* logline, ...)
 	vsnprintf(cbuffer, sizeof(cbuffer), logline, argList);
 	va_end(argList);
 
+	if ((m_bAsync) && (EnqueueLine(level, cbuffer)))
+		return;
+
+	unsigned long long threadid = 0;
+	if ((m_log_flags & LOG_DEBUG_INT) && (m_debug_flags & DEBUG_THREADIDS))
+		threadid = GetLogThreadID();
+	WriteLine(level, (m_bEnableLogTimestamps) ? TimeToString(NULL, TF_DateTimeMs) : "", threadid, cbuffer, true);
+}
+
+//Sends a formatted line to syslog, console, file and the in memory logs
+void CLogger::WriteLine(const _eLogLevel level, const std::string &sTime, const unsigned long long threadid, const char *cbuffer, const bool bFlush)
+{
 #ifndef WIN32
 	if (g_bUseSyslog)
 	{
@@ -188,17 +221,11 @@ void CLogger::Log(const _eLogLevel level, const char* logline, ...)
 
 	std::stringstream sstr;
 
-	if (m_bEnableLogTimestamps)
-		sstr << TimeToString(NULL, TF_DateTimeMs) << "  ";
+	if (!sTime.empty())
+		sstr << sTime << "  ";
 
-	if ((m_log_flags & LOG_DEBUG_INT) && (m_debug_flags & DEBUG_THREADIDS))
-	{
-#ifdef WIN32
-		sstr << "[" << std::setfill('0') << std::setw(4) << std::hex << ::GetCurrentThreadId() << "] ";
-#else
-		sstr << "[" << std::setfill('0') << std::setw(4) << std::hex << pthread_self() << "] ";
-#endif
-	}
+	if (threadid != 0)
+		sstr << "[" << std::setfill('0') << std::setw(4) << std::hex << threadid << "] ";
 
 	if (level & LOG_STATUS)
 		sstr << "Status: " << cbuffer;
@@ -242,8 +269,9 @@ void CLogger::Log(const _eLogLevel level, const char* logline, ...)
 		if (m_outputfile.is_open())
 		{
 			//output to file
-			m_outputfile << szIntLog << std::endl;
-			m_outputfile.flush();
+			m_outputfile << szIntLog << '\n';
+			if (bFlush)
+				m_outputfile.flush();
 		}
 
 		std::map<_eLogLevel, std::deque<_tLogLineStruct> >::iterator itt;
@@ -258,6 +286,187 @@ void CLogger::Log(const _eLogLevel level, const char* logline, ...)
 	}
 }
 
+void CLogger::SetAsyncMode(const size_t queueLines, const _eAsyncOverflow overflow)
+{
+	m_asyncQueueLines = queueLines;
+	m_asyncOverflow = overflow;
+}
+
+void CLogger::StartAsync()
+{
+	if ((m_asyncQueueLines == 0) || (m_asyncThread))
+		return;
+	size_t capacity = 2;
+	while (capacity < m_asyncQueueLines)
+		capacity <<= 1;
+	m_asyncQueue.reset(new _tAsyncLogCell[capacity]);
+	for (size_t ii = 0; ii < capacity; ii++)
+	{
+		m_asyncQueue[ii].sequence.store(ii, std::memory_order_relaxed);
+		m_asyncQueue[ii].line.message.reserve(128);
+	}
+	m_asyncMask = capacity - 1;
+	m_asyncEnqueuePos = 0;
+	m_asyncDequeuePos = 0;
+	m_bAsyncStop = false;
+	m_asyncThread = std::make_shared<std::thread>(&CLogger::Do_AsyncWork, this);
+	SetThreadName(m_asyncThread->native_handle(), "Logger");
+	m_bAsync = true;
+}
+
+void CLogger::StopAsync()
+{
+	if (!m_asyncThread)
+		return;
+	m_bAsync = false;
+	m_bAsyncStop = true;
+	m_asyncCondition.notify_one();
+	m_asyncThread->join();
+	m_asyncThread.reset();
+}
+
+//Returns false when async logging was stopped, the caller should write the line itself
+bool CLogger::EnqueueLine(const _eLogLevel level, const char *message)
+{
+	m_nAsyncWriters++;
+	if (!m_bAsync)
+	{
+		m_nAsyncWriters--;
+		return false;
+	}
+	_tAsyncLogCell *cell;
+	size_t pos = m_asyncEnqueuePos.load(std::memory_order_relaxed);
+	while (true)
+	{
+		cell = &m_asyncQueue[pos & m_asyncMask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0)
+		{
+			if (m_asyncEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			//queue is full
+			if (m_asyncOverflow == ASYNC_OVERFLOW_DROP)
+			{
+				m_nAsyncDropped++;
+				m_nAsyncWriters--;
+				return true;
+			}
+			m_asyncCondition.notify_one();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			pos = m_asyncEnqueuePos.load(std::memory_order_relaxed);
+		}
+		else
+			pos = m_asyncEnqueuePos.load(std::memory_order_relaxed);
+	}
+	cell->line.level = level;
+	cell->line.logtime = std::chrono::system_clock::now();
+	cell->line.threadid = ((m_log_flags & LOG_DEBUG_INT) && (m_debug_flags & DEBUG_THREADIDS)) ? GetLogThreadID() : 0;
+	cell->line.message.assign(message);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	m_nAsyncWriters--;
+	m_asyncCondition.notify_one();
+	return true;
+}
+
+//Only called from the logger thread
+bool CLogger::DequeueLine(_tAsyncLogLine &line)
+{
+	_tAsyncLogCell &cell = m_asyncQueue[m_asyncDequeuePos & m_asyncMask];
+	if (cell.sequence.load(std::memory_order_acquire) != m_asyncDequeuePos + 1)
+		return false;
+	line.level = cell.line.level;
+	line.logtime = cell.line.logtime;
+	line.threadid = cell.line.threadid;
+	line.message.swap(cell.line.message);
+	cell.sequence.store(m_asyncDequeuePos + m_asyncMask + 1, std::memory_order_release);
+	m_asyncDequeuePos++;
+	return true;
+}
+
+static std::string FormatLogTime(const std::chrono::system_clock::time_point &logtime)
+{
+	time_t tsecs = std::chrono::system_clock::to_time_t(logtime);
+	int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(logtime.time_since_epoch()).count() % 1000);
+	char szMs[8];
+	sprintf(szMs, ".%03d", ms);
+	return TimeToString(&tsecs, TF_DateTime) + szMs;
+}
+
+void CLogger::SetSynchronous()
+{
+	if (!m_bAsync)
+		return;
+	m_bAsync = false;
+	//do not wait forever, the logger thread could have crashed while writing
+	if (!m_asyncDequeueMutex.try_lock_for(std::chrono::milliseconds(500)))
+		return;
+	_tAsyncLogLine line;
+	while (DequeueLine(line))
+		WriteLine(line.level, (m_bEnableLogTimestamps) ? FormatLogTime(line.logtime) : "", line.threadid, line.message.c_str(), true);
+	m_asyncDequeueMutex.unlock();
+}
+
+void CLogger::Do_AsyncWork()
+{
+	_tAsyncLogLine line;
+	line.message.reserve(128);
+	uint64_t nReportedDropped = 0;
+	time_t lastFileCheck = 0;
+	while (true)
+	{
+		{
+			std::lock_guard<std::timed_mutex> l(m_asyncDequeueMutex);
+			if (DequeueLine(line))
+			{
+				WriteLine(line.level, (m_bEnableLogTimestamps) ? FormatLogTime(line.logtime) : "", line.threadid, line.message.c_str(), false);
+				continue;
+			}
+		}
+
+		//queue is empty
+		uint64_t nDropped = m_nAsyncDropped;
+		if (nDropped != nReportedDropped)
+		{
+			char szMessage[100];
+			sprintf(szMessage, "Logger: %llu lines were dropped, the log queue was full!", (unsigned long long)(nDropped - nReportedDropped));
+			WriteLine(LOG_ERROR, (m_bEnableLogTimestamps) ? TimeToString(NULL, TF_DateTimeMs) : "", 0, szMessage, false);
+			nReportedDropped = nDropped;
+		}
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_outputfile.is_open())
+			{
+				m_outputfile.flush();
+				//reopen the file when it was moved away (logrotate)
+				time_t atime = mytime(NULL);
+				if ((atime - lastFileCheck >= 10) && (!m_szOutputFile.empty()))
+				{
+					lastFileCheck = atime;
+					if (!file_exist(m_szOutputFile.c_str()))
+					{
+						m_outputfile.close();
+						m_outputfile.open(m_szOutputFile.c_str(), std::ios::out | std::ios::app);
+					}
+				}
+			}
+		}
+		if ((m_bAsyncStop) && (m_nAsyncWriters == 0))
+		{
+			std::lock_guard<std::timed_mutex> l(m_asyncDequeueMutex);
+			if (!DequeueLine(line))
+				break;
+			WriteLine(line.level, (m_bEnableLogTimestamps) ? FormatLogTime(line.logtime) : "", line.threadid, line.message.c_str(), true);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_asyncMutex);
+		m_asyncCondition.wait_for(lock, std::chrono::milliseconds(100));
+	}
+}
+
 void CLogger::Debug(const _eDebugLevel level, const char* logline, ...)
 {
 	if (!IsDebugLevelEnabled(level))
@@ -4,6 +4,11 @@
 #include <list>
 #include <string>
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <condition_variable>
 
 enum _eLogLevel : uint32_t
 {
@@ -38,6 +43,12 @@ public:
 		_tLogLineStruct(const _eLogLevel nlevel, const std::string &nlogmessage);
 	};
 
+	enum _eAsyncOverflow
+	{
+		ASYNC_OVERFLOW_DROP = 0,	// lines that don't fit in the queue are dropped (and counted)
+		ASYNC_OVERFLOW_BLOCK,		// the caller waits until there is room
+	};
+
 	CLogger(void);
 	~CLogger(void);
 
@@ -60,6 +71,18 @@ public:
 
 	void SetOutputFile(const char *OutputFile);
 
+	//Lines are queued and written by a background thread, queueLines is rounded up to a power of 2.
+	//SetAsyncMode only stores the settings, the thread is started by StartAsync (after daemonizing)
+	void SetAsyncMode(const size_t queueLines, const _eAsyncOverflow overflow);
+	void StartAsync();
+	//Writes the queued lines and continues writing on the calling threads
+	void StopAsync();
+	//Same without waiting for the logger thread (that may be the one that crashed), for the fatal signal handler
+	void SetSynchronous();
+	uint64_t GetDroppedLines() {
+		return m_nAsyncDropped;
+	}
+
 	void Log(const _eLogLevel level, const std::string& sLogline);
 	void Log(const _eLogLevel level, const char* logline, ...)
 #ifdef __GNUC__
@@ -88,11 +111,46 @@ public:
 	std::list<_tLogLineStruct> GetNotificationLogs();
 	bool NotificationLogsEnabled();
 private:
+	struct _tAsyncLogLine
+	{
+		_eLogLevel level;
+		std::chrono::system_clock::time_point logtime;
+		unsigned long long threadid;
+		std::string message;
+	};
+	struct _tAsyncLogCell
+	{
+		std::atomic<size_t> sequence;
+		_tAsyncLogLine line;
+	};
+
+	void WriteLine(const _eLogLevel level, const std::string &sTime, const unsigned long long threadid, const char *message, const bool bFlush);
+	bool EnqueueLine(const _eLogLevel level, const char *message);
+	bool DequeueLine(_tAsyncLogLine &line);
+	void Do_AsyncWork();
+
 	uint32_t m_log_flags;
 	uint32_t m_debug_flags;
 
 	std::mutex m_mutex;
 	std::ofstream m_outputfile;
+	std::string m_szOutputFile;
+
+	//async mode, a bounded multi producer queue (sequence numbers per cell, no locks)
+	size_t m_asyncQueueLines;
+	_eAsyncOverflow m_asyncOverflow;
+	std::atomic<bool> m_bAsync;
+	std::atomic<bool> m_bAsyncStop;
+	std::atomic<int> m_nAsyncWriters;
+	std::atomic<uint64_t> m_nAsyncDropped;
+	std::unique_ptr<_tAsyncLogCell[]> m_asyncQueue;
+	size_t m_asyncMask;
+	std::atomic<size_t> m_asyncEnqueuePos;
+	size_t m_asyncDequeuePos;
+	std::timed_mutex m_asyncDequeueMutex;	// the logger thread is the only reader, except for SetSynchronous
+	std::mutex m_asyncMutex;
+	std::condition_variable m_asyncCondition;
+	std::shared_ptr<std::thread> m_asyncThread;
 	std::map<_eLogLevel, std::deque<_tLogLineStruct> > m_lastlog;
 	std::deque<_tLogLineStruct> m_notification_log;
 	bool m_bInSequenceMode;
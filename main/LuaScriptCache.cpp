@@ -0,0 +1,133 @@
+#include "stdafx.h"
+#include "LuaScriptCache.h"
+#include "Helper.h"
+#include <sys/stat.h>
+
+extern "C" {
+#ifdef WITH_EXTERNAL_LUA
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#else
+#include "../lua/src/lua.h"
+#include "../lua/src/lualib.h"
+#include "../lua/src/lauxlib.h"
+#endif
+}
+
+//Modification times have a resolution of a second on some file systems, so a listing or chunk
+//is only trusted when it was taken after the second in which the directory or file was last changed
+
+uint64_t CLuaScriptCache::GetDirectoryListing(std::vector<std::string> &entries, const std::string &dir, const uint64_t knownGeneration)
+{
+	struct stat st;
+	if (stat(dir.c_str(), &st) != 0)
+	{
+		entries.clear();
+		std::lock_guard<std::mutex> l(m_cacheMutex);
+		m_directories.erase(dir);
+		return 0;
+	}
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	std::map<std::string, _tDirectoryListing>::iterator itt = m_directories.find(dir);
+	if ((itt != m_directories.end()) && (itt->second.mtime == st.st_mtime) && (itt->second.listed > st.st_mtime))
+	{
+		if (itt->second.generation != knownGeneration)
+			entries = itt->second.entries;
+		return itt->second.generation;
+	}
+	_tDirectoryListing &listing = m_directories[dir];
+	listing.mtime = st.st_mtime;
+	listing.listed = time(NULL);
+	listing.generation = ++m_generation;
+	listing.entries.clear();
+	DirectoryListing(listing.entries, dir, false, true);
+	entries = listing.entries;
+	return listing.generation;
+}
+
+static int ChunkWriter(lua_State *lua_state, const void *p, size_t sz, void *ud)
+{
+	reinterpret_cast<std::string*>(ud)->append(reinterpret_cast<const char*>(p), sz);
+	return 0;
+}
+
+bool CLuaScriptCache::DumpChunk(lua_State *lua_state, std::string &bytecode)
+{
+	bytecode.clear();
+	//Debug info is kept, so errors still report line numbers
+#if LUA_VERSION_NUM >= 503
+	return (lua_dump(lua_state, ChunkWriter, &bytecode, 0) == 0);
+#else
+	return (lua_dump(lua_state, ChunkWriter, &bytecode) == 0);
+#endif
+}
+
+int CLuaScriptCache::LoadFile(lua_State *lua_state, const std::string &filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return luaL_loadfile(lua_state, filename.c_str());
+
+	std::string chunkname = "@" + filename;
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	std::map<std::string, _tCompiledChunk>::const_iterator itt = m_files.find(filename);
+	if (
+		(itt != m_files.end()) &&
+		(itt->second.mtime == st.st_mtime) &&
+		(itt->second.size == (int64_t)st.st_size) &&
+		(itt->second.compiled > st.st_mtime)
+		)
+	{
+		return luaL_loadbufferx(lua_state, itt->second.bytecode.c_str(), itt->second.bytecode.size(), chunkname.c_str(), "b");
+	}
+
+	time_t compiled = time(NULL);
+	int status = luaL_loadfile(lua_state, filename.c_str());
+	if (status != 0)
+	{
+		m_files.erase(filename);
+		return status;
+	}
+	_tCompiledChunk &chunk = m_files[filename];
+	chunk.mtime = st.st_mtime;
+	chunk.size = (int64_t)st.st_size;
+	chunk.compiled = compiled;
+	if (!DumpChunk(lua_state, chunk.bytecode))
+		m_files.erase(filename);
+	return status;
+}
+
+int CLuaScriptCache::LoadScriptString(lua_State *lua_state, const std::string &name, const std::string &script)
+{
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	std::map<std::string, _tCompiledChunk>::const_iterator itt = m_strings.find(name);
+	if ((itt != m_strings.end()) && (itt->second.source == script))
+	{
+		//luaL_loadstring uses the script itself as chunk name
+		return luaL_loadbufferx(lua_state, itt->second.bytecode.c_str(), itt->second.bytecode.size(), script.c_str(), "b");
+	}
+
+	int status = luaL_loadstring(lua_state, script.c_str());
+	if (status != 0)
+	{
+		m_strings.erase(name);
+		return status;
+	}
+	_tCompiledChunk &chunk = m_strings[name];
+	chunk.mtime = 0;
+	chunk.size = (int64_t)script.size();
+	chunk.compiled = 0;
+	chunk.source = script;
+	if (!DumpChunk(lua_state, chunk.bytecode))
+		m_strings.erase(name);
+	return status;
+}
+
+void CLuaScriptCache::Clear()
+{
+	std::lock_guard<std::mutex> l(m_cacheMutex);
+	m_directories.clear();
+	m_files.clear();
+	m_strings.clear();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <ctime>
+#include <cstdint>
+
+struct lua_State;
+
+//Keeps the listings of the event script directories and the compiled Lua chunks,
+//both are validated against the modification time of the directory or file on every use
+class CLuaScriptCache
+{
+public:
+	CLuaScriptCache() : m_generation(0) {};
+
+	//Files in the directory, read again when the directory changed. Returns a number that changes
+	//every time the directory is read, entries are only filled when it differs from knownGeneration
+	uint64_t GetDirectoryListing(std::vector<std::string> &entries, const std::string &dir, const uint64_t knownGeneration = 0);
+	//Same as luaL_loadfile, the bytecode of the script is reused until the file changes
+	int LoadFile(lua_State *lua_state, const std::string &filename);
+	//Same as luaL_loadstring, the bytecode is reused as long as the script text for this name stays the same
+	int LoadScriptString(lua_State *lua_state, const std::string &name, const std::string &script);
+	void Clear();
+private:
+	struct _tDirectoryListing
+	{
+		time_t mtime;
+		time_t listed;
+		uint64_t generation;
+		std::vector<std::string> entries;
+	};
+	struct _tCompiledChunk
+	{
+		time_t mtime;
+		int64_t size;
+		time_t compiled;
+		std::string source;
+		std::string bytecode;
+	};
+
+	bool DumpChunk(lua_State *lua_state, std::string &bytecode);
+
+	std::mutex m_cacheMutex;
+	uint64_t m_generation;
+	std::map<std::string, _tDirectoryListing> m_directories;
+	std::map<std::string, _tCompiledChunk> m_files;
+	std::map<std::string, _tCompiledChunk> m_strings;
+};
@@ -19,6 +19,7 @@
 #include "clx_unzip.h"
 #include "../notifications/NotificationHelper.h"
 #include "IFTTT.h"
+#include "../zlib/zlib.h"
 #ifdef ENABLE_PYTHON
 #include "../hardware/plugins/Plugins.h"
 #endif
@@ -34,11 +35,31 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
-#define DB_VERSION 133
+#define DB_VERSION 134
 
 extern http::server::CWebServerHelper m_webservers;
 extern std::string szWWWFolder;
 
+//Short logs that are also kept in the time series store, with their value columns in store order
+static const struct _tTimeSeriesTable
+{
+	const char *szTable;
+	const char *szColumns;
+	int nColumns;
+} TimeSeriesTables[] = {
+	{ "Temperature", "Temperature, Chill, Humidity, Barometer, DewPoint, SetPoint", 6 },
+};
+
+static const _tTimeSeriesTable *GetTimeSeriesTable(const std::string &szTable)
+{
+	for (const auto &itt : TimeSeriesTables)
+	{
+		if (szTable == itt.szTable)
+			return &itt;
+	}
+	return NULL;
+}
+
 const char *sqlCreateDeviceStatus =
 "CREATE TABLE IF NOT EXISTS [DeviceStatus] ("
 "[ID] INTEGER PRIMARY KEY, "
@@ -267,6 +288,50 @@ const char *sqlCreateMeter_Calendar =
 "[Counter] BIGINT DEFAULT 0, "
 "[Date] DATETIME DEFAULT (datetime('now','localtime')));";
 
+const char *sqlCreateMeter_Rollup =
+"CREATE TABLE IF NOT EXISTS [Meter_Rollup] ("
+"[DeviceRowID] BIGINT NOT NULL, "
+"[Period] INTEGER NOT NULL, "
+"[Date] DATETIME NOT NULL, "
+"[Value_Min] BIGINT DEFAULT 0, "
+"[Value_Max] BIGINT DEFAULT 0, "
+"[Value_Sum] FLOAT DEFAULT 0, "
+"[Usage_Max] BIGINT DEFAULT 0, "
+"[Usage_Sum] FLOAT DEFAULT 0, "
+"[Counter] BIGINT DEFAULT 0, "
+"[Samples] INTEGER DEFAULT 0, "
+"PRIMARY KEY([DeviceRowID], [Period], [Date]));";
+
+const char *sqlCreateMultiMeter_Rollup =
+"CREATE TABLE IF NOT EXISTS [MultiMeter_Rollup] ("
+"[DeviceRowID] BIGINT NOT NULL, "
+"[Period] INTEGER NOT NULL, "
+"[Date] DATETIME NOT NULL, "
+"[Value1_Min] BIGINT DEFAULT 0, "
+"[Value2_Min] BIGINT DEFAULT 0, "
+"[Value3_Min] BIGINT DEFAULT 0, "
+"[Value4_Min] BIGINT DEFAULT 0, "
+"[Value5_Min] BIGINT DEFAULT 0, "
+"[Value6_Min] BIGINT DEFAULT 0, "
+"[Value1_Max] BIGINT DEFAULT 0, "
+"[Value2_Max] BIGINT DEFAULT 0, "
+"[Value3_Max] BIGINT DEFAULT 0, "
+"[Value4_Max] BIGINT DEFAULT 0, "
+"[Value5_Max] BIGINT DEFAULT 0, "
+"[Value6_Max] BIGINT DEFAULT 0, "
+"[Value1_Sum] FLOAT DEFAULT 0, "
+"[Value2_Sum] FLOAT DEFAULT 0, "
+"[Value3_Sum] FLOAT DEFAULT 0, "
+"[Value4_Sum] FLOAT DEFAULT 0, "
+"[Value5_Sum] FLOAT DEFAULT 0, "
+"[Value6_Sum] FLOAT DEFAULT 0, "
+"[Counter1] BIGINT DEFAULT 0, "
+"[Counter2] BIGINT DEFAULT 0, "
+"[Counter3] BIGINT DEFAULT 0, "
+"[Counter4] BIGINT DEFAULT 0, "
+"[Samples] INTEGER DEFAULT 0, "
+"PRIMARY KEY([DeviceRowID], [Period], [Date]));";
+
 const char *sqlCreateLightSubDevices =
 "CREATE TABLE IF NOT EXISTS [LightSubDevices] ("
 "[ID] INTEGER PRIMARY KEY, "
@@ -619,7 +684,8 @@ const char *sqlCreateMobileDevices =
 
 extern std::string szUserDataFolder;
 
-CSQLHelper::CSQLHelper(void)
+CSQLHelper::CSQLHelper(void) :
+	m_devicecache(*this)
 {
 	m_LastSwitchRowID = 0;
 	m_dbase = NULL;
@@ -638,6 +704,13 @@ CSQLHelper::CSQLHelper(void)
 	m_ShortLogInterval = 5;
 	m_bPreviousAcceptNewHardware = false;
 	m_bLogEventScriptTrigger = false;
+	m_iReaderConnections = 3;
+	m_bTimeSeriesStore = false;
+	m_transaction_depth = 0;
+	m_bTransactionFailed = false;
+	m_transaction_owner = std::thread::id();
+	m_bTodayValid = false;
+	m_todayGeneration = 0;
 
 	SetDatabaseName("domoticz.db");
 }
@@ -648,6 +721,54 @@ CSQLHelper::~CSQLHelper(void)
 	CloseDatabase();
 }
 
+//Called by SQLite for every row written on the writer connection, must not use the database
+//Tables that change the device list beyond the state of single devices or scenes
+static const char *szDeviceStructureTables[] = {
+	"Hardware",
+	"DeviceToPlansMap",
+	"Plans",
+	"SharedDevices",
+	"Timers",
+	"SetpointTimers",
+	"SceneTimers",
+	"Notifications",
+	NULL
+};
+
+static void DeviceStatusUpdateHook(void *pUser, int op, char const * /*szDatabase*/, char const *szTable, sqlite3_int64 rowid)
+{
+	CDeviceStateCache *pCache = reinterpret_cast<CDeviceStateCache*>(pUser);
+	if (strcmp(szTable, "DeviceStatus") == 0)
+	{
+		if (op == SQLITE_DELETE)
+			pCache->OnRowDeleted(static_cast<uint64_t>(rowid));
+		else
+			pCache->OnRowChanged(static_cast<uint64_t>(rowid));
+		return;
+	}
+	if (strcmp(szTable, "Scenes") == 0)
+	{
+		if (op == SQLITE_DELETE)
+			pCache->OnSceneDeleted(static_cast<uint64_t>(rowid));
+		else
+			pCache->OnSceneChanged(static_cast<uint64_t>(rowid));
+		return;
+	}
+	for (int ii = 0; szDeviceStructureTables[ii] != NULL; ii++)
+	{
+		if (strcmp(szTable, szDeviceStructureTables[ii]) == 0)
+		{
+			pCache->OnStructureChanged();
+			return;
+		}
+	}
+}
+
+static void DeviceStatusRollbackHook(void *pUser)
+{
+	reinterpret_cast<CDeviceStateCache*>(pUser)->OnRollback();
+}
+
 bool CSQLHelper::OpenDatabase()
 {
 	//Open Database
@@ -704,6 +825,8 @@ bool CSQLHelper::OpenDatabase()
 	query(sqlCreateMeter_Calendar);
 	query(sqlCreateMultiMeter);
 	query(sqlCreateMultiMeter_Calendar);
+	query(sqlCreateMeter_Rollup);
+	query(sqlCreateMultiMeter_Rollup);
 	query(sqlCreateNotifications);
 	query(sqlCreateHardware);
 	query(sqlCreateUsers);
@@ -2603,6 +2726,11 @@ bool CSQLHelper::OpenDatabase()
 			query("INSERT INTO Hardware(ID, Name, Enabled, Type, Address, Port, SerialPort, Username, Password, Extra, Mode1, Mode2, Mode3, Mode4, Mode5, Mode6, DataTimeout) SELECT ID, Name, Enabled, Type, Address, Port, SerialPort, Username, Password, Extra, Mode1, Mode2, Mode3, Mode4, Mode5, Mode6, DataTimeout FROM tmp_Hardware;");
 			query("DROP TABLE tmp_Hardware;");
 		}
+		if (dbversion < 134)
+		{
+			//Fill the rollup tables from the existing short logs and calendars
+			RebuildMeterRollups(0);
+		}
 	}
 	else if (bNewInstall)
 	{
@@ -2685,6 +2813,10 @@ bool CSQLHelper::OpenDatabase()
 	{
 		UpdatePreferencesVar("UseAutoBackup", 0);
 	}
+	if (!GetPreferencesVar("CompressAutoBackup", nValue))
+	{
+		UpdatePreferencesVar("CompressAutoBackup", 0);
+	}
 
 	if (GetPreferencesVar("Rego6XXType", nValue))
 	{
@@ -3059,6 +3191,29 @@ bool CSQLHelper::OpenDatabase()
 		UpdatePreferencesVar("EmailEnabled", 1);
 	}
 
+	OpenReaders();
+
+	sqlite3_update_hook(m_dbase, DeviceStatusUpdateHook, &m_devicecache);
+	sqlite3_rollback_hook(m_dbase, DeviceStatusRollbackHook, &m_devicecache);
+	m_devicecache.Load();
+	InvalidateTodayBaselines();
+
+	if (m_bTimeSeriesStore)
+	{
+		//next to the database, catches up with the rows written while it was not open
+		size_t pos = m_dbase_name.find_last_of("/\\");
+		std::string szFolder = (pos != std::string::npos) ? m_dbase_name.substr(0, pos + 1) : "";
+		if (m_tsstore.Open(szFolder + "timeseries"))
+		{
+			for (const auto &itt : TimeSeriesTables)
+			{
+				int nRows = ImportTimeSeries(itt.szTable);
+				if (nRows > 0)
+					_log.Log(LOG_STATUS, "TimeSeriesStore: %d rows of %s imported", nRows, itt.szTable);
+			}
+		}
+	}
+
 	//Start background thread
 	if (!StartThread())
 		return false;
@@ -3067,9 +3222,15 @@ bool CSQLHelper::OpenDatabase()
 
 void CSQLHelper::CloseDatabase()
 {
-	std::lock_guard<std::mutex> l(m_sqlQueryMutex);
+	m_tsstore.Close();
+	CloseReaders();
+	std::lock_guard<std::recursive_mutex> l(m_sqlQueryMutex);
+	m_devicecache.Clear();
 	if (m_dbase != NULL)
 	{
+		sqlite3_update_hook(m_dbase, NULL, NULL);
+		sqlite3_rollback_hook(m_dbase, NULL, NULL);
+		ClearStatementCache(m_statement_cache);
 		OptimizeDatabase(m_dbase);
 		sqlite3_close(m_dbase);
 		m_dbase = NULL;
@@ -3250,36 +3411,39 @@ void CSQLHelper::Do_Work()
 			}
 			else if (itt->_ItemType == TITEM_GETURL)
 			{
-				std::string response;
-				std::vector<std::string> headerData, extraHeaders;
+				std::vector<std::string> extraHeaders;
 				std::string postData = itt->_command;
 				std::string callback = itt->_ID;
+				std::string url = itt->_sValue;
 
 				if (!itt->_relatedEvent.empty())
 					StringSplit(itt->_relatedEvent, "!#", extraHeaders);
 
 				HTTPClient::_eHTTPmethod method = static_cast<HTTPClient::_eHTTPmethod>(itt->_switchtype);
 
-				bool ret;
-				if (method == HTTPClient::HTTP_METHOD_GET)
-				{
-					ret = HTTPClient::GET(itt->_sValue, extraHeaders, response, headerData);
-				}
-				else if (method == HTTPClient::HTTP_METHOD_POST)
-				{
-					ret = HTTPClient::POST(itt->_sValue, postData, extraHeaders, response, headerData);
-				}
-
-				if (m_bEnableEventSystem && !callback.empty())
+				//performed on the HTTP thread, so a slow site does not hold up the other tasks
+				bool bQueued = HTTPClient::AsyncRequest(method, url, postData, extraHeaders,
+					[this, url, callback](const bool bSuccess, std::vector<unsigned char> &vResponse, std::vector<std::string> &headerData)
 				{
-					if (ret)
-						headerData.push_back("200");
-					m_mainworker.m_eventsystem.TriggerURL(response, headerData, callback);
-				}
+					//the result of HTTPClient::GET/POST as before: an error code of a GET fails and is the last header,
+					//an empty reply fails as well, only a success gets "200" added
+					bool ret = (bSuccess) && (!vResponse.empty());
+					if (m_bEnableEventSystem && !callback.empty())
+					{
+						std::string response(vResponse.begin(), vResponse.end());
+						if (ret)
+							headerData.push_back("200");
+						m_mainworker.m_eventsystem.TriggerURL(response, headerData, callback);
+					}
 
-				if (!ret)
+					if (!ret)
+					{
+						_log.Log(LOG_ERROR, "Error opening url: %s", url.c_str());
+					}
+				});
+				if (!bQueued)
 				{
-					_log.Log(LOG_ERROR, "Error opening url: %s", itt->_sValue.c_str());
+					_log.Log(LOG_ERROR, "Error opening url: %s", url.c_str());
 				}
 			}
 			else if ((itt->_ItemType == TITEM_SEND_EMAIL) || (itt->_ItemType == TITEM_SEND_EMAIL_TO))
@@ -3456,7 +3620,10 @@ void CSQLHelper::safe_exec_no_return(const char *fmt, ...)
 	va_end(args);
 	if (!zQuery)
 		return;
-	sqlite3_exec(m_dbase, zQuery, NULL, NULL, NULL);
+	{
+		CSQLConnectionLock connection(*this, false);
+		sqlite3_exec(connection.GetDB(), zQuery, NULL, NULL, NULL);
+	}
 	sqlite3_free(zQuery);
 }
 
@@ -3471,22 +3638,17 @@ bool CSQLHelper::safe_UpdateBlobInTableWithID(const std::string &Table, const st
 		_log.Log(LOG_ERROR, "SQL: Out of memory, or invalid printf!....");
 		return false;
 	}
-	int rc = sqlite3_prepare_v2(m_dbase, zQuery, -1, &stmt, NULL);
+	CSQLConnectionLock connection(*this, false);
+	int rc = sqlite3_prepare_v2(connection.GetDB(), zQuery, -1, &stmt, NULL);
 	sqlite3_free(zQuery);
 	if (rc != SQLITE_OK) {
 		return false;
 	}
 	rc = sqlite3_bind_blob(stmt, 1, BlobData.c_str(), BlobData.size(), SQLITE_STATIC);
-	if (rc != SQLITE_OK) {
-		return false;
-	}
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE)
-	{
-		return false;
-	}
+	if (rc == SQLITE_OK)
+		rc = sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
-	return true;
+	return (rc == SQLITE_DONE);
 }
 
 std::vector<std::vector<std::string> > CSQLHelper::safe_query(const char *fmt, ...)
@@ -3506,6 +3668,20 @@ std::vector<std::vector<std::string> > CSQLHelper::safe_query(const char *fmt, .
 	return results;
 }
 
+//Only plain SELECT statements are sent to the read-only pool
+static bool IsReadOnlyQuery(const char *szQuery)
+{
+	while ((*szQuery == ' ') || (*szQuery == '\t') || (*szQuery == '\r') || (*szQuery == '\n'))
+		szQuery++;
+	const char *szSelect = "SELECT";
+	while (*szSelect)
+	{
+		if (toupper(*szQuery++) != *szSelect++)
+			return false;
+	}
+	return true;
+}
+
 std::vector<std::vector<std::string> > CSQLHelper::query(const std::string &szQuery)
 {
 	if (!m_dbase)
@@ -3514,45 +3690,8 @@ std::vector<std::vector<std::string> > CSQLHelper::query(const std::string &szQu
 		std::vector<std::vector<std::string> > results;
 		return results;
 	}
-	std::lock_guard<std::mutex> l(m_sqlQueryMutex);
-
-	sqlite3_stmt *statement;
-	std::vector<std::vector<std::string> > results;
-
-	if (sqlite3_prepare_v2(m_dbase, szQuery.c_str(), -1, &statement, 0) == SQLITE_OK)
-	{
-		int cols = sqlite3_column_count(statement);
-		while (true)
-		{
-			int result = sqlite3_step(statement);
-			if (result == SQLITE_ROW)
-			{
-				std::vector<std::string> values;
-				for (int col = 0; col < cols; col++)
-				{
-					char* value = (char*)sqlite3_column_text(statement, col);
-					if ((value == 0) && (col == 0))
-						break;
-					else if (value == 0)
-						values.push_back(std::string("")); //insert empty string
-					else
-						values.push_back(value);
-				}
-				if (values.size() > 0)
-					results.push_back(values);
-			}
-			else
-			{
-				break;
-			}
-		}
-		sqlite3_finalize(statement);
-	}
-
-	std::string error = sqlite3_errmsg(m_dbase);
-	if (error != "not an error")
-		_log.Log(LOG_ERROR, "SQL Query(\"%s\") : %s", szQuery.c_str(), error.c_str());
-	return results;
+	CSQLConnectionLock connection(*this, IsReadOnlyQuery(szQuery.c_str()));
+	return query(connection.GetDB(), szQuery, false);
 }
 
 std::vector<std::vector<std::string> > CSQLHelper::safe_queryBlob(const char *fmt, ...)
@@ -3581,12 +3720,16 @@ std::vector<std::vector<std::string> > CSQLHelper::queryBlob(const std::string &
 		std::vector<std::vector<std::string> > results;
 		return results;
 	}
-	std::lock_guard<std::mutex> l(m_sqlQueryMutex);
+	CSQLConnectionLock connection(*this, IsReadOnlyQuery(szQuery.c_str()));
+	return query(connection.GetDB(), szQuery, true);
+}
 
+std::vector<std::vector<std::string> > CSQLHelper::query(sqlite3 *dbase, const std::string &szQuery, const bool bBlob)
+{
 	sqlite3_stmt *statement;
 	std::vector<std::vector<std::string> > results;
 
-	if (sqlite3_prepare_v2(m_dbase, szQuery.c_str(), -1, &statement, 0) == SQLITE_OK)
+	if (sqlite3_prepare_v2(dbase, szQuery.c_str(), -1, &statement, 0) == SQLITE_OK)
 	{
 		int cols = sqlite3_column_count(statement);
 		while (true)
@@ -3597,14 +3740,27 @@ std::vector<std::vector<std::string> > CSQLHelper::queryBlob(const std::string &
 				std::vector<std::string> values;
 				for (int col = 0; col < cols; col++)
 				{
-					int blobSize = sqlite3_column_bytes(statement, col);
-					char* value = (char*)sqlite3_column_blob(statement, col);
-					if ((blobSize == 0) && (col == 0))
-						break;
-					else if (value == 0)
-						values.push_back(std::string("")); //insert empty string
+					if (bBlob)
+					{
+						int blobSize = sqlite3_column_bytes(statement, col);
+						char* value = (char*)sqlite3_column_blob(statement, col);
+						if ((blobSize == 0) && (col == 0))
+							break;
+						else if (value == 0)
+							values.push_back(std::string("")); //insert empty string
+						else
+							values.push_back(std::string(value, value + blobSize));
+					}
 					else
-						values.push_back(std::string(value, value + blobSize));
+					{
+						char* value = (char*)sqlite3_column_text(statement, col);
+						if ((value == 0) && (col == 0))
+							break;
+						else if (value == 0)
+							values.push_back(std::string("")); //insert empty string
+						else
+							values.push_back(value);
+					}
 				}
 				if (values.size() > 0)
 					results.push_back(values);
@@ -3617,119 +3773,825 @@ std::vector<std::vector<std::string> > CSQLHelper::queryBlob(const std::string &
 		sqlite3_finalize(statement);
 	}
 
-	std::string error = sqlite3_errmsg(m_dbase);
+	std::string error = sqlite3_errmsg(dbase);
 	if (error != "not an error")
 		_log.Log(LOG_ERROR, "SQL Query(\"%s\") : %s", szQuery.c_str(), error.c_str());
 	return results;
 }
 
-uint64_t CSQLHelper::CreateDevice(const int HardwareID, const int SensorType, const int SensorSubType, std::string &devname, const unsigned long nid, const std::string &soptions)
+void CSQLHelper::SetReaderConnections(const int nConnections)
 {
-	uint64_t DeviceRowIdx = (uint64_t)-1;
-	char ID[20];
-	sprintf(ID, "%lu", nid);
+	m_iReaderConnections = (nConnections < 0) ? 0 : nConnections;
+}
 
-#ifdef ENABLE_PYTHON
+int CSQLHelper::GetReaderConnections()
+{
+	std::lock_guard<std::mutex> l(m_readersMutex);
+	return static_cast<int>(m_readers.size());
+}
+
+bool CSQLHelper::OpenReaders()
+{
+#ifndef WIN32
+	//Readers only make sense in WAL mode, they never block the writer (and vice versa)
+	for (int ii = 0; ii < m_iReaderConnections; ii++)
 	{
-		std::vector<std::vector<std::string> > result;
-		result = m_sql.safe_query("SELECT Type FROM Hardware WHERE (ID == %d)", HardwareID);
-		if (!result.empty())
+		sqlite3 *dbase = NULL;
+		int rc = sqlite3_open_v2(m_dbase_name.c_str(), &dbase, SQLITE_OPEN_READONLY, NULL);
+		if (rc != SQLITE_OK)
 		{
-			std::vector<std::string> sd = result[0];
-			_eHardwareTypes Type = (_eHardwareTypes)atoi(sd[0].c_str());
-			if (Type == HTYPE_PythonPlugin)
-			{
-				// Not allowed to add device to plugin HW (plugin framework does not use key column "ID" but instead uses column "unit" as key)
-				_log.Log(LOG_ERROR, "CSQLHelper::CreateDevice: Not allowed to add device owned by plugin %u!", HardwareID);
-				return DeviceRowIdx;
-			}
+			_log.Log(LOG_ERROR, "SQLHelper: Error opening read-only database connection: %s", sqlite3_errmsg(dbase));
+			sqlite3_close(dbase);
+			break;
 		}
+		sqlite3_busy_timeout(dbase, 1000);
+		_tSQLReader *pReader = new _tSQLReader;
+		pReader->dbase = dbase;
+		pReader->depth = 0;
+		std::lock_guard<std::mutex> l(m_readersMutex);
+		m_readers.push_back(pReader);
+		m_free_readers.push_back(pReader);
 	}
+	if (!m_readers.empty())
+		_log.Log(LOG_STATUS, "SQLHelper: Using %d read-only database connections", (int)m_readers.size());
 #endif
+	return true;
+}
 
-	switch (SensorType)
+void CSQLHelper::CloseReaders()
+{
+	std::unique_lock<std::mutex> lock(m_readersMutex);
+	//wait till all readers are returned to the pool
+	while (m_free_readers.size() != m_readers.size())
+		m_readersCondition.wait(lock);
+	for (auto & itt : m_readers)
+	{
+		ClearStatementCache(itt->statement_cache);
+		sqlite3_close(itt->dbase);
+		delete itt;
+	}
+	m_readers.clear();
+	m_free_readers.clear();
+}
+
+_tSQLReader *CSQLHelper::AcquireReader()
+{
+	std::unique_lock<std::mutex> lock(m_readersMutex);
+	if (m_readers.empty())
+		return NULL;
+	std::thread::id self = std::this_thread::get_id();
+	for (auto & itt : m_readers)
+	{
+		if ((itt->depth > 0) && (itt->owner == self))
+		{
+			itt->depth++;
+			return itt;
+		}
+	}
+	//All readers taken, possibly by threads that wait for something we hold, use the writer instead
+	if (!m_readersCondition.wait_for(lock, std::chrono::milliseconds(250), [this] { return !m_free_readers.empty(); }))
+		return NULL;
+	_tSQLReader *pReader = m_free_readers.back();
+	m_free_readers.pop_back();
+	pReader->owner = self;
+	pReader->depth = 1;
+	return pReader;
+}
+
+void CSQLHelper::ReleaseReader(_tSQLReader *pReader)
+{
 	{
+		std::lock_guard<std::mutex> l(m_readersMutex);
+		if (--pReader->depth > 0)
+			return;
+		pReader->owner = std::thread::id();
+		m_free_readers.push_back(pReader);
+	}
+	m_readersCondition.notify_all();
+}
 
-	case pTypeTEMP:
-	case pTypeWEIGHT:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0", devname);
-		break;
-	case pTypeUV:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;0.0", devname);
-		break;
-	case pTypeRAIN:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0;0", devname);
-		break;
-	case pTypeTEMP_BARO:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;1038.0;0;188.0", devname);
-		break;
-	case pTypeHUM:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 50, "1", devname);
-		break;
-	case pTypeTEMP_HUM:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;50;1", devname);
-		break;
-	case pTypeTEMP_HUM_BARO:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;50;1;1010;1", devname);
-		break;
-	case pTypeRFXMeter:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 10, 255, 0, "0", devname);
-		break;
-	case pTypeUsage:
-	case pTypeLux:
-	case pTypeP1Gas:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0", devname);
-		break;
-	case pTypeP1Power:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0;0;0;0;0;0", devname);
-		break;
-	case pTypeAirQuality:
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, devname);
-		break;
-	case pTypeCURRENT:
-		//Current/Ampere
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;0.0;0.0", devname);
-		break;
-	case pTypeThermostat: //Thermostat Setpoint
+static std::string GetCallerThreadName()
+{
+#if defined(__linux__) || defined(__linux) || defined(linux)
+	char szName[16];
+	if (pthread_getname_np(pthread_self(), szName, sizeof(szName)) == 0)
+		return szName;
+#endif
+	std::stringstream sstr;
+	sstr << std::this_thread::get_id();
+	return sstr.str();
+}
+
+//Called for every statement: the counters of the calling thread are looked up once, after that only atomics are updated
+void CSQLHelper::AddLockStatistics(const bool bReadOnly, const uint64_t wait_us)
+{
+	static thread_local std::shared_ptr<_tSQLLockCounters> counters;
+	if (!counters)
+		counters = GetLockCounters(GetCallerThreadName());
+	if (bReadOnly)
 	{
-		unsigned char ID1 = (unsigned char)((nid & 0xFF000000) >> 24);
-		unsigned char ID2 = (unsigned char)((nid & 0x00FF0000) >> 16);
-		unsigned char ID3 = (unsigned char)((nid & 0x0000FF00) >> 8);
-		unsigned char ID4 = (unsigned char)((nid & 0x000000FF));
-		sprintf(ID, "%X%02X%02X%02X", ID1, ID2, ID3, ID4);
+		counters->reads.fetch_add(1, std::memory_order_relaxed);
+		counters->read_wait_us.fetch_add(wait_us, std::memory_order_relaxed);
+	}
+	else
+	{
+		counters->writes.fetch_add(1, std::memory_order_relaxed);
+		counters->write_wait_us.fetch_add(wait_us, std::memory_order_relaxed);
+	}
+	uint64_t max_wait_us = counters->max_wait_us.load(std::memory_order_relaxed);
+	while ((wait_us > max_wait_us) && (!counters->max_wait_us.compare_exchange_weak(max_wait_us, wait_us, std::memory_order_relaxed)))
+	{
+	}
+}
 
-		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "20.5", devname);
-		break;
+std::shared_ptr<_tSQLLockCounters> CSQLHelper::GetLockCounters(const std::string &szCaller)
+{
+	std::lock_guard<std::mutex> l(m_lockstatsMutex);
+	std::shared_ptr<_tSQLLockCounters> &counters = m_lockstats[szCaller];
+	if (!counters)
+	{
+		counters = std::make_shared<_tSQLLockCounters>();
+		counters->reads = 0;
+		counters->writes = 0;
+		counters->read_wait_us = 0;
+		counters->write_wait_us = 0;
+		counters->max_wait_us = 0;
+	}
+	return counters;
+}
+
+std::map<std::string, _tSQLLockStats> CSQLHelper::GetLockStatistics()
+{
+	std::map<std::string, _tSQLLockStats> result;
+	std::lock_guard<std::mutex> l(m_lockstatsMutex);
+	for (const auto &itt : m_lockstats)
+	{
+		_tSQLLockStats &stats = result[itt.first];
+		stats.reads = itt.second->reads.load(std::memory_order_relaxed);
+		stats.writes = itt.second->writes.load(std::memory_order_relaxed);
+		stats.read_wait_us = itt.second->read_wait_us.load(std::memory_order_relaxed);
+		stats.write_wait_us = itt.second->write_wait_us.load(std::memory_order_relaxed);
+		stats.max_wait_us = itt.second->max_wait_us.load(std::memory_order_relaxed);
 	}
+	return result;
+}
 
-	case pTypeGeneral:
+static std::string GetTodayDate()
+{
+	time_t now = mytime(NULL);
+	struct tm ltime;
+	localtime_r(&now, &ltime);
+	char szDate[40];
+	sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+	return szDate;
+}
+
+//Reads the today values of all devices with one grouped query per table
+//Queries run without m_todayMutex, the result is only marked valid when nothing changed meanwhile
+void CSQLHelper::LoadTodayBaselines()
+{
+	std::string szDate = GetTodayDate();
+	uint64_t generation;
 	{
-		switch (SensorSubType)
-		{
-		case sTypePressure: //Pressure (Bar)
-		case sTypePercentage: //Percentage
-		case sTypeWaterflow: //Waterflow
+		std::lock_guard<std::mutex> l(m_todayMutex);
+		if ((m_bTodayValid) && (m_todayDate == szDate))
+			return;
+		generation = m_todayGeneration;
+	}
+
+	std::map<uint64_t, _tMeterToday> meter_today;
+	{
+		CSQLStatement stmt(*this, "SELECT DeviceRowID, MIN(Value), MAX(Value) FROM Meter WHERE (Date>=?) GROUP BY DeviceRowID");
+		stmt.Bind(szDate);
+		while (stmt.Step())
 		{
-			std::string rID = std::string(ID);
-			padLeft(rID, 8, '0');
-			DeviceRowIdx = UpdateValue(HardwareID, rID.c_str(), 1, SensorType, SensorSubType, 12, 255, 0, "0.0", devname);
+			_tMeterToday &values = meter_today[stmt.GetUInt64(0)];
+			values.MinValue = stmt.GetInt64(1);
+			values.MaxValue = stmt.GetInt64(2);
 		}
-		break;
-		case sTypeCounterIncremental:
-			DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0", devname);
-			break;
-		case sTypeManagedCounter:
-			DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "-1;0", devname);
-			break;
-		case sTypeVoltage:		//Voltage
+	}
+	std::map<uint64_t, _tMultiMeterToday> multimeter_today;
+	{
+		CSQLStatement stmt(*this,
+			"SELECT DeviceRowID, MIN(Value1), MIN(Value2), MIN(Value3), MIN(Value4), MIN(Value5), MIN(Value6), "
+			"MAX(Value1), MAX(Value2), MAX(Value3), MAX(Value4), MAX(Value5), MAX(Value6) "
+			"FROM MultiMeter WHERE (Date>=?) GROUP BY DeviceRowID");
+		stmt.Bind(szDate);
+		while (stmt.Step())
 		{
-			std::string rID = std::string(ID);
-			padLeft(rID, 8, '0');
-			DeviceRowIdx = UpdateValue(HardwareID, rID.c_str(), 1, SensorType, SensorSubType, 12, 255, 0, "0.000", devname);
+			_tMultiMeterToday &values = multimeter_today[stmt.GetUInt64(0)];
+			for (int ii = 0; ii < 6; ii++)
+			{
+				values.MinValue[ii] = stmt.GetInt64(1 + ii);
+				values.MaxValue[ii] = stmt.GetInt64(7 + ii);
+			}
 		}
-		break;
-		case sTypeTextStatus:		//Text
-		{
+	}
+
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	m_meter_today.swap(meter_today);
+	m_multimeter_today.swap(multimeter_today);
+	m_todayDate = szDate;
+	m_bTodayValid = (generation == m_todayGeneration);
+}
+
+bool CSQLHelper::GetMeterToday(const uint64_t DeviceRowID, _tMeterToday &values)
+{
+	LoadTodayBaselines();
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	std::map<uint64_t, _tMeterToday>::const_iterator itt = m_meter_today.find(DeviceRowID);
+	if (itt == m_meter_today.end())
+		return false;
+	values = itt->second;
+	return true;
+}
+
+bool CSQLHelper::GetMultiMeterToday(const uint64_t DeviceRowID, _tMultiMeterToday &values)
+{
+	LoadTodayBaselines();
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	std::map<uint64_t, _tMultiMeterToday>::const_iterator itt = m_multimeter_today.find(DeviceRowID);
+	if (itt == m_multimeter_today.end())
+		return false;
+	values = itt->second;
+	return true;
+}
+
+void CSQLHelper::InvalidateTodayBaselines()
+{
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	m_bTodayValid = false;
+	m_todayGeneration++;
+}
+
+void CSQLHelper::AddMeterToday(const uint64_t DeviceRowID, const int64_t Value)
+{
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	m_todayGeneration++;
+	if ((!m_bTodayValid) || (m_todayDate != GetTodayDate()))
+		return; //reloaded on the next read
+	std::map<uint64_t, _tMeterToday>::iterator itt = m_meter_today.find(DeviceRowID);
+	if (itt == m_meter_today.end())
+	{
+		_tMeterToday values;
+		values.MinValue = Value;
+		values.MaxValue = Value;
+		m_meter_today[DeviceRowID] = values;
+		return;
+	}
+	itt->second.MinValue = std::min(itt->second.MinValue, Value);
+	itt->second.MaxValue = std::max(itt->second.MaxValue, Value);
+}
+
+void CSQLHelper::AddMultiMeterToday(const uint64_t DeviceRowID, const int64_t Values[6])
+{
+	std::lock_guard<std::mutex> l(m_todayMutex);
+	m_todayGeneration++;
+	if ((!m_bTodayValid) || (m_todayDate != GetTodayDate()))
+		return; //reloaded on the next read
+	std::map<uint64_t, _tMultiMeterToday>::iterator itt = m_multimeter_today.find(DeviceRowID);
+	if (itt == m_multimeter_today.end())
+	{
+		_tMultiMeterToday &values = m_multimeter_today[DeviceRowID];
+		for (int ii = 0; ii < 6; ii++)
+		{
+			values.MinValue[ii] = Values[ii];
+			values.MaxValue[ii] = Values[ii];
+		}
+		return;
+	}
+	for (int ii = 0; ii < 6; ii++)
+	{
+		itt->second.MinValue[ii] = std::min(itt->second.MinValue[ii], Values[ii]);
+		itt->second.MaxValue[ii] = std::max(itt->second.MaxValue[ii], Values[ii]);
+	}
+}
+
+//Adds a sample (hour) or a calendar day (month) to a rollup bucket
+void CSQLHelper::AddMeterRollup(const uint64_t DeviceRowID, const _eRollupPeriod Period, const std::string &szDate, const double Value, const double Usage, const double Counter)
+{
+	{
+		CSQLStatement stmt(*this, "INSERT OR IGNORE INTO Meter_Rollup (DeviceRowID, Period, Date, Value_Min, Value_Max, Usage_Max, Counter) VALUES (?, ?, ?, ?, ?, ?, ?)");
+		stmt.Bind(DeviceRowID).Bind(int(Period)).Bind(szDate).Bind(Value).Bind(Value).Bind(Usage).Bind(Counter);
+		stmt.Execute();
+	}
+	CSQLStatement stmt(*this,
+		"UPDATE Meter_Rollup SET Value_Min=MIN(Value_Min, ?), Value_Max=MAX(Value_Max, ?), Value_Sum=Value_Sum + ?, "
+		"Usage_Max=MAX(Usage_Max, ?), Usage_Sum=Usage_Sum + ?, Counter=MAX(Counter, ?), Samples=Samples + 1 "
+		"WHERE (DeviceRowID=?) AND (Period=?) AND (Date=?)");
+	stmt.Bind(Value).Bind(Value).Bind(Value).Bind(Usage).Bind(Usage).Bind(Counter);
+	stmt.Bind(DeviceRowID).Bind(int(Period)).Bind(szDate);
+	stmt.Execute();
+}
+
+void CSQLHelper::AddMultiMeterRollup(const uint64_t DeviceRowID, const _eRollupPeriod Period, const std::string &szDate, const double Values[6], const double Counters[4])
+{
+	{
+		CSQLStatement stmt(*this,
+			"INSERT OR IGNORE INTO MultiMeter_Rollup (DeviceRowID, Period, Date, "
+			"Value1_Min, Value2_Min, Value3_Min, Value4_Min, Value5_Min, Value6_Min, "
+			"Value1_Max, Value2_Max, Value3_Max, Value4_Max, Value5_Max, Value6_Max, "
+			"Counter1, Counter2, Counter3, Counter4) "
+			"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+		stmt.Bind(DeviceRowID).Bind(int(Period)).Bind(szDate);
+		for (int ii = 0; ii < 6; ii++)
+			stmt.Bind(Values[ii]);
+		for (int ii = 0; ii < 6; ii++)
+			stmt.Bind(Values[ii]);
+		for (int ii = 0; ii < 4; ii++)
+			stmt.Bind(Counters[ii]);
+		stmt.Execute();
+	}
+	CSQLStatement stmt(*this,
+		"UPDATE MultiMeter_Rollup SET "
+		"Value1_Min=MIN(Value1_Min, ?), Value2_Min=MIN(Value2_Min, ?), Value3_Min=MIN(Value3_Min, ?), "
+		"Value4_Min=MIN(Value4_Min, ?), Value5_Min=MIN(Value5_Min, ?), Value6_Min=MIN(Value6_Min, ?), "
+		"Value1_Max=MAX(Value1_Max, ?), Value2_Max=MAX(Value2_Max, ?), Value3_Max=MAX(Value3_Max, ?), "
+		"Value4_Max=MAX(Value4_Max, ?), Value5_Max=MAX(Value5_Max, ?), Value6_Max=MAX(Value6_Max, ?), "
+		"Value1_Sum=Value1_Sum + ?, Value2_Sum=Value2_Sum + ?, Value3_Sum=Value3_Sum + ?, "
+		"Value4_Sum=Value4_Sum + ?, Value5_Sum=Value5_Sum + ?, Value6_Sum=Value6_Sum + ?, "
+		"Counter1=MAX(Counter1, ?), Counter2=MAX(Counter2, ?), Counter3=MAX(Counter3, ?), Counter4=MAX(Counter4, ?), "
+		"Samples=Samples + 1 "
+		"WHERE (DeviceRowID=?) AND (Period=?) AND (Date=?)");
+	for (int jj = 0; jj < 3; jj++)
+	{
+		for (int ii = 0; ii < 6; ii++)
+			stmt.Bind(Values[ii]);
+	}
+	for (int ii = 0; ii < 4; ii++)
+		stmt.Bind(Counters[ii]);
+	stmt.Bind(DeviceRowID).Bind(int(Period)).Bind(szDate);
+	stmt.Execute();
+}
+
+void CSQLHelper::RebuildMeterRollups(const uint64_t DeviceRowID, const std::string &szDate)
+{
+	std::string szDeviceFilter = "(1=1)";
+	std::string szHourFilter, szHourRollupFilter, szMonthFilter, szMonthRollupFilter;
+	if (DeviceRowID != 0)
+	{
+		szDeviceFilter = "(DeviceRowID=" + std::to_string(DeviceRowID) + ")";
+		bool bValidDate = (szDate.size() >= 10);
+		for (size_t ii = 0; (bValidDate) && (ii < 10); ii++)
+			bValidDate = ((ii == 4) || (ii == 7)) ? (szDate[ii] == '-') : (isdigit(szDate[ii]) != 0);
+		if (bValidDate)
+		{
+			std::string szHour = szDate.substr(0, 10) + " 00:00:00";
+			if ((szDate.size() >= 13) && (isdigit(szDate[11])) && (isdigit(szDate[12])))
+				szHour = szDate.substr(0, 13) + ":00:00";
+			std::string szMonth = szDate.substr(0, 8) + "01";
+			szHourFilter = " AND (strftime('%Y-%m-%d %H:00:00', Date)='" + szHour + "')";
+			szHourRollupFilter = " AND (Date='" + szHour + "')";
+			szMonthFilter = " AND (strftime('%Y-%m-01', Date)='" + szMonth + "')";
+			szMonthRollupFilter = " AND (Date='" + szMonth + "')";
+		}
+	}
+
+	BeginTransaction();
+	safe_query("DELETE FROM Meter_Rollup WHERE %s AND (Period=%d)%s", szDeviceFilter.c_str(), ROLLUP_HOUR, szHourRollupFilter.c_str());
+	safe_query(
+		"INSERT OR IGNORE INTO Meter_Rollup (DeviceRowID, Period, Date, Value_Min, Value_Max, Value_Sum, Usage_Max, Usage_Sum, Counter, Samples) "
+		"SELECT DeviceRowID, %d, strftime('%%Y-%%m-%%d %%H:00:00', Date) AS RollupDate, MIN(Value), MAX(Value), SUM(Value), MAX([Usage]), SUM([Usage]), 0, COUNT(*) "
+		"FROM Meter WHERE %s%s GROUP BY DeviceRowID, RollupDate",
+		ROLLUP_HOUR, szDeviceFilter.c_str(), szHourFilter.c_str());
+	safe_query("DELETE FROM Meter_Rollup WHERE %s AND (Period=%d)%s", szDeviceFilter.c_str(), ROLLUP_MONTH, szMonthRollupFilter.c_str());
+	safe_query(
+		"INSERT OR IGNORE INTO Meter_Rollup (DeviceRowID, Period, Date, Value_Min, Value_Max, Value_Sum, Usage_Max, Usage_Sum, Counter, Samples) "
+		"SELECT DeviceRowID, %d, strftime('%%Y-%%m-01', Date) AS RollupDate, MIN(Value), MAX(Value), SUM(Value), 0, 0, MAX(Counter), COUNT(*) "
+		"FROM Meter_Calendar WHERE %s%s GROUP BY DeviceRowID, RollupDate",
+		ROLLUP_MONTH, szDeviceFilter.c_str(), szMonthFilter.c_str());
+
+	safe_query("DELETE FROM MultiMeter_Rollup WHERE %s AND (Period=%d)%s", szDeviceFilter.c_str(), ROLLUP_HOUR, szHourRollupFilter.c_str());
+	safe_query(
+		"INSERT OR IGNORE INTO MultiMeter_Rollup (DeviceRowID, Period, Date, "
+		"Value1_Min, Value2_Min, Value3_Min, Value4_Min, Value5_Min, Value6_Min, "
+		"Value1_Max, Value2_Max, Value3_Max, Value4_Max, Value5_Max, Value6_Max, "
+		"Value1_Sum, Value2_Sum, Value3_Sum, Value4_Sum, Value5_Sum, Value6_Sum, "
+		"Counter1, Counter2, Counter3, Counter4, Samples) "
+		"SELECT DeviceRowID, %d, strftime('%%Y-%%m-%%d %%H:00:00', Date) AS RollupDate, "
+		"MIN(Value1), MIN(Value2), MIN(Value3), MIN(Value4), MIN(Value5), MIN(Value6), "
+		"MAX(Value1), MAX(Value2), MAX(Value3), MAX(Value4), MAX(Value5), MAX(Value6), "
+		"SUM(Value1), SUM(Value2), SUM(Value3), SUM(Value4), SUM(Value5), SUM(Value6), "
+		"0, 0, 0, 0, COUNT(*) "
+		"FROM MultiMeter WHERE %s%s GROUP BY DeviceRowID, RollupDate",
+		ROLLUP_HOUR, szDeviceFilter.c_str(), szHourFilter.c_str());
+	safe_query("DELETE FROM MultiMeter_Rollup WHERE %s AND (Period=%d)%s", szDeviceFilter.c_str(), ROLLUP_MONTH, szMonthRollupFilter.c_str());
+	safe_query(
+		"INSERT OR IGNORE INTO MultiMeter_Rollup (DeviceRowID, Period, Date, "
+		"Value1_Min, Value2_Min, Value3_Min, Value4_Min, Value5_Min, Value6_Min, "
+		"Value1_Max, Value2_Max, Value3_Max, Value4_Max, Value5_Max, Value6_Max, "
+		"Value1_Sum, Value2_Sum, Value3_Sum, Value4_Sum, Value5_Sum, Value6_Sum, "
+		"Counter1, Counter2, Counter3, Counter4, Samples) "
+		"SELECT DeviceRowID, %d, strftime('%%Y-%%m-01', Date) AS RollupDate, "
+		"MIN(Value1), MIN(Value2), MIN(Value3), MIN(Value4), MIN(Value5), MIN(Value6), "
+		"MAX(Value1), MAX(Value2), MAX(Value3), MAX(Value4), MAX(Value5), MAX(Value6), "
+		"SUM(Value1), SUM(Value2), SUM(Value3), SUM(Value4), SUM(Value5), SUM(Value6), "
+		"MAX(Counter1), MAX(Counter2), MAX(Counter3), MAX(Counter4), COUNT(*) "
+		"FROM MultiMeter_Calendar WHERE %s%s GROUP BY DeviceRowID, RollupDate",
+		ROLLUP_MONTH, szDeviceFilter.c_str(), szMonthFilter.c_str());
+	CommitTransaction();
+}
+
+void CSQLHelper::BeginTransaction()
+{
+	m_sqlQueryMutex.lock();
+	if (m_transaction_depth++ == 0)
+	{
+		m_transaction_owner = std::this_thread::get_id();
+		if (m_dbase)
+		{
+			//Without a transaction every statement commits on its own, CommitTransaction checks the autocommit state
+			char *errorMessage = NULL;
+			if (sqlite3_exec(m_dbase, "BEGIN TRANSACTION", NULL, NULL, &errorMessage) != SQLITE_OK)
+			{
+				_log.Log(LOG_ERROR, "SQLHelper: Begin transaction failed: %s", (errorMessage != NULL) ? errorMessage : "unknown");
+				sqlite3_free(errorMessage);
+			}
+		}
+	}
+}
+
+void CSQLHelper::CommitTransaction()
+{
+	std::vector<std::function<void()> > after_commit;
+	if (--m_transaction_depth == 0)
+	{
+		bool bCommitted = !m_bTransactionFailed;
+		m_bTransactionFailed = false;
+		if (!bCommitted)
+		{
+			if ((m_dbase) && (!sqlite3_get_autocommit(m_dbase)))
+				sqlite3_exec(m_dbase, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+		}
+		else if ((m_dbase) && (!sqlite3_get_autocommit(m_dbase)))
+		{
+			char *errorMessage = NULL;
+			if (sqlite3_exec(m_dbase, "COMMIT TRANSACTION", NULL, NULL, &errorMessage) != SQLITE_OK)
+			{
+				_log.Log(LOG_ERROR, "SQLHelper: Commit transaction failed: %s", (errorMessage != NULL) ? errorMessage : "unknown");
+				sqlite3_free(errorMessage);
+				//Do not leave the transaction open, the next BEGIN would fail and all later writes would end up in it
+				sqlite3_exec(m_dbase, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+				bCommitted = false;
+			}
+		}
+		m_transaction_owner = std::thread::id();
+		if (bCommitted)
+		{
+			m_devicecache.OnCommit();
+			after_commit.swap(m_after_commit);
+		}
+		else
+		{
+			m_devicecache.OnRollback();
+			m_after_commit.clear();
+		}
+	}
+	m_sqlQueryMutex.unlock();
+	for (const auto & itt : after_commit)
+		itt();
+}
+
+void CSQLHelper::RollbackTransaction()
+{
+	m_bTransactionFailed = true;
+	CommitTransaction();
+}
+
+void CSQLHelper::RunAfterCommit(const std::function<void()> &action)
+{
+	if (IsTransactionOwner())
+		m_after_commit.push_back(action);
+	else
+		action();
+}
+
+bool CSQLHelper::IsTransactionOwner()
+{
+	return (m_transaction_owner == std::this_thread::get_id());
+}
+
+CSQLConnectionLock::CSQLConnectionLock(CSQLHelper &sql, const bool bReadOnly) :
+	m_sql(sql),
+	m_reader(NULL),
+	m_dbase(NULL),
+	m_statement_cache(NULL)
+{
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	//Inside our own transaction we have to read back what we wrote, so stay on the writer
+	if ((bReadOnly) && (!m_sql.IsTransactionOwner()))
+		m_reader = m_sql.AcquireReader();
+	if (m_reader)
+	{
+		m_dbase = m_reader->dbase;
+		m_statement_cache = &m_reader->statement_cache;
+	}
+	else
+	{
+		m_sql.m_sqlQueryMutex.lock();
+		m_dbase = m_sql.m_dbase;
+		m_statement_cache = &m_sql.m_statement_cache;
+	}
+	uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tstart).count();
+	m_sql.AddLockStatistics(m_reader != NULL, wait_us);
+}
+
+CSQLConnectionLock::~CSQLConnectionLock()
+{
+	if (m_reader)
+	{
+		m_sql.ReleaseReader(m_reader);
+		return;
+	}
+	//Outside a transaction our changes are committed by now
+	if (m_sql.m_transaction_depth == 0)
+		m_sql.m_devicecache.OnCommit();
+	m_sql.m_sqlQueryMutex.unlock();
+}
+
+#define SQL_STATEMENT_CACHE_MAX 128
+
+sqlite3_stmt* CSQLHelper::GetCachedStatement(sqlite3 *dbase, std::map<std::string, sqlite3_stmt*> &cache, const char *szQuery, bool &bCached)
+{
+	bCached = false;
+	if (!dbase)
+		return NULL;
+	std::map<std::string, sqlite3_stmt*>::iterator itt = cache.find(szQuery);
+	//a nested read on the same connection can ask for a statement that is still stepping, that one gets its own
+	bool bBusy = ((itt != cache.end()) && (sqlite3_stmt_busy(itt->second)));
+	if ((itt != cache.end()) && (!bBusy))
+	{
+		bCached = true;
+		return itt->second;
+	}
+	sqlite3_stmt *statement = NULL;
+	if (sqlite3_prepare_v2(dbase, szQuery, -1, &statement, NULL) != SQLITE_OK)
+	{
+		_log.Log(LOG_ERROR, "SQL Prepare(\"%s\") : %s", szQuery, sqlite3_errmsg(dbase));
+		return NULL;
+	}
+	//Only statements with bound parameters end up here, so the cache stays small
+	//If it is full anyway the statement is finalized after use
+	if ((!bBusy) && (cache.size() < SQL_STATEMENT_CACHE_MAX))
+	{
+		cache[szQuery] = statement;
+		bCached = true;
+	}
+	return statement;
+}
+
+void CSQLHelper::ClearStatementCache(std::map<std::string, sqlite3_stmt*> &cache)
+{
+	for (auto & itt : cache)
+		sqlite3_finalize(itt.second);
+	cache.clear();
+}
+
+CSQLStatement::CSQLStatement(CSQLHelper &sql, const char *szQuery) :
+	m_connection(sql, IsReadOnlyQuery(szQuery)),
+	m_stmt(NULL),
+	m_bCached(false),
+	m_bindIndex(0),
+	m_stepResult(SQLITE_OK)
+{
+	m_stmt = sql.GetCachedStatement(m_connection.GetDB(), m_connection.GetStatementCache(), szQuery, m_bCached);
+}
+
+CSQLStatement::~CSQLStatement()
+{
+	if (!m_stmt)
+		return;
+	if (m_bCached)
+	{
+		sqlite3_reset(m_stmt);
+		sqlite3_clear_bindings(m_stmt);
+	}
+	else
+		sqlite3_finalize(m_stmt);
+}
+
+CSQLStatement& CSQLStatement::Bind(const int Value)
+{
+	if (m_stmt)
+		sqlite3_bind_int(m_stmt, ++m_bindIndex, Value);
+	return *this;
+}
+
+CSQLStatement& CSQLStatement::Bind(const int64_t Value)
+{
+	if (m_stmt)
+		sqlite3_bind_int64(m_stmt, ++m_bindIndex, static_cast<sqlite3_int64>(Value));
+	return *this;
+}
+
+CSQLStatement& CSQLStatement::Bind(const uint64_t Value)
+{
+	if (m_stmt)
+		sqlite3_bind_int64(m_stmt, ++m_bindIndex, static_cast<sqlite3_int64>(Value));
+	return *this;
+}
+
+CSQLStatement& CSQLStatement::Bind(const double Value)
+{
+	if (m_stmt)
+		sqlite3_bind_double(m_stmt, ++m_bindIndex, Value);
+	return *this;
+}
+
+CSQLStatement& CSQLStatement::Bind(const char *Value)
+{
+	if (m_stmt)
+		sqlite3_bind_text(m_stmt, ++m_bindIndex, Value, -1, SQLITE_TRANSIENT);
+	return *this;
+}
+
+CSQLStatement& CSQLStatement::Bind(const std::string &Value)
+{
+	if (m_stmt)
+		sqlite3_bind_text(m_stmt, ++m_bindIndex, Value.c_str(), static_cast<int>(Value.size()), SQLITE_TRANSIENT);
+	return *this;
+}
+
+bool CSQLStatement::Step()
+{
+	if (!m_stmt)
+		return false;
+	m_stepResult = sqlite3_step(m_stmt);
+	if (m_stepResult == SQLITE_ROW)
+		return true;
+	if (m_stepResult != SQLITE_DONE)
+		_log.Log(LOG_ERROR, "SQL Query(\"%s\") : %s", sqlite3_sql(m_stmt), sqlite3_errmsg(m_connection.GetDB()));
+	return false;
+}
+
+void CSQLStatement::Reset()
+{
+	if (!m_stmt)
+		return;
+	sqlite3_reset(m_stmt);
+	sqlite3_clear_bindings(m_stmt);
+	m_bindIndex = 0;
+	m_stepResult = SQLITE_OK;
+}
+
+bool CSQLStatement::Execute()
+{
+	while (Step())
+		;
+	return (m_stepResult == SQLITE_DONE);
+}
+
+int CSQLStatement::ColumnCount()
+{
+	return (m_stmt) ? sqlite3_column_count(m_stmt) : 0;
+}
+
+bool CSQLStatement::IsNull(const int col)
+{
+	return (sqlite3_column_type(m_stmt, col) == SQLITE_NULL);
+}
+
+int CSQLStatement::GetInt(const int col)
+{
+	return sqlite3_column_int(m_stmt, col);
+}
+
+int64_t CSQLStatement::GetInt64(const int col)
+{
+	return static_cast<int64_t>(sqlite3_column_int64(m_stmt, col));
+}
+
+uint64_t CSQLStatement::GetUInt64(const int col)
+{
+	return static_cast<uint64_t>(sqlite3_column_int64(m_stmt, col));
+}
+
+double CSQLStatement::GetDouble(const int col)
+{
+	return sqlite3_column_double(m_stmt, col);
+}
+
+const char* CSQLStatement::GetText(const int col)
+{
+	const char *value = (const char*)sqlite3_column_text(m_stmt, col);
+	return (value != NULL) ? value : "";
+}
+
+std::string CSQLStatement::GetString(const int col)
+{
+	const char *value = (const char*)sqlite3_column_text(m_stmt, col);
+	if (value == NULL)
+		return "";
+	return std::string(value, sqlite3_column_bytes(m_stmt, col));
+}
+
+uint64_t CSQLHelper::CreateDevice(const int HardwareID, const int SensorType, const int SensorSubType, std::string &devname, const unsigned long nid, const std::string &soptions)
+{
+	uint64_t DeviceRowIdx = (uint64_t)-1;
+	char ID[20];
+	sprintf(ID, "%lu", nid);
+
+#ifdef ENABLE_PYTHON
+	{
+		std::vector<std::vector<std::string> > result;
+		result = m_sql.safe_query("SELECT Type FROM Hardware WHERE (ID == %d)", HardwareID);
+		if (!result.empty())
+		{
+			std::vector<std::string> sd = result[0];
+			_eHardwareTypes Type = (_eHardwareTypes)atoi(sd[0].c_str());
+			if (Type == HTYPE_PythonPlugin)
+			{
+				// Not allowed to add device to plugin HW (plugin framework does not use key column "ID" but instead uses column "unit" as key)
+				_log.Log(LOG_ERROR, "CSQLHelper::CreateDevice: Not allowed to add device owned by plugin %u!", HardwareID);
+				return DeviceRowIdx;
+			}
+		}
+	}
+#endif
+
+	switch (SensorType)
+	{
+
+	case pTypeTEMP:
+	case pTypeWEIGHT:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0", devname);
+		break;
+	case pTypeUV:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;0.0", devname);
+		break;
+	case pTypeRAIN:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0;0", devname);
+		break;
+	case pTypeTEMP_BARO:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;1038.0;0;188.0", devname);
+		break;
+	case pTypeHUM:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 50, "1", devname);
+		break;
+	case pTypeTEMP_HUM:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;50;1", devname);
+		break;
+	case pTypeTEMP_HUM_BARO:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;50;1;1010;1", devname);
+		break;
+	case pTypeRFXMeter:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 10, 255, 0, "0", devname);
+		break;
+	case pTypeUsage:
+	case pTypeLux:
+	case pTypeP1Gas:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0", devname);
+		break;
+	case pTypeP1Power:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0;0;0;0;0;0", devname);
+		break;
+	case pTypeAirQuality:
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, devname);
+		break;
+	case pTypeCURRENT:
+		//Current/Ampere
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0.0;0.0;0.0", devname);
+		break;
+	case pTypeThermostat: //Thermostat Setpoint
+	{
+		unsigned char ID1 = (unsigned char)((nid & 0xFF000000) >> 24);
+		unsigned char ID2 = (unsigned char)((nid & 0x00FF0000) >> 16);
+		unsigned char ID3 = (unsigned char)((nid & 0x0000FF00) >> 8);
+		unsigned char ID4 = (unsigned char)((nid & 0x000000FF));
+		sprintf(ID, "%X%02X%02X%02X", ID1, ID2, ID3, ID4);
+
+		DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "20.5", devname);
+		break;
+	}
+
+	case pTypeGeneral:
+	{
+		switch (SensorSubType)
+		{
+		case sTypePressure: //Pressure (Bar)
+		case sTypePercentage: //Percentage
+		case sTypeWaterflow: //Waterflow
+		{
+			std::string rID = std::string(ID);
+			padLeft(rID, 8, '0');
+			DeviceRowIdx = UpdateValue(HardwareID, rID.c_str(), 1, SensorType, SensorSubType, 12, 255, 0, "0.0", devname);
+		}
+		break;
+		case sTypeCounterIncremental:
+			DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "0", devname);
+			break;
+		case sTypeManagedCounter:
+			DeviceRowIdx = UpdateValue(HardwareID, ID, 1, SensorType, SensorSubType, 12, 255, 0, "-1;0", devname);
+			break;
+		case sTypeVoltage:		//Voltage
+		{
+			std::string rID = std::string(ID);
+			padLeft(rID, 8, '0');
+			DeviceRowIdx = UpdateValue(HardwareID, rID.c_str(), 1, SensorType, SensorSubType, 12, 255, 0, "0.000", devname);
+		}
+		break;
+		case sTypeTextStatus:		//Text
+		{
 			std::string rID = std::string(ID);
 			padLeft(rID, 8, '0');
 			DeviceRowIdx = UpdateValue(HardwareID, rID.c_str(), 1, SensorType, SensorSubType, 12, 255, 0, "Hello World", devname);
@@ -4178,14 +5040,8 @@ uint64_t CSQLHelper::InsertDevice(const int HardwareID, const char* ID, const un
 }
 
 bool CSQLHelper::DoesDeviceExist(const int HardwareID, const char* ID, const unsigned char unit, const unsigned char devType, const unsigned char subType) {
-	std::vector<std::vector<std::string> > result;
-	result = safe_query("SELECT ID,Name FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d)", HardwareID, ID, unit, devType, subType);
-	if (result.empty()) {
-		return false;
-	}
-	else {
-		return true;
-	}
+	_tDeviceCacheItem dev;
+	return m_devicecache.FindDevice(HardwareID, ID, unit, devType, subType, dev);
 }
 
 uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const unsigned char unit, const unsigned char devType, const unsigned char subType, const unsigned char signallevel, const unsigned char batterylevel, const int nValue, const char* sValue, std::string &devname, const bool bUseOnOffAction)
@@ -4196,11 +5052,27 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 		return -1;
 
 	uint64_t ulID = 0;
+	bool bDeviceExists = false;
 	bool bDeviceUsed = false;
 	bool bSameDeviceStatusValue = false;
+	_eSwitchType stype = STYPE_OnOff;
+	int old_nValue = 0;
+	std::string old_sValue, sLastUpdate, sOption;
+	_tDeviceCacheItem dev;
+	if (m_devicecache.FindDevice(HardwareID, ID, unit, devType, subType, dev))
+	{
+		bDeviceExists = true;
+		ulID = dev.ID;
+		devname = dev.Name;
+		bDeviceUsed = dev.Used;
+		stype = (_eSwitchType)dev.SwitchType;
+		old_nValue = dev.nValue;
+		old_sValue = dev.sValue;
+		sLastUpdate = dev.LastUpdate;
+		sOption = dev.Options;
+	}
 	std::vector<std::vector<std::string> > result;
-	result = safe_query("SELECT ID,Name, Used, SwitchType, nValue, sValue, LastUpdate, Options FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d)", HardwareID, ID, unit, devType, subType);
-	if (result.empty())
+	if (!bDeviceExists)
 	{
 		//Insert
 		ulID = InsertDevice(HardwareID, ID, unit, devType, subType, 0, nValue, sValue, devname, signallevel, batterylevel);
@@ -4222,17 +5094,12 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 	else
 	{
 		//Update
-		ulID = std::strtoull(result[0][0].c_str(), nullptr, 10);
-		std::string sOption = result[0][7];
 		auto options = BuildDeviceOptions(sOption);
-		devname = result[0][1];
-		bDeviceUsed = atoi(result[0][2].c_str()) != 0;
-		_eSwitchType stype = (_eSwitchType)atoi(result[0][3].c_str());
-		int old_nValue = atoi(result[0][4].c_str());
-		std::string old_sValue = result[0][5];
 		time_t now = time(0);
 		struct tm ltime;
 		localtime_r(&now, &ltime);
+		char szLastUpdate[40];
+		sprintf(szLastUpdate, "%04d-%02d-%02d %02d:%02d:%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday, ltime.tm_hour, ltime.tm_min, ltime.tm_sec);
 		//Commit: If Option 1: energy is computed as usage*time
 		//Default is option 0, read from device
 		if (options["EnergyMeterMode"] == "1" && devType == pTypeGeneral && subType == sTypeKwh)
@@ -4242,12 +5109,11 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 			double interval;
 			float nEnergy;
 			char sCompValue[100];
-			std::string sLastUpdate = result[0][6];
 			time_t lutime;
 			ParseSQLdatetime(lutime, ntime, sLastUpdate, ltime.tm_isdst);
 
 			interval = difftime(now, lutime);
-			StringSplit(result[0][5].c_str(), ";", parts);
+			StringSplit(old_sValue, ";", parts);
 			nEnergy = static_cast<float>(strtof(parts[0].c_str(), NULL)*interval / 3600 + strtof(parts[1].c_str(), NULL)); //Rob: whats happening here... strtof ?
 			StringSplit(sValue, ";", parts);
 			sprintf(sCompValue, "%s;%.1f", parts[0].c_str(), nEnergy);
@@ -4256,13 +5122,9 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 		//~ use different update queries based on the device type
 		if (devType == pTypeGeneral && subType == sTypeCounterIncremental)
 		{
-			result = safe_query(
-				"UPDATE DeviceStatus SET SignalLevel=%d, BatteryLevel=%d, nValue= nValue + %d, sValue= sValue + '%q', LastUpdate='%04d-%02d-%02d %02d:%02d:%02d' "
-				"WHERE (ID = %" PRIu64 ")",
-				signallevel, batterylevel,
-				nValue, sValue,
-				ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday, ltime.tm_hour, ltime.tm_min, ltime.tm_sec,
-				ulID);
+			CSQLStatement stmt(*this, "UPDATE DeviceStatus SET SignalLevel=?, BatteryLevel=?, nValue= nValue + ?, sValue= sValue + ?, LastUpdate=? WHERE (ID = ?)");
+			stmt.Bind(signallevel).Bind(batterylevel).Bind(nValue).Bind(sValue).Bind(szLastUpdate).Bind(ulID);
+			stmt.Execute();
 		}
 		else
 		{
@@ -4298,13 +5160,9 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 				}
 			}
 
-			result = safe_query(
-				"UPDATE DeviceStatus SET SignalLevel=%d, BatteryLevel=%d, nValue=%d, sValue='%q', LastUpdate='%04d-%02d-%02d %02d:%02d:%02d' "
-				"WHERE (ID = %" PRIu64 ")",
-				signallevel, batterylevel,
-				nValue, sValue,
-				ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday, ltime.tm_hour, ltime.tm_min, ltime.tm_sec,
-				ulID);
+			CSQLStatement stmt(*this, "UPDATE DeviceStatus SET SignalLevel=?, BatteryLevel=?, nValue=?, sValue=?, LastUpdate=? WHERE (ID = ?)");
+			stmt.Bind(signallevel).Bind(batterylevel).Bind(nValue).Bind(sValue).Bind(szLastUpdate).Bind(ulID);
+			stmt.Execute();
 		}
 	}
 
@@ -4352,11 +5210,11 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 		//Add Lighting log
 		m_LastSwitchID = ID;
 		m_LastSwitchRowID = ulID;
-		result = safe_query(
-			"INSERT INTO LightingLog (DeviceRowID, nValue, sValue) "
-			"VALUES ('%" PRIu64 "', '%d', '%q')",
-			ulID,
-			nValue, sValue);
+		{
+			CSQLStatement stmt(*this, "INSERT INTO LightingLog (DeviceRowID, nValue, sValue) VALUES (?, ?, ?)");
+			stmt.Bind(ulID).Bind(nValue).Bind(sValue);
+			stmt.Execute();
+		}
 
 		if (!bDeviceUsed)
 			return ulID;	//don't process further as the device is not used
@@ -4615,28 +5473,14 @@ uint64_t CSQLHelper::UpdateValueInt(const int HardwareID, const char* ID, const
 
 bool CSQLHelper::GetLastValue(const int HardwareID, const char* DeviceID, const unsigned char unit, const unsigned char devType, const unsigned char subType, int &nValue, std::string &sValue, struct tm &LastUpdateTime)
 {
-	bool result = false;
-	std::vector<std::vector<std::string> > sqlresult;
-	std::string sLastUpdate;
-	//std::string sValue;
-	//struct tm LastUpdateTime;
-	sqlresult = safe_query(
-		"SELECT nValue,sValue,LastUpdate FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d) order by LastUpdate desc limit 1",
-		HardwareID, DeviceID, unit, devType, subType);
-
-	if (sqlresult.size() != 0)
-	{
-		nValue = (int)atoi(sqlresult[0][0].c_str());
-		sValue = sqlresult[0][1];
-		sLastUpdate = sqlresult[0][2];
-
-		time_t lutime;
-		ParseSQLdatetime(lutime, LastUpdateTime, sLastUpdate);
-
-		result = true;
-	}
-
-	return result;
+	_tDeviceCacheItem dev;
+	if (!m_devicecache.FindDevice(HardwareID, DeviceID, unit, devType, subType, dev))
+		return false;
+	nValue = dev.nValue;
+	sValue = dev.sValue;
+	time_t lutime;
+	ParseSQLdatetime(lutime, LastUpdateTime, dev.LastUpdate);
+	return true;
 }
 
 
@@ -4644,42 +5488,31 @@ void CSQLHelper::GetAddjustment(const int HardwareID, const char* ID, const unsi
 {
 	AddjValue = 0.0f;
 	AddjMulti = 1.0f;
-	std::vector<std::vector<std::string> > result;
-	result = safe_query(
-		"SELECT AddjValue,AddjMulti FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d)",
-		HardwareID, ID, unit, devType, subType);
-	if (!result.empty())
+	_tDeviceCacheItem dev;
+	if (m_devicecache.FindDevice(HardwareID, ID, unit, devType, subType, dev))
 	{
-		AddjValue = static_cast<float>(atof(result[0][0].c_str()));
-		AddjMulti = static_cast<float>(atof(result[0][1].c_str()));
+		AddjValue = dev.AddjValue;
+		AddjMulti = dev.AddjMulti;
 	}
 }
 
 void CSQLHelper::GetMeterType(const int HardwareID, const char* ID, const unsigned char unit, const unsigned char devType, const unsigned char subType, int &meterType)
 {
 	meterType = 0;
-	std::vector<std::vector<std::string> > result;
-	result = safe_query(
-		"SELECT SwitchType FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d)",
-		HardwareID, ID, unit, devType, subType);
-	if (!result.empty())
-	{
-		meterType = atoi(result[0][0].c_str());
-	}
+	_tDeviceCacheItem dev;
+	if (m_devicecache.FindDevice(HardwareID, ID, unit, devType, subType, dev))
+		meterType = dev.SwitchType;
 }
 
 void CSQLHelper::GetAddjustment2(const int HardwareID, const char* ID, const unsigned char unit, const unsigned char devType, const unsigned char subType, float &AddjValue, float &AddjMulti)
 {
 	AddjValue = 0.0f;
 	AddjMulti = 1.0f;
-	std::vector<std::vector<std::string> > result;
-	result = safe_query(
-		"SELECT AddjValue2,AddjMulti2 FROM DeviceStatus WHERE (HardwareID=%d AND DeviceID='%q' AND Unit=%d AND Type=%d AND SubType=%d)",
-		HardwareID, ID, unit, devType, subType);
-	if (!result.empty())
+	_tDeviceCacheItem dev;
+	if (m_devicecache.FindDevice(HardwareID, ID, unit, devType, subType, dev))
 	{
-		AddjValue = static_cast<float>(atof(result[0][0].c_str()));
-		AddjMulti = static_cast<float>(atof(result[0][1].c_str()));
+		AddjValue = dev.AddjValue2;
+		AddjMulti = dev.AddjMulti2;
 	}
 }
 
@@ -4834,6 +5667,14 @@ void CSQLHelper::UpdateRFXCOMHardwareDetails(const int HardwareID, const int msg
 		msg1, msg2, msg3, msg4, msg5, msg6, HardwareID);
 }
 
+//The Timers flag of every device depends on the active plan, the pending structure change is published by the preference write
+void CSQLHelper::SetActiveTimerPlan(const int TimerPlan)
+{
+	m_ActiveTimerPlan = TimerPlan;
+	m_devicecache.OnStructureChanged();
+	UpdatePreferencesVar("ActiveTimerPlan", TimerPlan);
+}
+
 bool CSQLHelper::HasTimers(const uint64_t Idx)
 {
 	if (!m_dbase)
@@ -4886,6 +5727,45 @@ bool CSQLHelper::HasSceneTimers(const std::string &Idx)
 	return HasSceneTimers(idxll);
 }
 
+//Runs a short log/calendar job in one transaction and keeps how long it took and how many rows it wrote
+int CSQLHelper::RunRollupJob(const char *szName, void (CSQLHelper::*job)())
+{
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	BeginTransaction();
+	int changes = sqlite3_total_changes(m_dbase);
+	try
+	{
+		(this->*job)();
+	}
+	catch (...)
+	{
+		RollbackTransaction();
+		throw;
+	}
+	changes = sqlite3_total_changes(m_dbase) - changes;
+	CommitTransaction();
+	AddJobStatistics(szName, changes, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
+	return changes;
+}
+
+void CSQLHelper::AddJobStatistics(const std::string &szName, const int rows, const double duration)
+{
+	std::lock_guard<std::mutex> l(m_jobstatsMutex);
+	_tSQLJobStats &stats = m_jobstats[szName];
+	stats.runs++;
+	stats.rows += rows;
+	stats.last_rows = rows;
+	stats.last_ms = duration;
+	if (duration > stats.max_ms)
+		stats.max_ms = duration;
+}
+
+std::map<std::string, _tSQLJobStats> CSQLHelper::GetJobStatistics()
+{
+	std::lock_guard<std::mutex> l(m_jobstatsMutex);
+	return m_jobstats;
+}
+
 void CSQLHelper::ScheduleShortlog()
 {
 #ifdef _DEBUG
@@ -4899,17 +5779,22 @@ void CSQLHelper::ScheduleShortlog()
 		//Force WAL flush
 		sqlite3_wal_checkpoint(m_dbase, NULL);
 
-		UpdateTemperatureLog();
-		UpdateRainLog();
-		UpdateWindLog();
-		UpdateUVLog();
-		UpdateMeter();
-		UpdateMultiMeter();
-		UpdatePercentageLog();
-		UpdateFanLog();
+		std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+		int rows = 0;
+		rows += RunRollupJob("UpdateTemperatureLog", &CSQLHelper::UpdateTemperatureLog);
+		rows += RunRollupJob("UpdateRainLog", &CSQLHelper::UpdateRainLog);
+		rows += RunRollupJob("UpdateWindLog", &CSQLHelper::UpdateWindLog);
+		rows += RunRollupJob("UpdateUVLog", &CSQLHelper::UpdateUVLog);
+		rows += RunRollupJob("UpdateMeter", &CSQLHelper::UpdateMeter);
+		rows += RunRollupJob("UpdateMultiMeter", &CSQLHelper::UpdateMultiMeter);
+		rows += RunRollupJob("UpdatePercentageLog", &CSQLHelper::UpdatePercentageLog);
+		rows += RunRollupJob("UpdateFanLog", &CSQLHelper::UpdateFanLog);
 		//Removing the line below could cause a very large database,
 		//and slow(large) data transfer (specially when working remote!!)
+		//Not in a transaction, it deletes in chunks and lets other writers in between
 		CleanupShortLog();
+		_log.Debug(DEBUG_NORM, "SQLHelper: Short log: %d rows in %.1f ms", rows,
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
 	}
 	catch (boost::exception & e)
 	{
@@ -4933,15 +5818,20 @@ void CSQLHelper::ScheduleDay()
 		//Force WAL flush
 		sqlite3_wal_checkpoint(m_dbase, NULL);
 
-		AddCalendarTemperature();
-		AddCalendarUpdateRain();
-		AddCalendarUpdateUV();
-		AddCalendarUpdateWind();
-		AddCalendarUpdateMeter();
-		AddCalendarUpdateMultiMeter();
-		AddCalendarUpdatePercentage();
-		AddCalendarUpdateFan();
-		CleanupLightSceneLog();
+		std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+		int rows = 0;
+		rows += RunRollupJob("AddCalendarTemperature", &CSQLHelper::AddCalendarTemperature);
+		rows += RunRollupJob("AddCalendarUpdateRain", &CSQLHelper::AddCalendarUpdateRain);
+		rows += RunRollupJob("AddCalendarUpdateUV", &CSQLHelper::AddCalendarUpdateUV);
+		rows += RunRollupJob("AddCalendarUpdateWind", &CSQLHelper::AddCalendarUpdateWind);
+		rows += RunRollupJob("AddCalendarUpdateMeter", &CSQLHelper::AddCalendarUpdateMeter);
+		rows += RunRollupJob("AddCalendarUpdateMultiMeter", &CSQLHelper::AddCalendarUpdateMultiMeter);
+		rows += RunRollupJob("AddCalendarUpdatePercentage", &CSQLHelper::AddCalendarUpdatePercentage);
+		rows += RunRollupJob("AddCalendarUpdateFan", &CSQLHelper::AddCalendarUpdateFan);
+		rows += RunRollupJob("CleanupLightSceneLog", &CSQLHelper::CleanupLightSceneLog);
+		rows += RunRollupJob("IncrementalVacuum", &CSQLHelper::IncrementalVacuum);
+		_log.Log(LOG_STATUS, "SQLHelper: Daily calendar update: %d rows in %.1f ms", rows,
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
 	}
 	catch (boost::exception & e)
 	{
@@ -4962,6 +5852,9 @@ void CSQLHelper::UpdateTemperatureLog()
 		return;
 	struct tm tm1;
 	localtime_r(&now, &tm1);
+	//the table row and the store sample get the same time, ImportTimeSeries compares them
+	const int64_t SampleTime = CTimeSeriesStore::ToLocalSeconds(tm1);
+	const std::string szSampleDate = CTimeSeriesStore::FormatLocalSeconds(SampleTime);
 
 	int SensorTimeOut = 60;
 	GetPreferencesVar("SensorTimeout", SensorTimeOut);
@@ -5122,16 +6015,22 @@ void CSQLHelper::UpdateTemperatureLog()
 			}
 			//insert record
 			safe_query(
-				"INSERT INTO Temperature (DeviceRowID, Temperature, Chill, Humidity, Barometer, DewPoint, SetPoint) "
-				"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%d', '%d', '%.2f', '%.2f')",
+				"INSERT INTO Temperature (DeviceRowID, Temperature, Chill, Humidity, Barometer, DewPoint, SetPoint, Date) "
+				"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%d', '%d', '%.2f', '%.2f', '%q')",
 				ID,
 				temp,
 				chill,
 				humidity,
 				barometer,
 				dewpoint,
-				setpoint
+				setpoint,
+				szSampleDate.c_str()
 			);
+			if (m_bTimeSeriesStore)
+			{
+				m_tsstore.Append("Temperature", ID, SampleTime,
+					{ temp, chill, static_cast<double>(humidity), static_cast<double>(barometer), dewpoint, setpoint });
+			}
 		}
 	}
 }
@@ -5371,6 +6270,8 @@ bool CSQLHelper::UpdateCalendarMeter(
 				DeviceRowID, date
 			);
 		}
+		InvalidateTodayBaselines();
+		RebuildMeterRollups(DeviceRowID, date);
 	}
 	else
 	{
@@ -5400,6 +6301,7 @@ bool CSQLHelper::UpdateCalendarMeter(
 				DeviceRowID, date
 			);
 		}
+		RebuildMeterRollups(DeviceRowID, date);
 	}
 	return true;
 }
@@ -5411,6 +6313,8 @@ void CSQLHelper::UpdateMeter()
 		return;
 	struct tm tm1;
 	localtime_r(&now, &tm1);
+	char szHour[40];
+	sprintf(szHour, "%04d-%02d-%02d %02d:00:00", tm1.tm_year + 1900, tm1.tm_mon + 1, tm1.tm_mday, tm1.tm_hour);
 
 	int SensorTimeOut = 60;
 	GetPreferencesVar("SensorTimeout", SensorTimeOut);
@@ -5649,6 +6553,8 @@ void CSQLHelper::UpdateMeter()
 				MeterValue,
 				MeterUsage
 			);
+			AddMeterToday(ID, MeterValue);
+			AddMeterRollup(ID, ROLLUP_HOUR, szHour, double(MeterValue), double(MeterUsage), 0);
 		}
 	}
 }
@@ -5660,6 +6566,8 @@ void CSQLHelper::UpdateMultiMeter()
 		return;
 	struct tm tm1;
 	localtime_r(&now, &tm1);
+	char szHour[40];
+	sprintf(szHour, "%04d-%02d-%02d %02d:00:00", tm1.tm_year + 1900, tm1.tm_mon + 1, tm1.tm_mday, tm1.tm_hour);
 
 	int SensorTimeOut = 60;
 	GetPreferencesVar("SensorTimeout", SensorTimeOut);
@@ -5752,6 +6660,11 @@ void CSQLHelper::UpdateMultiMeter()
 				value5,
 				value6
 			);
+			const int64_t values[6] = { (int64_t)value1, (int64_t)value2, (int64_t)value3, (int64_t)value4, (int64_t)value5, (int64_t)value6 };
+			AddMultiMeterToday(ID, values);
+			const double rollup_values[6] = { double(value1), double(value2), double(value3), double(value4), double(value5), double(value6) };
+			const double rollup_counters[4] = { 0, 0, 0, 0 };
+			AddMultiMeterRollup(ID, ROLLUP_HOUR, szHour, rollup_values, rollup_counters);
 		}
 	}
 }
@@ -5869,160 +6782,64 @@ void CSQLHelper::UpdateFanLog()
 }
 
 
-void CSQLHelper::AddCalendarTemperature()
+//Dates of the day that is added to the calendar tables (yesterday) and of today
+static void GetCalendarDates(std::string &szDateStart, std::string &szDateEnd)
 {
-	//Get All temperature devices in the Temperature Table
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Temperature ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
+	char szDate[40];
 
 	time_t now = mytime(NULL);
 	struct tm ltime;
 	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+	sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+	szDateEnd = szDate;
 
 	time_t yesterday;
 	struct tm tm2;
 	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
-
-	std::vector<std::vector<std::string> > result;
-
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
-
-		result = safe_query("SELECT MIN(Temperature), MAX(Temperature), AVG(Temperature), MIN(Chill), MAX(Chill), AVG(Humidity), AVG(Barometer), MIN(DewPoint), MIN(SetPoint), MAX(SetPoint), AVG(SetPoint) FROM Temperature WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
+	sprintf(szDate, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
+	szDateStart = szDate;
+}
 
-			float temp_min = static_cast<float>(atof(sd[0].c_str()));
-			float temp_max = static_cast<float>(atof(sd[1].c_str()));
-			float temp_avg = static_cast<float>(atof(sd[2].c_str()));
-			float chill_min = static_cast<float>(atof(sd[3].c_str()));
-			float chill_max = static_cast<float>(atof(sd[4].c_str()));
-			int humidity = atoi(sd[5].c_str());
-			int barometer = atoi(sd[6].c_str());
-			float dewpoint = static_cast<float>(atof(sd[7].c_str()));
-			float setpoint_min = static_cast<float>(atof(sd[8].c_str()));
-			float setpoint_max = static_cast<float>(atof(sd[9].c_str()));
-			float setpoint_avg = static_cast<float>(atof(sd[10].c_str()));
-			result = safe_query(
-				"INSERT INTO Temperature_Calendar (DeviceRowID, Temp_Min, Temp_Max, Temp_Avg, Chill_Min, Chill_Max, Humidity, Barometer, DewPoint, SetPoint_Min, SetPoint_Max, SetPoint_Avg, Date) "
-				"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%d', '%d', '%.2f', '%.2f', '%.2f', '%.2f', '%q')",
-				ID,
-				temp_min,
-				temp_max,
-				temp_avg,
-				chill_min,
-				chill_max,
-				humidity,
-				barometer,
-				dewpoint,
-				setpoint_min,
-				setpoint_max,
-				setpoint_avg,
-				szDateStart
-			);
-		}
-	}
+void CSQLHelper::AddCalendarTemperature()
+{
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	//One row for every device that had readings yesterday
+	CSQLStatement stmt(*this,
+		"INSERT INTO Temperature_Calendar (DeviceRowID, Temp_Min, Temp_Max, Temp_Avg, Chill_Min, Chill_Max, Humidity, Barometer, DewPoint, SetPoint_Min, SetPoint_Max, SetPoint_Avg, Date) "
+		"SELECT d.DeviceRowID, ROUND(MIN(t.Temperature),2), ROUND(MAX(t.Temperature),2), ROUND(AVG(t.Temperature),2), "
+		"ROUND(MIN(t.Chill),2), ROUND(MAX(t.Chill),2), CAST(AVG(t.Humidity) AS INTEGER), CAST(AVG(t.Barometer) AS INTEGER), "
+		"ROUND(MIN(t.DewPoint),2), ROUND(MIN(t.SetPoint),2), ROUND(MAX(t.SetPoint),2), ROUND(AVG(t.SetPoint),2), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM Temperature) d "
+		"INNER JOIN Temperature t ON (t.DeviceRowID=d.DeviceRowID AND t.Date>=? AND t.Date<?) "
+		"GROUP BY d.DeviceRowID");
+	stmt.Bind(szDateStart).Bind(szDateStart).Bind(szDateEnd).Execute();
 }
 
 void CSQLHelper::AddCalendarUpdateRain()
 {
-	//Get All UV devices
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Rain ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
-
-	std::vector<std::vector<std::string> > result;
-
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
-
-		//Get Device Information
-		result = safe_query("SELECT SubType FROM DeviceStatus WHERE (ID='%" PRIu64 "')", ID);
-		if (result.empty())
-			continue;
-		std::vector<std::string> sd = result[0];
-
-		unsigned char subType = atoi(sd[0].c_str());
-
-		if (subType != sTypeRAINWU)
-		{
-			result = safe_query("SELECT MIN(Total), MAX(Total), MAX(Rate) FROM Rain WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-				ID,
-				szDateStart,
-				szDateEnd
-			);
-		}
-		else
-		{
-			result = safe_query("SELECT Total, Total, Rate FROM Rain WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q') ORDER BY ROWID DESC LIMIT 1",
-				ID,
-				szDateStart,
-				szDateEnd
-			);
-		}
-
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
-
-			float total_min = static_cast<float>(atof(sd[0].c_str()));
-			float total_max = static_cast<float>(atof(sd[1].c_str()));
-			int rate = atoi(sd[2].c_str());
-
-			float total_real = 0;
-			if (subType != sTypeRAINWU)
-			{
-				total_real = total_max - total_min;
-			}
-			else
-			{
-				total_real = total_max;
-			}
-
-
-			if (total_real < 1000)
-			{
-				result = safe_query(
-					"INSERT INTO Rain_Calendar (DeviceRowID, Total, Rate, Date) "
-					"VALUES ('%" PRIu64 "', '%.2f', '%d', '%q')",
-					ID,
-					total_real,
-					rate,
-					szDateStart
-				);
-			}
-		}
-	}
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	//Rain of the day is the difference between the highest and lowest total
+	CSQLStatement stmt(*this,
+		"INSERT INTO Rain_Calendar (DeviceRowID, Total, Rate, Date) "
+		"SELECT d.DeviceRowID, ROUND(MAX(r.Total) - MIN(r.Total),2), CAST(MAX(r.Rate) AS INTEGER), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM Rain) d "
+		"INNER JOIN DeviceStatus ds ON (ds.ID=d.DeviceRowID AND ds.SubType<>?) "
+		"INNER JOIN Rain r ON (r.DeviceRowID=d.DeviceRowID AND r.Date>=? AND r.Date<?) "
+		"GROUP BY d.DeviceRowID "
+		"HAVING (MAX(r.Total) - MIN(r.Total) < 1000)");
+	stmt.Bind(szDateStart).Bind(static_cast<int>(sTypeRAINWU)).Bind(szDateStart).Bind(szDateEnd).Execute();
+
+	//Weather Underground reports the total of the day, take the last reading
+	CSQLStatement stmtWU(*this,
+		"INSERT INTO Rain_Calendar (DeviceRowID, Total, Rate, Date) "
+		"SELECT r.DeviceRowID, ROUND(r.Total,2), CAST(r.Rate AS INTEGER), ? "
+		"FROM Rain r INNER JOIN DeviceStatus ds ON (ds.ID=r.DeviceRowID AND ds.SubType=?) "
+		"WHERE r.ROWID IN (SELECT MAX(ROWID) FROM Rain WHERE (Date>=? AND Date<?) GROUP BY DeviceRowID) AND (r.Total < 1000)");
+	stmtWU.Bind(szDateStart).Bind(static_cast<int>(sTypeRAINWU)).Bind(szDateStart).Bind(szDateEnd).Execute();
 }
 
 void CSQLHelper::AddCalendarUpdateMeter()
@@ -6038,545 +6855,400 @@ void CSQLHelper::AddCalendarUpdateMeter()
 	}
 	if (GetPreferencesVar("MeterDividerGas", tValue))
 	{
-		GasDivider = float(tValue);
-	}
-	if (GetPreferencesVar("MeterDividerWater", tValue))
-	{
-		WaterDivider = float(tValue);
-	}
-
-	//Get All Meter devices
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Meter ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
-
-	std::vector<std::vector<std::string> > result;
-
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
-
-		//Get Device Information
-		result = safe_query("SELECT Name, HardwareID, DeviceID, Unit, Type, SubType, SwitchType FROM DeviceStatus WHERE (ID='%" PRIu64 "')", ID);
-		if (result.empty())
-			continue;
-		std::vector<std::string> sd = result[0];
-		std::string devname = sd[0];
-		//int hardwareID= atoi(sd[1].c_str());
-		//std::string DeviceID=sd[2];
-		//unsigned char Unit = atoi(sd[3].c_str());
-		unsigned char devType = atoi(sd[4].c_str());
-		unsigned char subType = atoi(sd[5].c_str());
-		_eSwitchType switchtype = (_eSwitchType)atoi(sd[6].c_str());
-		_eMeterType metertype = (_eMeterType)switchtype;
-
-		float tGasDivider = GasDivider;
-
-		if (devType == pTypeP1Power)
-		{
-			metertype = MTYPE_ENERGY;
-		}
-		else if (devType == pTypeP1Gas)
-		{
-			metertype = MTYPE_GAS;
-			tGasDivider = 1000.0f;
-		}
-		else if ((devType == pTypeRego6XXValue) && (subType == sTypeRego6XXCounter))
-		{
-			metertype = MTYPE_COUNTER;
-		}
-
-
-		result = safe_query("SELECT MIN(Value), MAX(Value), AVG(Value) FROM Meter WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
-
-			double total_min = (double)atof(sd[0].c_str());
-			double total_max = (double)atof(sd[1].c_str());
-			double avg_value = (double)atof(sd[2].c_str());
-
-			if (
-				(devType != pTypeAirQuality) &&
-				(devType != pTypeRFXSensor) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeVisibility))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeDistance))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeSolarRadiation))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeSoilMoisture))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeLeafWetness))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeVoltage))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeCurrent))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypePressure))) &&
-				(!((devType == pTypeGeneral) && (subType == sTypeSoundLevel))) &&
-				(devType != pTypeLux) &&
-				(devType != pTypeWEIGHT) &&
-				(devType != pTypeUsage)
-				)
-			{
-				double total_real = total_max - total_min;
-				double counter = total_max;
-
-				result = safe_query(
-					"INSERT INTO Meter_Calendar (DeviceRowID, Value, Counter, Date) "
-					"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%q')",
-					ID,
-					total_real,
-					counter,
-					szDateStart
-				);
-
-				//Check for Notification
-				musage = 0;
-				switch (metertype)
-				{
-				case MTYPE_ENERGY:
-				case MTYPE_ENERGY_GENERATED:
-					musage = float(total_real) / EnergyDivider;
-					if (musage != 0)
-						m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYENERGY, musage);
-					break;
-				case MTYPE_GAS:
-					musage = float(total_real) / tGasDivider;
-					if (musage != 0)
-						m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYGAS, musage);
-					break;
-				case MTYPE_WATER:
-					musage = float(total_real) / WaterDivider;
-					if (musage != 0)
-						m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYGAS, musage);
-					break;
-				case MTYPE_COUNTER:
-					musage = float(total_real);
-					if (musage != 0)
-						m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYCOUNTER, musage);
-					break;
-				default:
-					//Unhandled
-					musage = 0;
-					break;
-				}
-			}
-			else
-			{
-				//AirQuality/Usage Meter/Moisture/RFXSensor/Voltage/Lux/SoundLevel insert into MultiMeter_Calendar table
-				result = safe_query(
-					"INSERT INTO MultiMeter_Calendar (DeviceRowID, Value1,Value2,Value3,Value4,Value5,Value6, Date) "
-					"VALUES ('%" PRIu64 "', '%.2f','%.2f','%.2f','%.2f','%.2f','%.2f', '%q')",
-					ID,
-					total_min, total_max, avg_value, 0.0f, 0.0f, 0.0f,
-					szDateStart
-				);
-			}
-			if (
-				(devType != pTypeAirQuality) &&
-				(devType != pTypeRFXSensor) &&
-				((devType != pTypeGeneral) && (subType != sTypeVisibility)) &&
-				((devType != pTypeGeneral) && (subType != sTypeDistance)) &&
-				((devType != pTypeGeneral) && (subType != sTypeSolarRadiation)) &&
-				((devType != pTypeGeneral) && (subType != sTypeVoltage)) &&
-				((devType != pTypeGeneral) && (subType != sTypeCurrent)) &&
-				((devType != pTypeGeneral) && (subType != sTypePressure)) &&
-				((devType != pTypeGeneral) && (subType != sTypeSoilMoisture)) &&
-				((devType != pTypeGeneral) && (subType != sTypeLeafWetness)) &&
-				((devType != pTypeGeneral) && (subType != sTypeSoundLevel)) &&
-				(devType != pTypeLux) &&
-				(devType != pTypeWEIGHT)
-				)
-			{
-				result = safe_query("SELECT Value FROM Meter WHERE (DeviceRowID='%" PRIu64 "') ORDER BY ROWID DESC LIMIT 1", ID);
-				if (!result.empty())
-				{
-					std::vector<std::string> sd = result[0];
-					//Insert the last (max) counter value into the meter table to get the "today" value correct.
-					result = safe_query(
-						"INSERT INTO Meter (DeviceRowID, Value, Date) "
-						"VALUES ('%" PRIu64 "', '%q', '%q')",
-						ID,
-						sd[0].c_str(),
-						szDateEnd
-					);
-				}
-			}
-		}
-		else
-		{
-			//no new meter result received in last day
-			result = safe_query(
-				"INSERT INTO Meter_Calendar (DeviceRowID, Value, Date) "
-				"VALUES ('%" PRIu64 "', '%.2f', '%q')",
-				ID,
-				0.0f,
-				szDateStart
-			);
-		}
-	}
-}
-
-void CSQLHelper::AddCalendarUpdateMultiMeter()
-{
-	float EnergyDivider = 1000.0f;
-	int tValue;
-	if (GetPreferencesVar("MeterDividerEnergy", tValue))
-	{
-		EnergyDivider = float(tValue);
-	}
-
-	//Get All meter devices
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM MultiMeter ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
-
-	std::vector<std::vector<std::string> > result;
-
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
-
-		//Get Device Information
-		result = safe_query("SELECT Name, HardwareID, DeviceID, Unit, Type, SubType, SwitchType FROM DeviceStatus WHERE (ID='%" PRIu64 "')", ID);
-		if (result.empty())
-			continue;
-		std::vector<std::string> sd = result[0];
-
-		std::string devname = sd[0];
-		//int hardwareID= atoi(sd[1].c_str());
-		//std::string DeviceID=sd[2];
-		//unsigned char Unit = atoi(sd[3].c_str());
-		unsigned char devType = atoi(sd[4].c_str());
-		unsigned char subType = atoi(sd[5].c_str());
-		//_eSwitchType switchtype=(_eSwitchType) atoi(sd[6].c_str());
-		//_eMeterType metertype=(_eMeterType)switchtype;
-
-		result = safe_query(
-			"SELECT MIN(Value1), MAX(Value1), MIN(Value2), MAX(Value2), MIN(Value3), MAX(Value3), MIN(Value4), MAX(Value4), MIN(Value5), MAX(Value5), MIN(Value6), MAX(Value6) FROM MultiMeter WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
-
-			float total_real[6];
-			float counter1 = 0;
-			float counter2 = 0;
-			float counter3 = 0;
-			float counter4 = 0;
-
-			if (devType == pTypeP1Power)
-			{
-				for (int ii = 0; ii < 6; ii++)
-				{
-					float total_min = static_cast<float>(atof(sd[(ii * 2) + 0].c_str()));
-					float total_max = static_cast<float>(atof(sd[(ii * 2) + 1].c_str()));
-					total_real[ii] = total_max - total_min;
-				}
-				counter1 = static_cast<float>(atof(sd[1].c_str()));
-				counter2 = static_cast<float>(atof(sd[3].c_str()));
-				counter3 = static_cast<float>(atof(sd[9].c_str()));
-				counter4 = static_cast<float>(atof(sd[11].c_str()));
-			}
-			else
-			{
-				for (int ii = 0; ii < 6; ii++)
-				{
-					float fvalue = static_cast<float>(atof(sd[ii].c_str()));
-					total_real[ii] = fvalue;
-				}
-			}
-
-			result = safe_query(
-				"INSERT INTO MultiMeter_Calendar (DeviceRowID, Value1, Value2, Value3, Value4, Value5, Value6, Counter1, Counter2, Counter3, Counter4, Date) "
-				"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%q')",
-				ID,
-				total_real[0],
-				total_real[1],
-				total_real[2],
-				total_real[3],
-				total_real[4],
-				total_real[5],
-				counter1,
-				counter2,
-				counter3,
-				counter4,
-				szDateStart
-			);
-
-			//Check for Notification
-			if (devType == pTypeP1Power)
-			{
-				float musage = (total_real[0] + total_real[4]) / EnergyDivider;
-				m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYENERGY, musage);
-			}
-			/*
-			//Insert the last (max) counter values into the table to get the "today" value correct.
-			sprintf(szTmp,
-			"INSERT INTO MultiMeter (DeviceRowID, Value1, Value2, Value3, Value4, Value5, Value6, Date) "
-			"VALUES (%" PRIu64 ", %s, %s, %s, %s, %s, %s, '%s')",
-			ID,
-			sd[0].c_str(),
-			sd[1].c_str(),
-			sd[2].c_str(),
-			sd[3].c_str(),
-			sd[4].c_str(),
-			sd[5].c_str(),
-			szDateEnd
-			);
-			result=query(szTmp);
-			*/
-		}
-	}
-}
-
-void CSQLHelper::AddCalendarUpdateWind()
-{
-	//Get All Wind devices
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Wind ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
-
-	std::vector<std::vector<std::string> > result;
-
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
-
-		result = safe_query("SELECT AVG(Direction), MIN(Speed), MAX(Speed), MIN(Gust), MAX(Gust) FROM Wind WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
-
-			float Direction = static_cast<float>(atof(sd[0].c_str()));
-			int speed_min = atoi(sd[1].c_str());
-			int speed_max = atoi(sd[2].c_str());
-			int gust_min = atoi(sd[3].c_str());
-			int gust_max = atoi(sd[4].c_str());
-
-			result = safe_query(
-				"INSERT INTO Wind_Calendar (DeviceRowID, Direction, Speed_Min, Speed_Max, Gust_Min, Gust_Max, Date) "
-				"VALUES ('%" PRIu64 "', '%.2f', '%d', '%d', '%d', '%d', '%q')",
-				ID,
-				Direction,
-				speed_min,
-				speed_max,
-				gust_min,
-				gust_max,
-				szDateStart
-			);
-		}
-	}
-}
-
-void CSQLHelper::AddCalendarUpdateUV()
-{
-	//Get All UV devices
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM UV ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+		GasDivider = float(tValue);
+	}
+	if (GetPreferencesVar("MeterDividerWater", tValue))
+	{
+		WaterDivider = float(tValue);
+	}
 
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+	std::string szMonth = szDateStart.substr(0, 8) + "01";
+
+	struct _tMeterDay
+	{
+		uint64_t ID;
+		std::string devname;
+		unsigned char devType;
+		unsigned char subType;
+		_eSwitchType switchtype;
+		double total_min;
+		double total_max;
+		double avg_value;
+		bool bHaveLastValue;
+		std::string szLastValue;
+	};
+	std::vector<_tMeterDay> days;
+
+	//Yesterday of all devices in one go, from the hourly rollup instead of all the samples in the Meter table,
+	//together with the last counter value in the Meter table.
+	//Devices without samples yesterday get a zero calendar row and no carry-over, as before.
+	//Read everything first, the inserts below go to the tables this query is reading
+	std::vector<uint64_t> idle_devices;
+	{
+		CSQLStatement stmt(*this,
+			"SELECT r.DeviceRowID, ds.Name, ds.Type, ds.SubType, ds.SwitchType, r.Value_Min, r.Value_Max, r.Value_Avg, l.Value "
+			"FROM (SELECT DeviceRowID, MIN(Value_Min) AS Value_Min, MAX(Value_Max) AS Value_Max, SUM(Value_Sum) / SUM(Samples) AS Value_Avg "
+			"FROM Meter_Rollup WHERE (Period=? AND Date>=? AND Date<?) GROUP BY DeviceRowID) r "
+			"INNER JOIN DeviceStatus ds ON (ds.ID=r.DeviceRowID) "
+			"LEFT JOIN (SELECT DeviceRowID, MAX(ROWID), Value FROM Meter GROUP BY DeviceRowID) l ON (l.DeviceRowID=r.DeviceRowID) "
+			"ORDER BY r.DeviceRowID");
+		stmt.Bind(static_cast<int>(ROLLUP_HOUR)).Bind(szDateStart).Bind(szDateEnd);
+		while (stmt.Step())
+		{
+			_tMeterDay day;
+			day.ID = stmt.GetUInt64(0);
+			day.devname = stmt.GetString(1);
+			day.devType = static_cast<unsigned char>(stmt.GetInt(2));
+			day.subType = static_cast<unsigned char>(stmt.GetInt(3));
+			day.switchtype = (_eSwitchType)stmt.GetInt(4);
+			day.total_min = stmt.GetDouble(5);
+			day.total_max = stmt.GetDouble(6);
+			day.avg_value = stmt.GetDouble(7);
+			day.bHaveLastValue = !stmt.IsNull(8);
+			if (day.bHaveLastValue)
+				day.szLastValue = stmt.GetString(8);
+			days.push_back(day);
+		}
+	}
+	{
+		CSQLStatement stmt(*this,
+			"SELECT DISTINCT m.DeviceRowID FROM Meter m "
+			"INNER JOIN DeviceStatus ds ON (ds.ID=m.DeviceRowID) "
+			"WHERE m.DeviceRowID NOT IN (SELECT DeviceRowID FROM Meter_Rollup WHERE (Period=? AND Date>=? AND Date<?)) "
+			"ORDER BY m.DeviceRowID");
+		stmt.Bind(static_cast<int>(ROLLUP_HOUR)).Bind(szDateStart).Bind(szDateEnd);
+		while (stmt.Step())
+			idle_devices.push_back(stmt.GetUInt64(0));
+	}
 
 	std::vector<std::vector<std::string> > result;
 
-	for (const auto & itt : resultdevices)
+	for (const auto &day : days)
 	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
+		uint64_t ID = day.ID;
+		const std::string &devname = day.devname;
+		unsigned char devType = day.devType;
+		unsigned char subType = day.subType;
+		_eMeterType metertype = (_eMeterType)day.switchtype;
 
-		result = safe_query("SELECT MAX(Level) FROM UV WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
+		float tGasDivider = GasDivider;
+
+		if (devType == pTypeP1Power)
 		{
-			std::vector<std::string> sd = result[0];
+			metertype = MTYPE_ENERGY;
+		}
+		else if (devType == pTypeP1Gas)
+		{
+			metertype = MTYPE_GAS;
+			tGasDivider = 1000.0f;
+		}
+		else if ((devType == pTypeRego6XXValue) && (subType == sTypeRego6XXCounter))
+		{
+			metertype = MTYPE_COUNTER;
+		}
 
-			float level = static_cast<float>(atof(sd[0].c_str()));
+		double total_min = day.total_min;
+		double total_max = day.total_max;
+		double avg_value = day.avg_value;
+
+		if (
+			(devType != pTypeAirQuality) &&
+			(devType != pTypeRFXSensor) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeVisibility))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeDistance))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeSolarRadiation))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeSoilMoisture))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeLeafWetness))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeVoltage))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeCurrent))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypePressure))) &&
+			(!((devType == pTypeGeneral) && (subType == sTypeSoundLevel))) &&
+			(devType != pTypeLux) &&
+			(devType != pTypeWEIGHT) &&
+			(devType != pTypeUsage)
+			)
+		{
+			double total_real = total_max - total_min;
+			double counter = total_max;
+
+			result = safe_query(
+				"INSERT INTO Meter_Calendar (DeviceRowID, Value, Counter, Date) "
+				"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%q')",
+				ID,
+				total_real,
+				counter,
+				szDateStart.c_str()
+			);
+			AddMeterRollup(ID, ROLLUP_MONTH, szMonth, total_real, 0, counter);
 
+			//Check for Notification
+			musage = 0;
+			switch (metertype)
+			{
+			case MTYPE_ENERGY:
+			case MTYPE_ENERGY_GENERATED:
+				musage = float(total_real) / EnergyDivider;
+				if (musage != 0)
+					m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYENERGY, musage);
+				break;
+			case MTYPE_GAS:
+				musage = float(total_real) / tGasDivider;
+				if (musage != 0)
+					m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYGAS, musage);
+				break;
+			case MTYPE_WATER:
+				musage = float(total_real) / WaterDivider;
+				if (musage != 0)
+					m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYGAS, musage);
+				break;
+			case MTYPE_COUNTER:
+				musage = float(total_real);
+				if (musage != 0)
+					m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYCOUNTER, musage);
+				break;
+			default:
+				//Unhandled
+				musage = 0;
+				break;
+			}
+		}
+		else
+		{
+			//AirQuality/Usage Meter/Moisture/RFXSensor/Voltage/Lux/SoundLevel insert into MultiMeter_Calendar table
+			result = safe_query(
+				"INSERT INTO MultiMeter_Calendar (DeviceRowID, Value1,Value2,Value3,Value4,Value5,Value6, Date) "
+				"VALUES ('%" PRIu64 "', '%.2f','%.2f','%.2f','%.2f','%.2f','%.2f', '%q')",
+				ID,
+				total_min, total_max, avg_value, 0.0f, 0.0f, 0.0f,
+				szDateStart.c_str()
+			);
+			const double rollup_values[6] = { total_min, total_max, avg_value, 0, 0, 0 };
+			const double rollup_counters[4] = { 0, 0, 0, 0 };
+			AddMultiMeterRollup(ID, ROLLUP_MONTH, szMonth, rollup_values, rollup_counters);
+		}
+		if (
+			(devType != pTypeAirQuality) &&
+			(devType != pTypeRFXSensor) &&
+			((devType != pTypeGeneral) && (subType != sTypeVisibility)) &&
+			((devType != pTypeGeneral) && (subType != sTypeDistance)) &&
+			((devType != pTypeGeneral) && (subType != sTypeSolarRadiation)) &&
+			((devType != pTypeGeneral) && (subType != sTypeVoltage)) &&
+			((devType != pTypeGeneral) && (subType != sTypeCurrent)) &&
+			((devType != pTypeGeneral) && (subType != sTypePressure)) &&
+			((devType != pTypeGeneral) && (subType != sTypeSoilMoisture)) &&
+			((devType != pTypeGeneral) && (subType != sTypeLeafWetness)) &&
+			((devType != pTypeGeneral) && (subType != sTypeSoundLevel)) &&
+			(devType != pTypeLux) &&
+			(devType != pTypeWEIGHT) &&
+			(day.bHaveLastValue)
+			)
+		{
+			const std::string &szLastValue = day.szLastValue;
+			//Insert the last (max) counter value into the meter table to get the "today" value correct.
 			result = safe_query(
-				"INSERT INTO UV_Calendar (DeviceRowID, Level, Date) "
-				"VALUES ('%" PRIu64 "', '%g', '%q')",
+				"INSERT INTO Meter (DeviceRowID, Value, Date) "
+				"VALUES ('%" PRIu64 "', '%q', '%q')",
 				ID,
-				level,
-				szDateStart
+				szLastValue.c_str(),
+				szDateEnd.c_str()
 			);
+			AddMeterRollup(ID, ROLLUP_HOUR, szDateEnd + " 00:00:00", atof(szLastValue.c_str()), 0, 0);
 		}
 	}
+	for (const auto &ID : idle_devices)
+	{
+		//no new meter result received in last day
+		safe_query(
+			"INSERT INTO Meter_Calendar (DeviceRowID, Value, Date) "
+			"VALUES ('%" PRIu64 "', '%.2f', '%q')",
+			ID,
+			0.0f,
+			szDateStart.c_str()
+		);
+		AddMeterRollup(ID, ROLLUP_MONTH, szMonth, 0, 0, 0);
+	}
+	//New day, the last counter values of yesterday were carried over
+	InvalidateTodayBaselines();
 }
 
-void CSQLHelper::AddCalendarUpdatePercentage()
+void CSQLHelper::AddCalendarUpdateMultiMeter()
 {
-	//Get All Percentage devices in the Percentage Table
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Percentage ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
+	float EnergyDivider = 1000.0f;
+	int tValue;
+	if (GetPreferencesVar("MeterDividerEnergy", tValue))
+	{
+		EnergyDivider = float(tValue);
+	}
 
-	char szDateStart[40];
-	char szDateEnd[40];
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+	std::string szMonth = szDateStart.substr(0, 8) + "01";
 
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+	struct _tMultiMeterDay
+	{
+		uint64_t ID;
+		std::string devname;
+		unsigned char devType;
+		unsigned char subType;
+		float sd[12];
+	};
+	std::vector<_tMultiMeterDay> days;
 
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
+	//Yesterday of all devices in one go, from the hourly rollup instead of all the samples in the MultiMeter table.
+	//Read everything first, the monthly rollup below goes to the table this query is reading
+	{
+		CSQLStatement stmt(*this,
+			"SELECT d.DeviceRowID, ds.Name, ds.Type, ds.SubType, "
+			"MIN(r.Value1_Min), MAX(r.Value1_Max), MIN(r.Value2_Min), MAX(r.Value2_Max), MIN(r.Value3_Min), MAX(r.Value3_Max), "
+			"MIN(r.Value4_Min), MAX(r.Value4_Max), MIN(r.Value5_Min), MAX(r.Value5_Max), MIN(r.Value6_Min), MAX(r.Value6_Max) "
+			"FROM (SELECT DISTINCT DeviceRowID FROM MultiMeter) d "
+			"INNER JOIN DeviceStatus ds ON (ds.ID=d.DeviceRowID) "
+			"INNER JOIN MultiMeter_Rollup r ON (r.DeviceRowID=d.DeviceRowID AND r.Period=? AND r.Date>=? AND r.Date<?) "
+			"GROUP BY d.DeviceRowID");
+		stmt.Bind(static_cast<int>(ROLLUP_HOUR)).Bind(szDateStart).Bind(szDateEnd);
+		while (stmt.Step())
+		{
+			_tMultiMeterDay day;
+			day.ID = stmt.GetUInt64(0);
+			day.devname = stmt.GetString(1);
+			day.devType = static_cast<unsigned char>(stmt.GetInt(2));
+			day.subType = static_cast<unsigned char>(stmt.GetInt(3));
+			for (int ii = 0; ii < 12; ii++)
+				day.sd[ii] = static_cast<float>(stmt.GetDouble(4 + ii));
+			days.push_back(day);
+		}
+	}
 
 	std::vector<std::vector<std::string> > result;
 
-	for (const auto & itt : resultdevices)
+	for (const auto &day : days)
 	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
+		uint64_t ID = day.ID;
+		const std::string &devname = day.devname;
+		unsigned char devType = day.devType;
+		unsigned char subType = day.subType;
+		const float *sd = day.sd;
+
+		float total_real[6];
+		float counter1 = 0;
+		float counter2 = 0;
+		float counter3 = 0;
+		float counter4 = 0;
+
+		if (devType == pTypeP1Power)
+		{
+			for (int ii = 0; ii < 6; ii++)
+			{
+				float total_min = sd[(ii * 2) + 0];
+				float total_max = sd[(ii * 2) + 1];
+				total_real[ii] = total_max - total_min;
+			}
+			counter1 = sd[1];
+			counter2 = sd[3];
+			counter3 = sd[9];
+			counter4 = sd[11];
+		}
+		else
+		{
+			for (int ii = 0; ii < 6; ii++)
+			{
+				total_real[ii] = sd[ii];
+			}
+		}
 
-		result = safe_query("SELECT MIN(Percentage), MAX(Percentage), AVG(Percentage) FROM Percentage WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
+		result = safe_query(
+			"INSERT INTO MultiMeter_Calendar (DeviceRowID, Value1, Value2, Value3, Value4, Value5, Value6, Counter1, Counter2, Counter3, Counter4, Date) "
+			"VALUES ('%" PRIu64 "', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%.2f', '%q')",
 			ID,
-			szDateStart,
-			szDateEnd
+			total_real[0],
+			total_real[1],
+			total_real[2],
+			total_real[3],
+			total_real[4],
+			total_real[5],
+			counter1,
+			counter2,
+			counter3,
+			counter4,
+			szDateStart.c_str()
 		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
+		const double rollup_values[6] = { total_real[0], total_real[1], total_real[2], total_real[3], total_real[4], total_real[5] };
+		const double rollup_counters[4] = { counter1, counter2, counter3, counter4 };
+		AddMultiMeterRollup(ID, ROLLUP_MONTH, szMonth, rollup_values, rollup_counters);
 
-			float percentage_min = static_cast<float>(atof(sd[0].c_str()));
-			float percentage_max = static_cast<float>(atof(sd[1].c_str()));
-			float percentage_avg = static_cast<float>(atof(sd[2].c_str()));
-			result = safe_query(
-				"INSERT INTO Percentage_Calendar (DeviceRowID, Percentage_Min, Percentage_Max, Percentage_Avg, Date) "
-				"VALUES ('%" PRIu64 "', '%g', '%g', '%g','%q')",
-				ID,
-				percentage_min,
-				percentage_max,
-				percentage_avg,
-				szDateStart
-			);
+		//Check for Notification
+		if (devType == pTypeP1Power)
+		{
+			float musage = (total_real[0] + total_real[4]) / EnergyDivider;
+			m_notifications.CheckAndHandleNotification(ID, devname, devType, subType, NTYPE_TODAYENERGY, musage);
 		}
 	}
 }
 
-
-void CSQLHelper::AddCalendarUpdateFan()
+void CSQLHelper::AddCalendarUpdateWind()
 {
-	//Get All FAN devices in the Fan Table
-	std::vector<std::vector<std::string> > resultdevices;
-	resultdevices = safe_query("SELECT DISTINCT(DeviceRowID) FROM Fan ORDER BY DeviceRowID");
-	if (resultdevices.size() < 1)
-		return; //nothing to do
-
-	char szDateStart[40];
-	char szDateEnd[40];
-
-	time_t now = mytime(NULL);
-	struct tm ltime;
-	localtime_r(&now, &ltime);
-	sprintf(szDateEnd, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-	time_t yesterday;
-	struct tm tm2;
-	getNoon(yesterday, tm2, ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday - 1); // we only want the date
-	sprintf(szDateStart, "%04d-%02d-%02d", tm2.tm_year + 1900, tm2.tm_mon + 1, tm2.tm_mday);
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	CSQLStatement stmt(*this,
+		"INSERT INTO Wind_Calendar (DeviceRowID, Direction, Speed_Min, Speed_Max, Gust_Min, Gust_Max, Date) "
+		"SELECT d.DeviceRowID, ROUND(AVG(w.Direction),2), CAST(MIN(w.Speed) AS INTEGER), CAST(MAX(w.Speed) AS INTEGER), "
+		"CAST(MIN(w.Gust) AS INTEGER), CAST(MAX(w.Gust) AS INTEGER), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM Wind) d "
+		"INNER JOIN Wind w ON (w.DeviceRowID=d.DeviceRowID AND w.Date>=? AND w.Date<?) "
+		"GROUP BY d.DeviceRowID");
+	stmt.Bind(szDateStart).Bind(szDateStart).Bind(szDateEnd).Execute();
+}
 
-	std::vector<std::vector<std::string> > result;
+void CSQLHelper::AddCalendarUpdateUV()
+{
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	CSQLStatement stmt(*this,
+		"INSERT INTO UV_Calendar (DeviceRowID, Level, Date) "
+		"SELECT d.DeviceRowID, MAX(u.Level), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM UV) d "
+		"INNER JOIN UV u ON (u.DeviceRowID=d.DeviceRowID AND u.Date>=? AND u.Date<?) "
+		"GROUP BY d.DeviceRowID");
+	stmt.Bind(szDateStart).Bind(szDateStart).Bind(szDateEnd).Execute();
+}
 
-	for (const auto & itt : resultdevices)
-	{
-		std::vector<std::string> sddev = itt;
-		uint64_t ID = std::strtoull(sddev[0].c_str(), nullptr, 10);
+void CSQLHelper::AddCalendarUpdatePercentage()
+{
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	CSQLStatement stmt(*this,
+		"INSERT INTO Percentage_Calendar (DeviceRowID, Percentage_Min, Percentage_Max, Percentage_Avg, Date) "
+		"SELECT d.DeviceRowID, MIN(p.Percentage), MAX(p.Percentage), AVG(p.Percentage), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM Percentage) d "
+		"INNER JOIN Percentage p ON (p.DeviceRowID=d.DeviceRowID AND p.Date>=? AND p.Date<?) "
+		"GROUP BY d.DeviceRowID");
+	stmt.Bind(szDateStart).Bind(szDateStart).Bind(szDateEnd).Execute();
+}
 
-		result = safe_query("SELECT MIN(Speed), MAX(Speed), AVG(Speed) FROM Fan WHERE (DeviceRowID='%" PRIu64 "' AND Date>='%q' AND Date<'%q')",
-			ID,
-			szDateStart,
-			szDateEnd
-		);
-		if (!result.empty())
-		{
-			std::vector<std::string> sd = result[0];
 
-			int speed_min = (int)atoi(sd[0].c_str());
-			int speed_max = (int)atoi(sd[1].c_str());
-			int speed_avg = (int)atoi(sd[2].c_str());
-			result = safe_query(
-				"INSERT INTO Fan_Calendar (DeviceRowID, Speed_Min, Speed_Max, Speed_Avg, Date) "
-				"VALUES ('%" PRIu64 "', '%d', '%d', '%d','%q')",
-				ID,
-				speed_min,
-				speed_max,
-				speed_avg,
-				szDateStart
-			);
-		}
-	}
+void CSQLHelper::AddCalendarUpdateFan()
+{
+	std::string szDateStart, szDateEnd;
+	GetCalendarDates(szDateStart, szDateEnd);
+
+	CSQLStatement stmt(*this,
+		"INSERT INTO Fan_Calendar (DeviceRowID, Speed_Min, Speed_Max, Speed_Avg, Date) "
+		"SELECT d.DeviceRowID, CAST(MIN(f.Speed) AS INTEGER), CAST(MAX(f.Speed) AS INTEGER), CAST(AVG(f.Speed) AS INTEGER), ? "
+		"FROM (SELECT DISTINCT DeviceRowID FROM Fan) d "
+		"INNER JOIN Fan f ON (f.DeviceRowID=d.DeviceRowID AND f.Date>=? AND f.Date<?) "
+		"GROUP BY d.DeviceRowID");
+	stmt.Bind(szDateStart).Bind(szDateStart).Bind(szDateEnd).Execute();
 }
 
+//Deletes in chunks of SHORTLOG_PURGE_CHUNK rows, so other writers get the database in between
+#define SHORTLOG_PURGE_CHUNK 500
+#define SHORTLOG_PURGE_PAUSE_MS 20
+
 void CSQLHelper::CleanupShortLog()
 {
 	int n5MinuteHistoryDays = 1;
@@ -6588,42 +7260,102 @@ void CSQLHelper::CleanupShortLog()
 			_log.Log(LOG_ERROR, "CleanupShortLog(): MinuteHistoryDays is zero!");
 			return;
 		}
-#if 0
+
+		//Dates are stored in local time, compare them as strings so the (DeviceRowID, Date) indexes can be used
 		char szDateStr[40];
 		time_t clear_time = mytime(NULL) - (n5MinuteHistoryDays * 24 * 3600);
 		struct tm ltime;
 		localtime_r(&clear_time, &ltime);
 		sprintf(szDateStr, "%04d-%02d-%02d %02d:%02d:%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday, ltime.tm_hour, ltime.tm_min, ltime.tm_sec);
-		_log.Log(LOG_STATUS, "Cleaning up shortlog older than %s", szDateStr);
-#endif
-
-		char szQuery[250];
-		std::string szQueryFilter = "strftime('%s',datetime('now','localtime')) - strftime('%s',Date) > (SELECT p.nValue * 86400 From Preferences AS p WHERE p.Key='5MinuteHistoryDays')";
-
-		sprintf(szQuery, "DELETE FROM Temperature WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
 
-		sprintf(szQuery, "DELETE FROM Rain WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+		PurgeShortLogTable("Temperature", "", szDateStr);
+		PurgeShortLogTable("Rain", "", szDateStr);
+		PurgeShortLogTable("Wind", "", szDateStr);
+		PurgeShortLogTable("UV", "", szDateStr);
+		PurgeShortLogTable("Meter", "", szDateStr);
+		PurgeShortLogTable("MultiMeter", "", szDateStr);
 
-		sprintf(szQuery, "DELETE FROM Wind WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+		//hourly rollups are kept as long as the samples they were made of
+		std::string szHourFilter = " AND (t.Period=" + std::to_string(ROLLUP_HOUR) + ")";
+		PurgeShortLogTable("Meter_Rollup", szHourFilter.c_str(), szDateStr);
+		PurgeShortLogTable("MultiMeter_Rollup", szHourFilter.c_str(), szDateStr);
 
-		sprintf(szQuery, "DELETE FROM UV WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+		PurgeShortLogTable("Percentage", "", szDateStr);
+		PurgeShortLogTable("Fan", "", szDateStr);
 
-		sprintf(szQuery, "DELETE FROM Meter WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+		if (m_bTimeSeriesStore)
+		{
+			for (const auto &itt : TimeSeriesTables)
+			{
+				std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+				size_t nRemoved = m_tsstore.Purge(itt.szTable, CTimeSeriesStore::ToLocalSeconds(ltime));
+				AddJobStatistics(std::string("CleanupShortLog TimeSeries ") + itt.szTable, static_cast<int>(nRemoved),
+					std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
+			}
+		}
+	}
+}
 
-		sprintf(szQuery, "DELETE FROM MultiMeter WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+//Deletes the rows older than szDate, device by device through the index (CROSS JOIN keeps DeviceStatus the outer loop).
+//The join never reaches rows of devices that no longer exist, those are found with one index seek per device id and purged by id
+int CSQLHelper::PurgeShortLogTable(const char *szTable, const char *szFilter, const char *szDate)
+{
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	std::vector<uint64_t> orphans;
+	{
+		std::set<uint64_t> devices;
+		{
+			CSQLStatement stmt(*this, "SELECT ID FROM DeviceStatus");
+			while (stmt.Step())
+				devices.insert(stmt.GetUInt64(0));
+		}
+		std::string szSeek = std::string("SELECT MIN(DeviceRowID) FROM ") + szTable + " WHERE (DeviceRowID>?)";
+		CSQLStatement stmt(*this, szSeek.c_str());
+		int64_t lastID = -1;
+		while (stmt.Bind(lastID).Step() && !stmt.IsNull(0))
+		{
+			lastID = stmt.GetInt64(0);
+			if (devices.find(static_cast<uint64_t>(lastID)) == devices.end())
+				orphans.push_back(static_cast<uint64_t>(lastID));
+			stmt.Reset();
+		}
+	}
 
-		sprintf(szQuery, "DELETE FROM Percentage WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+	std::string szQuery = std::string("DELETE FROM ") + szTable + " WHERE ROWID IN ("
+		"SELECT t.ROWID FROM DeviceStatus AS ds CROSS JOIN " + szTable + " AS t ON (t.DeviceRowID=ds.ID) "
+		"WHERE (t.Date<?)" + szFilter + " LIMIT ?)";
+	std::string szOrphanQuery = std::string("DELETE FROM ") + szTable + " WHERE ROWID IN ("
+		"SELECT t.ROWID FROM " + szTable + " AS t "
+		"WHERE (t.DeviceRowID=?) AND (t.Date<?)" + szFilter + " LIMIT ?)";
 
-		sprintf(szQuery, "DELETE FROM Fan WHERE %s", szQueryFilter.c_str());
-		query(szQuery);
+	int total = 0;
+	bool bStop = false;
+	//pass 0 purges the existing devices, every following pass one orphaned device id
+	for (size_t pass = 0; (pass <= orphans.size()) && (!bStop); pass++)
+	{
+		while (true)
+		{
+			int changes = 0;
+			{
+				CSQLStatement stmt(*this, (pass == 0) ? szQuery.c_str() : szOrphanQuery.c_str());
+				if (pass != 0)
+					stmt.Bind(orphans[pass - 1]);
+				stmt.Bind(szDate).Bind(SHORTLOG_PURGE_CHUNK);
+				if (!stmt.Execute())
+					break;
+				changes = sqlite3_changes(m_dbase);
+			}
+			total += changes;
+			if (changes < SHORTLOG_PURGE_CHUNK)
+				break;
+			bStop = IsStopRequested(SHORTLOG_PURGE_PAUSE_MS);
+			if (bStop)
+				break;
+		}
 	}
+	AddJobStatistics(std::string("CleanupShortLog ") + szTable, total,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
+	return total;
 }
 
 void CSQLHelper::ClearShortLog()
@@ -6634,16 +7366,155 @@ void CSQLHelper::ClearShortLog()
 	query("DELETE FROM UV");
 	query("DELETE FROM Meter");
 	query("DELETE FROM MultiMeter");
+	InvalidateTodayBaselines();
+	safe_query("DELETE FROM Meter_Rollup WHERE (Period=%d)", ROLLUP_HOUR);
+	safe_query("DELETE FROM MultiMeter_Rollup WHERE (Period=%d)", ROLLUP_HOUR);
 	query("DELETE FROM Percentage");
 	query("DELETE FROM Fan");
+	if (m_bTimeSeriesStore)
+	{
+		for (const auto &itt : TimeSeriesTables)
+			m_tsstore.Clear(itt.szTable);
+	}
 	VacuumDatabase();
 }
 
+void CSQLHelper::EnableTimeSeriesStore(const bool bEnable)
+{
+	m_bTimeSeriesStore = bEnable;
+}
+
+bool CSQLHelper::IsTimeSeriesEnabled()
+{
+	return (m_bTimeSeriesStore) && (m_tsstore.IsOpen());
+}
+
+std::vector<std::vector<std::string> > CSQLHelper::QueryTimeSeries(const std::string &szTable, const uint64_t DeviceRowID, const std::string &szDateStart, const std::string &szDateEnd)
+{
+	std::vector<std::vector<std::string> > result;
+	if (GetTimeSeriesTable(szTable) == NULL)
+		return result;
+	m_tsstore.Range(szTable, DeviceRowID, CTimeSeriesStore::ToLocalSeconds(szDateStart), CTimeSeriesStore::ToLocalSeconds(szDateEnd),
+		[&result](const int64_t Time, const std::vector<double> &Values)
+	{
+		std::vector<std::string> row;
+		char szTmp[40];
+		for (const auto &itt : Values)
+		{
+			//integer columns (Humidity, Barometer) come back without decimals, like from the table
+			if (itt == std::floor(itt))
+				sprintf(szTmp, "%.0f", itt);
+			else
+				sprintf(szTmp, "%.2f", itt);
+			row.push_back(szTmp);
+		}
+		row.push_back(CTimeSeriesStore::FormatLocalSeconds(Time));
+		result.push_back(row);
+	});
+	//the local time steps back when DST ends, return the rows in the same order as ORDER BY Date
+	std::stable_sort(result.begin(), result.end(),
+		[](const std::vector<std::string> &a, const std::vector<std::string> &b) { return a.back() < b.back(); });
+	return result;
+}
+
+int CSQLHelper::ImportTimeSeries(const std::string &szTable, const uint64_t DeviceRowID)
+{
+	const _tTimeSeriesTable *pTable = GetTimeSeriesTable(szTable);
+	if ((pTable == NULL) || (!m_tsstore.IsOpen()))
+		return 0;
+
+	std::vector<uint64_t> devices;
+	if (DeviceRowID != 0)
+		devices.push_back(DeviceRowID);
+	else
+	{
+		std::string szQuery = "SELECT DISTINCT DeviceRowID FROM " + szTable;
+		CSQLStatement stmt(*this, szQuery.c_str());
+		while (stmt.Step())
+			devices.push_back(stmt.GetUInt64(0));
+	}
+
+	std::string szQuery = std::string("SELECT ") + pTable->szColumns + ", Date FROM " + szTable + " WHERE (DeviceRowID=?) AND (Date>?) ORDER BY Date ASC";
+	std::vector<double> values(pTable->nColumns);
+	int total = 0;
+	for (const auto &itt : devices)
+	{
+		int64_t LastTime = m_tsstore.GetLastTime(szTable, itt);
+		CSQLStatement stmt(*this, szQuery.c_str());
+		stmt.Bind(itt).Bind((LastTime != 0) ? CTimeSeriesStore::FormatLocalSeconds(LastTime) : std::string());
+		while (stmt.Step())
+		{
+			for (int ii = 0; ii < pTable->nColumns; ii++)
+				values[ii] = stmt.GetDouble(ii);
+			if (m_tsstore.Append(szTable, itt, CTimeSeriesStore::ToLocalSeconds(stmt.GetString(pTable->nColumns)), values))
+				total++;
+		}
+	}
+	return total;
+}
+
+int CSQLHelper::ExportTimeSeries(const std::string &szTable)
+{
+	const _tTimeSeriesTable *pTable = GetTimeSeriesTable(szTable);
+	if ((pTable == NULL) || (!m_tsstore.IsOpen()))
+		return 0;
+
+	std::string szDelete = "DELETE FROM " + szTable + " WHERE (DeviceRowID=?)";
+	std::string szInsert = "INSERT INTO " + szTable + " (DeviceRowID, " + pTable->szColumns + ", Date) VALUES (?";
+	for (int ii = 0; ii <= pTable->nColumns; ii++)
+		szInsert += ", ?";
+	szInsert += ")";
+
+	int total = 0;
+	std::vector<uint64_t> devices = m_tsstore.GetDevices(szTable);
+	for (const auto &itt : devices)
+	{
+		//read the series first, the store is not locked while writing to the database
+		std::vector<std::pair<int64_t, std::vector<double> > > samples;
+		m_tsstore.Range(szTable, itt, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(),
+			[&samples](const int64_t Time, const std::vector<double> &Values) { samples.push_back(std::make_pair(Time, Values)); });
+
+		BeginTransaction();
+		CSQLStatement(*this, szDelete.c_str()).Bind(itt).Execute();
+		for (const auto &itt2 : samples)
+		{
+			CSQLStatement stmt(*this, szInsert.c_str());
+			stmt.Bind(itt);
+			for (const auto &itt3 : itt2.second)
+				stmt.Bind(itt3);
+			stmt.Bind(CTimeSeriesStore::FormatLocalSeconds(itt2.first));
+			if (stmt.Execute())
+				total++;
+		}
+		CommitTransaction();
+	}
+	return total;
+}
+
+void CSQLHelper::ResyncTimeSeries(const std::string &szTable, const uint64_t DeviceRowID)
+{
+	if (!m_bTimeSeriesStore)
+		return;
+	m_tsstore.Remove(szTable, DeviceRowID);
+	ImportTimeSeries(szTable, DeviceRowID);
+}
+
 void CSQLHelper::VacuumDatabase()
 {
+	//Switches to incremental auto vacuum (only takes effect with a full VACUUM),
+	//after that the free pages are given back daily by IncrementalVacuum()
+	query("PRAGMA auto_vacuum = INCREMENTAL");
 	query("VACUUM");
 }
 
+void CSQLHelper::IncrementalVacuum()
+{
+	std::vector<std::vector<std::string> > result = query("PRAGMA auto_vacuum");
+	if ((result.empty()) || (atoi(result[0][0].c_str()) != 2))
+		return; //not enabled, needs a full VACUUM first
+	query("PRAGMA incremental_vacuum");
+}
+
 void CSQLHelper::OptimizeDatabase(sqlite3 *dbase)
 {
 	if (dbase == NULL)
@@ -6722,11 +7593,7 @@ void CSQLHelper::DeleteDevices(const std::string &idx)
 		}
 #endif
 		{
-			//Avoid mutex deadlock here
-			std::lock_guard<std::mutex> l(m_sqlQueryMutex);
-
-			char* errorMessage;
-			sqlite3_exec(m_dbase, "BEGIN TRANSACTION", NULL, NULL, &errorMessage);
+			BeginTransaction();
 
 			for (const auto & itt : _idx)
 			{
@@ -6737,6 +7604,7 @@ void CSQLHelper::DeleteDevices(const std::string &idx)
 				safe_exec_no_return("DELETE FROM Rain WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM Rain_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM Temperature WHERE (DeviceRowID == '%q')", itt.c_str());
+				ResyncTimeSeries("Temperature", std::strtoull(itt.c_str(), nullptr, 10));
 				safe_exec_no_return("DELETE FROM Temperature_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM Timers WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM SetpointTimers WHERE (DeviceRowID == '%q')", itt.c_str());
@@ -6748,19 +7616,25 @@ void CSQLHelper::DeleteDevices(const std::string &idx)
 				safe_exec_no_return("DELETE FROM Meter_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM MultiMeter WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM MultiMeter_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
+				safe_exec_no_return("DELETE FROM Meter_Rollup WHERE (DeviceRowID == '%q')", itt.c_str());
+				safe_exec_no_return("DELETE FROM MultiMeter_Rollup WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM Percentage WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM Percentage_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
+				safe_exec_no_return("DELETE FROM Fan WHERE (DeviceRowID == '%q')", itt.c_str());
+				safe_exec_no_return("DELETE FROM Fan_Calendar WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM SceneDevices WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM DeviceToPlansMap WHERE (DeviceRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM CamerasActiveDevices WHERE (DevSceneType==0) AND (DevSceneRowID == '%q')", itt.c_str());
 				safe_exec_no_return("DELETE FROM SharedDevices WHERE (DeviceRowID== '%q')", itt.c_str());
-				//notify eventsystem device is no longer present
+				//notify eventsystem device is no longer present, once the writer is released
 				uint64_t ullidx = std::strtoull(itt.c_str(), nullptr, 10);
-				m_mainworker.m_eventsystem.RemoveSingleState(ullidx, m_mainworker.m_eventsystem.REASON_DEVICE);
+				RunAfterCommit([ullidx]() {
+					m_mainworker.m_eventsystem.RemoveSingleState(ullidx, m_mainworker.m_eventsystem.REASON_DEVICE);
+				});
 				//and now delete all records in the DeviceStatus table itself
 				safe_exec_no_return("DELETE FROM DeviceStatus WHERE (ID == '%q')", itt.c_str());
 			}
-			sqlite3_exec(m_dbase, "COMMIT TRANSACTION", NULL, NULL, &errorMessage);
+			CommitTransaction();
 		}
 #ifdef ENABLE_PYTHON
 		for (const auto & it : removeddevices)
@@ -6815,6 +7689,8 @@ void CSQLHelper::TransferDevice(const std::string &idx, const std::string &newid
 		safe_query("UPDATE Temperature SET DeviceRowID='%q' WHERE (DeviceRowID == '%q') AND (Date<'%q')", newidx.c_str(), idx.c_str(), result[0][0].c_str());
 	else
 		safe_query("UPDATE Temperature SET DeviceRowID='%q' WHERE (DeviceRowID == '%q')", newidx.c_str(), idx.c_str());
+	ResyncTimeSeries("Temperature", std::strtoull(idx.c_str(), nullptr, 10));
+	ResyncTimeSeries("Temperature", std::strtoull(newidx.c_str(), nullptr, 10));
 
 	result = safe_query("SELECT Date FROM Temperature_Calendar WHERE (DeviceRowID == '%q') ORDER BY Date ASC LIMIT 1", newidx.c_str());
 	if (!result.empty())
@@ -6869,12 +7745,15 @@ void CSQLHelper::TransferDevice(const std::string &idx, const std::string &newid
 		safe_query("UPDATE MultiMeter SET DeviceRowID='%q' WHERE (DeviceRowID == '%q') AND (Date<'%q')", newidx.c_str(), idx.c_str(), result[0][0].c_str());
 	else
 		safe_query("UPDATE MultiMeter SET DeviceRowID='%q' WHERE (DeviceRowID == '%q')", newidx.c_str(), idx.c_str());
+	InvalidateTodayBaselines();
 
 	result = safe_query("SELECT Date FROM MultiMeter_Calendar WHERE (DeviceRowID == '%q') ORDER BY Date ASC LIMIT 1", newidx.c_str());
 	if (!result.empty())
 		safe_query("UPDATE MultiMeter_Calendar SET DeviceRowID='%q' WHERE (DeviceRowID == '%q') AND (Date<'%q')", newidx.c_str(), idx.c_str(), result[0][0].c_str());
 	else
 		safe_query("UPDATE MultiMeter_Calendar SET DeviceRowID='%q' WHERE (DeviceRowID == '%q')", newidx.c_str(), idx.c_str());
+	RebuildMeterRollups(std::strtoull(idx.c_str(), nullptr, 10));
+	RebuildMeterRollups(std::strtoull(newidx.c_str(), nullptr, 10));
 
 	//Percentage
 	result = safe_query("SELECT Date FROM Percentage WHERE (DeviceRowID == '%q') ORDER BY Date ASC LIMIT 1", newidx.c_str());
@@ -7077,8 +7956,11 @@ void CSQLHelper::DeleteDataPoint(const char *ID, const std::string &Date)
 		safe_query("DELETE FROM Wind WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
 		safe_query("DELETE FROM UV WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
 		safe_query("DELETE FROM Temperature WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
+		ResyncTimeSeries("Temperature", std::strtoull(ID, nullptr, 10));
 		safe_query("DELETE FROM Meter WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
 		safe_query("DELETE FROM MultiMeter WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
+		InvalidateTodayBaselines();
+		RebuildMeterRollups(std::strtoull(ID, nullptr, 10), Date);
 		safe_query("DELETE FROM Percentage WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
 		safe_query("DELETE FROM Fan WHERE (DeviceRowID=='%q') AND (Date>='%q') AND (Date<='%q')", ID, Date.c_str(), szDateEnd);
 	}
@@ -7091,6 +7973,7 @@ void CSQLHelper::DeleteDataPoint(const char *ID, const std::string &Date)
 		safe_query("DELETE FROM Temperature_Calendar WHERE (DeviceRowID=='%q') AND (Date=='%q')", ID, Date.c_str());
 		safe_query("DELETE FROM Meter_Calendar WHERE (DeviceRowID=='%q') AND (Date=='%q')", ID, Date.c_str());
 		safe_query("DELETE FROM MultiMeter_Calendar WHERE (DeviceRowID=='%q') AND (Date=='%q')", ID, Date.c_str());
+		RebuildMeterRollups(std::strtoull(ID, nullptr, 10), Date);
 		safe_query("DELETE FROM Percentage_Calendar WHERE (DeviceRowID=='%q') AND (Date=='%q')", ID, Date.c_str());
 		safe_query("DELETE FROM Fan_Calendar WHERE (DeviceRowID=='%q') AND (Date=='%q')", ID, Date.c_str());
 	}
@@ -7145,6 +8028,66 @@ void CSQLHelper::EventsGetTaskItems(std::vector<_tTaskItem> &currentTasks)
 		currentTasks.push_back(it);
 }
 
+static bool GZipFile(const std::string &InputFile, const std::string &OutputFile)
+{
+	FILE *fIn = fopen(InputFile.c_str(), "rb");
+	if (fIn == NULL)
+		return false;
+	gzFile fOut = gzopen(OutputFile.c_str(), "wb6");
+	if (fOut == NULL)
+	{
+		fclose(fIn);
+		return false;
+	}
+	bool bResult = true;
+	char szBuffer[65536];
+	size_t nRead;
+	while ((nRead = fread(szBuffer, 1, sizeof(szBuffer), fIn)) > 0)
+	{
+		if (gzwrite(fOut, szBuffer, static_cast<unsigned int>(nRead)) != static_cast<int>(nRead))
+		{
+			bResult = false;
+			break;
+		}
+	}
+	if (ferror(fIn))
+		bResult = false;
+	fclose(fIn);
+	if (gzclose(fOut) != Z_OK)
+		bResult = false;
+	return bResult;
+}
+
+static bool GUnzipFile(const std::string &InputFile, const std::string &OutputFile)
+{
+	gzFile fIn = gzopen(InputFile.c_str(), "rb");
+	if (fIn == NULL)
+		return false;
+	FILE *fOut = fopen(OutputFile.c_str(), "wb");
+	if (fOut == NULL)
+	{
+		gzclose(fIn);
+		return false;
+	}
+	bool bResult = true;
+	char szBuffer[65536];
+	int nRead;
+	while ((nRead = gzread(fIn, szBuffer, sizeof(szBuffer))) > 0)
+	{
+		if (fwrite(szBuffer, 1, static_cast<size_t>(nRead), fOut) != static_cast<size_t>(nRead))
+		{
+			bResult = false;
+			break;
+		}
+	}
+	if (nRead < 0)
+		bResult = false;
+	gzclose(fIn);
+	if (fclose(fOut) != 0)
+		bResult = false;
+	return bResult;
+}
+
 bool CSQLHelper::RestoreDatabase(const std::string &dbase)
 {
 	_log.Log(LOG_STATUS, "Restore Database: Starting...");
@@ -7162,8 +8105,11 @@ bool CSQLHelper::RestoreDatabase(const std::string &dbase)
 #else
 	std::string outputfile = "/tmp/restore.db";
 #endif
+	//automatic backups can be gzip compressed
+	bool bCompressed = (dbase.size() > 2) && (static_cast<unsigned char>(dbase[0]) == 0x1f) && (static_cast<unsigned char>(dbase[1]) == 0x8b);
+	std::string writefile = (bCompressed) ? outputfile + ".gz" : outputfile;
 	std::ofstream outfile;
-	outfile.open(outputfile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	outfile.open(writefile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
 	if (!outfile.is_open())
 	{
 		_log.Log(LOG_ERROR, "Restore Database: Could not open backup file for writing!");
@@ -7172,6 +8118,16 @@ bool CSQLHelper::RestoreDatabase(const std::string &dbase)
 	outfile << dbase;
 	outfile.flush();
 	outfile.close();
+	if (bCompressed)
+	{
+		bool bDecompressed = GUnzipFile(writefile, outputfile);
+		std::remove(writefile.c_str());
+		if (!bDecompressed)
+		{
+			_log.Log(LOG_ERROR, "Restore Database: Could not decompress backup file!");
+			return false;
+		}
+	}
 	//check if we can open the database (check if valid)
 	sqlite3 *dbase_restore = NULL;
 	int rc = sqlite3_open(outputfile.c_str(), &dbase_restore);
@@ -7195,22 +8151,40 @@ bool CSQLHelper::RestoreDatabase(const std::string &dbase)
 	}
 	OptimizeDatabase(dbase_restore);
 	sqlite3_close(dbase_restore);
-	//we have a valid database!
-	std::remove(outputfile.c_str());
+	//we have a valid database! (kept until it is copied when the upload was compressed)
+	if (!bCompressed)
+		std::remove(outputfile.c_str());
 
 	StopThread();
 
 	//stop database
-	sqlite3_close(m_dbase);
-	m_dbase = NULL;
+	CloseReaders();
+	{
+		std::lock_guard<std::recursive_mutex> l(m_sqlQueryMutex);
+		m_devicecache.Clear();
+		ClearStatementCache(m_statement_cache);
+		sqlite3_close(m_dbase);
+		m_dbase = NULL;
+	}
 	std::ofstream outfile2;
 	outfile2.open(m_dbase_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
 	if (!outfile2.is_open())
 	{
 		_log.Log(LOG_ERROR, "Restore Database: Could not open backup file for writing!");
+		if (bCompressed)
+			std::remove(outputfile.c_str());
 		return false;
 	}
-	outfile2 << dbase;
+	if (bCompressed)
+	{
+		//the upload is gzip data, the database is the inflated file we validated
+		std::ifstream infile(outputfile.c_str(), std::ios::in | std::ios::binary);
+		outfile2 << infile.rdbuf();
+		infile.close();
+		std::remove(outputfile.c_str());
+	}
+	else
+		outfile2 << dbase;
 	outfile2.flush();
 	outfile2.close();
 	//change ownership
@@ -7231,53 +8205,97 @@ bool CSQLHelper::RestoreDatabase(const std::string &dbase)
 		_log.Log(LOG_ERROR, "Restore Database: Error opening new database!");
 		return false;
 	}
-	//Cleanup the database
+	//Cleanup the database, a restore is on demand so the full VACUUM is acceptable here
+	_log.Log(LOG_STATUS, "Restore Database: Vacuuming the restored database...");
 	VacuumDatabase();
 	_log.Log(LOG_STATUS, "Restore Database: Succeeded!");
 	return true;
 }
 
-bool CSQLHelper::BackupDatabase(const std::string &OutputFile)
+#define BACKUP_STEP_PAGES 256
+#define BACKUP_STEP_PAUSE_MS 10
+
+bool CSQLHelper::BackupDatabase(const std::string &OutputFile, const bool bCompress)
 {
 	if (!m_dbase)
 		return false; //database not open!
 
-	//First cleanup the database
-	OptimizeDatabase(m_dbase);
-	VacuumDatabase();
-
-	std::lock_guard<std::mutex> l(m_sqlQueryMutex);
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	std::string BackupFile = (bCompress) ? OutputFile + ".tmp" : OutputFile;
 
 	int rc;                     // Function return code
 	sqlite3 *pFile;             // Database connection opened on zFilename
 	sqlite3_backup *pBackup;    // Backup handle used to copy data
 
 	// Open the database file identified by zFilename.
-	rc = sqlite3_open(OutputFile.c_str(), &pFile);
+	rc = sqlite3_open(BackupFile.c_str(), &pFile);
 	if (rc != SQLITE_OK)
+	{
+		sqlite3_close(pFile);
 		return false;
+	}
+
+	//With WAL the pages are copied from an own read connection, a few at a time, while the writer keeps going.
+	//Its read transaction stays open until the copy is done, so the backup is one snapshot and never restarts.
+	sqlite3 *pSource = NULL;
+	bool bOnline = false;
+	if (sqlite3_open_v2(m_dbase_name.c_str(), &pSource, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+	{
+		std::vector<std::vector<std::string> > result = query(pSource, "PRAGMA journal_mode", false);
+		bOnline = (!result.empty()) && (result[0][0] == "wal") &&
+			(sqlite3_exec(pSource, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", NULL, NULL, NULL) == SQLITE_OK);
+	}
+
+	if (bOnline)
+	{
+		pBackup = sqlite3_backup_init(pFile, "main", pSource, "main");
+		if (pBackup)
+		{
+			do {
+				rc = sqlite3_backup_step(pBackup, BACKUP_STEP_PAGES);
+				if ((rc == SQLITE_OK) || (rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED))
+					sqlite3_sleep(BACKUP_STEP_PAUSE_MS);
+			} while ((rc == SQLITE_OK) || (rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED));
 
-	// Open the sqlite3_backup object used to accomplish the transfer
-	pBackup = sqlite3_backup_init(pFile, "main", m_dbase, "main");
-	if (pBackup)
+			/* Release resources allocated by backup_init(). */
+			sqlite3_backup_finish(pBackup);
+		}
+		sqlite3_exec(pSource, "COMMIT", NULL, NULL, NULL);
+		sqlite3_close(pSource);
+	}
+	else
 	{
-		// Each iteration of this loop copies 5 database pages from database
-		// pDb to the backup database.
-		do {
-			rc = sqlite3_backup_step(pBackup, 5);
-			//xProgress(  sqlite3_backup_remaining(pBackup), sqlite3_backup_pagecount(pBackup) );
-			//if( rc==SQLITE_OK || rc==SQLITE_BUSY || rc==SQLITE_LOCKED ){
-			  //sqlite3_sleep(250);
-			//}
-		} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+		sqlite3_close(pSource);
+
+		//Without WAL a reader would block the writer, copy everything in one go under the database lock
+		std::lock_guard<std::recursive_mutex> l(m_sqlQueryMutex);
+		pBackup = sqlite3_backup_init(pFile, "main", m_dbase, "main");
+		if (pBackup)
+		{
+			do {
+				rc = sqlite3_backup_step(pBackup, -1);
+			} while ((rc == SQLITE_OK) || (rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED));
 
-		/* Release resources allocated by backup_init(). */
-		sqlite3_backup_finish(pBackup);
+			/* Release resources allocated by backup_init(). */
+			sqlite3_backup_finish(pBackup);
+		}
 	}
 	rc = sqlite3_errcode(pFile);
 	// Close the database connection opened on database file zFilename
 	// and return the result of this function.
 	sqlite3_close(pFile);
+
+	if (bCompress)
+	{
+		if ((rc == SQLITE_OK) && (!GZipFile(BackupFile, OutputFile)))
+		{
+			_log.Log(LOG_ERROR, "Backup Database: Error compressing %s", OutputFile.c_str());
+			rc = SQLITE_IOERR;
+		}
+		std::remove(BackupFile.c_str());
+	}
+	_log.Debug(DEBUG_NORM, "Backup Database: %s %s (%s) in %.1f ms", (rc == SQLITE_OK) ? "Wrote" : "Failed", OutputFile.c_str(), (bOnline) ? "online" : "locked",
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tstart).count());
 	return (rc == SQLITE_OK);
 }
 
@@ -7889,7 +8907,8 @@ void CSQLHelper::FixDaylightSaving()
 			}
 		}
 	}
-
+	//Calendar rows were merged or moved
+	RebuildMeterRollups(0);
 }
 
 std::string CSQLHelper::DeleteUserVariable(const std::string &idx)
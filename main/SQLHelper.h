@@ -1,16 +1,22 @@
 #pragma once
 
 #include <string>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 #include "RFXNames.h"
 #include "../hardware/hardwaretypes.h"
 #include "Helper.h"
 #include "../httpclient/UrlEncode.h"
 #include "../httpclient/HTTPClient.h"
 #include "StoppableTask.h"
+#include "DeviceStateCache.h"
+#include "TimeSeriesStore.h"
 
 #define timer_resolution_hz 25
 
 struct sqlite3;
+struct sqlite3_stmt;
 
 enum _eWindUnit
 {
@@ -33,6 +39,14 @@ enum _eWeightUnit
     WEIGHTUNIT_LB,
 };
 
+//Bucket size of the rows in the Meter_Rollup and MultiMeter_Rollup tables
+//(days are the Meter_Calendar and MultiMeter_Calendar tables)
+enum _eRollupPeriod
+{
+	ROLLUP_HOUR = 0,
+	ROLLUP_MONTH,
+};
+
 enum _eTaskItemType
 {
 	TITEM_SWITCHCMD=0,
@@ -280,6 +294,125 @@ typedef   std::vector<std::string> TSqlRowQuery;
 // result for an sql query : Vector of TSqlRowQuery
 typedef   std::vector<TSqlRowQuery> TSqlQueryResult;
 
+class CSQLHelper;
+
+//Connection from the read-only pool
+struct _tSQLReader
+{
+	sqlite3 *dbase;
+	std::map<std::string, sqlite3_stmt*> statement_cache;
+	//a thread that reads while it is reading gets the same connection back
+	std::thread::id owner;
+	int depth;
+};
+
+//Time spent waiting for a database connection, per calling thread
+struct _tSQLLockStats
+{
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t read_wait_us;
+	uint64_t write_wait_us;
+	uint64_t max_wait_us;
+};
+
+//Lock wait counters of all threads with the same name, updated without taking a lock
+struct _tSQLLockCounters
+{
+	std::atomic<uint64_t> reads;
+	std::atomic<uint64_t> writes;
+	std::atomic<uint64_t> read_wait_us;
+	std::atomic<uint64_t> write_wait_us;
+	std::atomic<uint64_t> max_wait_us;
+};
+
+//Runtime of the short log and calendar jobs
+struct _tSQLJobStats
+{
+	uint64_t runs;
+	uint64_t rows;
+	int last_rows;
+	double last_ms;
+	double max_ms;
+};
+
+//Lowest/highest counter value stored since midnight in the Meter and MultiMeter tables
+struct _tMeterToday
+{
+	int64_t MinValue;
+	int64_t MaxValue;
+};
+
+struct _tMultiMeterToday
+{
+	int64_t MinValue[6];
+	int64_t MaxValue[6];
+};
+
+//Locks the writer connection, or takes one from the read-only pool when bReadOnly is set
+//Falls back to the writer when no readers are available
+class CSQLConnectionLock
+{
+public:
+	CSQLConnectionLock(CSQLHelper &sql, const bool bReadOnly);
+	~CSQLConnectionLock();
+	sqlite3 *GetDB() { return m_dbase; };
+	//The read-only connection was already in use by this thread
+	bool IsNested() const { return ((m_reader != NULL) && (m_reader->depth > 1)); };
+	std::map<std::string, sqlite3_stmt*> &GetStatementCache() { return *m_statement_cache; };
+private:
+	CSQLHelper &m_sql;
+	_tSQLReader *m_reader;
+	sqlite3 *m_dbase;
+	std::map<std::string, sqlite3_stmt*> *m_statement_cache;
+};
+
+//Prepared statement taken from the CSQLHelper statement cache
+//A connection is held for the lifetime of this object, so keep it in a small scope
+//and do not call safe_query/safe_exec_no_return while it is alive
+//SELECT statements run on the read-only pool, everything else on the writer
+//Parameters ('?' placeholders) are bound in order with Bind
+class CSQLStatement
+{
+public:
+	CSQLStatement(CSQLHelper &sql, const char *szQuery);
+	~CSQLStatement();
+
+	bool IsValid() const { return (m_stmt != NULL); };
+	//Runs on a read-only connection that an outer statement of this thread is still reading from
+	bool IsNestedRead() const { return m_connection.IsNested(); };
+
+	CSQLStatement& Bind(const int Value);
+	CSQLStatement& Bind(const int64_t Value);
+	CSQLStatement& Bind(const uint64_t Value);
+	CSQLStatement& Bind(const double Value);
+	CSQLStatement& Bind(const char *Value);
+	CSQLStatement& Bind(const std::string &Value);
+
+	//Returns true when a result row is available
+	bool Step();
+	//Makes the statement ready to run again, the parameters have to be bound again
+	void Reset();
+	//Runs a statement that does not return rows, returns true on success
+	bool Execute();
+
+	int ColumnCount();
+	bool IsNull(const int col);
+	int GetInt(const int col);
+	int64_t GetInt64(const int col);
+	uint64_t GetUInt64(const int col);
+	double GetDouble(const int col);
+	//Returned pointer is only valid until the next Step(), never NULL
+	const char* GetText(const int col);
+	std::string GetString(const int col);
+private:
+	CSQLConnectionLock m_connection;
+	sqlite3_stmt *m_stmt;
+	bool m_bCached;
+	int m_bindIndex;
+	int m_stepResult;
+};
+
 class CSQLHelper : public StoppableTask
 {
 public:
@@ -287,11 +420,26 @@ public:
 	~CSQLHelper(void);
 
 	void SetDatabaseName(const std::string &DBName);
+	void SetReaderConnections(const int nConnections);
+	//Keeps the short logs that support it also in the time series store, next to the database
+	void EnableTimeSeriesStore(const bool bEnable);
+
+	//Groups all writes of the calling thread into one transaction, the writer stays locked until the commit
+	//Can be nested, only the outer pair starts/commits the transaction
+	void BeginTransaction();
+	void CommitTransaction();
+	//Ends the pair like CommitTransaction, the outer pair then rolls back the whole transaction
+	void RollbackTransaction();
+	//Inside a transaction of the calling thread the action runs after the commit, with the writer released,
+	//otherwise it runs right away. Use it for work that does not need to be part of the transaction
+	void RunAfterCommit(const std::function<void()> &action);
+	bool IsTransactionOwner();
 
 	bool OpenDatabase();
 	void CloseDatabase();
 
-	bool BackupDatabase(const std::string &OutputFile);
+	//Does not block the database in WAL mode, bCompress writes a gzip file
+	bool BackupDatabase(const std::string &OutputFile, const bool bCompress = false);
 	bool RestoreDatabase(const std::string &dbase);
 
 	//Returns DeviceRowID
@@ -330,6 +478,7 @@ public:
 	int GetLastBackupNo(const char *Key, int &nValue);
 	void SetLastBackupNo(const char *Key, const int nValue);
 
+	void SetActiveTimerPlan(const int TimerPlan);
 	bool HasTimers(const uint64_t Idx);
 	bool HasTimers(const std::string &Idx);
 	bool HasSceneTimers(const uint64_t Idx);
@@ -345,6 +494,7 @@ public:
 
 	void ClearShortLog();
 	void VacuumDatabase();
+	void IncrementalVacuum();
 	void OptimizeDatabase(sqlite3 *dbase);
 
 	void DeleteHardware(const std::string &idx);
@@ -405,6 +555,29 @@ public:
 	bool SetDeviceOptions(const uint64_t idx, const std::map<std::string, std::string> & options);
 
 	float GetCounterDivider(const int metertype, const int dType, const float DefaultValue);
+
+	int GetReaderConnections();
+	std::map<std::string, _tSQLLockStats> GetLockStatistics();
+	std::map<std::string, _tSQLJobStats> GetJobStatistics();
+
+	//Counter values of today, kept up to date when the short logs are written (no aggregate query per device)
+	bool GetMeterToday(const uint64_t DeviceRowID, _tMeterToday &values);
+	bool GetMultiMeterToday(const uint64_t DeviceRowID, _tMultiMeterToday &values);
+	//Call after changing Meter/MultiMeter rows of today outside UpdateMeter/UpdateMultiMeter
+	void InvalidateTodayBaselines();
+	//Recalculates the rollups from the Meter/MultiMeter and calendar tables (all devices when DeviceRowID is 0)
+	//When a date is given, only the hour and month that contain it are done
+	void RebuildMeterRollups(const uint64_t DeviceRowID, const std::string &szDate = "");
+
+	bool IsTimeSeriesEnabled();
+	//Rows of a short log read from the time series store, value columns in table order followed by the Date
+	std::vector<std::vector<std::string> > QueryTimeSeries(const std::string &szTable, const uint64_t DeviceRowID, const std::string &szDateStart, const std::string &szDateEnd);
+	//Copies the rows newer than the store from the table (all devices when DeviceRowID is 0), returns the number of rows
+	int ImportTimeSeries(const std::string &szTable, const uint64_t DeviceRowID = 0);
+	//Replaces the rows of the table with the ones in the store, returns the number of rows
+	int ExportTimeSeries(const std::string &szTable);
+	//Rebuilds the series of a device after its rows were changed or deleted
+	void ResyncTimeSeries(const std::string &szTable, const uint64_t DeviceRowID);
 public:
 	std::string m_LastSwitchID;	//for learning command
 	uint64_t m_LastSwitchRowID;
@@ -424,9 +597,43 @@ public:
 	int			m_ShortLogInterval;
 	bool		m_bLogEventScriptTrigger;
 	bool		m_bDisableDzVentsSystem;
+
+	//Cached copy of DeviceStatus, use this instead of querying the table for single devices
+	CDeviceStateCache m_devicecache;
 private:
-	std::mutex		m_sqlQueryMutex;
+	friend class CSQLStatement;
+	friend class CSQLConnectionLock;
+
+	std::recursive_mutex	m_sqlQueryMutex;
 	sqlite3			*m_dbase;
+	std::map<std::string, sqlite3_stmt*> m_statement_cache;
+
+	int m_iReaderConnections;
+	std::vector<_tSQLReader*> m_readers;
+	std::vector<_tSQLReader*> m_free_readers;
+	std::mutex m_readersMutex;
+	std::condition_variable m_readersCondition;
+
+	std::map<std::string, std::shared_ptr<_tSQLLockCounters> > m_lockstats;
+	std::mutex m_lockstatsMutex;
+	std::map<std::string, _tSQLJobStats> m_jobstats;
+	std::mutex m_jobstatsMutex;
+
+	bool m_bTimeSeriesStore;
+	CTimeSeriesStore m_tsstore;
+
+	int m_transaction_depth;
+	bool m_bTransactionFailed;	// a nested pair rolled back
+	std::atomic<std::thread::id> m_transaction_owner;
+	std::vector<std::function<void()> > m_after_commit;	// only touched by the transaction owner
+
+	std::mutex m_todayMutex;
+	std::string m_todayDate;
+	bool m_bTodayValid;
+	uint64_t m_todayGeneration;
+	std::map<uint64_t, _tMeterToday> m_meter_today;
+	std::map<uint64_t, _tMultiMeterToday> m_multimeter_today;
+
 	std::string		m_dbase_name;
 	unsigned char	m_sensortimeoutcounter;
 	std::map<uint64_t, int> m_timeoutlastsend;
@@ -484,6 +691,9 @@ private:
 	void AddCalendarUpdatePercentage();
 	void AddCalendarUpdateFan();
 	void CleanupShortLog();
+	int PurgeShortLogTable(const char *szTable, const char *szFilter, const char *szDate);
+	int RunRollupJob(const char *szName, void (CSQLHelper::*job)());
+	void AddJobStatistics(const std::string &szName, const int rows, const double duration);
 	bool CheckDate(const std::string &sDate, int &d, int &m, int &y);
 	bool CheckDateSQL(const std::string &sDate);
 	bool CheckDateTimeSQL(const std::string &sDateTime);
@@ -491,6 +701,25 @@ private:
 
 	std::vector<std::vector<std::string> > query(const std::string &szQuery);
 	std::vector<std::vector<std::string> > queryBlob(const std::string &szQuery);
+
+	std::vector<std::vector<std::string> > query(sqlite3 *dbase, const std::string &szQuery, const bool bBlob);
+
+	bool OpenReaders();
+	void CloseReaders();
+	_tSQLReader *AcquireReader();
+	void ReleaseReader(_tSQLReader *pReader);
+	void AddLockStatistics(const bool bReadOnly, const uint64_t wait_us);
+	std::shared_ptr<_tSQLLockCounters> GetLockCounters(const std::string &szCaller);
+
+	void LoadTodayBaselines();
+	void AddMeterToday(const uint64_t DeviceRowID, const int64_t Value);
+	void AddMultiMeterToday(const uint64_t DeviceRowID, const int64_t Values[6]);
+	void AddMeterRollup(const uint64_t DeviceRowID, const _eRollupPeriod Period, const std::string &szDate, const double Value, const double Usage, const double Counter);
+	void AddMultiMeterRollup(const uint64_t DeviceRowID, const _eRollupPeriod Period, const std::string &szDate, const double Values[6], const double Counters[4]);
+
+	//Statement cache, the connection has to be locked by the caller
+	sqlite3_stmt* GetCachedStatement(sqlite3 *dbase, std::map<std::string, sqlite3_stmt*> &cache, const char *szQuery, bool &bCached);
+	void ClearStatementCache(std::map<std::string, sqlite3_stmt*> &cache);
 };
 
 extern CSQLHelper m_sql;
@@ -854,16 +854,12 @@ void CScheduler::CheckSchedules()
 					else
 					{
 						//Get SwitchType
-						std::vector<std::vector<std::string> > result;
-						result = m_sql.safe_query("SELECT Type,SubType,SwitchType FROM DeviceStatus WHERE (ID == %" PRIu64 ")",
-							itt.RowID);
-						if (!result.empty())
+						_tDeviceCacheItem dev;
+						if (m_sql.m_devicecache.GetDevice(itt.RowID, dev))
 						{
-							std::vector<std::string> sd = result[0];
-
-							unsigned char dType = atoi(sd[0].c_str());
-							unsigned char dSubType = atoi(sd[1].c_str());
-							_eSwitchType switchtype = (_eSwitchType)atoi(sd[2].c_str());
+							unsigned char dType = (unsigned char)dev.Type;
+							unsigned char dSubType = (unsigned char)dev.SubType;
+							_eSwitchType switchtype = (_eSwitchType)dev.SwitchType;
 							std::string lstatus = "";
 							int llevel = 0;
 							bool bHaveDimmer = false;
@@ -1192,8 +1188,7 @@ namespace http {
 				if (result.empty())
 					return; //timerplan not found!
 				_log.Log(LOG_STATUS, "Scheduler Timerplan changed (%d - %s)", rnvalue, result[0][0].c_str());
-				m_sql.UpdatePreferencesVar("ActiveTimerPlan", rnvalue);
-				m_sql.m_ActiveTimerPlan = rnvalue;
+				m_sql.SetActiveTimerPlan(rnvalue);
 				m_mainworker.m_scheduler.ReloadSchedules();
 			}
 
@@ -2241,8 +2236,7 @@ namespace http {
 			if (m_sql.m_ActiveTimerPlan == iPlan)
 			{
 				//Set active timer plan to default
-				m_sql.UpdatePreferencesVar("ActiveTimerPlan", 0);
-				m_sql.m_ActiveTimerPlan = 0;
+				m_sql.SetActiveTimerPlan(0);
 				m_mainworker.m_scheduler.ReloadSchedules();
 			}
 		}
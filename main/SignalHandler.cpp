@@ -418,6 +418,8 @@ void signal_handler(int sig_num
 	case SIGILL:
 	case SIGABRT:
 	case SIGFPE:
+		//queued lines would be lost when the process is killed, write everything from here on directly
+		_log.SetSynchronous();
 #if defined(__linux__)
 #if defined(__GLIBC__)
 		pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
@@ -474,6 +476,7 @@ void signal_handler(int sig_num
 	case SIGUSR1:
 		fatal_handling = 1;
 		fatal_handling_thread = pthread_self();
+		_log.SetSynchronous();
 		_log.Log(LOG_ERROR, "Domoticz(%d) is exiting due to watchdog triggered...", getpid());
 		// Print call stack of all threads to aid debugging of deadlock
 		dumpstack_gdb(true);
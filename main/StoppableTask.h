@@ -35,6 +35,11 @@ public:
 		// checks if value in future object is available
 		return (m_futureObj.wait_for(std::chrono::milliseconds(timeMS)) != std::future_status::timeout);
 	}
+	//Blocks until the thread is requested to stop
+	void WaitForStopRequest()
+	{
+		m_futureObj.wait();
+	}
 	// Request the thread to stop by setting value in promise object
 	void RequestStop()
 	{
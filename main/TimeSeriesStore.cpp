@@ -0,0 +1,729 @@
+#include "stdafx.h"
+#include "TimeSeriesStore.h"
+#include "Helper.h"
+#include "Logger.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <cstdio>
+#include <cstring>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#define TS_BLOCK_MAGIC 0x31535444	// "DTS1"
+#define TS_BLOCK_HEADER_SIZE 28		// magic, columns, count, first, last, size
+#define TS_BLOCK_SAMPLES 288		// one day of 5 minute samples
+#define TS_FILE_EXTENSION ".tss"
+
+namespace
+{
+	//the files are little endian, whatever the host is
+	void PutLE(std::vector<uint8_t> &buf, const uint64_t value, const int nbytes)
+	{
+		for (int ii = 0; ii < nbytes; ii++)
+			buf.push_back(static_cast<uint8_t>(value >> (ii * 8)));
+	}
+
+	uint64_t GetLE(const uint8_t *p, const int nbytes)
+	{
+		uint64_t value = 0;
+		for (int ii = 0; ii < nbytes; ii++)
+			value |= static_cast<uint64_t>(p[ii]) << (ii * 8);
+		return value;
+	}
+
+	int LeadingZeros(const uint64_t value)
+	{
+		int nbits = 0;
+		for (uint64_t mask = 1ULL << 63; (mask != 0) && ((value & mask) == 0); mask >>= 1)
+			nbits++;
+		return nbits;
+	}
+
+	int TrailingZeros(const uint64_t value)
+	{
+		int nbits = 0;
+		for (uint64_t mask = 1; (mask != 0) && ((value & mask) == 0); mask <<= 1)
+			nbits++;
+		return nbits;
+	}
+
+	class CBitWriter
+	{
+	public:
+		explicit CBitWriter(std::vector<uint8_t> &buf) : m_buf(buf), m_free(0) {}
+		//writes the lowest nbits of value, most significant bit first
+		void Write(const uint64_t value, int nbits)
+		{
+			while (nbits > 0)
+			{
+				if (m_free == 0)
+				{
+					m_buf.push_back(0);
+					m_free = 8;
+				}
+				int n = (nbits < m_free) ? nbits : m_free;
+				uint8_t bits = static_cast<uint8_t>((value >> (nbits - n)) & ((1U << n) - 1));
+				m_buf.back() |= static_cast<uint8_t>(bits << (m_free - n));
+				m_free -= n;
+				nbits -= n;
+			}
+		}
+	private:
+		std::vector<uint8_t> &m_buf;
+		int m_free;
+	};
+
+	class CBitReader
+	{
+	public:
+		CBitReader(const uint8_t *data, const size_t size) : m_data(data), m_size(size), m_pos(0), m_bError(false) {}
+		uint64_t Read(int nbits)
+		{
+			uint64_t value = 0;
+			while (nbits > 0)
+			{
+				size_t byte = m_pos >> 3;
+				if (byte >= m_size)
+				{
+					m_bError = true;
+					return 0;
+				}
+				int avail = 8 - static_cast<int>(m_pos & 7);
+				int n = (nbits < avail) ? nbits : avail;
+				value = (value << n) | ((m_data[byte] >> (avail - n)) & ((1U << n) - 1));
+				m_pos += n;
+				nbits -= n;
+			}
+			return value;
+		}
+		bool Error() const { return m_bError; }
+	private:
+		const uint8_t *m_data;
+		size_t m_size;
+		size_t m_pos;
+		bool m_bError;
+	};
+
+	//Delta-of-delta of the timestamps, the 5 minute interval costs one bit per sample
+	void EncodeTime(CBitWriter &writer, const int64_t dod)
+	{
+		if (dod == 0)
+			writer.Write(0, 1);
+		else if ((dod >= -63) && (dod <= 64))
+		{
+			writer.Write(2, 2);
+			writer.Write(static_cast<uint64_t>(dod + 63), 7);
+		}
+		else if ((dod >= -255) && (dod <= 256))
+		{
+			writer.Write(6, 3);
+			writer.Write(static_cast<uint64_t>(dod + 255), 9);
+		}
+		else if ((dod >= -2047) && (dod <= 2048))
+		{
+			writer.Write(14, 4);
+			writer.Write(static_cast<uint64_t>(dod + 2047), 12);
+		}
+		else if ((dod >= std::numeric_limits<int32_t>::min()) && (dod <= std::numeric_limits<int32_t>::max()))
+		{
+			writer.Write(30, 5);
+			writer.Write(static_cast<uint32_t>(dod), 32);
+		}
+		else
+		{
+			writer.Write(31, 5);
+			writer.Write(static_cast<uint64_t>(dod), 64);
+		}
+	}
+
+	int64_t DecodeTime(CBitReader &reader)
+	{
+		if (reader.Read(1) == 0)
+			return 0;
+		if (reader.Read(1) == 0)
+			return static_cast<int64_t>(reader.Read(7)) - 63;
+		if (reader.Read(1) == 0)
+			return static_cast<int64_t>(reader.Read(9)) - 255;
+		if (reader.Read(1) == 0)
+			return static_cast<int64_t>(reader.Read(12)) - 2047;
+		if (reader.Read(1) == 0)
+			return static_cast<int32_t>(static_cast<uint32_t>(reader.Read(32)));
+		return static_cast<int64_t>(reader.Read(64));
+	}
+
+	//XOR with the previous value of the column, only the bits that changed are stored
+	struct _tValueState
+	{
+		uint64_t Bits;
+		int Leading;	// window of the previous XOR, -1 when there is none
+		int Trailing;
+	};
+
+	void EncodeValue(CBitWriter &writer, _tValueState &state, const double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint64_t x = bits ^ state.Bits;
+		state.Bits = bits;
+		if (x == 0)
+		{
+			writer.Write(0, 1);
+			return;
+		}
+		int leading = LeadingZeros(x);
+		int trailing = TrailingZeros(x);
+		if ((state.Leading >= 0) && (leading >= state.Leading) && (trailing >= state.Trailing))
+		{
+			writer.Write(2, 2);
+			writer.Write(x >> state.Trailing, 64 - state.Leading - state.Trailing);
+			return;
+		}
+		int meaningful = 64 - leading - trailing;
+		writer.Write(3, 2);
+		writer.Write(static_cast<uint64_t>(leading), 6);
+		writer.Write(static_cast<uint64_t>(meaningful - 1), 6);
+		writer.Write(x >> trailing, meaningful);
+		state.Leading = leading;
+		state.Trailing = trailing;
+	}
+
+	bool DecodeValue(CBitReader &reader, _tValueState &state, double &value)
+	{
+		if (reader.Read(1) != 0)
+		{
+			uint64_t x;
+			if (reader.Read(1) == 0)
+			{
+				if (state.Leading < 0)
+					return false;
+				x = reader.Read(64 - state.Leading - state.Trailing) << state.Trailing;
+			}
+			else
+			{
+				int leading = static_cast<int>(reader.Read(6));
+				int meaningful = static_cast<int>(reader.Read(6)) + 1;
+				if (leading + meaningful > 64)
+					return false;
+				state.Leading = leading;
+				state.Trailing = 64 - leading - meaningful;
+				x = reader.Read(meaningful) << state.Trailing;
+			}
+			state.Bits ^= x;
+		}
+		memcpy(&value, &state.Bits, sizeof(value));
+		return !reader.Error();
+	}
+
+	void EncodeBlock(std::vector<uint8_t> &buf, const std::vector<int64_t> &times, const std::vector<double> &values, const uint16_t columns)
+	{
+		CBitWriter writer(buf);
+		std::vector<_tValueState> states(columns, _tValueState{ 0, -1, 0 });
+		int64_t prevDelta = 0;
+		for (size_t ii = 0; ii < times.size(); ii++)
+		{
+			if (ii == 0)
+				writer.Write(static_cast<uint64_t>(times[0]), 64);
+			else
+			{
+				int64_t delta = times[ii] - times[ii - 1];
+				EncodeTime(writer, delta - prevDelta);
+				prevDelta = delta;
+			}
+			for (uint16_t jj = 0; jj < columns; jj++)
+				EncodeValue(writer, states[jj], values[ii * columns + jj]);
+		}
+	}
+
+	bool DecodeBlock(const uint8_t *data, const size_t size, const uint16_t count, const uint16_t columns,
+		const int64_t From, const int64_t To, const CTimeSeriesStore::sample_handler &handler, size_t &total)
+	{
+		CBitReader reader(data, size);
+		std::vector<_tValueState> states(columns, _tValueState{ 0, -1, 0 });
+		std::vector<double> values(columns);
+		int64_t time = 0;
+		int64_t delta = 0;
+		for (uint16_t ii = 0; ii < count; ii++)
+		{
+			if (ii == 0)
+				time = static_cast<int64_t>(reader.Read(64));
+			else
+			{
+				delta += DecodeTime(reader);
+				time += delta;
+			}
+			for (uint16_t jj = 0; jj < columns; jj++)
+			{
+				if (!DecodeValue(reader, states[jj], values[jj]))
+					return false;
+			}
+			if (reader.Error())
+				return false;
+			if ((time >= From) && (time <= To))
+			{
+				handler(time, values);
+				total++;
+			}
+		}
+		return true;
+	}
+
+	int64_t DaysFromCivil(int64_t y, const unsigned m, const unsigned d)
+	{
+		y -= (m <= 2);
+		const int64_t era = ((y >= 0) ? y : y - 399) / 400;
+		const unsigned yoe = static_cast<unsigned>(y - era * 400);
+		const unsigned doy = (153 * ((m > 2) ? (m - 3) : (m + 9)) + 2) / 5 + d - 1;
+		const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + static_cast<int64_t>(doe) - 719468;
+	}
+
+	void CivilFromDays(int64_t z, int &y, unsigned &m, unsigned &d)
+	{
+		z += 719468;
+		const int64_t era = ((z >= 0) ? z : z - 146096) / 146097;
+		const unsigned doe = static_cast<unsigned>(z - era * 146097);
+		const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		const unsigned mp = (5 * doy + 2) / 153;
+		d = doy - (153 * mp + 2) / 5 + 1;
+		m = (mp < 10) ? (mp + 3) : (mp - 9);
+		y = static_cast<int>(static_cast<int64_t>(yoe) + era * 400 + ((m <= 2) ? 1 : 0));
+	}
+} // namespace
+
+CTimeSeriesStore::CTimeSeriesStore() :
+	m_bOpen(false)
+{
+}
+
+CTimeSeriesStore::~CTimeSeriesStore()
+{
+	Close();
+}
+
+bool CTimeSeriesStore::Open(const std::string &Folder)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	m_Folder = Folder;
+	if ((!m_Folder.empty()) && (m_Folder[m_Folder.size() - 1] != '/') && (m_Folder[m_Folder.size() - 1] != '\\'))
+		m_Folder += "/";
+	mkdir_deep(m_Folder.c_str(), 0755);
+	m_series.clear();
+	m_bOpen = true;
+	return true;
+}
+
+void CTimeSeriesStore::Close()
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return;
+	for (auto &itt : m_series)
+	{
+		for (auto &itt2 : itt.second)
+			WriteOpenBlock(itt.first, itt2.first, itt2.second);
+	}
+	m_series.clear();
+	m_bOpen = false;
+}
+
+bool CTimeSeriesStore::IsOpen()
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	return m_bOpen;
+}
+
+std::string CTimeSeriesStore::GetFileName(const std::string &Table, const uint64_t DeviceRowID)
+{
+	return m_Folder + Table + "/" + std::to_string(DeviceRowID) + TS_FILE_EXTENSION;
+}
+
+//m_mutex should be locked
+CTimeSeriesStore::_tSeries &CTimeSeriesStore::GetSeries(const std::string &Table, const uint64_t DeviceRowID)
+{
+	std::map<uint64_t, _tSeries> &tseries = m_series[Table];
+	auto itt = tseries.find(DeviceRowID);
+	if (itt != tseries.end())
+		return itt->second;
+	_tSeries &series = tseries[DeviceRowID];
+	LoadIndex(GetFileName(Table, DeviceRowID), series);
+	return series;
+}
+
+//Reads the block headers, a block that was not completely written is cut off
+void CTimeSeriesStore::LoadIndex(const std::string &FileName, _tSeries &series)
+{
+	series.Columns = 0;
+	series.FileSize = 0;
+	series.Blocks.clear();
+	if (!file_exist(FileName.c_str()))
+		return;
+
+	bool bDamaged = false;
+	try
+	{
+		boost::interprocess::file_mapping mapping(FileName.c_str(), boost::interprocess::read_only);
+		boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+		const uint8_t *data = static_cast<const uint8_t*>(region.get_address());
+		size_t size = region.get_size();
+		uint64_t offset = 0;
+		while (offset + TS_BLOCK_HEADER_SIZE <= size)
+		{
+			const uint8_t *p = data + offset;
+			if (GetLE(p, 4) != TS_BLOCK_MAGIC)
+				break;
+			uint16_t columns = static_cast<uint16_t>(GetLE(p + 4, 2));
+			_tBlockIndex block;
+			block.Count = static_cast<uint16_t>(GetLE(p + 6, 2));
+			block.First = static_cast<int64_t>(GetLE(p + 8, 8));
+			block.Last = static_cast<int64_t>(GetLE(p + 16, 8));
+			block.Size = static_cast<uint32_t>(GetLE(p + 24, 4));
+			block.Offset = offset;
+			if ((columns == 0) || ((series.Columns != 0) && (columns != series.Columns)) || (block.Count == 0))
+				break;
+			if (offset + TS_BLOCK_HEADER_SIZE + block.Size > size)
+				break;
+			series.Columns = columns;
+			series.Blocks.push_back(block);
+			offset += TS_BLOCK_HEADER_SIZE + block.Size;
+		}
+		series.FileSize = offset;
+		bDamaged = (offset != size);
+	}
+	catch (std::exception &)
+	{
+		//empty file, can not be mapped
+		bDamaged = true;
+	}
+	if (bDamaged)
+	{
+		_log.Log(LOG_ERROR, "TimeSeriesStore: %s is damaged after %" PRIu64 " bytes, the rest is dropped", FileName.c_str(), series.FileSize);
+		RewriteFile(FileName, series, 0);
+	}
+}
+
+//Copies the blocks from FirstBlock on to a new file that replaces the old one (removed when nothing is left)
+bool CTimeSeriesStore::RewriteFile(const std::string &FileName, _tSeries &series, const size_t FirstBlock)
+{
+	std::string TmpName = FileName + ".tmp";
+	std::vector<_tBlockIndex> blocks;
+	uint64_t offset = 0;
+	bool bOK = true;
+	if (FirstBlock < series.Blocks.size())
+	{
+		FILE *fOut = fopen(TmpName.c_str(), "wb");
+		if (fOut == NULL)
+		{
+			_log.Log(LOG_ERROR, "TimeSeriesStore: can not create %s", TmpName.c_str());
+			return false;
+		}
+		try
+		{
+			boost::interprocess::file_mapping mapping(FileName.c_str(), boost::interprocess::read_only);
+			boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+			const uint8_t *data = static_cast<const uint8_t*>(region.get_address());
+			for (size_t ii = FirstBlock; ii < series.Blocks.size(); ii++)
+			{
+				_tBlockIndex block = series.Blocks[ii];
+				size_t length = TS_BLOCK_HEADER_SIZE + block.Size;
+				if (fwrite(data + block.Offset, 1, length, fOut) != length)
+				{
+					bOK = false;
+					break;
+				}
+				block.Offset = offset;
+				offset += length;
+				blocks.push_back(block);
+			}
+		}
+		catch (std::exception &e)
+		{
+			_log.Log(LOG_ERROR, "TimeSeriesStore: can not read %s (%s)", FileName.c_str(), e.what());
+			bOK = false;
+		}
+		if (fclose(fOut) != 0)
+			bOK = false;
+		if (!bOK)
+		{
+			std::remove(TmpName.c_str());
+			return false;
+		}
+	}
+	if (blocks.empty())
+		std::remove(FileName.c_str());
+	else
+	{
+#ifdef WIN32
+		std::remove(FileName.c_str());
+#endif
+		if (std::rename(TmpName.c_str(), FileName.c_str()) != 0)
+		{
+			_log.Log(LOG_ERROR, "TimeSeriesStore: can not replace %s", FileName.c_str());
+			std::remove(TmpName.c_str());
+			return false;
+		}
+	}
+	series.Blocks = blocks;
+	series.FileSize = offset;
+	if (blocks.empty() && series.OpenTimes.empty())
+		series.Columns = 0;
+	return true;
+}
+
+//m_mutex should be locked
+bool CTimeSeriesStore::WriteOpenBlock(const std::string &Table, const uint64_t DeviceRowID, _tSeries &series)
+{
+	if (series.OpenTimes.empty())
+		return true;
+
+	_tBlockIndex block;
+	block.Count = static_cast<uint16_t>(series.OpenTimes.size());
+	block.First = *std::min_element(series.OpenTimes.begin(), series.OpenTimes.end());
+	block.Last = *std::max_element(series.OpenTimes.begin(), series.OpenTimes.end());
+	block.Offset = series.FileSize;
+
+	std::vector<uint8_t> buf;
+	PutLE(buf, TS_BLOCK_MAGIC, 4);
+	PutLE(buf, series.Columns, 2);
+	PutLE(buf, block.Count, 2);
+	PutLE(buf, static_cast<uint64_t>(block.First), 8);
+	PutLE(buf, static_cast<uint64_t>(block.Last), 8);
+	PutLE(buf, 0, 4);
+	EncodeBlock(buf, series.OpenTimes, series.OpenValues, series.Columns);
+	block.Size = static_cast<uint32_t>(buf.size() - TS_BLOCK_HEADER_SIZE);
+	for (int ii = 0; ii < 4; ii++)
+		buf[24 + ii] = static_cast<uint8_t>(block.Size >> (ii * 8));
+
+	if (series.FileSize == 0)
+		mkdir_deep((m_Folder + Table).c_str(), 0755);
+	std::string FileName = GetFileName(Table, DeviceRowID);
+	FILE *fOut = fopen(FileName.c_str(), "ab");
+	if (fOut == NULL)
+	{
+		_log.Log(LOG_ERROR, "TimeSeriesStore: can not write %s", FileName.c_str());
+		return false;
+	}
+	bool bOK = (fwrite(buf.data(), 1, buf.size(), fOut) == buf.size());
+	if (fclose(fOut) != 0)
+		bOK = false;
+	if (!bOK)
+	{
+		_log.Log(LOG_ERROR, "TimeSeriesStore: can not write %s", FileName.c_str());
+		return false;
+	}
+	series.Blocks.push_back(block);
+	series.FileSize += buf.size();
+	series.OpenTimes.clear();
+	series.OpenValues.clear();
+	return true;
+}
+
+bool CTimeSeriesStore::Append(const std::string &Table, const uint64_t DeviceRowID, const int64_t Time, const std::vector<double> &Values)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if ((!m_bOpen) || (Values.empty()))
+		return false;
+	_tSeries &series = GetSeries(Table, DeviceRowID);
+	if (series.Columns == 0)
+		series.Columns = static_cast<uint16_t>(Values.size());
+	if (Values.size() != series.Columns)
+		return false;
+	series.OpenTimes.push_back(Time);
+	series.OpenValues.insert(series.OpenValues.end(), Values.begin(), Values.end());
+	if (series.OpenTimes.size() < TS_BLOCK_SAMPLES)
+		return true;
+	return WriteOpenBlock(Table, DeviceRowID, series);
+}
+
+size_t CTimeSeriesStore::Range(const std::string &Table, const uint64_t DeviceRowID, const int64_t From, const int64_t To, const sample_handler &handler)
+{
+	size_t total = 0;
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return 0;
+	_tSeries &series = GetSeries(Table, DeviceRowID);
+
+	bool bInFile = false;
+	for (const auto &itt : series.Blocks)
+	{
+		if ((itt.Last >= From) && (itt.First <= To))
+		{
+			bInFile = true;
+			break;
+		}
+	}
+	if (bInFile)
+	{
+		std::string FileName = GetFileName(Table, DeviceRowID);
+		try
+		{
+			boost::interprocess::file_mapping mapping(FileName.c_str(), boost::interprocess::read_only);
+			boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+			const uint8_t *data = static_cast<const uint8_t*>(region.get_address());
+			size_t size = region.get_size();
+			for (const auto &itt : series.Blocks)
+			{
+				if ((itt.Last < From) || (itt.First > To))
+					continue;
+				if (itt.Offset + TS_BLOCK_HEADER_SIZE + itt.Size > size)
+					break;
+				if (!DecodeBlock(data + itt.Offset + TS_BLOCK_HEADER_SIZE, itt.Size, itt.Count, series.Columns, From, To, handler, total))
+				{
+					_log.Log(LOG_ERROR, "TimeSeriesStore: %s has a damaged block at %" PRIu64, FileName.c_str(), itt.Offset);
+					break;
+				}
+			}
+		}
+		catch (std::exception &e)
+		{
+			_log.Log(LOG_ERROR, "TimeSeriesStore: can not read %s (%s)", FileName.c_str(), e.what());
+		}
+	}
+
+	std::vector<double> values(series.Columns);
+	for (size_t ii = 0; ii < series.OpenTimes.size(); ii++)
+	{
+		if ((series.OpenTimes[ii] < From) || (series.OpenTimes[ii] > To))
+			continue;
+		std::copy(series.OpenValues.begin() + ii * series.Columns, series.OpenValues.begin() + (ii + 1) * series.Columns, values.begin());
+		handler(series.OpenTimes[ii], values);
+		total++;
+	}
+	return total;
+}
+
+int64_t CTimeSeriesStore::GetLastTime(const std::string &Table, const uint64_t DeviceRowID)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return 0;
+	_tSeries &series = GetSeries(Table, DeviceRowID);
+	int64_t LastTime = 0;
+	for (const auto &itt : series.Blocks)
+		LastTime = (std::max)(LastTime, itt.Last);
+	for (const auto &itt : series.OpenTimes)
+		LastTime = (std::max)(LastTime, itt);
+	return LastTime;
+}
+
+std::vector<uint64_t> CTimeSeriesStore::GetDevices(const std::string &Table)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return std::vector<uint64_t>();
+	return ListDevices(Table);
+}
+
+//m_mutex should be locked
+std::vector<uint64_t> CTimeSeriesStore::ListDevices(const std::string &Table)
+{
+	std::set<uint64_t> devices;
+	std::vector<std::string> entries;
+	DirectoryListing(entries, m_Folder + Table, false, true);
+	const std::string szExtension = TS_FILE_EXTENSION;
+	for (const auto &itt : entries)
+	{
+		if ((itt.size() <= szExtension.size()) || (itt.compare(itt.size() - szExtension.size(), szExtension.size(), szExtension) != 0))
+			continue;
+		devices.insert(std::strtoull(itt.c_str(), nullptr, 10));
+	}
+	auto itt = m_series.find(Table);
+	if (itt != m_series.end())
+	{
+		for (const auto &itt2 : itt->second)
+		{
+			if (!itt2.second.OpenTimes.empty())
+				devices.insert(itt2.first);
+		}
+	}
+	return std::vector<uint64_t>(devices.begin(), devices.end());
+}
+
+size_t CTimeSeriesStore::Purge(const std::string &Table, const int64_t Before)
+{
+	size_t removed = 0;
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return 0;
+	std::vector<uint64_t> devices = ListDevices(Table);
+	for (const auto &itt : devices)
+	{
+		_tSeries &series = GetSeries(Table, itt);
+		size_t nBlocks = 0;
+		size_t nSamples = 0;
+		while ((nBlocks < series.Blocks.size()) && (series.Blocks[nBlocks].Last < Before))
+			nSamples += series.Blocks[nBlocks++].Count;
+		if ((nBlocks > 0) && (RewriteFile(GetFileName(Table, itt), series, nBlocks)))
+			removed += nSamples;
+
+		//a device that stopped reporting can have old samples waiting for a full block
+		size_t nKeep = 0;
+		for (size_t ii = 0; ii < series.OpenTimes.size(); ii++)
+		{
+			if (series.OpenTimes[ii] < Before)
+				continue;
+			series.OpenTimes[nKeep] = series.OpenTimes[ii];
+			std::copy(series.OpenValues.begin() + ii * series.Columns, series.OpenValues.begin() + (ii + 1) * series.Columns, series.OpenValues.begin() + nKeep * series.Columns);
+			nKeep++;
+		}
+		removed += series.OpenTimes.size() - nKeep;
+		series.OpenTimes.resize(nKeep);
+		series.OpenValues.resize(nKeep * series.Columns);
+	}
+	return removed;
+}
+
+void CTimeSeriesStore::Remove(const std::string &Table, const uint64_t DeviceRowID)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return;
+	auto itt = m_series.find(Table);
+	if (itt != m_series.end())
+		itt->second.erase(DeviceRowID);
+	std::remove(GetFileName(Table, DeviceRowID).c_str());
+}
+
+void CTimeSeriesStore::Clear(const std::string &Table)
+{
+	std::lock_guard<std::mutex> l(m_mutex);
+	if (!m_bOpen)
+		return;
+	std::vector<uint64_t> devices = ListDevices(Table);
+	for (const auto &itt : devices)
+		std::remove(GetFileName(Table, itt).c_str());
+	m_series.erase(Table);
+}
+
+int64_t CTimeSeriesStore::ToLocalSeconds(const struct tm &ltime)
+{
+	return DaysFromCivil(ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday) * 86400 + ltime.tm_hour * 3600 + ltime.tm_min * 60 + ltime.tm_sec;
+}
+
+int64_t CTimeSeriesStore::ToLocalSeconds(const std::string &szDate)
+{
+	int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+	if (sscanf(szDate.c_str(), "%d-%d-%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second) < 3)
+		return 0;
+	return DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+std::string CTimeSeriesStore::FormatLocalSeconds(const int64_t Time)
+{
+	int64_t days = Time / 86400;
+	int64_t secs = Time % 86400;
+	if (secs < 0)
+	{
+		secs += 86400;
+		days--;
+	}
+	int year;
+	unsigned month, day;
+	CivilFromDays(days, year, month, day);
+	char szDate[40];
+	sprintf(szDate, "%04d-%02u-%02u %02d:%02d:%02d", year, month, day, static_cast<int>(secs / 3600), static_cast<int>((secs / 60) % 60), static_cast<int>(secs % 60));
+	return szDate;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+//Append-only history of short log samples, one file per table and device.
+//Samples are written in blocks, timestamps delta-of-delta and values XOR (Gorilla) encoded,
+//the block headers are the time index and range scans decode the blocks from a memory mapped file.
+//Times are local seconds (the local date/time counted as if it was UTC), so they compare like the Date columns
+class CTimeSeriesStore
+{
+public:
+	typedef std::function<void(const int64_t Time, const std::vector<double> &Values)> sample_handler;
+
+	CTimeSeriesStore();
+	~CTimeSeriesStore();
+
+	bool Open(const std::string &Folder);
+	//Writes the blocks that are still being filled
+	void Close();
+	bool IsOpen();
+
+	//Samples of a device are expected in time order (local time steps back when DST ends, that is allowed),
+	//the number of values is fixed by the first sample
+	bool Append(const std::string &Table, const uint64_t DeviceRowID, const int64_t Time, const std::vector<double> &Values);
+	//Calls handler for the samples with From <= Time <= To, oldest first, returns the number of samples
+	size_t Range(const std::string &Table, const uint64_t DeviceRowID, const int64_t From, const int64_t To, const sample_handler &handler);
+	//Time of the newest sample, 0 when there is none
+	int64_t GetLastTime(const std::string &Table, const uint64_t DeviceRowID);
+	std::vector<uint64_t> GetDevices(const std::string &Table);
+	//Drops the blocks with only samples before Before, returns the number of samples removed
+	size_t Purge(const std::string &Table, const int64_t Before);
+	void Remove(const std::string &Table, const uint64_t DeviceRowID);
+	void Clear(const std::string &Table);
+
+	static int64_t ToLocalSeconds(const struct tm &ltime);
+	static int64_t ToLocalSeconds(const std::string &szDate);	// YYYY-MM-DD HH:MM:SS
+	static std::string FormatLocalSeconds(const int64_t Time);
+private:
+	struct _tBlockIndex
+	{
+		int64_t First;		// oldest and newest time in the block
+		int64_t Last;
+		uint64_t Offset;	// of the header in the file
+		uint32_t Size;		// of the encoded samples
+		uint16_t Count;
+	};
+	struct _tSeries
+	{
+		uint16_t Columns;
+		uint64_t FileSize;
+		std::vector<_tBlockIndex> Blocks;
+		//block being filled, written when full or on Close
+		std::vector<int64_t> OpenTimes;
+		std::vector<double> OpenValues;
+	};
+
+	_tSeries &GetSeries(const std::string &Table, const uint64_t DeviceRowID);
+	std::string GetFileName(const std::string &Table, const uint64_t DeviceRowID);
+	std::vector<uint64_t> ListDevices(const std::string &Table);
+	void LoadIndex(const std::string &FileName, _tSeries &series);
+	bool WriteOpenBlock(const std::string &Table, const uint64_t DeviceRowID, _tSeries &series);
+	bool RewriteFile(const std::string &FileName, _tSeries &series, const size_t FirstBlock);
+
+	std::mutex m_mutex;
+	bool m_bOpen;
+	std::string m_Folder;
+	std::map<std::string, std::map<uint64_t, _tSeries> > m_series;
+};
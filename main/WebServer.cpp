@@ -44,6 +44,10 @@
 #include "Logger.h"
 #include "SQLHelper.h"
 #include "../push/BasePush.h"
+#include "../push/FibaroPush.h"
+#include "../push/GooglePubSubPush.h"
+#include "../push/HttpPush.h"
+#include "../push/InfluxPush.h"
 #include <algorithm>
 #ifdef ENABLE_PYTHON
 #include "../hardware/plugins/Plugins.h"
@@ -126,6 +130,29 @@ static const _tGuiLanguage guiLanguage[] =
 
 extern http::server::CWebServerHelper m_webservers;
 
+//Longest hold of a devices long-poll (seconds)
+#define DEVICES_LONG_POLL_MAX 60
+
+//Device list change token "<epoch>-<sequence>", tokens of an earlier run are rejected
+static std::string MakeDeviceChangeToken(const uint64_t sequence)
+{
+	std::stringstream sstr;
+	sstr << m_sql.m_devicecache.GetEpoch() << "-" << sequence;
+	return sstr.str();
+}
+
+static bool ParseDeviceChangeToken(const std::string &token, uint64_t &sequence)
+{
+	std::vector<std::string> strarray;
+	StringSplit(token, "-", strarray);
+	if (strarray.size() != 2)
+		return false;
+	if (std::strtoll(strarray[0].c_str(), nullptr, 10) != (long long)m_sql.m_devicecache.GetEpoch())
+		return false;
+	sequence = std::strtoull(strarray[1].c_str(), nullptr, 10);
+	return true;
+}
+
 namespace http {
 	namespace server {
 
@@ -176,8 +203,9 @@ namespace http {
 
 		void CWebServer::ReloadCustomSwitchIcons()
 		{
-			m_custom_light_icons.clear();
-			m_custom_light_icons_lookup.clear();
+			//Build new lists and swap them in, requests on other threads read the icons meanwhile
+			std::vector<_tCustomIcon> custom_light_icons;
+			std::map<int, int> custom_light_icons_lookup;
 			std::string sLine = "";
 
 			//First get them from the switch_icons.txt file
@@ -201,8 +229,8 @@ namespace http {
 							cImage.RootFile = results[0];
 							cImage.Title = results[1];
 							cImage.Description = results[2];
-							m_custom_light_icons.push_back(cImage);
-							m_custom_light_icons_lookup[cImage.idx] = m_custom_light_icons.size() - 1;
+							custom_light_icons.push_back(cImage);
+							custom_light_icons_lookup[cImage.idx] = custom_light_icons.size() - 1;
 						}
 					}
 				}
@@ -251,7 +279,12 @@ namespace http {
 								std::ofstream file;
 								file.open(IconFile.c_str(), std::ios::out | std::ios::binary);
 								if (!file.is_open())
+								{
+									std::lock_guard<std::mutex> l(m_customIconsMutex);
+									m_custom_light_icons.swap(custom_light_icons);
+									m_custom_light_icons_lookup.swap(custom_light_icons_lookup);
 									return;
+								}
 
 								file << result2[0][0];
 								file.close();
@@ -259,11 +292,29 @@ namespace http {
 						}
 					}
 
-					m_custom_light_icons.push_back(cImage);
-					m_custom_light_icons_lookup[cImage.idx] = m_custom_light_icons.size() - 1;
+					custom_light_icons.push_back(cImage);
+					custom_light_icons_lookup[cImage.idx] = custom_light_icons.size() - 1;
 					ii++;
 				}
 			}
+			std::lock_guard<std::mutex> l(m_customIconsMutex);
+			m_custom_light_icons.swap(custom_light_icons);
+			m_custom_light_icons_lookup.swap(custom_light_icons_lookup);
+		}
+
+		std::vector<CWebServer::_tCustomIcon> CWebServer::GetCustomIcons()
+		{
+			std::lock_guard<std::mutex> l(m_customIconsMutex);
+			return m_custom_light_icons;
+		}
+
+		std::string CWebServer::GetCustomIconFile(const int idx, const std::string &szDefault)
+		{
+			std::lock_guard<std::mutex> l(m_customIconsMutex);
+			std::map<int, int>::const_iterator ittIcon = m_custom_light_icons_lookup.find(idx);
+			if (ittIcon == m_custom_light_icons_lookup.end())
+				return szDefault;
+			return m_custom_light_icons[ittIcon->second].RootFile;
 		}
 
 		bool CWebServer::StartServer(server_settings & settings, const std::string & serverpath, const bool bIgnoreUsernamePassword)
@@ -319,10 +370,9 @@ namespace http {
 				{
 					std::vector<std::string> strarray;
 					StringSplit(WebLocalNetworks, ";", strarray);
-					for (const auto & itt : strarray)
-						m_pWebEm->AddLocalNetworks(itt);
 					//add local hostname
-					m_pWebEm->AddLocalNetworks("");
+					strarray.push_back("");
+					m_pWebEm->SetLocalNetworks(strarray);
 				}
 			}
 
@@ -332,8 +382,7 @@ namespace http {
 			{
 				std::vector<std::string> strarray;
 				StringSplit(WebRemoteProxyIPs, ";", strarray);
-				for (const auto & itt : strarray)
-					m_pWebEm->AddRemoteProxyIPs(itt);
+				m_pWebEm->SetRemoteProxyIPs(strarray);
 			}
 
 			//register callbacks
@@ -382,6 +431,10 @@ namespace http {
 			RegisterCommandCode("clearlog", boost::bind(&CWebServer::Cmd_ClearLog, this, _1, _2, _3));
 			RegisterCommandCode("getauth", boost::bind(&CWebServer::Cmd_GetAuth, this, _1, _2, _3), true);
 			RegisterCommandCode("getuptime", boost::bind(&CWebServer::Cmd_GetUptime, this, _1, _2, _3), true);
+			RegisterCommandCode("getdatabasestats", boost::bind(&CWebServer::Cmd_GetDatabaseStats, this, _1, _2, _3));
+			RegisterCommandCode("geteventsystemstats", boost::bind(&CWebServer::Cmd_GetEventSystemStats, this, _1, _2, _3));
+			RegisterCommandCode("getdeviceeventbusstats", boost::bind(&CWebServer::Cmd_GetDeviceEventBusStats, this, _1, _2, _3));
+			RegisterCommandCode("getpluginstats", boost::bind(&CWebServer::Cmd_GetPluginStats, this, _1, _2, _3));
 
 
 			RegisterCommandCode("gethardwaretypes", boost::bind(&CWebServer::Cmd_GetHardwareTypes, this, _1, _2, _3));
@@ -563,6 +616,7 @@ namespace http {
 			RegisterCommandCode("addlogmessage", boost::bind(&CWebServer::Cmd_AddLogMessage, this, _1, _2, _3));
 			RegisterCommandCode("clearshortlog", boost::bind(&CWebServer::Cmd_ClearShortLog, this, _1, _2, _3));
 			RegisterCommandCode("vacuumdatabase", boost::bind(&CWebServer::Cmd_VacuumDatabase, this, _1, _2, _3));
+			RegisterCommandCode("timeseries", boost::bind(&CWebServer::Cmd_TimeSeries, this, _1, _2, _3));
 
 			RegisterCommandCode("addmobiledevice", boost::bind(&CWebServer::Cmd_AddMobileDevice, this, _1, _2, _3));
 			RegisterCommandCode("updatemobiledevice", boost::bind(&CWebServer::Cmd_UpdateMobileDevice, this, _1, _2, _3));
@@ -817,7 +871,7 @@ namespace http {
 						else if (sLine.find("#SwitchIcons") != std::string::npos)
 						{
 							//Add database switch icons
-							for (const auto & itt : m_custom_light_icons)
+							for (const auto & itt : GetCustomIcons())
 							{
 								if (itt.idx >= 100)
 								{
@@ -867,15 +921,12 @@ namespace http {
 				HandleCommand(cparam, session, req, root);
 			} //(rtype=="command")
 			else {
+				if ((rtype == "devices") && (!CheckDevicesChanged(session, req, rep)))
+					return;
 				HandleRType(rtype, session, req, root);
 			}
 		exitjson:
-			std::string jcallback = request::findValue(&req, "jsoncallback");
-			if (jcallback.size() == 0) {
-				reply::set_content(&rep, root.toStyledString());
-				return;
-			}
-			reply::set_content(&rep, "var data=" + root.toStyledString() + '\n' + jcallback + "(data);");
+			m_pWebEm->SetJSonReply(req, rep, root);
 		}
 
 		void CWebServer::Cmd_GetLanguage(WebEmSession & session, const request& req, Json::Value &root)
@@ -932,24 +983,24 @@ namespace http {
 				if (request_handler::url_decode(tmpusrpass, usrpass))
 				{
 					usrname = base64_decode(usrname);
-					int iUser = FindUser(usrname.c_str());
-					if (iUser == -1) {
+					_tWebUserPassword user;
+					if (!FindUser(usrname.c_str(), user)) {
 						// log brute force attack
 						_log.Log(LOG_ERROR, "Failed login attempt from %s for user '%s' !", session.remote_host.c_str(), usrname.c_str());
 						return;
 					}
-					if (m_users[iUser].Password != usrpass) {
+					if (user.Password != usrpass) {
 						// log brute force attack
-						_log.Log(LOG_ERROR, "Failed login attempt from %s for '%s' !", session.remote_host.c_str(), m_users[iUser].Username.c_str());
+						_log.Log(LOG_ERROR, "Failed login attempt from %s for '%s' !", session.remote_host.c_str(), user.Username.c_str());
 						return;
 					}
-					_log.Log(LOG_STATUS, "Login successful from %s for user '%s'", session.remote_host.c_str(), m_users[iUser].Username.c_str());
+					_log.Log(LOG_STATUS, "Login successful from %s for user '%s'", session.remote_host.c_str(), user.Username.c_str());
 					root["status"] = "OK";
 					root["version"] = szAppVersion;
 					root["title"] = "logincheck";
 					session.isnew = true;
-					session.username = m_users[iUser].Username;
-					session.rights = m_users[iUser].userrights;
+					session.username = user.Username;
+					session.rights = user.userrights;
 					session.rememberme = (rememberme == "true");
 					root["user"] = session.username;
 					root["rights"] = session.rights;
@@ -2535,6 +2586,127 @@ namespace http {
 			root["seconds"] = seconds;
 		}
 
+		void CWebServer::Cmd_GetDatabaseStats(WebEmSession & session, const request& req, Json::Value &root)
+		{
+			if (session.rights != 2)
+			{
+				session.reply_status = reply::forbidden;
+				return; //Only admin user allowed
+			}
+			root["status"] = "OK";
+			root["title"] = "GetDatabaseStats";
+			root["ReaderConnections"] = m_sql.GetReaderConnections();
+
+			int ii = 0;
+			std::map<std::string, _tSQLLockStats> lockstats = m_sql.GetLockStatistics();
+			for (const auto & itt : lockstats)
+			{
+				root["LockWait"][ii]["Caller"] = itt.first;
+				root["LockWait"][ii]["Reads"] = (Json::UInt64)itt.second.reads;
+				root["LockWait"][ii]["Writes"] = (Json::UInt64)itt.second.writes;
+				root["LockWait"][ii]["ReadWaitMs"] = (double)itt.second.read_wait_us / 1000.0;
+				root["LockWait"][ii]["WriteWaitMs"] = (double)itt.second.write_wait_us / 1000.0;
+				root["LockWait"][ii]["MaxWaitMs"] = (double)itt.second.max_wait_us / 1000.0;
+				ii++;
+			}
+
+			ii = 0;
+			std::map<std::string, _tSQLJobStats> jobstats = m_sql.GetJobStatistics();
+			for (const auto & itt : jobstats)
+			{
+				root["Jobs"][ii]["Name"] = itt.first;
+				root["Jobs"][ii]["Runs"] = (Json::UInt64)itt.second.runs;
+				root["Jobs"][ii]["Rows"] = (Json::UInt64)itt.second.rows;
+				root["Jobs"][ii]["LastRows"] = itt.second.last_rows;
+				root["Jobs"][ii]["LastMs"] = itt.second.last_ms;
+				root["Jobs"][ii]["MaxMs"] = itt.second.max_ms;
+				ii++;
+			}
+		}
+
+		void CWebServer::Cmd_GetEventSystemStats(WebEmSession & session, const request& req, Json::Value &root)
+		{
+			if (session.rights != 2)
+			{
+				session.reply_status = reply::forbidden;
+				return; //Only admin user allowed
+			}
+			root["status"] = "OK";
+			root["title"] = "GetEventSystemStats";
+
+			CEventSystem::_tEventSystemStats stats;
+			m_mainworker.m_eventsystem.GetStatistics(stats);
+			root["QueueDepth"] = (Json::UInt64)stats.QueueDepth;
+			int ii = 0;
+			for (const auto & itt : stats.WorkerDepth)
+				root["WorkerDepth"][ii++] = (Json::UInt64)itt;
+			root["TasksDone"] = (Json::UInt64)stats.TasksDone;
+			root["TasksTimedOut"] = (Json::UInt64)stats.TasksTimedOut;
+			root["AvgLatencyMs"] = stats.AvgLatency;
+			root["MaxLatencyMs"] = stats.MaxLatency;
+			root["AvgRunTimeMs"] = stats.AvgRunTime;
+			root["MaxRunTimeMs"] = stats.MaxRunTime;
+		}
+
+		void CWebServer::Cmd_GetDeviceEventBusStats(WebEmSession & session, const request& req, Json::Value &root)
+		{
+			if (session.rights != 2)
+			{
+				session.reply_status = reply::forbidden;
+				return; //Only admin user allowed
+			}
+			root["status"] = "OK";
+			root["title"] = "GetDeviceEventBusStats";
+
+			std::vector<CDeviceEventBus::_tSubscriberStats> stats;
+			m_mainworker.m_deviceEventBus.GetStatistics(stats);
+			int ii = 0;
+			for (const auto & itt : stats)
+			{
+				root["result"][ii]["Name"] = itt.Name;
+				root["result"][ii]["Pending"] = (Json::UInt64)itt.Pending;
+				root["result"][ii]["Capacity"] = (Json::UInt64)itt.Capacity;
+				root["result"][ii]["Handled"] = (Json::UInt64)itt.Handled;
+				root["result"][ii]["Dropped"] = (Json::UInt64)itt.Dropped;
+				root["result"][ii]["Coalesced"] = (Json::UInt64)itt.Coalesced;
+				root["result"][ii]["Blocked"] = (Json::UInt64)itt.Blocked;
+				root["result"][ii]["Spilled"] = (Json::UInt64)itt.Spilled;
+				root["result"][ii]["LastLagMs"] = itt.LastLag;
+				root["result"][ii]["MaxLagMs"] = itt.MaxLag;
+				ii++;
+			}
+		}
+
+		void CWebServer::Cmd_GetPluginStats(WebEmSession & session, const request& req, Json::Value &root)
+		{
+			if (session.rights != 2)
+			{
+				session.reply_status = reply::forbidden;
+				return; //Only admin user allowed
+			}
+			root["status"] = "OK";
+			root["title"] = "GetPluginStats";
+#ifdef ENABLE_PYTHON
+			std::vector<Plugins::_tPluginQueueStats> stats;
+			m_mainworker.m_pluginsystem.GetStatistics(stats);
+			int ii = 0;
+			for (const auto & itt : stats)
+			{
+				root["result"][ii]["HardwareID"] = itt.HwdID;
+				root["result"][ii]["Name"] = itt.Name;
+				root["result"][ii]["Depth"] = (Json::UInt64)itt.Depth;
+				root["result"][ii]["MaxDepth"] = (Json::UInt64)itt.MaxDepth;
+				root["result"][ii]["Processed"] = (Json::UInt64)itt.Processed;
+				root["result"][ii]["LastLatencyMs"] = itt.LastLatency;
+				root["result"][ii]["MaxLatencyMs"] = itt.MaxLatency;
+				root["result"][ii]["LastRunTimeMs"] = itt.LastRunTime;
+				root["result"][ii]["MaxRunTimeMs"] = itt.MaxRunTime;
+				root["result"][ii]["SlowestMessage"] = itt.SlowestMessage;
+				ii++;
+			}
+#endif
+		}
+
 		void CWebServer::Cmd_GetActualHistory(WebEmSession & session, const request& req, Json::Value &root)
 		{
 			root["status"] = "OK";
@@ -2630,11 +2802,11 @@ namespace http {
 			unsigned long UserID = 0;
 			if (bHaveUser)
 			{
-				int iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
+				_tWebUserPassword user;
+				if (FindUser(session.username.c_str(), user))
 				{
-					urights = static_cast<int>(m_users[iUser].userrights);
-					UserID = m_users[iUser].ID;
+					urights = static_cast<int>(user.userrights);
+					UserID = user.ID;
 				}
 
 			}
@@ -2937,11 +3109,11 @@ namespace http {
 			bool bHaveUser = (session.username != "");
 			if (bHaveUser)
 			{
-				int iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
+				_tWebUserPassword user;
+				if (FindUser(session.username.c_str(), user))
 				{
-					urights = static_cast<int>(m_users[iUser].userrights);
-					_log.Log(LOG_STATUS, "User: %s initiated a Thermostat State change command", m_users[iUser].Username.c_str());
+					urights = static_cast<int>(user.userrights);
+					_log.Log(LOG_STATUS, "User: %s initiated a Thermostat State change command", user.Username.c_str());
 				}
 			}
 			if (urights < 1)
@@ -3126,9 +3298,9 @@ namespace http {
 			int urights = 3;
 			if (bHaveUser)
 			{
-				int iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
-					urights = static_cast<int>(m_users[iUser].userrights);
+				_tWebUserPassword user;
+				if (FindUser(session.username.c_str(), user))
+					urights = static_cast<int>(user.userrights);
 			}
 			root["statuscode"] = urights;
 
@@ -3199,14 +3371,14 @@ namespace http {
 			if (pSession->rights == 0)
 				return false; //viewer
 			//User
-			int iUser = FindUser(pSession->username.c_str());
-			if ((iUser < 0) || (iUser >= (int)m_users.size()))
+			_tWebUserPassword user;
+			if (!FindUser(pSession->username.c_str(), user))
 				return false;
 
-			if (m_users[iUser].TotSensors == 0)
+			if (user.TotSensors == 0)
 				return true; // all sensors
 
-			std::vector<std::vector<std::string> > result = m_sql.safe_query("SELECT DeviceRowID FROM SharedDevices WHERE (SharedUserID == '%d') AND (DeviceRowID == '%d')", m_users[iUser].ID, Idx);
+			std::vector<std::vector<std::string> > result = m_sql.safe_query("SELECT DeviceRowID FROM SharedDevices WHERE (SharedUserID == '%d') AND (DeviceRowID == '%d')", user.ID, Idx);
 			return (!result.empty());
 		}
 
@@ -3224,11 +3396,6 @@ namespace http {
 			char szTmp[300];
 
 			bool bHaveUser = (session.username != "");
-			int iUser = -1;
-			if (bHaveUser)
-			{
-				iUser = FindUser(session.username.c_str());
-			}
 
 			if (cparam == "deleteallsubdevices")
 			{
@@ -6427,12 +6594,11 @@ namespace http {
 				int urights = 3;
 				if (bHaveUser)
 				{
-					int iUser = -1;
-					iUser = FindUser(session.username.c_str());
-					if (iUser != -1)
+					_tWebUserPassword user;
+					if (FindUser(session.username.c_str(), user))
 					{
-						urights = (int)m_users[iUser].userrights;
-						_log.Log(LOG_STATUS, "User: %s initiated a modal command", m_users[iUser].Username.c_str());
+						urights = (int)user.userrights;
+						_log.Log(LOG_STATUS, "User: %s initiated a modal command", user.Username.c_str());
 					}
 				}
 				if (urights < 1)
@@ -7376,7 +7542,8 @@ namespace http {
 
 		void CWebServer::LoadUsers()
 		{
-			ClearUserPasswords();
+			//Build the complete list first, requests on other threads keep using the old one until it is swapped in
+			std::vector<_tWebUserPassword> users;
 			std::string WebUserName, WebPassword;
 			int nValue = 0;
 			if (m_sql.GetPreferencesVar("WebUserName", nValue, WebUserName))
@@ -7387,7 +7554,7 @@ namespace http {
 					{
 						WebUserName = base64_decode(WebUserName);
 						//WebPassword = WebPassword;
-						AddUser(10000, WebUserName, WebPassword, URIGHTS_ADMIN, 0xFFFF);
+						AddUser(users, 10000, WebUserName, WebPassword, URIGHTS_ADMIN, 0xFFFF);
 
 						std::vector<std::vector<std::string> > result;
 						result = m_sql.safe_query("SELECT ID, Active, Username, Password, Rights, TabsEnabled FROM Users");
@@ -7409,17 +7576,22 @@ namespace http {
 									_eUserRights rights = (_eUserRights)atoi(sd[4].c_str());
 									int activetabs = atoi(sd[5].c_str());
 
-									AddUser(ID, username, password, rights, activetabs);
+									AddUser(users, ID, username, password, rights, activetabs);
 								}
 							}
 						}
 					}
 				}
 			}
+			{
+				std::lock_guard<std::mutex> l(m_usersMutex);
+				m_users = users;
+			}
+			m_pWebEm->SetUserPasswords(users);
 			m_mainworker.LoadSharedUsers();
 		}
 
-		void CWebServer::AddUser(const unsigned long ID, const std::string &username, const std::string &password, const int userrights, const int activetabs)
+		void CWebServer::AddUser(std::vector<_tWebUserPassword> &users, const unsigned long ID, const std::string &username, const std::string &password, const int userrights, const int activetabs)
 		{
 			std::vector<std::vector<std::string> > result = m_sql.safe_query("SELECT COUNT(*) FROM SharedDevices WHERE (SharedUserID == '%d')", ID);
 			if (result.empty())
@@ -7432,31 +7604,36 @@ namespace http {
 			wtmp.userrights = (_eUserRights)userrights;
 			wtmp.ActiveTabs = activetabs;
 			wtmp.TotSensors = atoi(result[0][0].c_str());
-			m_users.push_back(wtmp);
-
-			m_pWebEm->AddUserPassword(ID, username, password, (_eUserRights)userrights, activetabs);
+			users.push_back(wtmp);
 		}
 
 		void CWebServer::ClearUserPasswords()
 		{
-			m_users.clear();
+			{
+				std::lock_guard<std::mutex> l(m_usersMutex);
+				m_users.clear();
+			}
 			m_pWebEm->ClearUserPasswords();
 		}
 
-		int CWebServer::FindUser(const char* szUserName)
+		//Returns a copy, the list can be reloaded by a request on another thread
+		bool CWebServer::FindUser(const char* szUserName, _tWebUserPassword &user)
 		{
-			int iUser = 0;
+			std::lock_guard<std::mutex> l(m_usersMutex);
 			for (const auto & itt : m_users)
 			{
 				if (itt.Username == szUserName)
-					return iUser;
-				iUser++;
+				{
+					user = itt;
+					return true;
+				}
 			}
-			return -1;
+			return false;
 		}
 
 		bool CWebServer::FindAdminUser()
 		{
+			std::lock_guard<std::mutex> l(m_usersMutex);
 			for (const auto & itt : m_users)
 			{
 				if (itt.userrights == URIGHTS_ADMIN)
@@ -7574,19 +7751,15 @@ namespace http {
 			m_sql.UpdatePreferencesVar("WebRemoteProxyIPs", WebRemoteProxyIPs.c_str());
 
 			LoadUsers();
-			m_pWebEm->ClearLocalNetworks();
 			std::vector<std::string> strarray;
 			StringSplit(WebLocalNetworks, ";", strarray);
-			for (const auto & itt : strarray)
-				m_pWebEm->AddLocalNetworks(itt);
 			//add local hostname
-			m_pWebEm->AddLocalNetworks("");
+			strarray.push_back("");
+			m_pWebEm->SetLocalNetworks(strarray);
 
-			m_pWebEm->ClearRemoteProxyIPs();
 			strarray.clear();
 			StringSplit(WebRemoteProxyIPs, ";", strarray);
-			for (const auto & itt : strarray)
-				m_pWebEm->AddRemoteProxyIPs(itt);
+			m_pWebEm->SetRemoteProxyIPs(strarray);
 
 			if (session.username.empty())
 			{
@@ -7628,6 +7801,8 @@ namespace http {
 
 			std::string senableautobackup = request::findValue(&req, "enableautobackup");
 			m_sql.UpdatePreferencesVar("UseAutoBackup", (senableautobackup == "on" ? 1 : 0));
+			std::string scompressautobackup = request::findValue(&req, "compressautobackup");
+			m_sql.UpdatePreferencesVar("CompressAutoBackup", (scompressautobackup == "on" ? 1 : 0));
 
 			float CostEnergy = static_cast<float>(atof(request::findValue(&req, "CostEnergy").c_str()));
 			float CostEnergyT2 = static_cast<float>(atof(request::findValue(&req, "CostEnergyT2").c_str()));
@@ -7649,8 +7824,7 @@ namespace http {
 			rnvalue = atoi(request::findValue(&req, "ActiveTimerPlan").c_str());
 			if (rnOldvalue != rnvalue)
 			{
-				m_sql.UpdatePreferencesVar("ActiveTimerPlan", rnvalue);
-				m_sql.m_ActiveTimerPlan = rnvalue;
+				m_sql.SetActiveTimerPlan(rnvalue);
 				m_mainworker.m_scheduler.ReloadSchedules();
 			}
 			m_sql.UpdatePreferencesVar("DoorbellCommand", atoi(request::findValue(&req, "DoorbellCommand").c_str()));
@@ -7874,6 +8048,10 @@ namespace http {
 			m_mainworker.StopDomoticzHardware();
 
 			m_sql.RestoreDatabase(dbasefile);
+			m_fibaropush.ReloadLinks();
+			m_httppush.ReloadLinks();
+			m_influxpush.ReloadLinks();
+			m_googlepubsubpush.ReloadLinks();
 			m_mainworker.AddAllDomoticzHardware();
 		}
 
@@ -7899,7 +8077,8 @@ namespace http {
 			const bool bFetchFavorites,
 			const time_t LastUpdate,
 			const std::string &username,
-			const std::string &hardwareid)
+			const std::string &hardwareid,
+			const _tDeviceChangeSet *pChanges)
 		{
 			std::vector<std::vector<std::string> > result;
 
@@ -7990,21 +8169,22 @@ namespace http {
 			unsigned char tempsign = m_sql.m_tempsign[0];
 
 			bool bHaveUser = false;
-			int iUser = -1;
+			_tWebUserPassword user;
+			bool bFoundUser = false;
 			unsigned int totUserDevices = 0;
 			bool bShowScenes = true;
 			bHaveUser = (username != "");
 			if (bHaveUser)
 			{
-				iUser = FindUser(username.c_str());
-				if (iUser != -1)
+				bFoundUser = FindUser(username.c_str(), user);
+				if (bFoundUser)
 				{
-					_eUserRights urights = m_users[iUser].userrights;
+					_eUserRights urights = user.userrights;
 					if (urights != URIGHTS_ADMIN)
 					{
-						result = m_sql.safe_query("SELECT DeviceRowID FROM SharedDevices WHERE (SharedUserID == %lu)", m_users[iUser].ID);
+						result = m_sql.safe_query("SELECT DeviceRowID FROM SharedDevices WHERE (SharedUserID == %lu)", user.ID);
 						totUserDevices = (unsigned int)result.size();
-						bShowScenes = (m_users[iUser].ActiveTabs&(1 << 1)) != 0;
+						bShowScenes = (user.ActiveTabs&(1 << 1)) != 0;
 					}
 				}
 			}
@@ -8017,7 +8197,8 @@ namespace http {
 			{
 				if (
 					(bShowScenes) &&
-					((rused == "all") || (rused == "true"))
+					((rused == "all") || (rused == "true")) &&
+					((pChanges == NULL) || (!pChanges->Scenes.empty()))
 					)
 				{
 					//add scenes
@@ -8061,6 +8242,9 @@ namespace http {
 						{
 							std::vector<std::string> sd = itt;
 
+							if ((pChanges != NULL) && (pChanges->Scenes.find(std::strtoull(sd[0].c_str(), nullptr, 10)) == pChanges->Scenes.end()))
+								continue;
+
 							unsigned char favorite = atoi(sd[4].c_str());
 							//Check if we only want favorite devices
 							if ((bFetchFavorites) && (!favorite))
@@ -8144,6 +8328,10 @@ namespace http {
 				}
 			}
 
+			//Incremental request without changed devices
+			if ((pChanges != NULL) && (pChanges->Devices.empty()))
+				return;
+
 			char szData[250];
 			if (totUserDevices == 0)
 			{
@@ -8259,13 +8447,13 @@ namespace http {
 			}
 			else
 			{
-				if (iUser == -1) {
+				if (!bFoundUser) {
 					return;
 				}
 				//Specific devices
 				if (rowid != "")
 				{
-					//_log.Log(LOG_STATUS, "Getting device with id: %s for user %lu", rowid.c_str(), m_users[iUser].ID);
+					//_log.Log(LOG_STATUS, "Getting device with id: %s for user %lu", rowid.c_str(), user.ID);
 					result = m_sql.safe_query(
 						"SELECT A.ID, A.DeviceID, A.Unit, A.Name, A.Used,"
 						" A.Type, A.SubType, A.SignalLevel, A.BatteryLevel,"
@@ -8279,7 +8467,7 @@ namespace http {
 						"FROM DeviceStatus as A, SharedDevices as B "
 						"WHERE (B.DeviceRowID==a.ID)"
 						" AND (B.SharedUserID==%lu) AND (A.ID=='%q')",
-						m_users[iUser].ID, rowid.c_str());
+						user.ID, rowid.c_str());
 				}
 				else if ((planID != "") && (planID != "0"))
 					result = m_sql.safe_query(
@@ -8297,7 +8485,7 @@ namespace http {
 						"WHERE (C.PlanID=='%q') AND (C.DeviceRowID==a.ID)"
 						" AND (B.DeviceRowID==a.ID) "
 						"AND (B.SharedUserID==%lu) ORDER BY C.[Order]",
-						planID.c_str(), m_users[iUser].ID);
+						planID.c_str(), user.ID);
 				else if ((floorID != "") && (floorID != "0"))
 					result = m_sql.safe_query(
 						"SELECT A.ID, A.DeviceID, A.Unit, A.Name, A.Used,"
@@ -8314,7 +8502,7 @@ namespace http {
 						"WHERE (D.FloorplanID=='%q') AND (D.ID==C.PlanID)"
 						" AND (C.DeviceRowID==a.ID) AND (B.DeviceRowID==a.ID)"
 						" AND (B.SharedUserID==%lu) ORDER BY C.[Order]",
-						floorID.c_str(), m_users[iUser].ID);
+						floorID.c_str(), user.ID);
 				else {
 					if (!bDisplayHidden)
 					{
@@ -8345,7 +8533,7 @@ namespace http {
 					{
 						sprintf(szOrderBy, "A.[Order],A.%%s ASC");
 					}
-					// _log.Log(LOG_STATUS, "Getting all devices for user %lu", m_users[iUser].ID);
+					// _log.Log(LOG_STATUS, "Getting all devices for user %lu", user.ID);
 					szQuery = (
 						"SELECT A.ID, A.DeviceID, A.Unit, A.Name, A.Used,"
 						" A.Type, A.SubType, A.SignalLevel, A.BatteryLevel,"
@@ -8361,7 +8549,7 @@ namespace http {
 						"WHERE (B.DeviceRowID==A.ID)"
 						" AND (B.SharedUserID==%lu) ORDER BY ");
 					szQuery += szOrderBy;
-					result = m_sql.safe_query(szQuery.c_str(), m_users[iUser].ID, order.c_str());
+					result = m_sql.safe_query(szQuery.c_str(), user.ID, order.c_str());
 				}
 			}
 
@@ -8371,6 +8559,9 @@ namespace http {
 				{
 					std::vector<std::string> sd = itt;
 
+					if ((pChanges != NULL) && (pChanges->Devices.find(std::strtoull(sd[0].c_str(), nullptr, 10)) == pChanges->Devices.end()))
+						continue;
+
 					unsigned char favorite = atoi(sd[12].c_str());
 					if ((planID != "") && (planID != "0"))
 						favorite = 1;
@@ -8802,13 +8993,7 @@ namespace http {
 						root["result"][ii]["StrParam1"] = strParam1;
 						root["result"][ii]["StrParam2"] = strParam2;
 
-						std::string IconFile = "Light";
-						std::map<int, int>::const_iterator ittIcon = m_custom_light_icons_lookup.find(CustomImage);
-						if (ittIcon != m_custom_light_icons_lookup.end())
-						{
-							IconFile = m_custom_light_icons[ittIcon->second].RootFile;
-						}
-						root["result"][ii]["Image"] = IconFile;
+						root["result"][ii]["Image"] = GetCustomIconFile(CustomImage, "Light");
 
 						if (switchtype == STYPE_Dimmer)
 						{
@@ -8869,10 +9054,11 @@ namespace http {
 						}
 
 						bool bIsSubDevice = false;
-						std::vector<std::vector<std::string> > resultSD;
-						resultSD = m_sql.safe_query("SELECT ID FROM LightSubDevices WHERE (DeviceRowID=='%q')",
-							sd[0].c_str());
-						bIsSubDevice = (resultSD.size() > 0);
+						{
+							CSQLStatement stmt(m_sql, "SELECT ID FROM LightSubDevices WHERE (DeviceRowID==?) LIMIT 1");
+							stmt.Bind(sd[0]);
+							bIsSubDevice = stmt.Step();
+						}
 
 						root["result"][ii]["IsSubDevice"] = bIsSubDevice;
 
@@ -9479,32 +9665,32 @@ namespace http {
 							char szDate[40];
 							sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
 
-							std::vector<std::vector<std::string> > result2;
-
-							if (dSubType != sTypeRAINWU)
+							bool bHaveRainToday = false;
+							double rain_total = 0;
 							{
-								result2 = m_sql.safe_query(
-									"SELECT MIN(Total), MAX(Total) FROM Rain WHERE (DeviceRowID='%q' AND Date>='%q')", sd[0].c_str(), szDate);
-							}
-							else
-							{
-								result2 = m_sql.safe_query(
-									"SELECT Total, Total FROM Rain WHERE (DeviceRowID='%q' AND Date>='%q') ORDER BY ROWID DESC LIMIT 1", sd[0].c_str(), szDate);
+								CSQLStatement stmt(m_sql, (dSubType != sTypeRAINWU) ?
+									"SELECT MIN(Total) FROM Rain WHERE (DeviceRowID=? AND Date>=?)" :
+									"SELECT Total FROM Rain WHERE (DeviceRowID=? AND Date>=?) ORDER BY ROWID DESC LIMIT 1");
+								stmt.Bind(sd[0]).Bind(szDate);
+								if (stmt.Step() && !stmt.IsNull(0))
+								{
+									bHaveRainToday = true;
+									rain_total = stmt.GetDouble(0);
+								}
 							}
-							if (!result2.empty())
+							if (bHaveRainToday)
 							{
 								double total_real = 0;
 								float rate = 0;
-								std::vector<std::string> sd2 = result2[0];
 								if (dSubType != sTypeRAINWU)
 								{
-									double total_min = atof(sd2[0].c_str());
+									double total_min = rain_total;
 									double total_max = atof(strarray[1].c_str());
 									total_real = total_max - total_min;
 								}
 								else
 								{
-									total_real = atof(sd2[1].c_str());
+									total_real = rain_total;
 								}
 								total_real *= AddjMulti;
 								rate = (static_cast<float>(atof(strarray[0].c_str())) / 100.0f)*float(AddjMulti);
@@ -9538,20 +9724,11 @@ namespace http {
 						}
 
 						//get value of today
-						time_t now = mytime(NULL);
-						struct tm ltime;
-						localtime_r(&now, &ltime);
-						char szDate[40];
-						sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-						std::vector<std::vector<std::string> > result2;
+						_tMeterToday meterToday;
 						strcpy(szTmp, "0");
-						result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')", sd[0].c_str(), szDate);
-						if (!result2.empty())
+						if (m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 						{
-							std::vector<std::string> sd2 = result2[0];
-
-							uint64_t total_min = std::stoull(sd2[0]);
+							uint64_t total_min = (uint64_t)meterToday.MinValue;
 							uint64_t total_max = std::stoull(sValue);
 							uint64_t total_real = total_max - total_min;
 							sprintf(szTmp, "%" PRIu64, total_real);
@@ -9644,20 +9821,11 @@ namespace http {
 						float divider = m_sql.GetCounterDivider(int(metertype), int(dType), float(AddjValue2));
 
 						//get value of today
-						time_t now = mytime(NULL);
-						struct tm ltime;
-						localtime_r(&now, &ltime);
-						char szDate[40];
-						sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-						std::vector<std::vector<std::string> > result2;
+						_tMeterToday meterToday;
 						strcpy(szTmp, "0");
-						result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')", sd[0].c_str(), szDate);
-						if (!result2.empty())
+						if (m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 						{
-							std::vector<std::string> sd2 = result2[0];
-
-							uint64_t total_min = std::stoull(sd2[0]);
+							uint64_t total_min = (uint64_t)meterToday.MinValue;
 							uint64_t total_max = std::stoull(sValue);
 							uint64_t total_real = total_max - total_min;
 							sprintf(szTmp, "%" PRIu64, total_real);
@@ -9815,49 +9983,38 @@ namespace http {
 						float divider = m_sql.GetCounterDivider(int(metertype), int(dType), float(AddjValue2));
 
 						//get value of today
-						time_t now = mytime(NULL);
-						struct tm ltime;
-						localtime_r(&now, &ltime);
-						char szDate[40];
-						sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-						std::vector<std::vector<std::string> > result2;
-						strcpy(szTmp, "0");
-						result2 = m_sql.safe_query("SELECT MIN(Value), MAX(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')", sd[0].c_str(), szDate);
-						if (!result2.empty())
-						{
-							std::vector<std::string> sd2 = result2[0];
+						_tMeterToday meterToday = { 0, 0 };
+						m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday);
 
-							unsigned long long total_min = std::strtoull(sd2[0].c_str(), nullptr, 10);
-							unsigned long long total_max = std::strtoull(sd2[1].c_str(), nullptr, 10);
-							unsigned long long total_real;
+						unsigned long long total_min = (unsigned long long)meterToday.MinValue;
+						unsigned long long total_max = (unsigned long long)meterToday.MaxValue;
+						unsigned long long total_real;
 
-							total_real = total_max - total_min;
-							sprintf(szTmp, "%llu", total_real);
+						total_real = total_max - total_min;
+						sprintf(szTmp, "%llu", total_real);
 
-							musage = 0;
-							switch (metertype)
-							{
-							case MTYPE_ENERGY:
-							case MTYPE_ENERGY_GENERATED:
-								musage = float(total_real) / divider;
-								sprintf(szTmp, "%.3f kWh", musage);
-								break;
-							case MTYPE_GAS:
-								musage = float(total_real) / divider;
-								sprintf(szTmp, "%.3f m3", musage);
-								break;
-							case MTYPE_WATER:
-								musage = float(total_real) / divider;
-								sprintf(szTmp, "%.3f m3", musage);
-								break;
-							case MTYPE_COUNTER:
-								sprintf(szTmp, "%llu %s", total_real, ValueUnits.c_str());
-								break;
-							default:
-								strcpy(szTmp, "0");
-								break;
-							}
+						musage = 0;
+						switch (metertype)
+						{
+						case MTYPE_ENERGY:
+						case MTYPE_ENERGY_GENERATED:
+							musage = float(total_real) / divider;
+							sprintf(szTmp, "%.3f kWh", musage);
+							break;
+						case MTYPE_GAS:
+							musage = float(total_real) / divider;
+							sprintf(szTmp, "%.3f m3", musage);
+							break;
+						case MTYPE_WATER:
+							musage = float(total_real) / divider;
+							sprintf(szTmp, "%.3f m3", musage);
+							break;
+						case MTYPE_COUNTER:
+							sprintf(szTmp, "%llu %s", total_real, ValueUnits.c_str());
+							break;
+						default:
+							strcpy(szTmp, "0");
+							break;
 						}
 						root["result"][ii]["CounterToday"] = szTmp;
 
@@ -10007,24 +10164,13 @@ namespace http {
 							root["result"][ii]["HaveTimeout"] = bHaveTimeout;
 
 							//get value of today
-							time_t now = mytime(NULL);
-							struct tm ltime;
-							localtime_r(&now, &ltime);
-							char szDate[40];
-							sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-							std::vector<std::vector<std::string> > result2;
-							strcpy(szTmp, "0");
-							result2 = m_sql.safe_query("SELECT MIN(Value1), MIN(Value2), MIN(Value5), MIN(Value6) FROM MultiMeter WHERE (DeviceRowID='%q' AND Date>='%q')",
-								sd[0].c_str(), szDate);
-							if (!result2.empty())
+							_tMultiMeterToday meterToday;
+							if (m_sql.GetMultiMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 							{
-								std::vector<std::string> sd2 = result2[0];
-
-								unsigned long long total_min_usage_1 = std::strtoull(sd2[0].c_str(), nullptr, 10);
-								unsigned long long total_min_deliv_1 = std::strtoull(sd2[1].c_str(), nullptr, 10);
-								unsigned long long total_min_usage_2 = std::strtoull(sd2[2].c_str(), nullptr, 10);
-								unsigned long long total_min_deliv_2 = std::strtoull(sd2[3].c_str(), nullptr, 10);
+								unsigned long long total_min_usage_1 = (unsigned long long)meterToday.MinValue[0];
+								unsigned long long total_min_deliv_1 = (unsigned long long)meterToday.MinValue[1];
+								unsigned long long total_min_usage_2 = (unsigned long long)meterToday.MinValue[4];
+								unsigned long long total_min_deliv_2 = (unsigned long long)meterToday.MinValue[5];
 								unsigned long long total_real_usage, total_real_deliv;
 
 								total_real_usage = powerusage - (total_min_usage_1 + total_min_usage_2);
@@ -10050,24 +10196,14 @@ namespace http {
 						root["result"][ii]["SwitchTypeVal"] = MTYPE_GAS;
 
 						//get lowest value of today
-						time_t now = mytime(NULL);
-						struct tm ltime;
-						localtime_r(&now, &ltime);
-						char szDate[40];
-						sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-						std::vector<std::vector<std::string> > result2;
+						_tMeterToday meterToday;
 
 						float divider = m_sql.GetCounterDivider(int(metertype), int(dType), float(AddjValue2));
 
 						strcpy(szTmp, "0");
-						result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')",
-							sd[0].c_str(), szDate);
-						if (!result2.empty())
+						if (m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 						{
-							std::vector<std::string> sd2 = result2[0];
-
-							uint64_t total_min_gas = std::stoull(sd2[0]);
+							uint64_t total_min_gas = (uint64_t)meterToday.MinValue;
 							uint64_t gasactual = std::stoull(sValue);
 							uint64_t total_real_gas = gasactual - total_min_gas;
 
@@ -10169,22 +10305,13 @@ namespace http {
 						{
 							double total = atof(strarray[1].c_str()) / 1000;
 
-							time_t now = mytime(NULL);
-							struct tm ltime;
-							localtime_r(&now, &ltime);
-							char szDate[40];
-							sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-							std::vector<std::vector<std::string> > result2;
+							_tMeterToday meterToday;
 							strcpy(szTmp, "0");
-							result2 = m_sql.safe_query("SELECT MIN(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')",
-								sd[0].c_str(), szDate);
-							if (!result2.empty())
+							if (m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 							{
 								float divider = m_sql.GetCounterDivider(int(metertype), int(dType), float(AddjValue2));
 
-								std::vector<std::string> sd2 = result2[0];
-								double minimum = atof(sd2[0].c_str()) / divider;
+								double minimum = double(meterToday.MinValue) / divider;
 
 								sprintf(szData, "%.3f kWh", total);
 								root["result"][ii]["Data"] = szData;
@@ -10394,13 +10521,7 @@ namespace http {
 
 							std::string IconFile = "Custom";
 							if (CustomImage != 0)
-							{
-								std::map<int, int>::const_iterator ittIcon = m_custom_light_icons_lookup.find(CustomImage);
-								if (ittIcon != m_custom_light_icons_lookup.end())
-								{
-									IconFile = m_custom_light_icons[ittIcon->second].RootFile;
-								}
-							}
+								IconFile = GetCustomIconFile(CustomImage, IconFile);
 							root["result"][ii]["Image"] = IconFile;
 							root["result"][ii]["TypeImg"] = IconFile;
 						}
@@ -10657,8 +10778,9 @@ namespace http {
 							root["result"][ii]["StrParam2"] = strParam2;
 							root["result"][ii]["Protected"] = (iProtected != 0);
 
-							if (CustomImage < static_cast<int>(m_custom_light_icons.size()))
-								root["result"][ii]["Image"] = m_custom_light_icons[CustomImage].RootFile;
+							std::vector<_tCustomIcon> custom_light_icons = GetCustomIcons();
+							if (CustomImage < static_cast<int>(custom_light_icons.size()))
+								root["result"][ii]["Image"] = custom_light_icons[CustomImage].RootFile;
 							else
 								root["result"][ii]["Image"] = "Light";
 
@@ -10677,22 +10799,12 @@ namespace http {
 						case sTypeRego6XXCounter:
 						{
 							//get value of today
-							time_t now = mytime(NULL);
-							struct tm ltime;
-							localtime_r(&now, &ltime);
-							char szDate[40];
-							sprintf(szDate, "%04d-%02d-%02d", ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
-
-							std::vector<std::vector<std::string> > result2;
+							_tMeterToday meterToday;
 							strcpy(szTmp, "0");
-							result2 = m_sql.safe_query("SELECT MIN(Value), MAX(Value) FROM Meter WHERE (DeviceRowID='%q' AND Date>='%q')",
-								sd[0].c_str(), szDate);
-							if (!result2.empty())
+							if (m_sql.GetMeterToday(std::strtoull(sd[0].c_str(), nullptr, 10), meterToday))
 							{
-								std::vector<std::string> sd2 = result2[0];
-
-								unsigned long long total_min = std::strtoull(sd2[0].c_str(), nullptr, 10);
-								unsigned long long total_max = std::strtoull(sd2[1].c_str(), nullptr, 10);
+								unsigned long long total_min = (unsigned long long)meterToday.MinValue;
+								unsigned long long total_max = (unsigned long long)meterToday.MaxValue;
 								unsigned long long total_real;
 
 								total_real = total_max - total_min;
@@ -10933,7 +11045,7 @@ namespace http {
 		{
 			int ii = 0;
 
-			std::vector<_tCustomIcon> temp_custom_light_icons = m_custom_light_icons;
+			std::vector<_tCustomIcon> temp_custom_light_icons = GetCustomIcons();
 			//Sort by name
 			std::sort(temp_custom_light_icons.begin(), temp_custom_light_icons.end(), compareIconsByName);
 
@@ -11327,7 +11439,69 @@ namespace http {
 			root["status"] = "OK";
 			root["title"] = "Devices";
 			root["app_version"] = szAppVersion;
-			GetJSonDevices(root, rused, rfilter, order, rid, planid, floorid, bDisplayHidden, bDisabledDisabled, bFetchFavorites, LastUpdate, session.username, hwidx);
+
+			//Clients pass the ChangeToken of their previous reply as 'since' to get the changed devices and scenes only
+			uint64_t sequence = m_sql.m_devicecache.Synchronize();
+			root["ChangeToken"] = MakeDeviceChangeToken(sequence);
+			uint64_t since;
+			if (!ParseDeviceChangeToken(request::findValue(&req, "since"), since))
+			{
+				root["Incremental"] = false;
+				GetJSonDevices(root, rused, rfilter, order, rid, planid, floorid, bDisplayHidden, bDisabledDisabled, bFetchFavorites, LastUpdate, session.username, hwidx);
+				return;
+			}
+
+			_tDeviceChangeSet changes;
+			m_sql.m_devicecache.GetChangesSince(since, changes);
+			root["Incremental"] = changes.bIncremental;
+			if (!changes.bIncremental)
+			{
+				GetJSonDevices(root, rused, rfilter, order, rid, planid, floorid, bDisplayHidden, bDisabledDisabled, bFetchFavorites, LastUpdate, session.username, hwidx);
+				return;
+			}
+			root["ActTime"] = static_cast<int>(mytime(NULL));
+			if (changes.Devices.empty() && changes.Scenes.empty())
+				return;
+			GetJSonDevices(root, rused, rfilter, order, rid, planid, floorid, bDisplayHidden, bDisabledDisabled, bFetchFavorites, LastUpdate, session.username, hwidx, &changes);
+
+			//Changed rows that are not in the list (anymore), because they were deleted or do not match the filter
+			for (const auto & itt : root["result"])
+			{
+				uint64_t idx = std::strtoull(itt["idx"].asString().c_str(), nullptr, 10);
+				std::string type = itt["Type"].asString();
+				if ((type == "Scene") || (type == "Group"))
+					changes.Scenes.erase(idx);
+				else
+					changes.Devices.erase(idx);
+			}
+			for (const auto & itt : changes.Devices)
+				root["Removed"].append(std::to_string(itt));
+			for (const auto & itt : changes.Scenes)
+				root["RemovedScenes"].append(std::to_string(itt));
+		}
+
+		//Holds long-polls of the devices list until something changed, and skips the list when the client's ETag is current
+		//Returns false when no content has to be generated
+		bool CWebServer::CheckDevicesChanged(const WebEmSession & session, const request& req, reply & rep)
+		{
+			uint64_t sequence = m_sql.m_devicecache.Synchronize();
+			uint64_t since;
+			int wait = atoi(request::findValue(&req, "wait").c_str());
+			if ((wait > 0) && (!req.long_poll_retry) && (ParseDeviceChangeToken(request::findValue(&req, "since"), since)) && (since == sequence))
+			{
+				rep.long_poll_ready = [since]() { return (m_sql.m_devicecache.GetChangeSequence() != since); };
+				rep.long_poll_timeout = std::min(wait, DEVICES_LONG_POLL_MAX);
+				rep.long_poll_notify = [since](const std::function<void()> &wake) { m_sql.m_devicecache.NotifyChange(since, wake); };
+				return false;
+			}
+			//Timeouts and sun times change without database changes, so the tag also expires every minute
+			std::stringstream sstr;
+			sstr << "W/\"" << MakeDeviceChangeToken(sequence) << "-" << (mytime(NULL) / 60) << "-" << std::hash<std::string>()(session.username) << "\"";
+			std::string etag = sstr.str();
+			reply::add_header(&rep, "ETag", etag);
+			//cWebemRequestHandler replies with a 304
+			const char *if_none_match = request::get_req_header(&req, "If-None-Match");
+			return ((if_none_match == NULL) || (etag != if_none_match));
 		}
 
 		void CWebServer::RType_Users(WebEmSession & session, const request& req, Json::Value &root)
@@ -11336,9 +11510,9 @@ namespace http {
 			int urights = 3;
 			if (bHaveUser)
 			{
-				int iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
-					urights = static_cast<int>(m_users[iUser].userrights);
+				_tWebUserPassword user;
+				if (FindUser(session.username.c_str(), user))
+					urights = static_cast<int>(user.userrights);
 			}
 			if (urights < 2)
 				return;
@@ -11373,9 +11547,9 @@ namespace http {
 			int urights = 3;
 			if (bHaveUser)
 			{
-				int iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
-					urights = static_cast<int>(m_users[iUser].userrights);
+				_tWebUserPassword user;
+				if (FindUser(session.username.c_str(), user))
+					urights = static_cast<int>(user.userrights);
 			}
 			if (urights < 2)
 				return;
@@ -11406,14 +11580,15 @@ namespace http {
 		void CWebServer::Cmd_SetSetpoint(WebEmSession & session, const request& req, Json::Value &root)
 		{
 			bool bHaveUser = (session.username != "");
-			int iUser = -1;
+			_tWebUserPassword user;
+			bool bFoundUser = false;
 			int urights = 3;
 			if (bHaveUser)
 			{
-				iUser = FindUser(session.username.c_str());
-				if (iUser != -1)
+				bFoundUser = FindUser(session.username.c_str(), user);
+				if (bFoundUser)
 				{
-					urights = static_cast<int>(m_users[iUser].userrights);
+					urights = static_cast<int>(user.userrights);
 				}
 			}
 			if (urights < 1)
@@ -11428,9 +11603,9 @@ namespace http {
 				return;
 			root["status"] = "OK";
 			root["title"] = "SetSetpoint";
-			if (iUser != -1)
+			if (bFoundUser)
 			{
-				_log.Log(LOG_STATUS, "User: %s initiated a SetPoint command", m_users[iUser].Username.c_str());
+				_log.Log(LOG_STATUS, "User: %s initiated a SetPoint command", user.Username.c_str());
 			}
 			m_mainworker.SetSetPoint(idx, static_cast<float>(atof(setpoint.c_str())));
 		}
@@ -11740,7 +11915,7 @@ namespace http {
 			root["status"] = "OK";
 			root["title"] = "GetCustomIconSet";
 			int ii = 0;
-			for (const auto & itt : m_custom_light_icons)
+			for (const auto & itt : GetCustomIcons())
 			{
 				if (itt.idx >= 100)
 				{
@@ -11777,7 +11952,7 @@ namespace http {
 			m_sql.safe_query("DELETE FROM CustomImages WHERE (ID == %d)", idx);
 
 			//Delete icons file from disk
-			for (const auto & itt : m_custom_light_icons)
+			for (const auto & itt : GetCustomIcons())
 			{
 				if (itt.idx == idx + 100)
 				{
@@ -11937,6 +12112,30 @@ namespace http {
 			m_sql.VacuumDatabase();
 		}
 
+		//Copies a short log between the database table and the time series store (action=import|export)
+		void CWebServer::Cmd_TimeSeries(WebEmSession & session, const request& req, Json::Value &root)
+		{
+			if (session.rights != 2)
+			{
+				session.reply_status = reply::forbidden;
+				return; //Only admin user allowed
+			}
+			std::string saction = request::findValue(&req, "action");
+			std::string stable = request::findValue(&req, "table");
+			if (stable.empty())
+				stable = "Temperature";
+			if (!m_sql.IsTimeSeriesEnabled())
+				return;
+			if (saction == "import")
+				root["rows"] = m_sql.ImportTimeSeries(stable);
+			else if (saction == "export")
+				root["rows"] = m_sql.ExportTimeSeries(stable);
+			else
+				return;
+			root["status"] = "OK";
+			root["title"] = "TimeSeries";
+		}
+
 		void CWebServer::Cmd_AddMobileDevice(WebEmSession & session, const request& req, Json::Value &root)
 		{
 			std::string suuid = request::findValue(&req, "uuid");
@@ -12271,11 +12470,6 @@ namespace http {
 			char szTmp[200];
 
 			bool bHaveUser = (session.username != "");
-			int iUser = -1;
-			if (bHaveUser)
-			{
-				iUser = FindUser(session.username.c_str());
-			}
 
 			int switchtype = -1;
 			if (sswitchtype != "")
@@ -12358,11 +12552,11 @@ namespace http {
 				int urights = 3;
 				if (bHaveUser)
 				{
-					int iUser = FindUser(session.username.c_str());
-					if (iUser != -1)
+					_tWebUserPassword user;
+					if (FindUser(session.username.c_str(), user))
 					{
-						urights = static_cast<int>(m_users[iUser].userrights);
-						_log.Log(LOG_STATUS, "User: %s initiated a SetPoint command", m_users[iUser].Username.c_str());
+						urights = static_cast<int>(user.userrights);
+						_log.Log(LOG_STATUS, "User: %s initiated a SetPoint command", user.Username.c_str());
 					}
 				}
 				if (urights < 1)
@@ -12379,11 +12573,11 @@ namespace http {
 				int urights = 3;
 				if (bHaveUser)
 				{
-					int iUser = FindUser(session.username.c_str());
-					if (iUser != -1)
+					_tWebUserPassword user;
+					if (FindUser(session.username.c_str(), user))
 					{
-						urights = static_cast<int>(m_users[iUser].userrights);
-						_log.Log(LOG_STATUS, "User: %s initiated a SetClock command", m_users[iUser].Username.c_str());
+						urights = static_cast<int>(user.userrights);
+						_log.Log(LOG_STATUS, "User: %s initiated a SetClock command", user.Username.c_str());
 					}
 				}
 				if (urights < 1)
@@ -12395,11 +12589,11 @@ namespace http {
 				int urights = 3;
 				if (bHaveUser)
 				{
-					int iUser = FindUser(session.username.c_str());
-					if (iUser != -1)
+					_tWebUserPassword user;
+					if (FindUser(session.username.c_str(), user))
 					{
-						urights = static_cast<int>(m_users[iUser].userrights);
-						_log.Log(LOG_STATUS, "User: %s initiated a Thermostat Mode command", m_users[iUser].Username.c_str());
+						urights = static_cast<int>(user.userrights);
+						_log.Log(LOG_STATUS, "User: %s initiated a Thermostat Mode command", user.Username.c_str());
 					}
 				}
 				if (urights < 1)
@@ -12411,11 +12605,11 @@ namespace http {
 				int urights = 3;
 				if (bHaveUser)
 				{
-					int iUser = FindUser(session.username.c_str());
-					if (iUser != -1)
+					_tWebUserPassword user;
+					if (FindUser(session.username.c_str(), user))
 					{
-						urights = static_cast<int>(m_users[iUser].userrights);
-						_log.Log(LOG_STATUS, "User: %s initiated a Thermostat Fan Mode command", m_users[iUser].Username.c_str());
+						urights = static_cast<int>(user.userrights);
+						_log.Log(LOG_STATUS, "User: %s initiated a Thermostat Fan Mode command", user.Username.c_str());
 					}
 				}
 				if (urights < 1)
@@ -12674,6 +12868,10 @@ namespace http {
 				{
 					root["UseAutoBackup"] = nValue;
 				}
+				else if (Key == "CompressAutoBackup")
+				{
+					root["CompressAutoBackup"] = nValue;
+				}
 				else if (Key == "Rego6XXType")
 				{
 					root["Rego6XXType"] = nValue;
@@ -13242,7 +13440,10 @@ namespace http {
 					root["status"] = "OK";
 					root["title"] = "Graph " + sensor + " " + srange;
 
-					result = m_sql.safe_query("SELECT Temperature, Chill, Humidity, Barometer, Date, SetPoint FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
+					if (m_sql.IsTimeSeriesEnabled())
+						result = m_sql.QueryTimeSeries(dbasetable, idx, "0000-01-01", "9999-12-31 23:59:59");
+					else
+						result = m_sql.safe_query("SELECT Temperature, Chill, Humidity, Barometer, DewPoint, SetPoint, Date FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
 					if (!result.empty())
 					{
 						int ii = 0;
@@ -13250,7 +13451,7 @@ namespace http {
 						{
 							std::vector<std::string> sd = itt;
 
-							root["result"][ii]["d"] = sd[4].substr(0, 16);
+							root["result"][ii]["d"] = sd[6].substr(0, 16);
 							if (
 								(dType == pTypeRego6XXTemp) ||
 								(dType == pTypeTEMP) ||
@@ -13841,7 +14042,6 @@ namespace http {
 						}
 
 						int ii = 0;
-						result = m_sql.safe_query("SELECT Value,[Usage], Date FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
 
 						int method = 0;
 						std::string sMethod = request::findValue(&req, "method");
@@ -13869,7 +14069,61 @@ namespace http {
 						std::string LastDateTime = "";
 						time_t lastTime = 0;
 
-						if (!result.empty())
+						if (method == 0)
+						{
+							//bars / hour, from the hourly rollup instead of every sample
+							result = m_sql.safe_query("SELECT Value_Min, Value_Max, Date FROM Meter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d) ORDER BY Date ASC", idx, ROLLUP_HOUR);
+							//the last hour is not complete yet
+							for (size_t jj = 0; jj + 1 < result.size(); jj++)
+							{
+								std::vector<std::string> sd = result[jj];
+
+								//the counter value never goes back
+								ulFirstValue = std::max(ulLastValue, std::strtoll(sd[0].c_str(), nullptr, 10));
+								ulLastValue = std::max(ulLastValue, std::strtoll(sd[1].c_str(), nullptr, 10));
+								if (!bHaveFirstRealValue)
+								{
+									bHaveFirstRealValue = true;
+									ulFirstRealValue = ulFirstValue;
+								}
+
+								root["result"][ii]["d"] = sd[2].substr(0, 13) + ":00";
+
+								long long ulTotalValue = ulLastValue - ulFirstValue;
+								if (ulTotalValue == 0)
+								{
+									//Could be the P1 Gas Meter, only transmits one every 1 a 2 hours
+									ulTotalValue = ulLastValue - ulFirstRealValue;
+								}
+								ulFirstRealValue = ulLastValue;
+								float TotalValue = float(ulTotalValue);
+								switch (metertype)
+								{
+								case MTYPE_ENERGY:
+								case MTYPE_ENERGY_GENERATED:
+									sprintf(szTmp, "%.3f", (TotalValue / divider)*1000.0f);	//from kWh -> Watt
+									break;
+								case MTYPE_GAS:
+									sprintf(szTmp, "%.3f", TotalValue / divider);
+									break;
+								case MTYPE_WATER:
+									sprintf(szTmp, "%.3f", TotalValue / divider);
+									break;
+								case MTYPE_COUNTER:
+									sprintf(szTmp, "%.1f", TotalValue);
+									break;
+								default:
+									strcpy(szTmp, "0");
+									break;
+								}
+								root["result"][ii]["v"] = szTmp;
+								ii++;
+							}
+						}
+						else
+							result = m_sql.safe_query("SELECT Value,[Usage], Date FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
+
+						if ((method != 0) && (!result.empty()))
 						{
 							std::vector<std::vector<std::string> >::const_iterator itt;
 							for (itt = result.begin(); itt!=result.end(); ++itt)
@@ -13991,20 +14245,24 @@ namespace http {
 						std::string LastDateTime = "";
 						time_t lastTime = 0;
 
+						int method = 0;
+						std::string sMethod = request::findValue(&req, "method");
+						if (sMethod.size() > 0)
+							method = atoi(sMethod.c_str());
+
 						if (bIsManagedCounter) {
 							result = m_sql.safe_query("SELECT Usage, Date FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
 							bHaveFirstValue = true;
 							bHaveFirstRealValue = true;
 						}
+						else if (method == 0) {
+							//bars / hour, from the hourly rollup instead of every sample (the lowest value is the first of the hour)
+							result = m_sql.safe_query("SELECT Value_Min, Date, Value_Max FROM Meter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d) ORDER BY Date ASC", idx, ROLLUP_HOUR);
+						}
 						else {
 							result = m_sql.safe_query("SELECT Value, Date FROM %s WHERE (DeviceRowID==%" PRIu64 ") ORDER BY Date ASC", dbasetable.c_str(), idx);
 						}
 
-						int method = 0;
-						std::string sMethod = request::findValue(&req, "method");
-						if (sMethod.size() > 0)
-							method = atoi(sMethod.c_str());
-
 						if (!result.empty())
 						{
 							for (const auto & itt : result)
@@ -14139,6 +14397,9 @@ namespace http {
 						}
 						if ((!bIsManagedCounter) && (bHaveFirstValue) && (method == 0))
 						{
+							//highest value of the running hour
+							ulLastValue = std::strtoull(result.back()[2].c_str(), nullptr, 10);
+
 							//add last value
 							root["result"][ii]["d"] = LastDateTime + ":00";
 
@@ -15294,15 +15555,65 @@ namespace http {
 
 					int ii = 0;
 					iPrev = 0;
+
+					//resolution=month gives one value per month, read from the monthly rollup
+					bool bMonthResolution = (request::findValue(&req, "resolution") == "month") && ((dType == pTypeP1Power) || (dbasetable == "Meter_Calendar"));
+					bool bAddToday = false;
+					std::string szThisMonth;
+					if (bMonthResolution)
+					{
+						szDateStart[8] = '0';
+						szDateStart[9] = '1';
+						szDateStartPrev[8] = '0';
+						szDateStartPrev[9] = '1';
+
+						//today is not in the rollup yet, it is added to the running month
+						struct tm loctime;
+						time_t now = mytime(NULL);
+						localtime_r(&now, &loctime);
+						char szToday[40];
+						sprintf(szToday, "%04d-%02d-%02d", loctime.tm_year + 1900, loctime.tm_mon + 1, loctime.tm_mday);
+						szThisMonth = std::string(szToday).substr(0, 8) + "01";
+						bAddToday = (strcmp(szToday, szDateStart) >= 0) && ((sactyear == "") || (strcmp(szToday, szDateEnd) < 0));
+					}
+
 					if (dType == pTypeP1Power)
 					{
 						//Actual Year
-						result = m_sql.safe_query(
-							"SELECT Value1,Value2,Value5,Value6, Date,"
-							" Counter1, Counter2, Counter3, Counter4 "
-							"FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q'"
-							" AND Date<='%q') ORDER BY Date ASC",
-							dbasetable.c_str(), idx, szDateStart, szDateEnd);
+						if (bMonthResolution)
+						{
+							result = m_sql.safe_query(
+								"SELECT Value1_Sum, Value2_Sum, Value5_Sum, Value6_Sum, Date,"
+								" Counter1, Counter2, Counter3, Counter4 "
+								"FROM MultiMeter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d"
+								" AND Date>='%q' AND Date<'%q') ORDER BY Date ASC",
+								idx, ROLLUP_MONTH, szDateStart, szDateEnd);
+							_tMultiMeterToday meterToday;
+							if ((bAddToday) && (m_sql.GetMultiMeterToday(idx, meterToday)))
+							{
+								if ((result.empty()) || (result.back()[4] != szThisMonth))
+									result.push_back({ "0", "0", "0", "0", szThisMonth, "0", "0", "0", "0" });
+								std::vector<std::string> &sd = result.back();
+								//Value1, Value2, Value5 and Value6, with their counters
+								const int values[4] = { 0, 1, 4, 5 };
+								for (int jj = 0; jj < 4; jj++)
+								{
+									const int64_t todayMin = meterToday.MinValue[values[jj]];
+									const int64_t todayMax = meterToday.MaxValue[values[jj]];
+									sd[jj] = std::to_string(atof(sd[jj].c_str()) + double(todayMax - todayMin));
+									sd[5 + jj] = std::to_string(std::max(atof(sd[5 + jj].c_str()), double(todayMax)));
+								}
+							}
+						}
+						else
+						{
+							result = m_sql.safe_query(
+								"SELECT Value1,Value2,Value5,Value6, Date,"
+								" Counter1, Counter2, Counter3, Counter4 "
+								"FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q'"
+								" AND Date<='%q') ORDER BY Date ASC",
+								dbasetable.c_str(), idx, szDateStart, szDateEnd);
+						}
 						if (!result.empty())
 						{
 							bool bHaveDeliverd = false;
@@ -15389,10 +15700,16 @@ namespace http {
 							}
 						}
 						//Previous Year
-						result = m_sql.safe_query(
-							"SELECT Value1,Value2,Value5,Value6, Date "
-							"FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC",
-							dbasetable.c_str(), idx, szDateStartPrev, szDateEndPrev);
+						if (bMonthResolution)
+							result = m_sql.safe_query(
+								"SELECT Value1_Sum, Value2_Sum, Value5_Sum, Value6_Sum, Date "
+								"FROM MultiMeter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d AND Date>='%q' AND Date<'%q') ORDER BY Date ASC",
+								idx, ROLLUP_MONTH, szDateStartPrev, szDateEndPrev);
+						else
+							result = m_sql.safe_query(
+								"SELECT Value1,Value2,Value5,Value6, Date "
+								"FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC",
+								dbasetable.c_str(), idx, szDateStartPrev, szDateEndPrev);
 						if (!result.empty())
 						{
 							bool bHaveDeliverd = false;
@@ -15874,7 +16191,21 @@ namespace http {
 							root["counter"] = szTmp;
 						}
 						//Actual Year
-						result = m_sql.safe_query("SELECT Value, Date, Counter FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC", dbasetable.c_str(), idx, szDateStart, szDateEnd);
+						if (bMonthResolution)
+						{
+							result = m_sql.safe_query("SELECT Value_Sum, Date, Counter FROM Meter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d AND Date>='%q' AND Date<'%q') ORDER BY Date ASC", idx, ROLLUP_MONTH, szDateStart, szDateEnd);
+							_tMeterToday meterToday;
+							if ((bAddToday) && (!bIsManagedCounter) && (m_sql.GetMeterToday(idx, meterToday)))
+							{
+								if ((result.empty()) || (result.back()[1] != szThisMonth))
+									result.push_back({ "0", szThisMonth, "0" });
+								std::vector<std::string> &sd = result.back();
+								sd[0] = std::to_string(atof(sd[0].c_str()) + double(meterToday.MaxValue - meterToday.MinValue));
+								sd[2] = std::to_string(std::max(atof(sd[2].c_str()), double(meterToday.MaxValue)));
+							}
+						}
+						else
+							result = m_sql.safe_query("SELECT Value, Date, Counter FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC", dbasetable.c_str(), idx, szDateStart, szDateEnd);
 						if (!result.empty())
 						{
 							for (const auto & itt : result)
@@ -15931,7 +16262,10 @@ namespace http {
 							}
 						}
 						//Past Year
-						result = m_sql.safe_query("SELECT Value, Date, Counter FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC", dbasetable.c_str(), idx, szDateStartPrev, szDateEndPrev);
+						if (bMonthResolution)
+							result = m_sql.safe_query("SELECT Value_Sum, Date, Counter FROM Meter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period==%d AND Date>='%q' AND Date<'%q') ORDER BY Date ASC", idx, ROLLUP_MONTH, szDateStartPrev, szDateEndPrev);
+						else
+							result = m_sql.safe_query("SELECT Value, Date, Counter FROM %s WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q' AND Date<='%q') ORDER BY Date ASC", dbasetable.c_str(), idx, szDateStartPrev, szDateEndPrev);
 						if (!result.empty())
 						{
 							iPrev = 0;
@@ -15992,15 +16326,19 @@ namespace http {
 						}
 					}
 
-					if (dType == pTypeP1Power)
+					if (bMonthResolution)
+					{
+						//today was added to the running month
+					}
+					else if (dType == pTypeP1Power)
 					{
 						result = m_sql.safe_query(
-							"SELECT MIN(Value1), MAX(Value1), MIN(Value2),"
-							" MAX(Value2), MIN(Value5), MAX(Value5),"
-							" MIN(Value6), MAX(Value6) "
-							"FROM MultiMeter WHERE (DeviceRowID=%" PRIu64 ""
-							" AND Date>='%q')",
-							idx, szDateEnd);
+							"SELECT MIN(Value1_Min), MAX(Value1_Max), MIN(Value2_Min),"
+							" MAX(Value2_Max), MIN(Value5_Min), MAX(Value5_Max),"
+							" MIN(Value6_Min), MAX(Value6_Max) "
+							"FROM MultiMeter_Rollup WHERE (DeviceRowID=%" PRIu64 ""
+							" AND Period=%d AND Date>='%q')",
+							idx, ROLLUP_HOUR, szDateEnd);
 						bool bHaveDeliverd = false;
 						if (!result.empty())
 						{
@@ -16179,8 +16517,8 @@ namespace http {
 					else if (!bIsManagedCounter)
 					{
 						result = m_sql.safe_query(
-							"SELECT MIN(Value), MAX(Value) FROM Meter WHERE (DeviceRowID==%" PRIu64 " AND Date>='%q')",
-							idx, szDateEnd);
+							"SELECT MIN(Value_Min), MAX(Value_Max) FROM Meter_Rollup WHERE (DeviceRowID==%" PRIu64 " AND Period=%d AND Date>='%q')",
+							idx, ROLLUP_HOUR, szDateEnd);
 						if (!result.empty())
 						{
 							std::vector<std::string> sd = result[0];
@@ -16422,12 +16760,15 @@ namespace http {
 					if (sgraphtype == "1")
 					{
 						// Need to get all values of the end date so 23:59:59 is appended to the date string
-						result = m_sql.safe_query(
-							"SELECT Temperature, Chill, Humidity, Barometer,"
-							" Date, DewPoint, SetPoint "
-							"FROM Temperature WHERE (DeviceRowID==%" PRIu64 ""
-							" AND Date>='%q' AND Date<='%q 23:59:59') ORDER BY Date ASC",
-							idx, szDateStart.c_str(), szDateEnd.c_str());
+						if (m_sql.IsTimeSeriesEnabled())
+							result = m_sql.QueryTimeSeries("Temperature", idx, szDateStart, szDateEnd + " 23:59:59");
+						else
+							result = m_sql.safe_query(
+								"SELECT Temperature, Chill, Humidity, Barometer,"
+								" DewPoint, SetPoint, Date "
+								"FROM Temperature WHERE (DeviceRowID==%" PRIu64 ""
+								" AND Date>='%q' AND Date<='%q 23:59:59') ORDER BY Date ASC",
+								idx, szDateStart.c_str(), szDateEnd.c_str());
 						int ii = 0;
 						if (!result.empty())
 						{
@@ -16435,7 +16776,7 @@ namespace http {
 							{
 								std::vector<std::string> sd = itt;
 
-								root["result"][ii]["d"] = sd[4];//.substr(0,16);
+								root["result"][ii]["d"] = sd[6];//.substr(0,16);
 								if (sendTemp)
 								{
 									double te = ConvertTemperature(atof(sd[0].c_str()), tempsign);
@@ -16479,12 +16820,12 @@ namespace http {
 								}
 								if (sendDew)
 								{
-									double dp = ConvertTemperature(atof(sd[5].c_str()), tempsign);
+									double dp = ConvertTemperature(atof(sd[4].c_str()), tempsign);
 									root["result"][ii]["dp"] = dp;
 								}
 								if (sendSet)
 								{
-									double se = ConvertTemperature(atof(sd[6].c_str()), tempsign);
+									double se = ConvertTemperature(atof(sd[5].c_str()), tempsign);
 									root["result"][ii]["se"] = se;
 								}
 								ii++;
@@ -7,6 +7,7 @@
 
 struct lua_State;
 struct lua_Debug;
+struct _tDeviceChangeSet;
 
 namespace Json
 {
@@ -70,15 +71,16 @@ public:
 	void ReloadCustomSwitchIcons();
 
 	void LoadUsers();
-	void AddUser(const unsigned long ID, const std::string &username, const std::string &password, const int userrights, const int activetabs);
+	void AddUser(std::vector<_tWebUserPassword> &users, const unsigned long ID, const std::string &username, const std::string &password, const int userrights, const int activetabs);
 	void ClearUserPasswords();
 	bool FindAdminUser();
-	int FindUser(const char* szUserName);
+	bool FindUser(const char* szUserName, _tWebUserPassword &user);
 	void SetWebCompressionMode(const _eWebCompressionMode gzmode);
 	void SetAuthenticationMethod(const _eAuthenticationMethod amethod);
 	void SetWebTheme(const std::string &themename);
 	void SetWebRoot(const std::string &webRoot);
 	std::vector<_tWebUserPassword> m_users;
+	std::mutex m_usersMutex;	// json requests run on several threads, LoadUsers replaces the list
 	//JSon
 	void GetJSonDevices(
 		Json::Value &root,
@@ -93,7 +95,8 @@ public:
 		const bool bFetchFavorites,
 		const time_t LastUpdate,
 		const std::string &username,
-		const std::string &hardwareid = ""); // OTO
+		const std::string &hardwareid = "", // OTO
+		const _tDeviceChangeSet *pChanges = NULL);
 
 	// SessionStore interface
 	const WebEmStoredSession GetSession(const std::string & sessionId) override;
@@ -184,6 +187,10 @@ private:
 	void Cmd_GetVersion(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_GetAuth(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_GetUptime(WebEmSession & session, const request& req, Json::Value &root);
+	void Cmd_GetDatabaseStats(WebEmSession & session, const request& req, Json::Value &root);
+	void Cmd_GetEventSystemStats(WebEmSession & session, const request& req, Json::Value &root);
+	void Cmd_GetDeviceEventBusStats(WebEmSession & session, const request& req, Json::Value &root);
+	void Cmd_GetPluginStats(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_GetActualHistory(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_GetNewHistory(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_GetConfig(WebEmSession & session, const request& req, Json::Value &root);
@@ -252,6 +259,7 @@ private:
 	void Cmd_AddLogMessage(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_ClearShortLog(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_VacuumDatabase(WebEmSession & session, const request& req, Json::Value &root);
+	void Cmd_TimeSeries(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_PanasonicSetMode(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_PanasonicGetNodes(WebEmSession & session, const request& req, Json::Value &root);
 	void Cmd_PanasonicAddNode(WebEmSession & session, const request& req, Json::Value &root);
@@ -302,6 +310,7 @@ private:
 	void RType_Events(WebEmSession & session, const request& req, Json::Value &root);
 	void RType_Hardware(WebEmSession & session, const request& req, Json::Value &root);
 	void RType_Devices(WebEmSession & session, const request& req, Json::Value &root);
+	bool CheckDevicesChanged(const WebEmSession & session, const request& req, reply & rep);
 	void RType_Cameras(WebEmSession & session, const request& req, Json::Value &root);
 	void RType_Users(WebEmSession & session, const request& req, Json::Value &root);
 	void RType_Mobiles(WebEmSession & session, const request& req, Json::Value &root);
@@ -379,8 +388,11 @@ private:
 	std::map < std::string, webserver_response_function > m_webcommands;
 	std::map < std::string, webserver_response_function > m_webrtypes;
 	void Do_Work();
+	std::vector<_tCustomIcon> GetCustomIcons();
+	std::string GetCustomIconFile(const int idx, const std::string &szDefault);
 	std::vector<_tCustomIcon> m_custom_light_icons;
 	std::map<int, int> m_custom_light_icons_lookup;
+	std::mutex m_customIconsMutex;	// ReloadCustomSwitchIcons replaces both
 	bool m_bDoStop;
 	std::string m_server_alias;
 };
@@ -68,7 +68,11 @@ const char *szHelp =
 "\t-dbase file_path (for example /opt/domoticz/domoticz.db)\n"
 "\t-userdata file_path (for example /opt/domoticz)\n"
 #endif
+"\t-dbreaders number of read-only database connections (default=3, 0 = disabled)\n"
+"\t-dbtimeseries (also keep the temperature short log in a compressed time series store next to the database)\n"
+"\t-rxbatch max_messages max_latency_ms (received messages stored in one database transaction, default=16 25, 1 = disabled)\n"
 "\t-webroot additional web root, useful with proxy servers (for example domoticz)\n"
+"\t-wwwthreads io_threads worker_threads (threads of the web servers, default=2 4, 0 worker threads = handle all requests on the io threads)\n"
 "\t-startupdelay seconds (default=0)\n"
 "\t-nowwwpwd (in case you forgot the web server username/password)\n"
 "\t-nocache (do not return appcache, use only when developing the web pages)\n"
@@ -85,6 +89,7 @@ const char *szHelp =
 "\t-loglevel (combination of: normal,status,error,debug)\n"
 "\t-debuglevel (combination of: normal,hardware,received,webserver,eventsystem,python,thread_id)\n"
 "\t-notimestamps (do not prepend timestamps to logs; useful with syslog, etc.)\n"
+"\t-logasync lines [drop|block] (write the log from a background thread, lines queued and what to do when the queue is full, default=drop)\n"
 "\t-php_cgi_path (for example /usr/bin/php-cgi)\n"
 #ifndef WIN32
 "\t-daemon (run as background daemon)\n"
@@ -542,6 +547,24 @@ bool GetConfigBool(std::string szValue)
 	return (szValue == "yes");
 }
 
+//Queue size (1 or more lines) and overflow policy (drop or block) of the asynchronous log
+bool SetLogAsyncMode(const std::string &szLines, const std::string &szOverflow)
+{
+	char *pEnd = NULL;
+	long lines = strtol(szLines.c_str(), &pEnd, 10);
+	if ((szLines.empty()) || (*pEnd != 0) || (lines < 1))
+		return false;
+	CLogger::_eAsyncOverflow overflow;
+	if (szOverflow == "drop")
+		overflow = CLogger::ASYNC_OVERFLOW_DROP;
+	else if (szOverflow == "block")
+		overflow = CLogger::ASYNC_OVERFLOW_BLOCK;
+	else
+		return false;
+	_log.SetAsyncMode(static_cast<size_t>(lines), overflow);
+	return true;
+}
+
 bool ParseConfigFile(const std::string &szConfigFile)
 {
 	std::ifstream infile;
@@ -603,6 +626,19 @@ bool ParseConfigFile(const std::string &szConfigFile)
 		else if (szFlag == "web_root") {
 			szWebRoot = sLine;
 		}
+		else if (szFlag == "www_threads") {
+			std::vector<std::string> strarray;
+			StringSplit(sLine, " ", strarray);
+			if (strarray.size() == 2)
+			{
+				webserver_settings.io_threads = std::max(1, atoi(strarray[0].c_str()));
+				webserver_settings.worker_threads = std::max(0, atoi(strarray[1].c_str()));
+#ifdef WWW_ENABLE_SSL
+				secure_webserver_settings.io_threads = webserver_settings.io_threads;
+				secure_webserver_settings.worker_threads = webserver_settings.worker_threads;
+#endif
+			}
+		}
 		else if (szFlag == "www_compress_mode") {
 			if (sLine == "on")
 				g_wwwCompressMode = http::server::WWW_USE_GZIP;
@@ -633,6 +669,15 @@ bool ParseConfigFile(const std::string &szConfigFile)
 		else if (szFlag == "notimestamps") {
 			_log.EnableLogTimestamps(!GetConfigBool(sLine));
 		}
+		else if (szFlag == "log_async") {
+			std::vector<std::string> strarray;
+			StringSplit(sLine, " ", strarray);
+			if ((strarray.empty()) || (strarray.size() > 2) || (!SetLogAsyncMode(strarray[0], (strarray.size() > 1) ? strarray[1] : "drop")))
+			{
+				_log.Log(LOG_ERROR, "Invalid log_async value in Configuration file '%s'", szConfigFile.c_str());
+				return false;
+			}
+		}
 #ifndef WIN32
 		else if (szFlag == "syslog") {
 			g_bUseSyslog = true;
@@ -642,6 +687,18 @@ bool ParseConfigFile(const std::string &szConfigFile)
 		else if (szFlag == "dbase_file") {
 			dbasefile = sLine;
 		}
+		else if (szFlag == "dbase_readers") {
+			m_sql.SetReaderConnections(atoi(sLine.c_str()));
+		}
+		else if (szFlag == "dbase_timeseries") {
+			m_sql.EnableTimeSeriesStore(GetConfigBool(sLine));
+		}
+		else if (szFlag == "rx_batch") {
+			std::vector<std::string> strarray;
+			StringSplit(sLine, " ", strarray);
+			if (strarray.size() == 2)
+				m_mainworker.SetRxBatching(atoi(strarray[0].c_str()), atoi(strarray[1].c_str()));
+		}
 		else if (szFlag == "startup_delay") {
 			int DelaySeconds = atoi(sLine.c_str());
 			_log.Log(LOG_STATUS, "Startup delay... waiting %d seconds...", DelaySeconds);
@@ -743,6 +800,15 @@ int main(int argc, char**argv)
 		{
 			_log.EnableLogTimestamps(false);
 		}
+		if (cmdLine.HasSwitch("-logasync"))
+		{
+			int nArgs = cmdLine.GetArgumentCount("-logasync");
+			if ((nArgs < 1) || (nArgs > 2) || (!SetLogAsyncMode(cmdLine.GetSafeArgument("-logasync", 0, ""), cmdLine.GetSafeArgument("-logasync", 1, "drop"))))
+			{
+				_log.Log(LOG_ERROR, "Please specify the number of log lines to queue (1 or more), optionally followed by drop or block");
+				return 1;
+			}
+		}
 		if (cmdLine.HasSwitch("-log"))
 		{
 			if (cmdLine.GetArgumentCount("-log") != 1)
@@ -898,6 +964,20 @@ int main(int argc, char**argv)
 			if (szroot.size() != 0)
 				szWWWFolder = szroot;
 		}
+		if (cmdLine.HasSwitch("-wwwthreads"))
+		{
+			if (cmdLine.GetArgumentCount("-wwwthreads") != 2)
+			{
+				_log.Log(LOG_ERROR, "Please specify the number of io threads and worker threads of the web servers");
+				return 1;
+			}
+			webserver_settings.io_threads = std::max(1, atoi(cmdLine.GetSafeArgument("-wwwthreads", 0, "2").c_str()));
+			webserver_settings.worker_threads = std::max(0, atoi(cmdLine.GetSafeArgument("-wwwthreads", 1, "4").c_str()));
+#ifdef WWW_ENABLE_SSL
+			secure_webserver_settings.io_threads = webserver_settings.io_threads;
+			secure_webserver_settings.worker_threads = webserver_settings.worker_threads;
+#endif
+		}
 	}
 	webserver_settings.www_root = szWWWFolder;
 	m_mainworker.SetWebserverSettings(webserver_settings);
@@ -1053,6 +1133,30 @@ int main(int argc, char**argv)
 			}
 			dbasefile = cmdLine.GetSafeArgument("-dbase", 0, "domoticz.db");
 		}
+		if (cmdLine.HasSwitch("-dbreaders"))
+		{
+			if (cmdLine.GetArgumentCount("-dbreaders") != 1)
+			{
+				_log.Log(LOG_ERROR, "Please specify the number of read-only database connections");
+				return 1;
+			}
+			m_sql.SetReaderConnections(atoi(cmdLine.GetSafeArgument("-dbreaders", 0, "3").c_str()));
+		}
+		if (cmdLine.HasSwitch("-dbtimeseries"))
+		{
+			m_sql.EnableTimeSeriesStore(true);
+		}
+		if (cmdLine.HasSwitch("-rxbatch"))
+		{
+			if (cmdLine.GetArgumentCount("-rxbatch") != 2)
+			{
+				_log.Log(LOG_ERROR, "Please specify the maximum number of messages and the maximum latency (ms) of a batch");
+				return 1;
+			}
+			m_mainworker.SetRxBatching(
+				atoi(cmdLine.GetSafeArgument("-rxbatch", 0, "16").c_str()),
+				atoi(cmdLine.GetSafeArgument("-rxbatch", 1, "25").c_str()));
+		}
 	}
 	m_sql.SetDatabaseName(dbasefile);
 
@@ -1162,6 +1266,8 @@ int main(int argc, char**argv)
 		syslog(LOG_INFO, "Domoticz running...");
 	}
 #endif
+	//started after daemonizing, threads do not survive the fork
+	_log.StartAsync();
 
 	if (!g_bRunAsDaemon)
 	{
@@ -1255,6 +1361,7 @@ int main(int argc, char**argv)
 #endif
 	g_stop_watchdog = true;
 	thread_watchdog.join();
+	_log.StopAsync();
 	return 0;
 }
 
@@ -19,6 +19,9 @@ CdzVents::CdzVents(void) :
 	m_version("2.4.9")
 {
 	m_bdzVentsExist = false;
+	m_luaState = NULL;
+	m_bLuaStateBusy = false;
+	m_bDataValid = false;
 }
 
 CdzVents::~CdzVents(void)
@@ -32,10 +35,13 @@ const std::string CdzVents::GetVersion()
 
 void CdzVents::EvaluateDzVents(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items, const int secStatus)
 {
-	// reroute print library to Domoticz logger
-	luaL_openlibs(lua_state);
-	lua_pushcfunction(lua_state, l_domoticz_print);
-	lua_setglobal(lua_state, "print");
+	if (lua_state != m_luaState)
+	{
+		// reroute print library to Domoticz logger
+		luaL_openlibs(lua_state);
+		lua_pushcfunction(lua_state, l_domoticz_print);
+		lua_setglobal(lua_state, "print");
+	}
 
 	bool reasonTime = false;
 	bool reasonURL = false;
@@ -488,385 +494,920 @@ void CdzVents::SetGlobalVariables(lua_State *lua_state, const bool reasonTime, c
 	lua_setglobal(lua_state, "globalvariables");
 }
 
-void CdzVents::ExportDomoticzDataToLua(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items)
+void CdzVents::GetTriggerItems(const std::vector<CEventSystem::_tEventQueue> &items, const int reason, CdzVents::_tTriggerItems &triggers)
 {
-	boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_mainworker.m_eventsystem.m_devicestatesMutex);
-	int index = 1;
-	time_t now = mytime(NULL);
-	struct tm tm1;
-	localtime_r(&now, &tm1);
-	struct tm tLastUpdate;
-	localtime_r(&now, &tLastUpdate);
-	int SensorTimeOut = 60;
-	m_sql.GetPreferencesVar("SensorTimeout", SensorTimeOut);
+	std::vector<CEventSystem::_tEventQueue>::const_iterator itt;
+	for (itt = items.begin(); itt != items.end(); ++itt)
+	{
+		if (itt->reason == reason)
+			triggers.insert(std::make_pair(itt->id, &(*itt)));
+	}
+}
 
-	struct tm ntime;
-	time_t checktime;
+//Applies the values of the queue items that triggered this device, returns true when there were any
+bool CdzVents::ApplyDeviceTriggers(CEventSystem::_tDeviceStatus &sitem, const CdzVents::_tTriggerItems &triggers)
+{
+	bool triggerDevice = false;
+	auto range = triggers.equal_range(sitem.ID);
+	for (auto itt = range.first; itt != range.second; ++itt)
+	{
+		const CEventSystem::_tEventQueue *item = itt->second;
+		triggerDevice = true;
+		sitem.lastUpdate = item->lastUpdate;
+		sitem.lastLevel = item->lastLevel;
+		sitem.sValue = item->sValue;
+		sitem.nValueWording = item->nValueWording;
+		sitem.nValue = item->nValue;
+		if (item->JsonMapString.size() > 0)
+			sitem.JsonMapString = item->JsonMapString;
+		if (item->JsonMapFloat.size() > 0)
+			sitem.JsonMapFloat = item->JsonMapFloat;
+		if (item->JsonMapInt.size() > 0)
+			sitem.JsonMapInt = item->JsonMapInt;
+		if (item->JsonMapBool.size() > 0)
+			sitem.JsonMapBool = item->JsonMapBool;
+	}
+	return triggerDevice;
+}
 
-	lua_createtable(lua_state, 0, 0);
+bool CdzVents::ApplySceneGroupTriggers(CEventSystem::_tScenesGroups &sgitem, const CdzVents::_tTriggerItems &triggers)
+{
+	bool triggerScene = false;
+	auto range = triggers.equal_range(sgitem.ID);
+	for (auto itt = range.first; itt != range.second; ++itt)
+	{
+		triggerScene = true;
+		sgitem.lastUpdate = itt->second->lastUpdate;
+		sgitem.scenesgroupValue = itt->second->sValue;
+	}
+	return triggerScene;
+}
 
-	// First export all the devices.
-	std::map<uint64_t, CEventSystem::_tDeviceStatus>::iterator iterator;
-	for (iterator = m_mainworker.m_eventsystem.m_devicestates.begin(); iterator != m_mainworker.m_eventsystem.m_devicestates.end(); ++iterator)
+bool CdzVents::ApplyUserVariableTriggers(CEventSystem::_tUserVariable &uvitem, const CdzVents::_tTriggerItems &triggers)
+{
+	bool triggerVar = false;
+	auto range = triggers.equal_range(uvitem.ID);
+	for (auto itt = range.first; itt != range.second; ++itt)
 	{
-		CEventSystem::_tDeviceStatus sitem = iterator->second;
-		const char *dev_type = RFX_Type_Desc(sitem.devType, 1);
-		const char *sub_type = RFX_Type_SubType_Desc(sitem.devType, sitem.subType);
+		triggerVar = true;
+		uvitem.lastUpdate = itt->second->lastUpdate;
+		uvitem.variableValue = itt->second->sValue;
+	}
+	return triggerVar;
+}
 
-		bool triggerDevice = false;
-		std::vector<CEventSystem::_tEventQueue>::const_iterator itt;
-		for (itt = items.begin(); itt != items.end(); ++itt)
-		{
-			if (sitem.ID == itt->id && itt->reason == m_mainworker.m_eventsystem.REASON_DEVICE)
-			{
-				triggerDevice = true;
-				sitem.lastUpdate = itt->lastUpdate;
-				sitem.lastLevel = itt->lastLevel;
-				sitem.sValue = itt->sValue;
-				sitem.nValueWording = itt->nValueWording;
-				sitem.nValue = itt->nValue;
-				if (itt->JsonMapString.size() > 0)
-					sitem.JsonMapString = itt->JsonMapString;
-				if (itt->JsonMapFloat.size() > 0)
-					sitem.JsonMapFloat = itt->JsonMapFloat;
-				if (itt->JsonMapInt.size() > 0)
-					sitem.JsonMapInt = itt->JsonMapInt;
-				if (itt->JsonMapBool.size() > 0)
-					sitem.JsonMapBool = itt->JsonMapBool;
-			}
-		}
+void CdzVents::GetSceneDescriptions(std::map<uint64_t, std::string> &descriptions)
+{
+	descriptions.clear();
+	std::vector<std::vector<std::string> > result;
+	result = m_sql.safe_query("SELECT ID, Description FROM Scenes");
+	for (const auto & itt : result)
+		descriptions[std::stoull(itt[0])] = itt[1];
+}
+
+void CdzVents::PushDevice(lua_State *lua_state, const CEventSystem::_tDeviceStatus &sitem, const bool triggerDevice, const bool timed_out)
+{
+	const char *dev_type = RFX_Type_Desc(sitem.devType, 1);
+	const char *sub_type = RFX_Type_SubType_Desc(sitem.devType, sitem.subType);
 
-		//_log.Log(LOG_STATUS, "Getting device with id: %s", rowid.c_str());
+	lua_createtable(lua_state, 1, 11);
 
-		ParseSQLdatetime(checktime, ntime, sitem.lastUpdate, tm1.tm_isdst);
-		bool timed_out = (now - checktime >= SensorTimeOut * 60);
+	lua_pushstring(lua_state, "name");
+	lua_pushstring(lua_state, sitem.deviceName.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "id");
+	lua_pushnumber(lua_state, (lua_Number)sitem.ID);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "baseType");
+	lua_pushstring(lua_state, "device");
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "deviceType");
+	lua_pushstring(lua_state, dev_type);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "subType");
+	lua_pushstring(lua_state, sub_type);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "switchType");
+	lua_pushstring(lua_state, Switch_Type_Desc((_eSwitchType)sitem.switchtype));
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "switchTypeValue");
+	lua_pushnumber(lua_state, (lua_Number)sitem.switchtype);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "lastUpdate");
+	lua_pushstring(lua_state, sitem.lastUpdate.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "lastLevel");
+	lua_pushnumber(lua_state, (lua_Number)sitem.lastLevel);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "changed");
+	lua_pushboolean(lua_state, triggerDevice);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "timedOut");
+	lua_pushboolean(lua_state, timed_out);
+	lua_rawset(lua_state, -3);
 
-		lua_pushnumber(lua_state, (lua_Number)index);
+	//get all svalues separate
+	std::vector<std::string> strarray;
+	StringSplit(sitem.sValue, ";", strarray);
 
-		lua_createtable(lua_state, 1, 11);
+	lua_pushstring(lua_state, "rawData");
+	lua_createtable(lua_state, 0, 0);
 
-		lua_pushstring(lua_state, "name");
-		lua_pushstring(lua_state, sitem.deviceName.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "id");
-		lua_pushnumber(lua_state, (lua_Number)sitem.ID);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "baseType");
-		lua_pushstring(lua_state, "device");
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "deviceType");
-		lua_pushstring(lua_state, dev_type);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "subType");
-		lua_pushstring(lua_state, sub_type);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "switchType");
-		lua_pushstring(lua_state, Switch_Type_Desc((_eSwitchType)sitem.switchtype));
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "switchTypeValue");
-		lua_pushnumber(lua_state, (lua_Number)sitem.switchtype);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "lastUpdate");
-		lua_pushstring(lua_state, sitem.lastUpdate.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "lastLevel");
-		lua_pushnumber(lua_state, (lua_Number)sitem.lastLevel);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "changed");
-		lua_pushboolean(lua_state, triggerDevice);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "timedOut");
-		lua_pushboolean(lua_state, timed_out);
+	for (uint8_t i = 0; i < strarray.size(); i++)
+	{
+		lua_pushnumber(lua_state, (lua_Number)i + 1);
+		lua_pushstring(lua_state, strarray[i].c_str());
 		lua_rawset(lua_state, -3);
+	}
+	lua_settable(lua_state, -3); // rawData table
+
+	lua_pushstring(lua_state, "deviceID");
+	lua_pushstring(lua_state, sitem.deviceID.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "description");
+	lua_pushstring(lua_state, sitem.description.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "batteryLevel");
+	lua_pushnumber(lua_state, (lua_Number)sitem.batteryLevel);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "signalLevel");
+	lua_pushnumber(lua_state, (lua_Number)sitem.signalLevel);
+	lua_rawset(lua_state, -3);
 
-		//get all svalues separate
-		std::vector<std::string> strarray;
-		StringSplit(sitem.sValue, ";", strarray);
+	lua_pushstring(lua_state, "data");
+	lua_createtable(lua_state, 0, 0);
 
-		lua_pushstring(lua_state, "rawData");
-		lua_createtable(lua_state, 0, 0);
+	lua_pushstring(lua_state, "_state");
+	lua_pushstring(lua_state, sitem.nValueWording.c_str());
+	lua_rawset(lua_state, -3);
 
-		for (uint8_t i = 0; i < strarray.size(); i++)
-		{
-			lua_pushnumber(lua_state, (lua_Number)i + 1);
-			lua_pushstring(lua_state, strarray[i].c_str());
-			lua_rawset(lua_state, -3);
-		}
-		lua_settable(lua_state, -3); // rawData table
+	lua_pushstring(lua_state, "_nValue");
+	lua_pushnumber(lua_state, (lua_Number)sitem.nValue);
+	lua_rawset(lua_state, -3);
 
-		lua_pushstring(lua_state, "deviceID");
-		lua_pushstring(lua_state, sitem.deviceID.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "description");
-		lua_pushstring(lua_state, sitem.description.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "batteryLevel");
-		lua_pushnumber(lua_state, (lua_Number)sitem.batteryLevel);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "signalLevel");
-		lua_pushnumber(lua_state, (lua_Number)sitem.signalLevel);
-		lua_rawset(lua_state, -3);
 
-		lua_pushstring(lua_state, "data");
-		lua_createtable(lua_state, 0, 0);
+	lua_pushstring(lua_state, "hardwareID");
+	lua_pushnumber(lua_state, (lua_Number)sitem.hardwareID);
+	lua_rawset(lua_state, -3);
 
-		lua_pushstring(lua_state, "_state");
-		lua_pushstring(lua_state, sitem.nValueWording.c_str());
+	// Lux does not have it's own field yet.
+	if (sitem.devType == pTypeLux && sitem.subType == sTypeLux)
+	{
+		lua_pushstring(lua_state, "lux");
+		if (strarray.size() > 0)
+			lua_pushnumber(lua_state, (lua_Number)atoi(strarray[0].c_str()));
+		else
+			lua_pushnumber(lua_state, (lua_Number)0);
 		lua_rawset(lua_state, -3);
+	}
 
-		lua_pushstring(lua_state, "_nValue");
-		lua_pushnumber(lua_state, (lua_Number)sitem.nValue);
+	if (sitem.devType == pTypeGeneral && sitem.subType == sTypeKwh)
+	{
+		lua_pushstring(lua_state, "whTotal");
+		if (strarray.size() > 1)
+			lua_pushnumber(lua_state, atof(strarray[1].c_str()));
+		else
+			lua_pushnumber(lua_state, 0.0f);
 		lua_rawset(lua_state, -3);
-
-
-		lua_pushstring(lua_state, "hardwareID");
-		lua_pushnumber(lua_state, (lua_Number)sitem.hardwareID);
+		lua_pushstring(lua_state, "whActual");
+		if (strarray.size() > 0)
+			lua_pushnumber(lua_state, atof(strarray[0].c_str()));
+		else
+			lua_pushnumber(lua_state, 0.0f);
 		lua_rawset(lua_state, -3);
+	}
 
-		// Lux does not have it's own field yet.
-		if (sitem.devType == pTypeLux && sitem.subType == sTypeLux)
+	// Now see if we have additional fields from the JSON data
+	if (sitem.JsonMapString.size() > 0)
+	{
+		std::map<uint8_t, std::string>::const_iterator itt;
+		for (itt = sitem.JsonMapString.begin(); itt != sitem.JsonMapString.end(); ++itt)
 		{
-			lua_pushstring(lua_state, "lux");
-			if (strarray.size() > 0)
-				lua_pushnumber(lua_state, (lua_Number)atoi(strarray[0].c_str()));
+			lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
+			if (strcmp(m_mainworker.m_eventsystem.JsonMap[itt->first].szOriginal, "LevelNames") == 0 ||
+				strcmp(m_mainworker.m_eventsystem.JsonMap[itt->first].szOriginal, "LevelActions") == 0)
+				lua_pushstring(lua_state, base64_decode(itt->second).c_str());
 			else
-				lua_pushnumber(lua_state, (lua_Number)0);
+				lua_pushstring(lua_state, itt->second.c_str());
 			lua_rawset(lua_state, -3);
 		}
+	}
 
-		if (sitem.devType == pTypeGeneral && sitem.subType == sTypeKwh)
+	if (sitem.JsonMapFloat.size() > 0)
+	{
+		std::map<uint8_t, float>::const_iterator itt;
+		for (itt = sitem.JsonMapFloat.begin(); itt != sitem.JsonMapFloat.end(); ++itt)
 		{
-			lua_pushstring(lua_state, "whTotal");
-			if (strarray.size() > 1)
-				lua_pushnumber(lua_state, atof(strarray[1].c_str()));
-			else
-				lua_pushnumber(lua_state, 0.0f);
-			lua_rawset(lua_state, -3);
-			lua_pushstring(lua_state, "whActual");
-			if (strarray.size() > 0)
-				lua_pushnumber(lua_state, atof(strarray[0].c_str()));
-			else
-				lua_pushnumber(lua_state, 0.0f);
+			lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
+			lua_pushnumber(lua_state, itt->second);
 			lua_rawset(lua_state, -3);
 		}
+	}
 
-		// Now see if we have additional fields from the JSON data
-		if (sitem.JsonMapString.size() > 0)
+	if (sitem.JsonMapInt.size() > 0)
+	{
+		std::map<uint8_t, int>::const_iterator itt;
+		for (itt = sitem.JsonMapInt.begin(); itt != sitem.JsonMapInt.end(); ++itt)
 		{
-			std::map<uint8_t, std::string>::const_iterator itt;
-			for (itt = sitem.JsonMapString.begin(); itt != sitem.JsonMapString.end(); ++itt)
-			{
-				lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
-				if (strcmp(m_mainworker.m_eventsystem.JsonMap[itt->first].szOriginal, "LevelNames") == 0 ||
-					strcmp(m_mainworker.m_eventsystem.JsonMap[itt->first].szOriginal, "LevelActions") == 0)
-					lua_pushstring(lua_state, base64_decode(itt->second).c_str());
-				else
-					lua_pushstring(lua_state, itt->second.c_str());
-				lua_rawset(lua_state, -3);
-			}
+			lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
+			lua_pushnumber(lua_state, itt->second);
+			lua_rawset(lua_state, -3);
 		}
+	}
 
-		if (sitem.JsonMapFloat.size() > 0)
+	if (sitem.JsonMapBool.size() > 0)
+	{
+		std::map<uint8_t, bool>::const_iterator itt;
+		for (itt = sitem.JsonMapBool.begin(); itt != sitem.JsonMapBool.end(); ++itt)
 		{
-			std::map<uint8_t, float>::const_iterator itt;
-			for (itt = sitem.JsonMapFloat.begin(); itt != sitem.JsonMapFloat.end(); ++itt)
-			{
-				lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
-				lua_pushnumber(lua_state, itt->second);
-				lua_rawset(lua_state, -3);
-			}
+			lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
+			lua_pushboolean(lua_state, itt->second);
+			lua_rawset(lua_state, -3);
 		}
+	}
+
+	lua_settable(lua_state, -3); // data table
+}
+
+void CdzVents::PushSceneGroup(lua_State *lua_state, const CEventSystem::_tScenesGroups &sgitem, const bool triggerScene, const std::string &description)
+{
+	lua_createtable(lua_state, 1, 6);
+
+	lua_pushstring(lua_state, "name");
+	lua_pushstring(lua_state, sgitem.scenesgroupName.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "id");
+	lua_pushnumber(lua_state, (lua_Number)sgitem.ID);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "description");
+	lua_pushstring(lua_state, description.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "baseType");
+	lua_pushstring(lua_state, (sgitem.scenesgroupType == 0) ? "scene" : "group");
+	lua_rawset(lua_state, -3);
+
+	lua_pushstring(lua_state, "lastUpdate");
+	lua_pushstring(lua_state, sgitem.lastUpdate.c_str());
+	lua_rawset(lua_state, -3);
 
-		if (sitem.JsonMapInt.size() > 0)
+	lua_pushstring(lua_state, "changed");
+	lua_pushboolean(lua_state, triggerScene);
+	lua_rawset(lua_state, -3);
+
+	lua_pushstring(lua_state, "data");
+	lua_createtable(lua_state, 0, 0);
+
+	lua_pushstring(lua_state, "_state");
+	lua_pushstring(lua_state, sgitem.scenesgroupValue.c_str());
+	lua_rawset(lua_state, -3);
+	lua_rawset(lua_state, -3);
+
+	lua_pushstring(lua_state, "deviceIDs");
+	lua_createtable(lua_state, 0, 0);
+	std::vector<uint64_t>::const_iterator itt2;
+	if (sgitem.memberID.size() > 0)
+	{
+		int index = 1;
+		for (itt2 = sgitem.memberID.begin(); itt2 != sgitem.memberID.end(); ++itt2)
 		{
-			std::map<uint8_t, int>::const_iterator itt;
-			for (itt = sitem.JsonMapInt.begin(); itt != sitem.JsonMapInt.end(); ++itt)
-			{
-				lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
-				lua_pushnumber(lua_state, itt->second);
-				lua_rawset(lua_state, -3);
-			}
+			lua_pushnumber(lua_state, (lua_Number)index);
+			lua_pushnumber(lua_state, (lua_Number)*itt2);
+			lua_rawset(lua_state, -3);
+			index++;
 		}
+	}
+
+	lua_settable(lua_state, -3); // data table
+}
+
+void CdzVents::PushUserVariable(lua_State *lua_state, const CEventSystem::_tUserVariable &uvitem, const bool triggerVar)
+{
+	std::string vtype;
+
+	lua_createtable(lua_state, 1, 5);
+
+	lua_pushstring(lua_state, "name");
+	lua_pushstring(lua_state, uvitem.variableName.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "id");
+	lua_pushnumber(lua_state, (lua_Number)uvitem.ID);
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "baseType");
+	lua_pushstring(lua_state, "uservariable");
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "lastUpdate");
+	lua_pushstring(lua_state, uvitem.lastUpdate.c_str());
+	lua_rawset(lua_state, -3);
+	lua_pushstring(lua_state, "changed");
+	lua_pushboolean(lua_state, triggerVar);
+	lua_rawset(lua_state, -3);
+
+	lua_pushstring(lua_state, "data");
+	lua_createtable(lua_state, 0, 0);
+
+	lua_pushstring(lua_state, "value");
+	if (uvitem.variableType == 0)
+	{
+		//Integer
+		lua_pushnumber(lua_state, atoi(uvitem.variableValue.c_str()));
+		vtype = "integer";
+	}
+	else if (uvitem.variableType == 1)
+	{
+		//Float
+		lua_pushnumber(lua_state, atof(uvitem.variableValue.c_str()));
+		vtype = "float";
+	}
+	else
+	{
+		//String,Date,Time
+		lua_pushstring(lua_state, uvitem.variableValue.c_str());
+		if (uvitem.variableType == 2)
+			vtype = "string";
+		else if (uvitem.variableType == 3)
+			vtype = "date";
+		else if (uvitem.variableType == 4)
+			vtype = "time";
+		else
+			vtype = "unknown";
+	}
+	lua_rawset(lua_state, -3);
+
+	lua_settable(lua_state, -3); // data table
+
+	lua_pushstring(lua_state, "variableType");
+	lua_pushstring(lua_state, vtype.c_str());
+	lua_rawset(lua_state, -3);
+}
+
+void CdzVents::ExportDomoticzDataToLua(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items)
+{
+	//The long-lived state only gets the items changed since its last run
+	bool bPersistent = (lua_state == m_luaState);
+	if ((bPersistent) && (UpdateDomoticzData(lua_state, items)))
+		return;
+
+	_tTriggerItems deviceTriggers, sceneTriggers, variableTriggers;
+	GetTriggerItems(items, m_mainworker.m_eventsystem.REASON_DEVICE, deviceTriggers);
+	GetTriggerItems(items, m_mainworker.m_eventsystem.REASON_SCENEGROUP, sceneTriggers);
+	GetTriggerItems(items, m_mainworker.m_eventsystem.REASON_USERVARIABLE, variableTriggers);
+
+	if (bPersistent)
+	{
+		m_dataDevices.clear();
+		m_dataScenesGroups.clear();
+		m_dataUserVariables.clear();
+		m_triggeredDevices.clear();
+		m_triggeredScenesGroups.clear();
+		m_triggeredUserVariables.clear();
+	}
+
+	boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(m_mainworker.m_eventsystem.m_devicestatesMutex);
+	int index = 1;
+	time_t now = mytime(NULL);
+	struct tm tm1;
+	localtime_r(&now, &tm1);
+	int SensorTimeOut = 60;
+	m_sql.GetPreferencesVar("SensorTimeout", SensorTimeOut);
+
+	struct tm ntime;
+	time_t checktime;
+
+	lua_createtable(lua_state, 0, 0);
 
-		if (sitem.JsonMapBool.size() > 0)
+	// First export all the devices.
+	std::map<uint64_t, CEventSystem::_tDeviceStatus>::const_iterator iterator;
+	for (iterator = m_mainworker.m_eventsystem.m_devicestates.begin(); iterator != m_mainworker.m_eventsystem.m_devicestates.end(); ++iterator)
+	{
+		bool triggerDevice = (deviceTriggers.find(iterator->first) != deviceTriggers.end());
+		CEventSystem::_tDeviceStatus sitem;
+		if (triggerDevice)
 		{
-			std::map<uint8_t, bool>::const_iterator itt;
-			for (itt = sitem.JsonMapBool.begin(); itt != sitem.JsonMapBool.end(); ++itt)
-			{
-				lua_pushstring(lua_state, m_mainworker.m_eventsystem.JsonMap[itt->first].szNew);
-				lua_pushboolean(lua_state, itt->second);
-				lua_rawset(lua_state, -3);
-			}
+			sitem = iterator->second;
+			ApplyDeviceTriggers(sitem, deviceTriggers);
 		}
+		const CEventSystem::_tDeviceStatus &ditem = (triggerDevice) ? sitem : iterator->second;
+
+		ParseSQLdatetime(checktime, ntime, ditem.lastUpdate, tm1.tm_isdst);
+		bool timed_out = (now - checktime >= SensorTimeOut * 60);
+
+		PushDevice(lua_state, ditem, triggerDevice, timed_out);
+		lua_rawseti(lua_state, -2, index); // device entry
 
-		lua_settable(lua_state, -3); // data table
-		lua_settable(lua_state, -3); // device entry
+		if (bPersistent)
+		{
+			_tDataEntry &entry = m_dataDevices[ditem.ID];
+			entry.index = index;
+			entry.lastUpdate = checktime;
+			entry.timedOut = timed_out;
+			if (triggerDevice)
+				m_triggeredDevices.insert(ditem.ID);
+		}
 		index++;
 	}
 	devicestatesMutexLock.unlock();
 
 	// Now do the scenes and groups.
-	const char *description = "";
+	std::map<uint64_t, std::string> descriptions;
+	GetSceneDescriptions(descriptions);
 	boost::shared_lock<boost::shared_mutex> scenesgroupsMutexLock(m_mainworker.m_eventsystem.m_scenesgroupsMutex);
 
 	std::map<uint64_t, CEventSystem::_tScenesGroups>::const_iterator ittScenes;
 	for (ittScenes = m_mainworker.m_eventsystem.m_scenesgroups.begin(); ittScenes != m_mainworker.m_eventsystem.m_scenesgroups.end(); ++ittScenes)
 	{
 		CEventSystem::_tScenesGroups sgitem = ittScenes->second;
-		bool triggerScene = false;
-		std::vector<CEventSystem::_tEventQueue>::const_iterator itt;
-		for (itt = items.begin(); itt != items.end(); ++itt)
-		{
-			if (sgitem.ID == itt->id && itt->reason == m_mainworker.m_eventsystem.REASON_SCENEGROUP)
-			{
-				triggerScene = true;
-				sgitem.lastUpdate = itt->lastUpdate;
-				sgitem.scenesgroupValue = itt->sValue;
-			}
-		}
-
-		std::vector<std::vector<std::string> > result;
-		result = m_sql.safe_query("SELECT Description FROM Scenes WHERE (ID=='%d')", sgitem.ID);
-		if (result.empty())
-			description = "";
-		else
-			description = result[0][0].c_str();
-
-		lua_pushnumber(lua_state, (lua_Number)index);
-
-		lua_createtable(lua_state, 1, 6);
-
-		lua_pushstring(lua_state, "name");
-		lua_pushstring(lua_state, sgitem.scenesgroupName.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "id");
-		lua_pushnumber(lua_state, (lua_Number)sgitem.ID);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "description");
-		lua_pushstring(lua_state, description);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "baseType");
-		lua_pushstring(lua_state, (sgitem.scenesgroupType == 0) ? "scene" : "group");
-		lua_rawset(lua_state, -3);
-
-		lua_pushstring(lua_state, "lastUpdate");
-		lua_pushstring(lua_state, sgitem.lastUpdate.c_str());
-		lua_rawset(lua_state, -3);
+		bool triggerScene = ApplySceneGroupTriggers(sgitem, sceneTriggers);
 
-		lua_pushstring(lua_state, "changed");
-		lua_pushboolean(lua_state, triggerScene);
-		lua_rawset(lua_state, -3);
-
-		lua_pushstring(lua_state, "data");
-		lua_createtable(lua_state, 0, 0);
+		std::string description;
+		std::map<uint64_t, std::string>::const_iterator ittDesc = descriptions.find(sgitem.ID);
+		if (ittDesc != descriptions.end())
+			description = ittDesc->second;
 
-		lua_pushstring(lua_state, "_state");
-		lua_pushstring(lua_state, sgitem.scenesgroupValue.c_str());
-		lua_rawset(lua_state, -3);
-		lua_rawset(lua_state, -3);
+		PushSceneGroup(lua_state, sgitem, triggerScene, description);
+		lua_rawseti(lua_state, -2, index); // end entry
 
-		lua_pushstring(lua_state, "deviceIDs");
-		lua_createtable(lua_state, 0, 0);
-		std::vector<uint64_t>::const_iterator itt2;
-		if (sgitem.memberID.size() > 0)
+		if (bPersistent)
 		{
-			int index = 1;
-			for (itt2 = sgitem.memberID.begin(); itt2 != sgitem.memberID.end(); ++itt2)
-			{
-				lua_pushnumber(lua_state, (lua_Number)index);
-				lua_pushnumber(lua_state, (lua_Number)*itt2);
-				lua_rawset(lua_state, -3);
-				index++;
-			}
+			_tDataEntry &entry = m_dataScenesGroups[sgitem.ID];
+			entry.index = index;
+			entry.description = description;
+			if (triggerScene)
+				m_triggeredScenesGroups.insert(sgitem.ID);
 		}
-
-		lua_settable(lua_state, -3); // data table
-		lua_settable(lua_state, -3); // end entry
 		index++;
 	}
 	scenesgroupsMutexLock.unlock();
 
-	std::string vtype;
-
 	// Now do the user variables.
 	boost::shared_lock<boost::shared_mutex> uservariablesMutexLock(m_mainworker.m_eventsystem.m_uservariablesMutex);
 	std::map<uint64_t, CEventSystem::_tUserVariable>::const_iterator it_var;
 	for (it_var = m_mainworker.m_eventsystem.m_uservariables.begin(); it_var != m_mainworker.m_eventsystem.m_uservariables.end(); ++it_var)
 	{
 		CEventSystem::_tUserVariable uvitem = it_var->second;
-		bool triggerVar = false;
-		std::vector<CEventSystem::_tEventQueue>::const_iterator itt;
-		for (itt = items.begin(); itt != items.end(); ++itt)
+		bool triggerVar = ApplyUserVariableTriggers(uvitem, variableTriggers);
+
+		PushUserVariable(lua_state, uvitem, triggerVar);
+		lua_rawseti(lua_state, -2, index); // end entry
+
+		if (bPersistent)
 		{
-			if (uvitem.ID == itt->id && itt->reason == m_mainworker.m_eventsystem.REASON_USERVARIABLE)
-			{
-				triggerVar = true;
-				uvitem.lastUpdate = itt->lastUpdate;
-				uvitem.variableValue = itt->sValue;
-			}
+			_tDataEntry &entry = m_dataUserVariables[uvitem.ID];
+			entry.index = index;
+			if (triggerVar)
+				m_triggeredUserVariables.insert(uvitem.ID);
 		}
+		index++;
+	}
+	uservariablesMutexLock.unlock();
 
-		lua_pushnumber(lua_state, (lua_Number)index);
+	if (bPersistent)
+	{
+		lua_setfield(lua_state, LUA_REGISTRYINDEX, "dzvents_data");
+		m_bDataValid = true;
+		//scripts get a view, what they change must not end up in the next run
+		lua_getfield(lua_state, LUA_REGISTRYINDEX, "dzvents_data");
+		BeginDataViews(lua_state);
+		PushDataView(lua_state, -1);
+		lua_remove(lua_state, -2);
+	}
+	lua_setglobal(lua_state, "domoticzData");
+}
 
-		lua_createtable(lua_state, 1, 5);
+//Scripts see the kept domoticzData through copy-on-write views: an empty table per (sub)table they touch,
+//reads go to the kept table, writes to an overlay that is thrown away after the run.
+//The views of a run are found in two registry maps, view -> kept table and view -> overlay
+static char s_dataViewDeleted;	// overlay value of keys a script set to nil
 
-		lua_pushstring(lua_state, "name");
-		lua_pushstring(lua_state, uvitem.variableName.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "id");
-		lua_pushnumber(lua_state, (lua_Number)uvitem.ID);
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "baseType");
-		lua_pushstring(lua_state, "uservariable");
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "lastUpdate");
-		lua_pushstring(lua_state, uvitem.lastUpdate.c_str());
-		lua_rawset(lua_state, -3);
-		lua_pushstring(lua_state, "changed");
-		lua_pushboolean(lua_state, triggerVar);
-		lua_rawset(lua_state, -3);
+void CdzVents::BeginDataViews(lua_State *lua_state)
+{
+	lua_newtable(lua_state);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_source");
+	lua_newtable(lua_state);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_overlay");
+
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_mt");
+	bool bHaveMetatable = lua_istable(lua_state, -1);
+	lua_pop(lua_state, 1);
+	if (bHaveMetatable)
+		return;
+	lua_createtable(lua_state, 0, 5);
+	lua_pushcfunction(lua_state, l_dataview_index);
+	lua_setfield(lua_state, -2, "__index");
+	lua_pushcfunction(lua_state, l_dataview_newindex);
+	lua_setfield(lua_state, -2, "__newindex");
+	lua_pushcfunction(lua_state, l_dataview_pairs);
+	lua_setfield(lua_state, -2, "__pairs");
+	lua_pushcfunction(lua_state, l_dataview_ipairs);
+	lua_setfield(lua_state, -2, "__ipairs");
+	lua_pushcfunction(lua_state, l_dataview_len);
+	lua_setfield(lua_state, -2, "__len");
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_mt");
+}
 
-		lua_pushstring(lua_state, "data");
-		lua_createtable(lua_state, 0, 0);
+//Pushes a view of the table at tIndex
+void CdzVents::PushDataView(lua_State *lua_state, const int tIndex)
+{
+	int source = lua_absindex(lua_state, tIndex);
+	lua_newtable(lua_state);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_mt");
+	lua_setmetatable(lua_state, -2);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "dzvents_view_source");
+	lua_pushvalue(lua_state, -2);
+	lua_pushvalue(lua_state, source);
+	lua_rawset(lua_state, -3);
+	lua_pop(lua_state, 1);
+}
 
-		lua_pushstring(lua_state, "value");
-		if (uvitem.variableType == 0)
+//Pushes the kept table (or overlay) of the view at vIndex, nil when there is none
+void CdzVents::PushDataViewPart(lua_State *lua_state, const int vIndex, const char *szMap, const bool bCreate)
+{
+	int view = lua_absindex(lua_state, vIndex);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, szMap);
+	lua_pushvalue(lua_state, view);
+	lua_rawget(lua_state, -2);
+	if ((bCreate) && (lua_isnil(lua_state, -1)))
+	{
+		lua_pop(lua_state, 1);
+		lua_newtable(lua_state);
+		lua_pushvalue(lua_state, view);
+		lua_pushvalue(lua_state, -2);
+		lua_rawset(lua_state, -4);
+	}
+	lua_remove(lua_state, -2);
+}
+
+//view[key], overlay first, tables of the kept data are handed out as views (and remembered, so a script gets the same one again)
+int CdzVents::l_dataview_index(lua_State *lua_state)
+{
+	PushDataViewPart(lua_state, 1, "dzvents_view_overlay", false);
+	if (lua_istable(lua_state, -1))
+	{
+		lua_pushvalue(lua_state, 2);
+		lua_rawget(lua_state, -2);
+		if (!lua_isnil(lua_state, -1))
 		{
-			//Integer
-			lua_pushnumber(lua_state, atoi(uvitem.variableValue.c_str()));
-			vtype = "integer";
+			if (lua_touserdata(lua_state, -1) == &s_dataViewDeleted)
+				lua_pushnil(lua_state);
+			return 1;
 		}
-		else if (uvitem.variableType == 1)
+		lua_pop(lua_state, 1);
+	}
+	lua_pop(lua_state, 1);
+
+	PushDataViewPart(lua_state, 1, "dzvents_view_source", false);
+	if (!lua_istable(lua_state, -1))
+		return 1;
+	lua_pushvalue(lua_state, 2);
+	lua_rawget(lua_state, -2);
+	if (!lua_istable(lua_state, -1))
+		return 1;
+	PushDataView(lua_state, -1);
+	PushDataViewPart(lua_state, 1, "dzvents_view_overlay", true);
+	lua_pushvalue(lua_state, 2);
+	lua_pushvalue(lua_state, -3);
+	lua_rawset(lua_state, -3);
+	lua_pop(lua_state, 1);
+	return 1;
+}
+
+int CdzVents::l_dataview_newindex(lua_State *lua_state)
+{
+	PushDataViewPart(lua_state, 1, "dzvents_view_overlay", true);
+	lua_pushvalue(lua_state, 2);
+	if (lua_isnil(lua_state, 3))
+		lua_pushlightuserdata(lua_state, &s_dataViewDeleted);
+	else
+		lua_pushvalue(lua_state, 3);
+	lua_rawset(lua_state, -3);
+	return 0;
+}
+
+//next() over the view: the keys of the kept table, then the keys only the overlay has
+int CdzVents::l_dataview_next(lua_State *lua_state)
+{
+	lua_settop(lua_state, 2);
+	PushDataViewPart(lua_state, 1, "dzvents_view_source", false);		// 3
+	PushDataViewPart(lua_state, 1, "dzvents_view_overlay", false);	// 4
+	bool bInSource = lua_isnil(lua_state, 2);
+	if ((!bInSource) && (lua_istable(lua_state, 3)))
+	{
+		lua_pushvalue(lua_state, 2);
+		lua_rawget(lua_state, 3);
+		bInSource = !lua_isnil(lua_state, -1);
+		lua_pop(lua_state, 1);
+	}
+	if ((bInSource) && (lua_istable(lua_state, 3)))
+	{
+		lua_pushvalue(lua_state, 2);
+		while (lua_next(lua_state, 3) != 0)
 		{
-			//Float
-			lua_pushnumber(lua_state, atof(uvitem.variableValue.c_str()));
-			vtype = "float";
+			lua_pop(lua_state, 1);
+			lua_pushvalue(lua_state, -1);
+			lua_gettable(lua_state, 1);
+			if (!lua_isnil(lua_state, -1))
+				return 2;
+			lua_pop(lua_state, 1);
 		}
-		else
+		lua_pushnil(lua_state);
+		lua_replace(lua_state, 2);
+	}
+	if (!lua_istable(lua_state, 4))
+		return 0;
+	lua_pushvalue(lua_state, 2);
+	while (lua_next(lua_state, 4) != 0)
+	{
+		bool bSkip = (lua_touserdata(lua_state, -1) == &s_dataViewDeleted);
+		if ((!bSkip) && (lua_istable(lua_state, 3)))
 		{
-			//String,Date,Time
-			lua_pushstring(lua_state, uvitem.variableValue.c_str());
-			if (uvitem.variableType == 2)
-				vtype = "string";
-			else if (uvitem.variableType == 3)
-				vtype = "date";
-			else if (uvitem.variableType == 4)
-				vtype = "time";
-			else
-				vtype = "unknown";
+			lua_pushvalue(lua_state, -2);
+			lua_rawget(lua_state, 3);
+			bSkip = !lua_isnil(lua_state, -1);
+			lua_pop(lua_state, 1);
 		}
+		if (!bSkip)
+			return 2;
+		lua_pop(lua_state, 1);
+	}
+	return 0;
+}
+
+int CdzVents::l_dataview_pairs(lua_State *lua_state)
+{
+	lua_pushcfunction(lua_state, l_dataview_next);
+	lua_pushvalue(lua_state, 1);
+	lua_pushnil(lua_state);
+	return 3;
+}
+
+int CdzVents::l_dataview_inext(lua_State *lua_state)
+{
+	lua_Integer i = luaL_checkinteger(lua_state, 2) + 1;
+	lua_pushinteger(lua_state, i);
+	lua_pushinteger(lua_state, i);
+	lua_gettable(lua_state, 1);
+	return (lua_isnil(lua_state, -1)) ? 0 : 2;
+}
+
+int CdzVents::l_dataview_ipairs(lua_State *lua_state)
+{
+	lua_pushcfunction(lua_state, l_dataview_inext);
+	lua_pushvalue(lua_state, 1);
+	lua_pushinteger(lua_state, 0);
+	return 3;
+}
+
+//#view, the length of the kept table corrected for what the script added or removed at the end
+int CdzVents::l_dataview_len(lua_State *lua_state)
+{
+	lua_Integer n = 0;
+	PushDataViewPart(lua_state, 1, "dzvents_view_source", false);
+	if (lua_istable(lua_state, -1))
+		n = static_cast<lua_Integer>(lua_rawlen(lua_state, -1));
+	lua_pop(lua_state, 1);
+	while (true)
+	{
+		lua_pushinteger(lua_state, n + 1);
+		lua_gettable(lua_state, 1);
+		bool bNil = lua_isnil(lua_state, -1);
+		lua_pop(lua_state, 1);
+		if (bNil)
+			break;
+		n++;
+	}
+	while (n > 0)
+	{
+		lua_pushinteger(lua_state, n);
+		lua_gettable(lua_state, 1);
+		bool bNil = lua_isnil(lua_state, -1);
+		lua_pop(lua_state, 1);
+		if (!bNil)
+			break;
+		n--;
+	}
+	lua_pushinteger(lua_state, n);
+	return 1;
+}
+
+//Patches the domoticzData table kept in the long-lived state, returns false when it has to be exported again completely
+bool CdzVents::UpdateDomoticzData(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items)
+{
+	CEventSystem &eventsystem = m_mainworker.m_eventsystem;
+
+	std::set<uint64_t> devices, scenesgroups, uservariables;
+	bool bReload;
+	{
+		std::lock_guard<std::mutex> l(eventsystem.m_exportChangesMutex);
+		devices.swap(eventsystem.m_exportDevices);
+		scenesgroups.swap(eventsystem.m_exportScenesGroups);
+		uservariables.swap(eventsystem.m_exportUserVariables);
+		bReload = eventsystem.m_bExportReload;
+		eventsystem.m_bExportReload = false;
+	}
+	if ((bReload) || (!m_bDataValid))
+		return false;
+	m_bDataValid = false;
+
+	_tTriggerItems deviceTriggers, sceneTriggers, variableTriggers;
+	GetTriggerItems(items, eventsystem.REASON_DEVICE, deviceTriggers);
+	GetTriggerItems(items, eventsystem.REASON_SCENEGROUP, sceneTriggers);
+	GetTriggerItems(items, eventsystem.REASON_USERVARIABLE, variableTriggers);
+
+	//entries of last run's triggers are rebuilt to drop their 'changed' flag and queue values
+	devices.insert(m_triggeredDevices.begin(), m_triggeredDevices.end());
+	scenesgroups.insert(m_triggeredScenesGroups.begin(), m_triggeredScenesGroups.end());
+	uservariables.insert(m_triggeredUserVariables.begin(), m_triggeredUserVariables.end());
+	m_triggeredDevices.clear();
+	m_triggeredScenesGroups.clear();
+	m_triggeredUserVariables.clear();
+	for (const auto & itt : deviceTriggers)
+		devices.insert(itt.first);
+	for (const auto & itt : sceneTriggers)
+		scenesgroups.insert(itt.first);
+	for (const auto & itt : variableTriggers)
+		uservariables.insert(itt.first);
+
+	time_t now = mytime(NULL);
+	struct tm tm1;
+	localtime_r(&now, &tm1);
+	int SensorTimeOut = 60;
+	m_sql.GetPreferencesVar("SensorTimeout", SensorTimeOut);
+
+	struct tm ntime;
+	time_t checktime;
+
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "dzvents_data");
+	if (!lua_istable(lua_state, -1))
+	{
+		lua_pop(lua_state, 1);
+		return false;
+	}
+
+	boost::shared_lock<boost::shared_mutex> devicestatesMutexLock(eventsystem.m_devicestatesMutex);
+	if (eventsystem.m_devicestates.size() != m_dataDevices.size())
+	{
+		lua_pop(lua_state, 1);
+		return false;
+	}
+	for (const auto & ID : devices)
+	{
+		std::map<uint64_t, CEventSystem::_tDeviceStatus>::const_iterator itt = eventsystem.m_devicestates.find(ID);
+		std::map<uint64_t, _tDataEntry>::iterator ittEntry = m_dataDevices.find(ID);
+		if ((itt == eventsystem.m_devicestates.end()) || (ittEntry == m_dataDevices.end()))
+		{
+			lua_pop(lua_state, 1);
+			return false;
+		}
+		CEventSystem::_tDeviceStatus sitem = itt->second;
+		bool triggerDevice = ApplyDeviceTriggers(sitem, deviceTriggers);
+
+		ParseSQLdatetime(checktime, ntime, sitem.lastUpdate, tm1.tm_isdst);
+		bool timed_out = (now - checktime >= SensorTimeOut * 60);
+
+		PushDevice(lua_state, sitem, triggerDevice, timed_out);
+		lua_rawseti(lua_state, -2, ittEntry->second.index);
+		ittEntry->second.lastUpdate = checktime;
+		ittEntry->second.timedOut = timed_out;
+		if (triggerDevice)
+			m_triggeredDevices.insert(ID);
+	}
+	devicestatesMutexLock.unlock();
+
+	//timeouts change with the clock, not with the devices
+	for (auto & itt : m_dataDevices)
+	{
+		bool timed_out = (now - itt.second.lastUpdate >= SensorTimeOut * 60);
+		if (timed_out == itt.second.timedOut)
+			continue;
+		lua_rawgeti(lua_state, -1, itt.second.index);
+		lua_pushstring(lua_state, "timedOut");
+		lua_pushboolean(lua_state, timed_out);
 		lua_rawset(lua_state, -3);
+		lua_pop(lua_state, 1);
+		itt.second.timedOut = timed_out;
+	}
 
-		lua_settable(lua_state, -3); // data table
+	std::map<uint64_t, std::string> descriptions;
+	GetSceneDescriptions(descriptions);
+	boost::shared_lock<boost::shared_mutex> scenesgroupsMutexLock(eventsystem.m_scenesgroupsMutex);
+	if (eventsystem.m_scenesgroups.size() != m_dataScenesGroups.size())
+	{
+		lua_pop(lua_state, 1);
+		return false;
+	}
+	for (const auto & ID : scenesgroups)
+	{
+		std::map<uint64_t, CEventSystem::_tScenesGroups>::const_iterator itt = eventsystem.m_scenesgroups.find(ID);
+		std::map<uint64_t, _tDataEntry>::iterator ittEntry = m_dataScenesGroups.find(ID);
+		if ((itt == eventsystem.m_scenesgroups.end()) || (ittEntry == m_dataScenesGroups.end()))
+		{
+			lua_pop(lua_state, 1);
+			return false;
+		}
+		CEventSystem::_tScenesGroups sgitem = itt->second;
+		bool triggerScene = ApplySceneGroupTriggers(sgitem, sceneTriggers);
+
+		PushSceneGroup(lua_state, sgitem, triggerScene, descriptions[ID]);
+		lua_rawseti(lua_state, -2, ittEntry->second.index);
+		ittEntry->second.description = descriptions[ID];
+		if (triggerScene)
+			m_triggeredScenesGroups.insert(ID);
+	}
+	scenesgroupsMutexLock.unlock();
 
-		lua_pushstring(lua_state, "variableType");
-		lua_pushstring(lua_state, vtype.c_str());
+	//descriptions are edited without an event
+	for (auto & itt : m_dataScenesGroups)
+	{
+		const std::string &description = descriptions[itt.first];
+		if (description == itt.second.description)
+			continue;
+		lua_rawgeti(lua_state, -1, itt.second.index);
+		lua_pushstring(lua_state, "description");
+		lua_pushstring(lua_state, description.c_str());
 		lua_rawset(lua_state, -3);
+		lua_pop(lua_state, 1);
+		itt.second.description = description;
+	}
 
-		lua_settable(lua_state, -3); // end entry
+	boost::shared_lock<boost::shared_mutex> uservariablesMutexLock(eventsystem.m_uservariablesMutex);
+	if (eventsystem.m_uservariables.size() != m_dataUserVariables.size())
+	{
+		lua_pop(lua_state, 1);
+		return false;
+	}
+	for (const auto & ID : uservariables)
+	{
+		std::map<uint64_t, CEventSystem::_tUserVariable>::const_iterator itt = eventsystem.m_uservariables.find(ID);
+		std::map<uint64_t, _tDataEntry>::iterator ittEntry = m_dataUserVariables.find(ID);
+		if ((itt == eventsystem.m_uservariables.end()) || (ittEntry == m_dataUserVariables.end()))
+		{
+			lua_pop(lua_state, 1);
+			return false;
+		}
+		CEventSystem::_tUserVariable uvitem = itt->second;
+		bool triggerVar = ApplyUserVariableTriggers(uvitem, variableTriggers);
 
-		index++;
+		PushUserVariable(lua_state, uvitem, triggerVar);
+		lua_rawseti(lua_state, -2, ittEntry->second.index);
+		if (triggerVar)
+			m_triggeredUserVariables.insert(ID);
 	}
+	uservariablesMutexLock.unlock();
 
+	m_bDataValid = true;
+	BeginDataViews(lua_state);
+	PushDataView(lua_state, -1);
+	lua_remove(lua_state, -2);
 	lua_setglobal(lua_state, "domoticzData");
+	return true;
+}
+
+lua_State *CdzVents::AcquireLuaState()
+{
+	std::lock_guard<std::mutex> l(m_luaStateMutex);
+	if (m_bLuaStateBusy)
+		return NULL;
+	if (m_luaState == NULL)
+	{
+		m_luaState = luaL_newstate();
+		luaL_openlibs(m_luaState);
+
+		// reroute print library to Domoticz logger
+		lua_pushcfunction(m_luaState, l_domoticz_print);
+		lua_setglobal(m_luaState, "print");
+
+		lua_pushcfunction(m_luaState, CEventSystem::l_domoticz_applyJsonPath);
+		lua_setglobal(m_luaState, "domoticz_applyJsonPath");
+
+		lua_pushcfunction(m_luaState, CEventSystem::l_domoticz_applyXPath);
+		lua_setglobal(m_luaState, "domoticz_applyXPath");
+
+		CEventSystem::InitReusableLuaState(m_luaState);
+		m_bDataValid = false;
+	}
+	m_bLuaStateBusy = true;
+	CEventSystem::BeginReusableLuaRun(m_luaState);
+	return m_luaState;
+}
+
+void CdzVents::ReleaseLuaState(lua_State *lua_state)
+{
+	std::lock_guard<std::mutex> l(m_luaStateMutex);
+	if (lua_state == m_luaState)
+		m_bLuaStateBusy = false;
+}
+
+void CdzVents::CloseLuaState()
+{
+	std::lock_guard<std::mutex> l(m_luaStateMutex);
+	if ((m_luaState == NULL) || (m_bLuaStateBusy))
+		return;
+	lua_close(m_luaState);
+	m_luaState = NULL;
+	m_bDataValid = false;
+	m_dataDevices.clear();
+	m_dataScenesGroups.clear();
+	m_dataUserVariables.clear();
+	m_triggeredDevices.clear();
+	m_triggeredScenesGroups.clear();
+	m_triggeredUserVariables.clear();
 }
@@ -11,6 +11,10 @@ public:
 	void LoadEvents();
 	bool processLuaCommand(lua_State *lua_state, const std::string &filename, const int tIndex);
 	void EvaluateDzVents(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items, const int secStatus);
+	//Long-lived state that keeps domoticzData between runs, NULL while a previous run still uses it
+	lua_State *AcquireLuaState();
+	void ReleaseLuaState(lua_State *lua_state);
+	void CloseLuaState();
 
 	std::string m_scriptsDir, m_runtimeDir;
 	bool m_bdzVentsExist;
@@ -40,6 +44,27 @@ private:
 	bool UpdateVariable(lua_State *lua_state, const std::vector<_tLuaTableValues> &vLuaTable);
 	bool CancelItem(lua_State *lua_state, const std::vector<_tLuaTableValues> &vLuaTable);
 	void ExportDomoticzDataToLua(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items);
+	//Queue items per triggering device, scene or variable, in queue order
+	typedef std::multimap<uint64_t, const CEventSystem::_tEventQueue*> _tTriggerItems;
+	static void GetTriggerItems(const std::vector<CEventSystem::_tEventQueue> &items, const int reason, _tTriggerItems &triggers);
+	static bool ApplyDeviceTriggers(CEventSystem::_tDeviceStatus &sitem, const _tTriggerItems &triggers);
+	static bool ApplySceneGroupTriggers(CEventSystem::_tScenesGroups &sgitem, const _tTriggerItems &triggers);
+	static bool ApplyUserVariableTriggers(CEventSystem::_tUserVariable &uvitem, const _tTriggerItems &triggers);
+	bool UpdateDomoticzData(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items);
+	static void BeginDataViews(lua_State *lua_state);
+	static void PushDataView(lua_State *lua_state, const int tIndex);
+	static void PushDataViewPart(lua_State *lua_state, const int vIndex, const char *szMap, const bool bCreate);
+	static int l_dataview_index(lua_State *lua_state);
+	static int l_dataview_newindex(lua_State *lua_state);
+	static int l_dataview_next(lua_State *lua_state);
+	static int l_dataview_pairs(lua_State *lua_state);
+	static int l_dataview_inext(lua_State *lua_state);
+	static int l_dataview_ipairs(lua_State *lua_state);
+	static int l_dataview_len(lua_State *lua_state);
+	void PushDevice(lua_State *lua_state, const CEventSystem::_tDeviceStatus &sitem, const bool triggerDevice, const bool timed_out);
+	void PushSceneGroup(lua_State *lua_state, const CEventSystem::_tScenesGroups &sgitem, const bool triggerScene, const std::string &description);
+	void PushUserVariable(lua_State *lua_state, const CEventSystem::_tUserVariable &uvitem, const bool triggerVar);
+	void GetSceneDescriptions(std::map<uint64_t, std::string> &descriptions);
 	void IterateTable(lua_State *lua_state, const int tIndex, std::vector<_tLuaTableValues> &vLuaTable);
 	void SetGlobalVariables(lua_State *lua_state, const bool reasonTime, const int secStatus);
 	void ProcessHttpResponse(lua_State *lua_state, const std::vector<CEventSystem::_tEventQueue> &items);
@@ -48,4 +73,23 @@ private:
 	static int l_domoticz_print(lua_State* lua_state);
 	static CdzVents m_dzvents;
 	std::string m_version;
+
+	//Position and last exported state of every item in the domoticzData table of m_luaState
+	struct _tDataEntry
+	{
+		int index;
+		time_t lastUpdate;
+		bool timedOut;
+		std::string description;
+	};
+	std::mutex m_luaStateMutex;
+	lua_State *m_luaState;
+	bool m_bLuaStateBusy;
+	bool m_bDataValid;
+	std::map<uint64_t, _tDataEntry> m_dataDevices;
+	std::map<uint64_t, _tDataEntry> m_dataScenesGroups;
+	std::map<uint64_t, _tDataEntry> m_dataUserVariables;
+	std::set<uint64_t> m_triggeredDevices;
+	std::set<uint64_t> m_triggeredScenesGroups;
+	std::set<uint64_t> m_triggeredUserVariables;
 };
@@ -221,6 +221,22 @@ MainWorker::MainWorker()
 #endif
 	m_bIgnoreUsernamePassword = false;
 
+	//Received messages are published by ProcessRXMessage with the state captured when they were processed,
+	//the other updates are signalled right after they are written
+	sOnDeviceReceived.connect([this](const int HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand) {
+		if (pRXCommand != NULL)
+			return;
+		int nValue = 0;
+		std::string sValue;
+		_tDeviceCacheItem dev;
+		if (m_sql.m_devicecache.GetDevice(DeviceRowIdx, dev))
+		{
+			nValue = dev.nValue;
+			sValue = dev.sValue;
+		}
+		m_deviceEventBus.Publish(HwdID, DeviceRowIdx, DeviceName, nValue, sValue, mytime(NULL));
+	});
+
 	time_t atime = mytime(NULL);
 	m_LastHeartbeat = atime;
 	struct tm ltime;
@@ -243,6 +259,8 @@ MainWorker::MainWorker()
 	m_SecStatus = SECSTATUS_DISARMED;
 
 	m_rxMessageIdx = 1;
+	m_rxBatchMaxItems = 16;
+	m_rxBatchMaxLatencyMs = 25;
 	m_bForceLogNotificationCheck = false;
 }
 
@@ -1333,6 +1351,11 @@ void MainWorker::HandleAutomaticBackups()
 
 	_log.Log(LOG_STATUS, "Starting automatic database backup procedure...");
 
+	int nCompress = 0;
+	m_sql.GetPreferencesVar("CompressAutoBackup", nCompress);
+	bool bCompress = (nCompress == 1);
+	std::string szExtension = (bCompress) ? ".db.gz" : ".db";
+
 	std::stringstream backup_DirH;
 	std::stringstream backup_DirD;
 	std::stringstream backup_DirM;
@@ -1387,10 +1410,10 @@ void MainWorker::HandleAutomaticBackups()
 		if ((lDir = opendir(sbackup_DirH.c_str())) != NULL)
 		{
 			std::stringstream sTmp;
-			sTmp << "backup-hour-" << std::setw(2) << std::setfill('0') << hour << "-" << szInstanceName << ".db";
+			sTmp << "backup-hour-" << std::setw(2) << std::setfill('0') << hour << "-" << szInstanceName << szExtension;
 
 			std::string OutputFileName = sbackup_DirH + sTmp.str();
-			if (m_sql.BackupDatabase(OutputFileName)) {
+			if (m_sql.BackupDatabase(OutputFileName, bCompress)) {
 				m_sql.SetLastBackupNo("Hour", hour);
 			}
 			else {
@@ -1407,10 +1430,10 @@ void MainWorker::HandleAutomaticBackups()
 		if ((lDir = opendir(sbackup_DirD.c_str())) != NULL)
 		{
 			std::stringstream sTmp;
-			sTmp << "backup-day-" << std::setw(2) << std::setfill('0') << day << "-" << szInstanceName << ".db";
+			sTmp << "backup-day-" << std::setw(2) << std::setfill('0') << day << "-" << szInstanceName << szExtension;
 
 			std::string OutputFileName = sbackup_DirD + sTmp.str();
-			if (m_sql.BackupDatabase(OutputFileName)) {
+			if (m_sql.BackupDatabase(OutputFileName, bCompress)) {
 				m_sql.SetLastBackupNo("Day", day);
 			}
 			else {
@@ -1426,10 +1449,10 @@ void MainWorker::HandleAutomaticBackups()
 		if ((lDir = opendir(sbackup_DirM.c_str())) != NULL)
 		{
 			std::stringstream sTmp;
-			sTmp << "backup-month-" << std::setw(2) << std::setfill('0') << month + 1 << "-" << szInstanceName << ".db";
+			sTmp << "backup-month-" << std::setw(2) << std::setfill('0') << month + 1 << "-" << szInstanceName << szExtension;
 
 			std::string OutputFileName = sbackup_DirM + sTmp.str();
-			if (m_sql.BackupDatabase(OutputFileName)) {
+			if (m_sql.BackupDatabase(OutputFileName, bCompress)) {
 				m_sql.SetLastBackupNo("Month", month);
 			}
 			else {
@@ -2042,12 +2065,45 @@ void MainWorker::UnlockRxMessageQueue()
 	m_rxMessageQueue.push(rxMessage);
 }
 
+void MainWorker::SetRxBatching(const int MaxItems, const int MaxLatencyMs)
+{
+	m_rxBatchMaxItems = (MaxItems < 1) ? 1 : MaxItems;
+	m_rxBatchMaxLatencyMs = (MaxLatencyMs < 0) ? 0 : MaxLatencyMs;
+}
+
 void MainWorker::Do_Work_On_Rx_Messages()
 {
 	_log.Log(LOG_STATUS, "RxQueue: queue worker started...");
 
+	//Messages that are already waiting in the queue are processed inside one database transaction
+	//The batch is committed when the queue is empty, or when the batch size or latency limit is reached
+	bool bInTransaction = false;
+	int batchItems = 0;
+	std::chrono::steady_clock::time_point batchStart;
+	std::vector<queue_element_trigger*> batchTriggers;
+
 	while (!m_TaskRXMessage.IsStopRequested(0))
 	{
+		if (bInTransaction)
+		{
+			if (
+				(batchItems >= m_rxBatchMaxItems) ||
+				(m_rxMessageQueue.empty()) ||
+				(std::chrono::steady_clock::now() - batchStart >= std::chrono::milliseconds(m_rxBatchMaxLatencyMs))
+				)
+			{
+				m_sql.CommitTransaction();
+				bInTransaction = false;
+#ifdef DEBUG_RXQUEUE
+				_log.Log(LOG_STATUS, "RxQueue: committed batch of %d messages", batchItems);
+#endif
+				//Waiting senders may read back the result, so only release them after the commit
+				for (auto & itt : batchTriggers)
+					itt->popped();
+				batchTriggers.clear();
+			}
+		}
+
 		// Wait and pop next message or timeout
 		_tRxQueueItem rxQItem;
 		bool hasPopped = m_rxMessageQueue.timed_wait_and_pop<std::chrono::duration<int> >(rxQItem, std::chrono::duration<int>(5));
@@ -2112,12 +2168,30 @@ void MainWorker::Do_Work_On_Rx_Messages()
 			pRXCommand[1],
 			pRXCommand[2]);
 #endif
+		if ((!bInTransaction) && (m_rxBatchMaxItems > 1) && (!m_rxMessageQueue.empty()))
+		{
+			m_sql.BeginTransaction();
+			bInTransaction = true;
+			batchItems = 0;
+			batchStart = std::chrono::steady_clock::now();
+		}
 		ProcessRXMessage(pHardware, pRXCommand, rxQItem.Name.c_str(), rxQItem.BatteryLevel);
+		if (bInTransaction)
+			batchItems++;
 		if (rxQItem.trigger != NULL)
 		{
-			rxQItem.trigger->popped();
+			if (bInTransaction)
+				batchTriggers.push_back(rxQItem.trigger);
+			else
+				rxQItem.trigger->popped();
 		}
 	}
+	if (bInTransaction)
+	{
+		m_sql.CommitTransaction();
+		for (auto & itt : batchTriggers)
+			itt->popped();
+	}
 
 	_log.Log(LOG_STATUS, "RxQueue: queue worker stopped...");
 }
@@ -2430,10 +2504,26 @@ void MainWorker::ProcessRXMessage(const CDomoticzHardwareBase *pHardware, const
 
 	//TODO: Notify plugin?
 
-	//Send to connected Sharing Users
-	m_sharedserver.SendToAll(pHardware->m_HwdID, DeviceRowIdx, (const char*)pRXCommand, pRXCommand[0] + 1, pClient2Ignore);
+	//Sharing users and subscribers get the update when it is committed, and should not hold up a batch
+	//the command buffer belongs to the queue item, so keep a copy
+	std::vector<unsigned char> vRXCommand(pRXCommand, pRXCommand + Len);
+	//a later message in the same batch can change the device again, so take its state now
+	int nValue = 0;
+	std::string sValue;
+	_tDeviceCacheItem dev;
+	if (m_sql.m_devicecache.GetDevice(DeviceRowIdx, dev))
+	{
+		nValue = dev.nValue;
+		sValue = dev.sValue;
+	}
+	const time_t Updated = mytime(NULL);
+	m_sql.RunAfterCommit([this, HwdID, DeviceRowIdx, DeviceName, vRXCommand, pClient2Ignore, nValue, sValue, Updated]() {
+		//Send to connected Sharing Users
+		m_sharedserver.SendToAll(HwdID, DeviceRowIdx, (const char*)&vRXCommand[0], vRXCommand.size(), pClient2Ignore);
 
-	sOnDeviceReceived(pHardware->m_HwdID, DeviceRowIdx, DeviceName, pRXCommand);
+		sOnDeviceReceived(HwdID, DeviceRowIdx, DeviceName, &vRXCommand[0]);
+		m_deviceEventBus.Publish(HwdID, DeviceRowIdx, DeviceName, nValue, sValue, Updated);
+	});
 }
 
 void MainWorker::decode_InterfaceMessage(const int HwdID, const _eHardwareTypes HwdType, const tRBUF *pResponse, _tRxMessageProcessingResult & procResult)
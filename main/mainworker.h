@@ -11,6 +11,7 @@
 #include "StoppableTask.h"
 #include "../tcpserver/TCPServer.h"
 #include "concurrent_queue.h"
+#include "DeviceEventBus.h"
 #include "../webserver/server_settings.hpp"
 #ifdef ENABLE_PYTHON
 #	include "../hardware/plugins/PluginManager.h"
@@ -49,6 +50,7 @@ public:
 	std::string GetSecureWebserverPort();
 #endif
 	void DecodeRXMessage(const CDomoticzHardwareBase *pHardware, const unsigned char *pRXCommand, const char *defaultName, const int BatteryLevel);
+	void SetRxBatching(const int MaxItems, const int MaxLatencyMs);
 	void PushAndWaitRxMessage(const CDomoticzHardwareBase *pHardware, const unsigned char *pRXCommand, const char *defaultName, const int BatteryLevel);
 
 	bool SwitchLight(const std::string &idx, const std::string &switchcmd, const std::string &level, const std::string &color, const std::string &ooc, const int ExtraDelay);
@@ -106,6 +108,8 @@ public:
 
 	boost::signals2::signal<void(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)> sOnDeviceReceived;
 	boost::signals2::signal<void(const uint64_t SceneIdx, const std::string &SceneName)> sOnSwitchScene;
+	//Every sOnDeviceReceived is also published here, for subscribers that handle it on their own thread
+	CDeviceEventBus m_deviceEventBus;
 
 	CScheduler m_scheduler;
 	CEventSystem m_eventsystem;
@@ -198,6 +202,8 @@ private:
 	volatile unsigned long m_rxMessageIdx;
 	std::shared_ptr<std::thread> m_rxMessageThread;
 	StoppableTask m_TaskRXMessage;
+	int m_rxBatchMaxItems;
+	int m_rxBatchMaxLatencyMs;
 	void Do_Work_On_Rx_Messages();
 	struct _tRxQueueItem {
 		std::string Name;
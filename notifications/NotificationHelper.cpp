@@ -231,6 +231,12 @@ bool CNotificationHelper::CheckAndHandleNotification(const uint64_t DevRowIdx, c
 }
 
 bool CNotificationHelper::CheckAndHandleNotification(const uint64_t DevRowIdx, const int HardwareID, const std::string &ID, const std::string &sName, const unsigned char unit, const unsigned char cType, const unsigned char cSubType, const int nValue, const std::string &sValue, const float fValue) {
+	//While a batch of received messages is stored, check after the commit so the writer is not held up
+	if (m_sql.IsTransactionOwner())
+	{
+		m_sql.RunAfterCommit([=]() { CheckAndHandleNotification(DevRowIdx, HardwareID, ID, sName, unit, cType, cSubType, nValue, sValue, fValue); });
+		return false;
+	}
 	float fValue2;
 	bool r1, r2, r3;
 	int nsize;
@@ -823,6 +829,11 @@ bool CNotificationHelper::CheckAndHandleNotification(
 	const _eNotificationTypes ntype,
 	const std::string &message)
 {
+	if (m_sql.IsTransactionOwner())
+	{
+		m_sql.RunAfterCommit([=]() { CheckAndHandleNotification(Idx, devicename, ntype, message); });
+		return false;
+	}
 	std::vector<_tNotification> notifications = GetNotifications(Idx);
 	if (notifications.size() == 0)
 		return false;
@@ -874,6 +885,11 @@ bool CNotificationHelper::CheckAndHandleNotification(
 	const _eNotificationTypes ntype,
 	const float mvalue)
 {
+	if (m_sql.IsTransactionOwner())
+	{
+		m_sql.RunAfterCommit([=]() { CheckAndHandleNotification(Idx, devicename, devType, subType, ntype, mvalue); });
+		return false;
+	}
 	std::vector<_tNotification> notifications = GetNotifications(Idx);
 	if (notifications.size() == 0)
 		return false;
@@ -970,6 +986,11 @@ bool CNotificationHelper::CheckAndHandleSwitchNotification(
 	const std::string &devicename,
 	const _eNotificationTypes ntype)
 {
+	if (m_sql.IsTransactionOwner())
+	{
+		m_sql.RunAfterCommit([=]() { CheckAndHandleSwitchNotification(Idx, devicename, ntype); });
+		return false;
+	}
 	std::vector<_tNotification> notifications = GetNotifications(Idx);
 	if (notifications.size() == 0)
 		return false;
@@ -1084,6 +1105,11 @@ bool CNotificationHelper::CheckAndHandleSwitchNotification(
 	const _eNotificationTypes ntype,
 	const int llevel)
 {
+	if (m_sql.IsTransactionOwner())
+	{
+		m_sql.RunAfterCommit([=]() { CheckAndHandleSwitchNotification(Idx, devicename, ntype, llevel); });
+		return false;
+	}
 	std::vector<_tNotification> notifications = GetNotifications(Idx);
 	if (notifications.size() == 0)
 		return false;
@@ -376,6 +376,59 @@ CBasePush::CBasePush()
 {
 	m_bLinkActive = false;
 	m_DeviceRowIdx = -1;
+	m_bLinksLoaded = false;
+}
+
+void CBasePush::ReloadLinks()
+{
+	std::lock_guard<std::mutex> l(m_linksMutex);
+	m_bLinksLoaded = false;
+	m_links.clear();
+}
+
+//Reads the enabled links of this push type, m_linksMutex should be locked
+void CBasePush::LoadLinks()
+{
+	if (m_bLinksLoaded)
+		return;
+	std::string szFilter = "Enabled==1";
+	if (!m_szLinkFilter.empty())
+		szFilter += " AND " + m_szLinkFilter;
+	std::vector<std::vector<std::string> > result;
+	result = m_sql.safe_query(
+		"SELECT DeviceID, DelimitedValue, TargetType, TargetVariable, TargetDeviceID, TargetProperty, IncludeUnit FROM %s WHERE (%s)",
+		m_szLinkTable.c_str(), szFilter.c_str());
+	for (const auto &sd : result)
+	{
+		_tPushLinkItem link;
+		link.DeviceID = sd[0];
+		link.DelimitedValue = atoi(sd[1].c_str());
+		link.TargetType = atoi(sd[2].c_str());
+		link.TargetVariable = sd[3];
+		link.TargetDeviceID = atoi(sd[4].c_str());
+		link.TargetProperty = sd[5];
+		link.IncludeUnit = atoi(sd[6].c_str());
+		m_links[std::strtoull(sd[0].c_str(), nullptr, 10)].push_back(link);
+	}
+	m_bLinksLoaded = true;
+}
+
+bool CBasePush::GetLinks(const uint64_t DeviceRowIdx, std::vector<_tPushLinkItem> &links)
+{
+	std::lock_guard<std::mutex> l(m_linksMutex);
+	LoadLinks();
+	auto itt = m_links.find(DeviceRowIdx);
+	if (itt == m_links.end())
+		return false;
+	links = itt->second;
+	return true;
+}
+
+bool CBasePush::HasLinks(const uint64_t DeviceRowIdx)
+{
+	std::lock_guard<std::mutex> l(m_linksMutex);
+	LoadLinks();
+	return (m_links.find(DeviceRowIdx) != m_links.end());
 }
 
 // STATIC
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <boost/signals2.hpp>
+#include <unordered_map>
+#include <mutex>
 #include "../main/StoppableTask.h"
+#include "../main/DeviceEventBus.h"
 
 class CBasePush : public StoppableTask
 {
@@ -10,10 +13,30 @@ public:
 
 	static std::vector<std::string> DropdownOptions(const uint64_t DeviceRowIdxIn);
 	static std::string DropdownOptionsValue(const uint64_t DeviceRowIdxIn, const int pos);
+	//Forgets the cached links, they are read again on the next device update
+	void ReloadLinks();
 protected:
+	struct _tPushLinkItem
+	{
+		std::string DeviceID;
+		int DelimitedValue;
+		int TargetType;
+		std::string TargetVariable;
+		int TargetDeviceID;
+		std::string TargetProperty;
+		int IncludeUnit;
+	};
+	//Enabled links of a device, false when it has none
+	bool GetLinks(const uint64_t DeviceRowIdx, std::vector<_tPushLinkItem> &links);
+	bool HasLinks(const uint64_t DeviceRowIdx);
+
+	//table holding the links of this push type, with an optional extra filter
+	std::string m_szLinkTable;
+	std::string m_szLinkFilter;
+
 	bool m_bLinkActive;
 	uint64_t m_DeviceRowIdx;
-	boost::signals2::connection m_sConnection;
+	CDeviceEventBus::subscription m_deviceSubscription;
 	boost::signals2::connection m_sNotification;
 
 	std::string ProcessSendValue(const std::string &rawsendValue, const int delpos, const int nValue, const int includeUnit, const int devType, const int devSubType, const int metertype);
@@ -27,5 +50,11 @@ protected:
 #endif
 
 	static void replaceAll(std::string& context, const std::string& from, const std::string& to);
+private:
+	void LoadLinks();
+
+	std::mutex m_linksMutex;
+	bool m_bLinksLoaded;
+	std::unordered_map<uint64_t, std::vector<_tPushLinkItem> > m_links;
 };
 
@@ -14,21 +14,37 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
+//sent on the HTTP thread, a slow Fibaro does not hold up the next pushes
+static void SendToFibaro(const HTTPClient::_eHTTPmethod method, const std::string &url, const std::string &data, const std::vector<std::string> &ExtraHeaders)
+{
+	HTTPClient::AsyncRequest(method, url, data, ExtraHeaders,
+		[](const bool bSuccess, std::vector<unsigned char> &vResponse, std::vector<std::string> &/*vHeaderData*/)
+	{
+		if ((!bSuccess) || (vResponse.empty()))
+		{
+			_log.Log(LOG_ERROR, "Error sending data to Fibaro!");
+		}
+	});
+}
+
 CFibaroPush::CFibaroPush()
 {
 	m_bLinkActive = false;
+	m_szLinkTable = "FibaroLink";
 }
 
 void CFibaroPush::Start()
 {
 	UpdateActive();
-	m_sConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CFibaroPush::OnDeviceReceived, this, _1, _2, _3, _4));
+	//the link reads the current state of the device, a pending update is enough
+	m_deviceSubscription = m_mainworker.m_deviceEventBus.Subscribe("FibaroLink", [this](const CDeviceEventBus::_tDeviceEvent &event) {
+		OnDeviceReceived(event.HardwareID, event.DeviceRowIdx, event.DeviceName, NULL);
+	}, CDeviceEventBus::OVERFLOW_COALESCE);
 }
 
 void CFibaroPush::Stop()
 {
-	if (m_sConnection.connected())
-		m_sConnection.disconnect();
+	m_mainworker.m_deviceEventBus.Unsubscribe(m_deviceSubscription);
 }
 
 void CFibaroPush::UpdateActive()
@@ -41,7 +57,7 @@ void CFibaroPush::UpdateActive()
 void CFibaroPush::OnDeviceReceived(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)
 {
 	m_DeviceRowIdx = DeviceRowIdx;
-	if (m_bLinkActive)
+	if ((m_bLinkActive) && (HasLinks(DeviceRowIdx)))
 	{
 		DoFibaroPush();
 	}
@@ -130,7 +146,6 @@ void CFibaroPush::DoFibaroPush()
 				sendValue = lstatus;
 			}
 			if (sendValue != "") {
-				std::string sResult;
 				std::stringstream sPostData;
 				std::stringstream Url;
 				std::vector<std::string> ExtraHeaders;
@@ -168,21 +183,14 @@ void CFibaroPush::DoFibaroPush()
 					if (fibaroDebugActive) {
 						_log.Log(LOG_NORM, "FibaroLink: sending global variable %s with value: %s", targetVariable.c_str(), sendValue.c_str());
 					}
-					if (!HTTPClient::PUT(Url.str(), sPostData.str(), ExtraHeaders, sResult))
-					{
-						_log.Log(LOG_ERROR, "Error sending data to Fibaro!");
-
-					}
+					SendToFibaro(HTTPClient::HTTP_METHOD_PUT, Url.str(), sPostData.str(), ExtraHeaders);
 				}
 				else if (targetType == 1) {
 					Url << "api/callAction?deviceid=" << targetDeviceID << "&name=setProperty&arg1=" << targetProperty << "&arg2=" << sendValue;
 					if (fibaroDebugActive) {
 						_log.Log(LOG_NORM, "FibaroLink: sending value %s to property %s of virtual device id %d", sendValue.c_str(), targetProperty.c_str(), targetDeviceID);
 					}
-					if (!HTTPClient::GET(Url.str(), ExtraHeaders, sResult))
-					{
-						_log.Log(LOG_ERROR, "Error sending data to Fibaro!");
-					}
+					SendToFibaro(HTTPClient::HTTP_METHOD_GET, Url.str(), "", ExtraHeaders);
 				}
 				else if (targetType == 2) {
 					if (((delpos == 0) && (lstatus == "Off")) || ((delpos == 1) && (lstatus == "On"))) {
@@ -190,10 +198,7 @@ void CFibaroPush::DoFibaroPush()
 						if (fibaroDebugActive) {
 							_log.Log(LOG_NORM, "FibaroLink: activating scene %d", targetDeviceID);
 						}
-						if (!HTTPClient::GET(Url.str(), ExtraHeaders, sResult))
-						{
-							_log.Log(LOG_ERROR, "Error sending data to Fibaro!");
-						}
+						SendToFibaro(HTTPClient::HTTP_METHOD_GET, Url.str(), "", ExtraHeaders);
 					}
 				}
 				else if (targetType == 3) {
@@ -202,10 +207,7 @@ void CFibaroPush::DoFibaroPush()
 						if (fibaroDebugActive) {
 							_log.Log(LOG_NORM, "FibaroLink: reboot");
 						}
-						if (!HTTPClient::POST(Url.str(), sPostData.str(), ExtraHeaders, sResult))
-						{
-							_log.Log(LOG_ERROR, "Error sending data to Fibaro!");
-						}
+						SendToFibaro(HTTPClient::HTTP_METHOD_POST, Url.str(), sPostData.str(), ExtraHeaders);
 					}
 				}
 			}
@@ -380,6 +382,7 @@ namespace http {
 					idx.c_str()
 				);
 			}
+			m_fibaropush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "SaveFibaroLink";
 		}
@@ -396,6 +399,7 @@ namespace http {
 			if (idx == "")
 				return;
 			m_sql.safe_query("DELETE FROM FibaroLink WHERE (ID=='%q')", idx.c_str());
+			m_fibaropush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "DeleteFibaroLink";
 		}
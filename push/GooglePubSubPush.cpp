@@ -33,18 +33,21 @@ static struct PyModuleDef eventModuledef;
 CGooglePubSubPush::CGooglePubSubPush()
 {
 	m_bLinkActive = false;
+	m_szLinkTable = "GooglePubSubLink";
 }
 
 void CGooglePubSubPush::Start()
 {
 	UpdateActive();
-	m_sConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CGooglePubSubPush::OnDeviceReceived, this, _1, _2, _3, _4));
+	//the link reads the current state of the device, a pending update is enough
+	m_deviceSubscription = m_mainworker.m_deviceEventBus.Subscribe("GooglePubSubLink", [this](const CDeviceEventBus::_tDeviceEvent &event) {
+		OnDeviceReceived(event.HardwareID, event.DeviceRowIdx, event.DeviceName, NULL);
+	}, CDeviceEventBus::OVERFLOW_COALESCE);
 }
 
 void CGooglePubSubPush::Stop()
 {
-	if (m_sConnection.connected())
-		m_sConnection.disconnect();
+	m_mainworker.m_deviceEventBus.Unsubscribe(m_deviceSubscription);
 }
 
 
@@ -58,7 +61,7 @@ void CGooglePubSubPush::UpdateActive()
 void CGooglePubSubPush::OnDeviceReceived(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)
 {
 	m_DeviceRowIdx = DeviceRowIdx;
-	if (m_bLinkActive)
+	if ((m_bLinkActive) && (HasLinks(DeviceRowIdx)))
 	{
 		DoGooglePubSubPush();
 	}
@@ -440,6 +443,7 @@ namespace http {
 					idx.c_str()
 				);
 			}
+			m_googlepubsubpush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "SaveGooglePubSubLink";
 		}
@@ -456,6 +460,7 @@ namespace http {
 			if (idx == "")
 				return;
 			m_sql.safe_query("DELETE FROM GooglePubSubLink WHERE (ID=='%q')", idx.c_str());
+			m_googlepubsubpush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "DeleteGooglePubSubLink";
 		}
@@ -18,18 +18,21 @@
 CHttpPush::CHttpPush()
 {
 	m_bLinkActive = false;
+	m_szLinkTable = "HttpLink";
 }
 
 void CHttpPush::Start()
 {
 	UpdateActive();
-	m_sConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CHttpPush::OnDeviceReceived, this, _1, _2, _3, _4));
+	//the link reads the current state of the device, a pending update is enough
+	m_deviceSubscription = m_mainworker.m_deviceEventBus.Subscribe("HttpLink", [this](const CDeviceEventBus::_tDeviceEvent &event) {
+		OnDeviceReceived(event.HardwareID, event.DeviceRowIdx, event.DeviceName, NULL);
+	}, CDeviceEventBus::OVERFLOW_COALESCE);
 }
 
 void CHttpPush::Stop()
 {
-	if (m_sConnection.connected())
-		m_sConnection.disconnect();
+	m_mainworker.m_deviceEventBus.Unsubscribe(m_deviceSubscription);
 }
 
 
@@ -43,7 +46,7 @@ void CHttpPush::UpdateActive()
 void CHttpPush::OnDeviceReceived(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)
 {
 	m_DeviceRowIdx = DeviceRowIdx;
-	if (m_bLinkActive)
+	if ((m_bLinkActive) && (HasLinks(DeviceRowIdx)))
 	{
 		DoHttpPush();
 	}
@@ -201,7 +204,6 @@ void CHttpPush::DoHttpPush()
 			replaceAll(httpData, "%idx", sdeviceId);
 
 			if (sendValue != "") {
-				std::string sResult;
 				std::vector<std::string> ExtraHeaders;
 				if (httpAuthInt == 1) {			// BASIC authentication
 					std::stringstream sstr;
@@ -216,13 +218,16 @@ void CHttpPush::DoHttpPush()
 					_log.Log(LOG_NORM, "HttpLink: sending global variable %s with value: %s", targetVariable.c_str(), sendValue.c_str());
 				}
 
+				HTTPClient::_eHTTPmethod method;
+				const char *szMethod;
 				if (httpMethodInt == 0) {			// GET
-					if (!HTTPClient::GET(httpUrl, ExtraHeaders, sResult, true))
-					{
-						_log.Log(LOG_ERROR, "HttpLink: Error sending data to http with GET!");
-					}
+					method = HTTPClient::HTTP_METHOD_GET;
+					szMethod = "GET";
+					httpData.clear();
 				}
 				else if (httpMethodInt == 1) {		// POST
+					method = HTTPClient::HTTP_METHOD_POST;
+					szMethod = "POST";
 					if (httpHeaders.size() > 0)
 					{
 						// Add additional headers
@@ -233,22 +238,28 @@ void CHttpPush::DoHttpPush()
 							ExtraHeaders.push_back(ExtraHeaders2[i]);
 						}
 					}
-					if (!HTTPClient::POST(httpUrl, httpData, ExtraHeaders, sResult, true, true))
-					{
-						_log.Log(LOG_ERROR, "HttpLink: Error sending data to http with POST!");
-					}
 				}
 				else if (httpMethodInt == 2) {		// PUT
-					if (!HTTPClient::PUT(httpUrl, httpData, ExtraHeaders, sResult, true))
-					{
-						_log.Log(LOG_ERROR, "HttpLink: Error sending data to http with PUT!");
-					}
+					method = HTTPClient::HTTP_METHOD_PUT;
+					szMethod = "PUT";
 				}
+				else
+					continue;
 
-				// debug
-				if (httpDebugActive) {
-					_log.Log(LOG_NORM, "HttpLink: response %s", sResult.c_str());
-				}
+				// sent on the HTTP thread, a slow server does not hold up the next pushes
+				HTTPClient::AsyncRequest(method, httpUrl, httpData, ExtraHeaders,
+					[httpDebugActive, szMethod](const bool bSuccess, std::vector<unsigned char> &vResponse, std::vector<std::string> &/*vHeaderData*/)
+				{
+					if (!bSuccess)
+					{
+						_log.Log(LOG_ERROR, "HttpLink: Error sending data to http with %s!", szMethod);
+					}
+					// debug
+					if (httpDebugActive) {
+						std::string sResult(vResponse.begin(), vResponse.end());
+						_log.Log(LOG_NORM, "HttpLink: response %s", sResult.c_str());
+					}
+				});
 			}
 		}
 	}
@@ -443,6 +454,7 @@ namespace http {
 					idx.c_str()
 				);
 			}
+			m_httppush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "SaveHttpLink";
 		}
@@ -459,6 +471,7 @@ namespace http {
 			if (idx == "")
 				return;
 			m_sql.safe_query("DELETE FROM HttpLink WHERE (ID=='%q')", idx.c_str());
+			m_httppush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "DeleteHttpLink";
 		}
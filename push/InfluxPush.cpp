@@ -11,15 +11,33 @@
 #include "../main/WebServer.h"
 #include "../webserver/Base64.h"
 #include "../webserver/cWebem.h"
+#include "../webserver/GZipHelper.h"
 #include "../main/localtime_r.h"
+#include <fstream>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
+#define INFLUX_BATCH_SIZE 500 // points per write request
+#define INFLUX_FLUSH_INTERVAL 2 // seconds, send smaller batches after this
+#define INFLUX_MAX_QUEUE 5000 // points in memory, more are moved to the spool file
+#define INFLUX_MAX_SPOOL_SIZE (16 * 1024 * 1024) // bytes
+#define INFLUX_MAX_RETRY_DELAY 300 // seconds
+
+extern std::string szUserDataFolder;
+
 CInfluxPush::CInfluxPush() :
+	m_spoolSize(0),
+	m_spoolReadPos(0),
+	m_nQueued(0),
+	m_nSent(0),
+	m_nDropped(0),
+	m_nRetried(0),
 	m_InfluxPort(8086),
 	m_bInfluxDebugActive(false)
 {
 	m_bLinkActive = false;
+	m_szLinkTable = "PushLink";
+	m_szLinkFilter = "PushType==1";
 }
 
 bool CInfluxPush::Start()
@@ -30,18 +48,30 @@ bool CInfluxPush::Start()
 
 	UpdateSettings();
 
+	m_szSpoolFile = szUserDataFolder + "influxpush.spool";
+	m_spoolReadPos = 0;
+	m_spoolSize = 0;
+	std::ifstream infile(m_szSpoolFile.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+	if (infile.is_open())
+	{
+		m_spoolSize = static_cast<uint64_t>(infile.tellg());
+		infile.close();
+	}
+
 	m_thread = std::make_shared<std::thread>(&CInfluxPush::Do_Work, this);
 	SetThreadName(m_thread->native_handle(), "InfluxPush");
 
-	m_sConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CInfluxPush::OnDeviceReceived, this, _1, _2, _3, _4));
+	//every update is a point in the time series, so wait instead of dropping (queueing a point is fast)
+	m_deviceSubscription = m_mainworker.m_deviceEventBus.Subscribe("InfluxLink", [this](const CDeviceEventBus::_tDeviceEvent &event) {
+		OnDeviceReceived(event);
+	}, CDeviceEventBus::OVERFLOW_BLOCK);
 
 	return (m_thread != NULL);
 }
 
 void CInfluxPush::Stop()
 {
-	if (m_sConnection.connected())
-		m_sConnection.disconnect();
+	m_mainworker.m_deviceEventBus.Unsubscribe(m_deviceSubscription);
 
 	if (m_thread)
 	{
@@ -86,128 +116,321 @@ void CInfluxPush::UpdateSettings()
 	m_szURL = sURL.str();
 }
 
-void CInfluxPush::OnDeviceReceived(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)
+void CInfluxPush::OnDeviceReceived(const CDeviceEventBus::_tDeviceEvent &event)
 {
-	m_DeviceRowIdx = DeviceRowIdx;
+	m_DeviceRowIdx = event.DeviceRowIdx;
 	if (m_bLinkActive)
 	{
-		DoInfluxPush();
+		DoInfluxPush(event);
 	}
 }
 
-void CInfluxPush::DoInfluxPush()
+void CInfluxPush::DoInfluxPush(const CDeviceEventBus::_tDeviceEvent &event)
 {
-	std::vector<std::vector<std::string> > result;
-	result = m_sql.safe_query(
-		"SELECT A.DeviceID, A.DelimitedValue, B.ID, B.Type, B.SubType, B.nValue, B.sValue, A.TargetType, A.TargetVariable, A.TargetDeviceID, A.TargetProperty, A.IncludeUnit, B.Name, B.SwitchType FROM PushLink as A, DeviceStatus as B "
-		"WHERE (A.PushType==1 AND A.DeviceID == '%" PRIu64 "' AND A.Enabled==1 AND A.DeviceID==B.ID)",
-		m_DeviceRowIdx);
-	if (!result.empty())
+	std::vector<_tPushLinkItem> links;
+	if (!GetLinks(m_DeviceRowIdx, links))
+		return;
+	_tDeviceCacheItem dev;
+	if (!m_sql.m_devicecache.GetDevice(m_DeviceRowIdx, dev))
+		return;
+	//the value and time of the update itself, the device may have changed while the event was queued
+	time_t atime = event.Updated;
+	std::string sendValue;
+	for (const auto &link : links)
 	{
-		time_t atime = mytime(NULL);
-		std::string sendValue;
-		std::vector<std::vector<std::string> >::const_iterator itt;
-		for (itt = result.begin(); itt != result.end(); ++itt)
-		{
-			std::vector<std::string> sd = *itt;
-			int delpos = atoi(sd[1].c_str());
-			int dType = atoi(sd[3].c_str());
-			int dSubType = atoi(sd[4].c_str());
-			int nValue = atoi(sd[5].c_str());
-			std::string sValue = sd[6].c_str();
-			int targetType = atoi(sd[7].c_str());
-			//std::string targetVariable = sd[8].c_str();
-			//int targetDeviceID = atoi(sd[9].c_str());
-			//std::string targetProperty = sd[10].c_str();
-			int includeUnit = atoi(sd[11].c_str());
-			std::string name = sd[12];
-			int metertype = atoi(sd[13].c_str());
-
-			std::vector<std::string> strarray;
-			if (sValue.find(";") != std::string::npos) {
-				StringSplit(sValue, ";", strarray);
-				if (int(strarray.size()) >= delpos)
-				{
-					std::string rawsendValue = strarray[delpos - 1].c_str();
-					sendValue = ProcessSendValue(rawsendValue, delpos, nValue, includeUnit, dType, dSubType, metertype);
-				}
+		int delpos = link.DelimitedValue;
+		int dType = dev.Type;
+		int dSubType = dev.SubType;
+		int nValue = event.nValue;
+		std::string sValue = event.sValue;
+		int targetType = link.TargetType;
+		int includeUnit = link.IncludeUnit;
+		std::string name = dev.Name;
+		int metertype = dev.SwitchType;
+
+		std::vector<std::string> strarray;
+		if (sValue.find(";") != std::string::npos) {
+			StringSplit(sValue, ";", strarray);
+			if (int(strarray.size()) >= delpos)
+			{
+				std::string rawsendValue = strarray[delpos - 1].c_str();
+				sendValue = ProcessSendValue(rawsendValue, delpos, nValue, includeUnit, dType, dSubType, metertype);
 			}
-			else
-				sendValue = ProcessSendValue(sValue, delpos, nValue, includeUnit, dType, dSubType, metertype);
-
-			if (sendValue != "") {
-				std::string szKey;
-				std::string vType = CBasePush::DropdownOptionsValue(m_DeviceRowIdx, delpos);
-				stdreplace(vType, " ", "-");
-				stdreplace(name, " ", "-");
-				szKey = vType + ",idx=" + sd[0] + ",name=" + name;
-
-				_tPushItem pItem;
-				pItem.skey = szKey;
-				pItem.stimestamp = atime;
-				pItem.svalue = sendValue;
-
-				if (targetType == 0)
+		}
+		else
+			sendValue = ProcessSendValue(sValue, delpos, nValue, includeUnit, dType, dSubType, metertype);
+
+		if (sendValue != "") {
+			std::string szKey;
+			std::string vType = CBasePush::DropdownOptionsValue(m_DeviceRowIdx, delpos);
+			stdreplace(vType, " ", "-");
+			stdreplace(name, " ", "-");
+			szKey = vType + ",idx=" + link.DeviceID + ",name=" + name;
+
+			_tPushItem pItem;
+			pItem.skey = szKey;
+			pItem.stimestamp = atime;
+			pItem.svalue = sendValue;
+
+			if (targetType == 0)
+			{
+				//Only send on change
+				std::map<std::string, _tPushItem>::iterator itt = m_PushedItems.find(szKey);
+				if (itt != m_PushedItems.end())
 				{
-					//Only send on change
-					std::map<std::string, _tPushItem>::iterator itt = m_PushedItems.find(szKey);
-					if (itt != m_PushedItems.end())
-					{
-						if (sendValue == itt->second.svalue)
-							continue;
-					}
-					m_PushedItems[szKey] = pItem;
+					if (sendValue == itt->second.svalue)
+						continue;
 				}
+				m_PushedItems[szKey] = pItem;
+			}
 
-				std::lock_guard<std::mutex> l(m_background_task_mutex);
-				if (m_background_task_queue.size() < 50)
-					m_background_task_queue.push_back(pItem);
+			std::stringstream sziData;
+			sziData << szKey << " value=" << sendValue;
+			if (m_bInfluxDebugActive) {
+				_log.Log(LOG_NORM, "InfluxLink: value %s", sziData.str().c_str());
 			}
+			sziData << " " << atime;
+
+			std::lock_guard<std::mutex> l(m_background_task_mutex);
+			m_background_task_queue.push_back(sziData.str());
+			m_nQueued++;
 		}
 	}
 }
 
 void CInfluxPush::Do_Work()
 {
-	std::vector<_tPushItem> _items2do;
+	std::vector<std::string> _items2do;
+	bool bFromSpool = false;
+	uint64_t spoolNextPos = 0;
+	time_t lastSend = 0;
+	time_t nextAttempt = 0;
+	int retryDelay = 0;
 
 	while (!IsStopRequested(500))
 	{
-		{ // additional scope for lock (accessing size should be within lock too)
+		time_t atime = mytime(NULL);
+		{
 			std::lock_guard<std::mutex> l(m_background_task_mutex);
-			if (m_background_task_queue.empty())
-				continue;
-			_items2do = m_background_task_queue;
-			m_background_task_queue.clear();
+			if (m_background_task_queue.size() > INFLUX_MAX_QUEUE)
+			{
+				//server is not keeping up (or not reachable), keep the points on disk
+				std::vector<std::string> lines(m_background_task_queue.begin(), m_background_task_queue.end());
+				m_background_task_queue.clear();
+				SpoolLines(lines);
+			}
 		}
 
-		if (m_szURL.empty())
+		if ((m_szURL.empty()) || (atime < nextAttempt))
 			continue;
 
-		std::string sSendData;
-
-		std::vector<_tPushItem>::iterator itt = _items2do.begin();
-		while (itt != _items2do.end())
+		if (_items2do.empty())
 		{
-			if (!sSendData.empty())
-				sSendData += '\n';
+			//older points from the spool file go first
+			bFromSpool = ReadSpool(_items2do, spoolNextPos);
+			if (!bFromSpool)
+			{
+				std::lock_guard<std::mutex> l(m_background_task_mutex);
+				if (
+					(m_background_task_queue.empty()) ||
+					((m_background_task_queue.size() < INFLUX_BATCH_SIZE) && (atime - lastSend < INFLUX_FLUSH_INTERVAL))
+					)
+					continue;
+				size_t nItems = std::min<size_t>(m_background_task_queue.size(), INFLUX_BATCH_SIZE);
+				_items2do.assign(m_background_task_queue.begin(), m_background_task_queue.begin() + nItems);
+				m_background_task_queue.erase(m_background_task_queue.begin(), m_background_task_queue.begin() + nItems);
+			}
+		}
+		lastSend = atime;
 
-			std::stringstream sziData;
-			sziData << itt->skey << " value=" << itt->svalue;
-			if (m_bInfluxDebugActive) {
-				_log.Log(LOG_NORM, "InfluxLink: value %s", sziData.str().c_str());
+		bool bRetry = false;
+		if (SendBatch(_items2do, bRetry))
+		{
+			m_nSent += _items2do.size();
+			retryDelay = 0;
+		}
+		else if (bRetry)
+		{
+			//keep the batch and try again later, waiting longer every time
+			m_nRetried += _items2do.size();
+			retryDelay = (retryDelay == 0) ? 1 : std::min(retryDelay * 2, INFLUX_MAX_RETRY_DELAY);
+			nextAttempt = atime + retryDelay;
+			_log.Log(LOG_ERROR, "InfluxLink: Error sending data to InfluxDB server! (check address/port/database/username/password), retrying in %d seconds", retryDelay);
+			continue;
+		}
+		else
+		{
+			m_nDropped += _items2do.size();
+			_log.Log(LOG_ERROR, "InfluxLink: InfluxDB server refused %d points!", static_cast<int>(_items2do.size()));
+		}
+		if (bFromSpool)
+		{
+			m_spoolReadPos = spoolNextPos;
+			if (m_spoolReadPos >= m_spoolSize)
+			{
+				std::remove(m_szSpoolFile.c_str());
+				m_spoolSize = 0;
+				m_spoolReadPos = 0;
+			}
+			else if (m_spoolReadPos > m_spoolSize / 2)
+			{
+				//most of the file was delivered, give the space back to new points
+				CompactSpool();
 			}
-			sziData << " " << itt->stimestamp;
-			sSendData += sziData.str();
-			++itt;
 		}
-		std::vector<std::string> ExtraHeaders;
-		std::string sResult;
-		if (!HTTPClient::POST(m_szURL, sSendData, ExtraHeaders, sResult, true, true))
+		_items2do.clear();
+	}
+
+	//keep what was not sent for the next start
+	std::lock_guard<std::mutex> l(m_background_task_mutex);
+	if (bFromSpool)
+		_items2do.clear();
+	_items2do.insert(_items2do.end(), m_background_task_queue.begin(), m_background_task_queue.end());
+	m_background_task_queue.clear();
+	CompactSpool();
+	SpoolLines(_items2do);
+}
+
+//Returns false when the points were not accepted, bRetry is set when sending them again could help
+bool CInfluxPush::SendBatch(const std::vector<std::string> &lines, bool &bRetry)
+{
+	bRetry = true;
+	std::string sSendData;
+	for (const auto &itt : lines)
+	{
+		if (!sSendData.empty())
+			sSendData += '\n';
+		sSendData += itt;
+	}
+
+	std::vector<std::string> ExtraHeaders;
+	CA2GZIP gzip((char*)sSendData.c_str(), static_cast<int>(sSendData.size()));
+	if (gzip.Length > 0)
+	{
+		sSendData.assign((char*)gzip.pgzip, gzip.Length);
+		ExtraHeaders.push_back("Content-Encoding: gzip");
+	}
+
+	std::string sResult;
+	std::vector<std::string> vHeaderData;
+	if (!HTTPClient::POST(m_szURL, sSendData, ExtraHeaders, sResult, vHeaderData, true, true))
+		return false;
+
+	//status of the last response (after redirects)
+	int status = 0;
+	for (const auto &itt : vHeaderData)
+	{
+		if (itt.find("HTTP/") == 0)
+		{
+			size_t pos = itt.find(' ');
+			if (pos != std::string::npos)
+				status = atoi(itt.substr(pos + 1).c_str());
+		}
+	}
+	if ((status >= 200) && (status < 300))
+		return true;
+	//bad points, bad credentials or an unknown database won't get better by sending them again, the server being busy might
+	bRetry = ((status == 0) || (status == 429) || (status >= 500));
+	if ((status == 401) || (status == 403) || (status == 404))
+		_log.Log(LOG_ERROR, "InfluxLink: InfluxDB server returned status %d (check database/username/password)", status);
+	if (m_bInfluxDebugActive)
+		_log.Log(LOG_NORM, "InfluxLink: server returned status %d: %s", status, sResult.c_str());
+	return false;
+}
+
+//Appends points to the spool file, points that don't fit next to the ones still to be sent are dropped
+void CInfluxPush::SpoolLines(const std::vector<std::string> &lines)
+{
+	if (lines.empty())
+		return;
+	std::ofstream outfile(m_szSpoolFile.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+	if (!outfile.is_open())
+	{
+		_log.Log(LOG_ERROR, "InfluxLink: Could not write spool file '%s', %d points lost!", m_szSpoolFile.c_str(), static_cast<int>(lines.size()));
+		m_nDropped += lines.size();
+		return;
+	}
+	uint64_t nDropped = 0;
+	for (const auto &itt : lines)
+	{
+		if (m_spoolSize - m_spoolReadPos + itt.size() + 1 > INFLUX_MAX_SPOOL_SIZE)
 		{
-			_log.Log(LOG_ERROR, "InfluxLink: Error sending data to InfluxDB server! (check address/port/database/username/password)");
+			nDropped++;
+			continue;
 		}
+		outfile << itt << '\n';
+		m_spoolSize += itt.size() + 1;
+	}
+	outfile.close();
+	if (nDropped != 0)
+	{
+		_log.Log(LOG_ERROR, "InfluxLink: Spool file full, %" PRIu64 " points lost!", nDropped);
+		m_nDropped += nDropped;
+	}
+}
+
+//Reads the next batch from the spool file, nextPos is where the following batch starts
+bool CInfluxPush::ReadSpool(std::vector<std::string> &lines, uint64_t &nextPos)
+{
+	if (m_spoolReadPos >= m_spoolSize)
+		return false;
+	std::ifstream infile(m_szSpoolFile.c_str(), std::ios::in | std::ios::binary);
+	if (!infile.is_open())
+	{
+		m_spoolSize = 0;
+		m_spoolReadPos = 0;
+		return false;
+	}
+	infile.seekg(static_cast<std::streamoff>(m_spoolReadPos));
+	nextPos = m_spoolReadPos;
+	std::string sLine;
+	while ((lines.size() < INFLUX_BATCH_SIZE) && (std::getline(infile, sLine)))
+	{
+		nextPos += sLine.size() + 1;
+		if (!sLine.empty())
+			lines.push_back(sLine);
 	}
+	if (nextPos < m_spoolSize)
+		return true;
+	//a partial last line can only come from an unclean shutdown
+	nextPos = m_spoolSize;
+	if (lines.empty())
+	{
+		m_spoolReadPos = m_spoolSize.load();
+		return false;
+	}
+	return true;
+}
+
+//Removes the points that were already sent from the spool file
+void CInfluxPush::CompactSpool()
+{
+	if (m_spoolReadPos == 0)
+		return;
+	std::string sRemaining;
+	std::ifstream infile(m_szSpoolFile.c_str(), std::ios::in | std::ios::binary);
+	if (infile.is_open())
+	{
+		infile.seekg(static_cast<std::streamoff>(m_spoolReadPos));
+		sRemaining.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+		infile.close();
+	}
+	std::ofstream outfile(m_szSpoolFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	outfile << sRemaining;
+	outfile.close();
+	m_spoolSize = sRemaining.size();
+	m_spoolReadPos = 0;
+	if (sRemaining.empty())
+		std::remove(m_szSpoolFile.c_str());
+}
+
+void CInfluxPush::GetStatistics(uint64_t &queued, uint64_t &sent, uint64_t &dropped, uint64_t &retried, uint64_t &spooled)
+{
+	queued = m_nQueued;
+	sent = m_nSent;
+	dropped = m_nDropped;
+	retried = m_nRetried;
+	spooled = m_spoolSize - m_spoolReadPos;
 }
 
 
@@ -292,6 +515,13 @@ namespace http {
 			else {
 				root["InfluxDebug"] = 0;
 			}
+			uint64_t nQueued, nSent, nDropped, nRetried, nSpooled;
+			m_influxpush.GetStatistics(nQueued, nSent, nDropped, nRetried, nSpooled);
+			root["Statistics"]["Queued"] = (Json::UInt64)nQueued;
+			root["Statistics"]["Sent"] = (Json::UInt64)nSent;
+			root["Statistics"]["Dropped"] = (Json::UInt64)nDropped;
+			root["Statistics"]["Retried"] = (Json::UInt64)nRetried;
+			root["Statistics"]["SpoolBytes"] = (Json::UInt64)nSpooled;
 			root["status"] = "OK";
 			root["title"] = "GetInfluxLinkConfig";
 		}
@@ -367,6 +597,7 @@ namespace http {
 					idx.c_str()
 				);
 			}
+			m_influxpush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "SaveInfluxLink";
 		}
@@ -383,6 +614,7 @@ namespace http {
 			if (idx == "")
 				return;
 			m_sql.safe_query("DELETE FROM PushLink WHERE (ID=='%q')", idx.c_str());
+			m_influxpush.ReloadLinks();
 			root["status"] = "OK";
 			root["title"] = "DeleteInfluxLink";
 		}
@@ -1,5 +1,7 @@
 #pragma once
 #include "BasePush.h"
+#include <deque>
+#include <atomic>
 
 class CInfluxPush : public CBasePush
 {
@@ -14,16 +16,29 @@ public:
 	bool Start();
 	void Stop();
 	void UpdateSettings();
+	void GetStatistics(uint64_t &queued, uint64_t &sent, uint64_t &dropped, uint64_t &retried, uint64_t &spooled);
 private:
-	void OnDeviceReceived(const int m_HwdID, const uint64_t DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand);
-	void DoInfluxPush();
+	void OnDeviceReceived(const CDeviceEventBus::_tDeviceEvent &event);
+	void DoInfluxPush(const CDeviceEventBus::_tDeviceEvent &event);
 
 	std::shared_ptr<std::thread> m_thread;
 	std::mutex m_background_task_mutex;
 	void Do_Work();
+	bool SendBatch(const std::vector<std::string> &lines, bool &bRetry);
+	void SpoolLines(const std::vector<std::string> &lines);
+	bool ReadSpool(std::vector<std::string> &lines, uint64_t &nextPos);
+	void CompactSpool();
 
 	std::map<std::string,_tPushItem> m_PushedItems;
-	std::vector<_tPushItem> m_background_task_queue;
+	std::deque<std::string> m_background_task_queue;
+	//points that did not fit in memory or could not be sent before a shutdown, sent first
+	std::string m_szSpoolFile;
+	std::atomic<uint64_t> m_spoolSize;
+	std::atomic<uint64_t> m_spoolReadPos;
+	std::atomic<uint64_t> m_nQueued;
+	std::atomic<uint64_t> m_nSent;
+	std::atomic<uint64_t> m_nDropped;
+	std::atomic<uint64_t> m_nRetried;
 	std::string m_szURL;
 	std::string m_InfluxIP;
 	int m_InfluxPort;
@@ -1,10 +1,23 @@
 #include "stdafx.h"
 #include "WebsocketPush.h"
 #include "../webserver/WebsocketHandler.h"
+#include "../webserver/cWebem.h"
 #include "../main/mainworker.h"
+#include "../main/Helper.h"
 
 extern boost::signals2::signal<void(const std::string &Subject, const std::string &Text, const std::string &ExtraData, const int Priority, const std::string & Sound, const bool bFromNotification)> sOnNotificationReceived;
 
+#define WEBSOCKET_COALESCE_MS 200
+
+std::mutex CWebSocketPush::m_pushesMutex;
+std::set<CWebSocketPush*> CWebSocketPush::m_pushes;
+boost::signals2::connection CWebSocketPush::m_sDeviceConnection;
+std::shared_ptr<std::thread> CWebSocketPush::m_fanoutThread;
+std::mutex CWebSocketPush::m_pendingMutex;
+std::condition_variable CWebSocketPush::m_pendingCondition;
+std::set<unsigned long long> CWebSocketPush::m_pendingDevices;
+uint64_t CWebSocketPush::m_fanoutGeneration = 0;
+
 
 CWebSocketPush::CWebSocketPush(http::server::CWebsocketHandler *sock)
 {
@@ -19,9 +32,9 @@ void CWebSocketPush::Start()
 	if (isStarted) {
 		return;
 	}
-	m_sConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CWebSocketPush::OnDeviceReceived, this, _1, _2, _3, _4));
 	m_sNotification = sOnNotificationReceived.connect(boost::bind(&CWebSocketPush::OnNotificationReceived, this, _1, _2, _3, _4, _5, _6));
 	isStarted = true;
+	RegisterPush(this);
 }
 
 void CWebSocketPush::Stop()
@@ -30,10 +43,8 @@ void CWebSocketPush::Stop()
 		return;
 	}
 	isStarted = false;
+	UnregisterPush(this);
 	ClearListenTable();
-	if (m_sConnection.connected()) {
-		m_sConnection.disconnect();
-	}
 	if (m_sNotification.connected()) {
 		m_sNotification.disconnect();
 	}
@@ -41,7 +52,7 @@ void CWebSocketPush::Stop()
 
 void CWebSocketPush::ListenTo(const unsigned long long DeviceRowIdx)
 {
-	std::unique_lock<std::mutex>(listenMutex);
+	std::unique_lock<std::mutex> lock(listenMutex);
 	bool bExists = std::find(listenIdxs.begin(), listenIdxs.end(), DeviceRowIdx) != listenIdxs.end();
 	if (!bExists) {
 		listenIdxs.push_back(DeviceRowIdx);
@@ -50,13 +61,13 @@ void CWebSocketPush::ListenTo(const unsigned long long DeviceRowIdx)
 
 void CWebSocketPush::UnlistenTo(const unsigned long long DeviceRowIdx)
 {
-	std::unique_lock<std::mutex>(listenMutex);
+	std::unique_lock<std::mutex> lock(listenMutex);
 	listenIdxs.erase(std::remove(listenIdxs.begin(), listenIdxs.end(), DeviceRowIdx), listenIdxs.end());
 }
 
 void CWebSocketPush::ClearListenTable()
 {
-	std::unique_lock<std::mutex>(listenMutex);
+	std::unique_lock<std::mutex> lock(listenMutex);
 	listenIdxs.clear();
 }
 
@@ -96,19 +107,151 @@ void CWebSocketPush::onDeviceTableChanged()
 
 bool CWebSocketPush::WeListenTo(const unsigned long long DeviceRowIdx)
 {
-	std::unique_lock<std::mutex>(listenMutex);
+	std::unique_lock<std::mutex> lock(listenMutex);
 	return std::find(listenIdxs.begin(), listenIdxs.end(), DeviceRowIdx) != listenIdxs.end();
 }
 
+void CWebSocketPush::RegisterPush(CWebSocketPush *push)
+{
+	std::unique_lock<std::mutex> lock(m_pushesMutex);
+	m_pushes.insert(push);
+	if (m_pushes.size() > 1) {
+		return;
+	}
+	uint64_t generation;
+	{
+		std::unique_lock<std::mutex> pendingLock(m_pendingMutex);
+		generation = ++m_fanoutGeneration;
+		m_pendingDevices.clear();
+	}
+	m_fanoutThread = std::make_shared<std::thread>(&CWebSocketPush::FanoutThread, generation);
+	SetThreadName(m_fanoutThread->native_handle(), "WebSocketPush");
+	m_sDeviceConnection = m_mainworker.sOnDeviceReceived.connect(boost::bind(&CWebSocketPush::OnDeviceReceived, _1, _2, _3, _4));
+}
+
+void CWebSocketPush::UnregisterPush(CWebSocketPush *push)
+{
+	std::shared_ptr<std::thread> thread;
+	{
+		std::unique_lock<std::mutex> lock(m_pushesMutex);
+		m_pushes.erase(push);
+		if (!m_pushes.empty()) {
+			return;
+		}
+		if (m_sDeviceConnection.connected()) {
+			m_sDeviceConnection.disconnect();
+		}
+		std::unique_lock<std::mutex> pendingLock(m_pendingMutex);
+		m_fanoutGeneration++;
+		thread.swap(m_fanoutThread);
+	}
+	m_pendingCondition.notify_all();
+	if (thread) {
+		thread->join();
+	}
+}
+
 void CWebSocketPush::OnDeviceReceived(const int m_HwdID, const unsigned long long DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand)
 {
-	if (!isStarted) {
+	std::unique_lock<std::mutex> lock(m_pendingMutex);
+	m_pendingDevices.insert(DeviceRowIdx);
+	lock.unlock();
+	m_pendingCondition.notify_all();
+}
+
+void CWebSocketPush::FanoutThread(const uint64_t generation)
+{
+	std::unique_lock<std::mutex> lock(m_pendingMutex);
+	while (true)
+	{
+		m_pendingCondition.wait(lock, [generation] { return (!m_pendingDevices.empty()) || (generation != m_fanoutGeneration); });
+		if (generation != m_fanoutGeneration) {
+			break;
+		}
+		// repeated updates of a device within the interval are sent once
+		m_pendingCondition.wait_for(lock, std::chrono::milliseconds(WEBSOCKET_COALESCE_MS), [generation] { return (generation != m_fanoutGeneration); });
+		if (generation != m_fanoutGeneration) {
+			break;
+		}
+		std::set<unsigned long long> devices;
+		devices.swap(m_pendingDevices);
+		lock.unlock();
+		SendDeviceChanges(devices);
+		lock.lock();
+	}
+}
+
+void CWebSocketPush::SendDeviceChanges(const std::set<unsigned long long> &devices)
+{
+	// the reply depends on the devices a user may see, so it is built once per user,
+	// outside m_pushesMutex so connecting and closing websockets do not wait for the queries
+	std::map<std::string, std::pair<http::server::cWebem*, http::server::WebEmSession> > users;
+	{
+		std::unique_lock<std::mutex> lock(m_pushesMutex);
+		for (const auto & push : m_pushes)
+		{
+			if (!push->isStarted) {
+				continue;
+			}
+			http::server::WebEmSession session;
+			if (!push->m_sock->GetSession(session)) {
+				continue;
+			}
+			std::string user = session.username + "_" + std::to_string(session.rights);
+			if (users.find(user) == users.end()) {
+				users[user] = std::make_pair(push->m_sock->GetWebem(), session);
+			}
+		}
+	}
+	if (users.empty()) {
 		return;
 	}
 
-	m_sock->OnDeviceChanged(DeviceRowIdx);
-	if (WeListenTo(DeviceRowIdx)) {
-		// push notification to web socket
+	std::map<std::string, std::vector<std::string> > packets;
+	for (auto & itt : users)
+	{
+		std::vector<std::string> &userPackets = packets[itt.first];
+		for (const auto & DeviceRowIdx : devices)
+		{
+			std::string query = "type=devices&rid=" + std::to_string(DeviceRowIdx);
+			//Rob, needed a try/catch, but don't know why...
+			//When a browser was still open and polling/connecting to the websocket, and the application was started this caused a crash
+			try
+			{
+				userPackets.push_back(http::server::CWebsocketHandler::HandleQuery(itt.second.first, itt.second.second, query, -1));
+			}
+			catch (...)
+			{
+
+			}
+		}
+	}
+
+	// connections may have closed meanwhile, only the registered ones are written to
+	std::unique_lock<std::mutex> lock(m_pushesMutex);
+	for (const auto & push : m_pushes)
+	{
+		if (!push->isStarted) {
+			continue;
+		}
+		try
+		{
+			http::server::WebEmSession session;
+			if (!push->m_sock->GetSession(session)) {
+				continue;
+			}
+			std::map<std::string, std::vector<std::string> >::const_iterator itt = packets.find(session.username + "_" + std::to_string(session.rights));
+			if (itt == packets.end()) {
+				continue;
+			}
+			for (const auto & packet : itt->second) {
+				push->m_sock->SendPacket(packet);
+			}
+		}
+		catch (...)
+		{
+
+		}
 	}
 }
 
@@ -1,5 +1,9 @@
 #pragma once
 #include "BasePush.h"
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace http {
 	namespace server {
@@ -25,7 +29,6 @@ public:
 	// etc, we need a notification of all changes that need to be reflected in the UI
 	bool WeListenTo(const unsigned long long DeviceRowIdx);
 private:
-	void OnDeviceReceived(const int m_HwdID, const unsigned long long DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand);
 	void OnNotificationReceived(const std::string &Subject, const std::string &Text, const std::string &ExtraData, const int Priority, const std::string & Sound, const bool bFromNotification);
 	bool listenRoomplan;
 	bool listenDeviceTable;
@@ -33,5 +36,21 @@ private:
 	std::mutex listenMutex;
 	http::server::CWebsocketHandler *m_sock;
 	bool isStarted;
+
+	//Device changes of all websocket connections are collected and sent once per coalescing interval,
+	//the reply for a device is built once per user and the same packet is written to all connections of that user
+	static void RegisterPush(CWebSocketPush *push);
+	static void UnregisterPush(CWebSocketPush *push);
+	static void OnDeviceReceived(const int m_HwdID, const unsigned long long DeviceRowIdx, const std::string &DeviceName, const unsigned char *pRXCommand);
+	static void FanoutThread(const uint64_t generation);
+	static void SendDeviceChanges(const std::set<unsigned long long> &devices);
+	static std::mutex m_pushesMutex;
+	static std::set<CWebSocketPush*> m_pushes;
+	static boost::signals2::connection m_sDeviceConnection;
+	static std::shared_ptr<std::thread> m_fanoutThread;
+	static std::mutex m_pendingMutex;
+	static std::condition_variable m_pendingCondition;
+	static std::set<unsigned long long> m_pendingDevices;
+	static uint64_t m_fanoutGeneration;
 };
 
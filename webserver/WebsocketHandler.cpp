@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "WebsocketHandler.h"
 #include "../main/localtime_r.h"
+#include "../main/Logger.h"
 #include "../push/WebsocketPush.h"
 #include "../json/json.h"
 #include "cWebem.h"
@@ -8,10 +9,11 @@
 namespace http {
 	namespace server {
 
-		CWebsocketHandler::CWebsocketHandler(cWebem *pWebem, boost::function<void(const std::string &packet_data)> _MyWrite) : 
+		CWebsocketHandler::CWebsocketHandler(cWebem *pWebem, boost::function<void(const std::string &packet_data)> _MyWrite, work_poster _PostWork) : 
 			m_Push(this),
 			sessionid(""),
 			MyWrite(_MyWrite),
+			PostWork(_PostWork),
 			myWebem(pWebem)
 		{
 			
@@ -24,20 +26,8 @@ namespace http {
 
 		boost::tribool CWebsocketHandler::Handle(const std::string &packet_data)
 		{
-			reply rep;
-			Json::Value jsonValue;
-			Json::StyledWriter writer;
-			// todo: we now assume the session (still) exists
 			WebEmSession session;
-			std::map<std::string, WebEmSession>::iterator itt = myWebem->m_sessions.find(sessionid);
-			if (itt != myWebem->m_sessions.end()) {
-				session = itt->second;
-			}
-			else if (myWebem->m_userpasswords.size() == 0) {
-					session.rights = 2;
-			}
-			else {
-				// todo: check: AreWeInLocalNetwork(). If yes, then session.rights = 2 without a session being setup.
+			if (!GetSession(session)) {
 				return false;
 			}
 			Json::Reader reader;
@@ -48,28 +38,73 @@ namespace http {
 			if (value["event"] != "request") {
 				return true;
 			}
+			std::string query = value["query"].asString();
+			int64_t requestid = value["requestid"].asInt64();
+			if (PostWork.empty()) {
+				RunQuery(session, query, requestid);
+				return true;
+			}
+			// queries are json.htm commands that read the database, like slow http requests they run on the worker threads
+			PostWork(boost::bind(&CWebsocketHandler::RunQuery, this, session, query, requestid));
+			return true;
+		}
+
+		void CWebsocketHandler::RunQuery(WebEmSession session, const std::string &query, const int64_t requestid)
+		{
+			try {
+				MyWrite(HandleQuery(session, query, requestid));
+			}
+			catch (...) {
+				_log.Log(LOG_ERROR, "WebSocket: exception thrown while handling query '%s'", query.c_str());
+			}
+		}
+
+		bool CWebsocketHandler::GetSession(WebEmSession &session)
+		{
+			// todo: we now assume the session (still) exists
+			if (myWebem->GetSession(sessionid, session)) {
+				return true;
+			}
+			if (!myWebem->HaveUserPasswords()) {
+				session.rights = 2;
+				return true;
+			}
+			// todo: check: AreWeInLocalNetwork(). If yes, then session.rights = 2 without a session being setup.
+			return false;
+		}
+
+		std::string CWebsocketHandler::HandleQuery(WebEmSession &session, const std::string &query, const int64_t requestid)
+		{
+			return HandleQuery(myWebem, session, query, requestid);
+		}
+
+		std::string CWebsocketHandler::HandleQuery(cWebem *pWebem, WebEmSession &session, const std::string &query, const int64_t requestid)
+		{
+			reply rep;
+			Json::Value jsonValue;
+			Json::StyledWriter writer;
 			request req;
 			req.method = "GET";
-			std::string querystring = value["query"].asString();
-			req.uri = "/json.htm?" + querystring;
+			req.uri = "/json.htm?" + query;
 			req.http_version_major = 1;
 			req.http_version_minor = 1;
 			req.headers.resize(0); // todo: do we need any headers?
 			req.content.clear();
-			if (myWebem->CheckForPageOverride(session, req, rep)) {
+			if (pWebem->CheckForPageOverride(session, req, rep)) {
 				if (rep.status == reply::ok) {
 					jsonValue["event"] = "response";
-					jsonValue["requestid"] = value["requestid"].asInt64();
+					jsonValue["requestid"] = (Json::Int64)requestid;
 					jsonValue["data"] = rep.content;
-					std::string response = writer.write(jsonValue);
-					MyWrite(response);
-					return true;
+					return writer.write(jsonValue);
 				}
 			}
 			jsonValue["error"] = "Internal Server Error!!";
-			std::string response = writer.write(jsonValue);
-			MyWrite(response);
-			return true;
+			return writer.write(jsonValue);
+		}
+
+		void CWebsocketHandler::SendPacket(const std::string &packet_data)
+		{
+			MyWrite(packet_data);
 		}
 
 		void CWebsocketHandler::Start()
@@ -128,27 +163,6 @@ namespace http {
 			}
 		}
 
-		void CWebsocketHandler::OnDeviceChanged(const uint64_t DeviceRowIdx)
-		{
-			//Rob, needed a try/catch, but don't know why...
-			//When a browser was still open and polling/connecting to the websocket, and the application was started this caused a crash
-			try
-			{
-				std::string query = "type=devices&rid=" + std::to_string(DeviceRowIdx);
-				Json::Value request;
-				Json::StyledWriter writer;
-				request["event"] = "request";
-				request["requestid"] = -1;
-				request["query"] = query;
-				std::string packet = writer.write(request);
-				Handle(packet);
-			}
-			catch (...)
-			{
-				
-			}
-		}
-
 		void CWebsocketHandler::OnMessage(const std::string &Subject, const std::string &Text, const std::string &ExtraData, const int Priority, const std::string &Sound, const bool bFromNotification)
 		{
 			Json::Value json;
@@ -9,19 +9,33 @@ namespace http {
 	namespace server {
 
 		class cWebem;
+		struct _tWebEmSession;
+		typedef _tWebEmSession WebEmSession;
 
 		class CWebsocketHandler {
 		public:
-			CWebsocketHandler(cWebem *pWebem, boost::function<void(const std::string &packet_data)> _MyWrite);
+			//Runs work that may take long away from the io threads, it is run right away when empty
+			typedef boost::function<void(const boost::function<void()> &work)> work_poster;
+
+			CWebsocketHandler(cWebem *pWebem, boost::function<void(const std::string &packet_data)> _MyWrite, work_poster _PostWork = work_poster());
 			~CWebsocketHandler();
 			virtual boost::tribool Handle(const std::string &packet_data);
 			virtual void Start();
 			virtual void Stop();
-			virtual void OnDeviceChanged(const uint64_t DeviceRowIdx);
+			//Session of the connection, false when it expired
+			bool GetSession(WebEmSession &session);
+			//Reply packet to a json.htm query made in the given session
+			std::string HandleQuery(WebEmSession &session, const std::string &query, const int64_t requestid);
+			//Same, without a connection: the webserver outlives its websocket connections
+			static std::string HandleQuery(cWebem *pWebem, WebEmSession &session, const std::string &query, const int64_t requestid);
+			cWebem *GetWebem() const { return myWebem; }
+			void SendPacket(const std::string &packet_data);
 			virtual void OnMessage(const std::string &Subject, const std::string &Text, const std::string &ExtraData, const int Priority, const std::string &Sound, const bool bFromNotification);
 			virtual void store_session_id(const request &req, const reply &rep);
 		protected:
+			void RunQuery(WebEmSession session, const std::string &query, const int64_t requestid);
 			boost::function<void(const std::string &packet_data)> MyWrite;
+			work_poster PostWork;
 			std::string sessionid;
 			cWebem* myWebem;
 			CWebSocketPush m_Push;
@@ -157,8 +157,8 @@ namespace http {
 			return opcode;
 		};
 
-		CWebsocket::CWebsocket(boost::function<void(const std::string &packet_data)> _MyWrite, cWebem *_webEm, boost::function<void(const std::string &packet_data)> _WSWrite) :
-			handler(_webEm, _WSWrite),
+		CWebsocket::CWebsocket(boost::function<void(const std::string &packet_data)> _MyWrite, cWebem *_webEm, boost::function<void(const std::string &packet_data)> _WSWrite, CWebsocketHandler::work_poster _PostWork) :
+			handler(_webEm, _WSWrite, _PostWork),
 			OUR_PING_ID("fd")
 		{
 			start_new_packet = true;
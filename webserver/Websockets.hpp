@@ -48,7 +48,7 @@ namespace http {
 
 		class CWebsocket {
 		public:
-			CWebsocket(boost::function<void(const std::string &packet_data)> _MyWrite, cWebem *_webEm, boost::function<void(const std::string &packet_data)> _WSWrite);
+			CWebsocket(boost::function<void(const std::string &packet_data)> _MyWrite, cWebem *_webEm, boost::function<void(const std::string &packet_data)> _WSWrite, CWebsocketHandler::work_poster _PostWork = CWebsocketHandler::work_poster());
 			~CWebsocket();
 			virtual boost::tribool parse(const uint8_t *begin, size_t size, size_t &bytes_consumed, bool &keep_alive);
 			virtual void SendClose(const std::string &packet_data);
@@ -22,15 +22,17 @@
 #include "../main/Helper.h"
 #include "../main/localtime_r.h"
 #include "../main/Logger.h"
+#include "../json/json.h"
 
 #define SHORT_SESSION_TIMEOUT 600 // 10 minutes
 #define LONG_SESSION_TIMEOUT (30 * 86400) // 30 days
+#define GZIP_MIN_REPLY_SIZE 1024 // bytes
 
 #ifdef _WIN32
 #define gmtime_r(timep, result) gmtime_s(result, timep)
 #endif
 
-int m_failcounter = 0;
+std::atomic<int> m_failcounter(0);
 
 namespace http {
 	namespace server {
@@ -120,7 +122,7 @@ namespace http {
 
 		void cWebem::SetAuthenticationMethod(const _eAuthenticationMethod amethod)
 		{
-			m_authmethod = amethod;
+			m_authmethod.store(amethod);
 		}
 
 		void cWebem::SetWebCompressionMode(_eWebCompressionMode gzmode)
@@ -128,6 +130,135 @@ namespace http {
 			m_gzipmode = gzmode;
 		}
 
+		//Output buffer for the json writer, appends to the reply content and switches to
+		//gzip once the content grows past GZIP_MIN_REPLY_SIZE, so no second copy is made
+		class json_reply_buf : public std::streambuf
+		{
+		public:
+			json_reply_buf(std::string &content, const bool bAllowGZIP) :
+				m_content(content),
+				m_bAllowGZIP(bAllowGZIP),
+				m_bIsGZIP(false)
+			{
+				m_content.clear();
+				setp(m_buffer, m_buffer + sizeof(m_buffer));
+			}
+			~json_reply_buf()
+			{
+				if (m_bIsGZIP)
+					deflateEnd(&m_zstream);
+			}
+			//Flushes everything to the content, returns true when it is gzipped
+			bool finish()
+			{
+				sync();
+				if (!m_bIsGZIP)
+					return false;
+				deflate_data(NULL, 0, Z_FINISH);
+				deflateEnd(&m_zstream);
+				m_bIsGZIP = false;
+				m_content.swap(m_gzipped);
+				return true;
+			}
+		protected:
+			int_type overflow(int_type ch) override
+			{
+				sync();
+				if (ch != traits_type::eof())
+				{
+					*pptr() = traits_type::to_char_type(ch);
+					pbump(1);
+				}
+				return traits_type::not_eof(ch);
+			}
+			int sync() override
+			{
+				size_t len = pptr() - pbase();
+				if (len == 0)
+					return 0;
+				if (m_bIsGZIP)
+					deflate_data(pbase(), len, Z_NO_FLUSH);
+				else
+				{
+					m_content.append(pbase(), len);
+					if ((m_bAllowGZIP) && (m_content.size() >= GZIP_MIN_REPLY_SIZE))
+						start_gzip();
+				}
+				setp(m_buffer, m_buffer + sizeof(m_buffer));
+				return 0;
+			}
+		private:
+			void start_gzip()
+			{
+				memset(&m_zstream, 0, sizeof(m_zstream));
+				//windowBits + 16 writes the gzip header and trailer
+				if (deflateInit2(&m_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+				{
+					m_bAllowGZIP = false;
+					return;
+				}
+				m_bIsGZIP = true;
+				m_gzipped.reserve(m_content.size() / 4);
+				deflate_data(m_content.c_str(), m_content.size(), Z_NO_FLUSH);
+				m_content.clear();
+			}
+			void deflate_data(const char *data, const size_t len, const int flush)
+			{
+				unsigned char outbuf[Z_BUFSIZE];
+				m_zstream.next_in = (Bytef*)data;
+				m_zstream.avail_in = static_cast<uInt>(len);
+				do
+				{
+					m_zstream.next_out = outbuf;
+					m_zstream.avail_out = sizeof(outbuf);
+					int ret = deflate(&m_zstream, flush);
+					if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR))
+						break;
+					m_gzipped.append((const char*)outbuf, sizeof(outbuf) - m_zstream.avail_out);
+				} while (m_zstream.avail_out == 0);
+			}
+
+			std::string &m_content;
+			std::string m_gzipped;
+			bool m_bAllowGZIP;
+			bool m_bIsGZIP;
+			z_stream m_zstream;
+			char m_buffer[8192];
+		};
+
+		void cWebem::SetJSonReply(const request& req, reply& rep, const Json::Value &root)
+		{
+			bool bAllowGZIP = false;
+			if ((m_gzipmode == WWW_USE_GZIP) && (!rep.bIsGZIP))
+			{
+				const char *encoding_header = request::get_req_header(&req, "Accept-Encoding");
+				bAllowGZIP = ((encoding_header != NULL) && (strstr(encoding_header, "gzip") != NULL));
+			}
+
+			static Json::StreamWriterBuilder builder;
+			static std::once_flag builder_init;
+			std::call_once(builder_init, []() {
+				builder["indentation"] = "";
+				builder["commentStyle"] = "None";
+			});
+
+			std::string jcallback = request::findValue(&req, "jsoncallback");
+			json_reply_buf buf(rep.content, bAllowGZIP);
+			std::ostream os(&buf);
+			if (!jcallback.empty())
+				os << "var data=";
+			std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+			writer->write(root, &os);
+			if (!jcallback.empty())
+				os << '\n' << jcallback << "(data);";
+			if (buf.finish())
+			{
+				rep.bIsGZIP = true;
+				reply::add_header(&rep, "Content-Length", std::to_string(rep.content.size()));
+				reply::add_header(&rep, "Content-Encoding", "gzip");
+			}
+		}
+
 
 		/**
 
@@ -749,9 +880,16 @@ namespace http {
 
 		void cWebem::SetWebTheme(const std::string &themename)
 		{
+			std::unique_lock<std::mutex> lock(m_settingsMutex);
 			m_actTheme = "/styles/" + themename;
 		}
 
+		std::string cWebem::GetWebTheme()
+		{
+			std::unique_lock<std::mutex> lock(m_settingsMutex);
+			return m_actTheme;
+		}
+
 		void cWebem::SetWebRoot(const std::string &webRoot)
 		{
 			// remove trailing slash if required
@@ -806,7 +944,7 @@ namespace http {
 
 			if (request_path.find("/acttheme/") == 0)
 			{
-				request_path = m_actTheme + request_path.substr(9);
+				request_path = GetWebTheme() + request_path.substr(9);
 			}
 			return request_path;
 		}
@@ -847,20 +985,56 @@ namespace http {
 			wtmp.userrights = userrights;
 			wtmp.ActiveTabs = activetabs;
 			wtmp.TotSensors = 0;
+			std::unique_lock<std::mutex> lock(m_userpasswordsMutex);
 			m_userpasswords.push_back(wtmp);
 		}
 
 		void cWebem::ClearUserPasswords()
 		{
-			m_userpasswords.clear();
+			{
+				std::unique_lock<std::mutex> lock(m_userpasswordsMutex);
+				m_userpasswords.clear();
+			}
+
+			std::unique_lock<std::mutex> lock(m_sessionsMutex);
+			m_sessions.clear(); //TODO : check if it is really necessary
+		}
+
+		//Replaces all users at once, a request never sees a partly loaded (or empty) list
+		void cWebem::SetUserPasswords(const std::vector<_tWebUserPassword> &userpasswords)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_userpasswordsMutex);
+				m_userpasswords = userpasswords;
+			}
 
 			std::unique_lock<std::mutex> lock(m_sessionsMutex);
 			m_sessions.clear(); //TODO : check if it is really necessary
 		}
 
-		void cWebem::AddLocalNetworks(std::string network)
+		bool cWebem::FindUserPassword(const std::string &username, _tWebUserPassword &user)
+		{
+			std::unique_lock<std::mutex> lock(m_userpasswordsMutex);
+			for (const auto & itt : m_userpasswords)
+			{
+				if (itt.Username == username)
+				{
+					user = itt;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool cWebem::HaveUserPasswords()
+		{
+			std::unique_lock<std::mutex> lock(m_userpasswordsMutex);
+			return !m_userpasswords.empty();
+		}
+
+		//Returns false when network is not a valid network, mask or single IP
+		static bool ParseLocalNetwork(const std::string &network, _tIPNetwork &ipnetwork)
 		{
-			_tIPNetwork ipnetwork;
 			ipnetwork.network = 0;
 			ipnetwork.mask = 0;
 			ipnetwork.hostname = "";
@@ -869,13 +1043,11 @@ namespace http {
 			{
 				//add local host
 				char ac[256];
-				if (gethostname(ac, sizeof(ac)) != SOCKET_ERROR)
-				{
-					ipnetwork.hostname = ac;
-					std::transform(ipnetwork.hostname.begin(), ipnetwork.hostname.end(), ipnetwork.hostname.begin(), ::tolower);
-					m_localnetworks.push_back(ipnetwork);
-				}
-				return;
+				if (gethostname(ac, sizeof(ac)) == SOCKET_ERROR)
+					return false;
+				ipnetwork.hostname = ac;
+				std::transform(ipnetwork.hostname.begin(), ipnetwork.hostname.end(), ipnetwork.hostname.begin(), ::tolower);
+				return true;
 			}
 			std::string inetwork = network;
 			std::string inetworkmask = network;
@@ -888,7 +1060,7 @@ namespace http {
 				stdreplace(inetwork, "*", "0");
 				int a, b, c, d;
 				if (sscanf(inetwork.c_str(), "%d.%d.%d.%d", &a, &b, &c, &d) != 4)
-					return;
+					return false;
 				std::stringstream newnetwork;
 				newnetwork << std::dec << a << "." << std::dec << b << "." << std::dec << c << "." << std::dec << d;
 				inetwork = newnetwork.str();
@@ -896,7 +1068,7 @@ namespace http {
 				stdreplace(inetworkmask, "*", "999");
 				int e, f, g, h;
 				if (sscanf(inetworkmask.c_str(), "%d.%d.%d.%d", &e, &f, &g, &h) != 4)
-					return;
+					return false;
 
 				std::stringstream newmask;
 				if (e != 999) newmask << "255"; else newmask << "0";
@@ -930,7 +1102,7 @@ namespace http {
 					if (ec)
 					{
 						//only allow ip's, localhost is covered above
-						return;
+						return false;
 						//ipnetwork.hostname=network;
 					}
 					else
@@ -942,22 +1114,34 @@ namespace http {
 				}
 			}
 
-			m_localnetworks.push_back(ipnetwork);
+			return true;
 		}
 
-		void cWebem::ClearLocalNetworks()
+		//Replaces the local networks, an empty entry adds the local hostname
+		void cWebem::SetLocalNetworks(const std::vector<std::string> &networks)
 		{
-			m_localnetworks.clear();
+			std::vector<_tIPNetwork> localnetworks;
+			for (const auto & itt : networks)
+			{
+				_tIPNetwork ipnetwork;
+				if (ParseLocalNetwork(itt, ipnetwork))
+					localnetworks.push_back(ipnetwork);
+			}
+			std::unique_lock<std::mutex> lock(m_settingsMutex);
+			m_localnetworks.swap(localnetworks);
 		}
 
-		void cWebem::AddRemoteProxyIPs(const std::string &ipaddr)
+		void cWebem::SetRemoteProxyIPs(const std::vector<std::string> &ipaddrs)
 		{
-			myRemoteProxyIPs.push_back(ipaddr);
+			std::vector<std::string> remoteproxyips(ipaddrs);
+			std::unique_lock<std::mutex> lock(m_settingsMutex);
+			myRemoteProxyIPs.swap(remoteproxyips);
 		}
 
-		void cWebem::ClearRemoteProxyIPs()
+		bool cWebem::IsRemoteProxyIP(const std::string &ipaddr)
 		{
-			myRemoteProxyIPs.clear();
+			std::unique_lock<std::mutex> lock(m_settingsMutex);
+			return std::find(myRemoteProxyIPs.begin(), myRemoteProxyIPs.end(), ipaddr) != myRemoteProxyIPs.end();
 		}
 
 		void cWebem::SetDigistRealm(const std::string &realm)
@@ -998,15 +1182,14 @@ namespace http {
 			return m_settings.listening_port;
 		}
 
-		WebEmSession * cWebem::GetSession(const std::string & ssid)
+		bool cWebem::GetSession(const std::string & ssid, WebEmSession & session)
 		{
 			std::unique_lock<std::mutex> lock(m_sessionsMutex);
-			std::map<std::string, WebEmSession>::iterator itt = m_sessions.find(ssid);
-			if (itt != m_sessions.end())
-			{
-				return &itt->second;
-			}
-			return NULL;
+			std::map<std::string, WebEmSession>::const_iterator itt = m_sessions.find(ssid);
+			if (itt == m_sessions.end())
+				return false;
+			session = itt->second;
+			return true;
 		}
 
 		void cWebem::AddSession(const WebEmSession & session)
@@ -1015,6 +1198,29 @@ namespace http {
 			m_sessions[session.id] = session;
 		}
 
+		// Replaces a session that is still in memory, a session removed in the meantime stays removed
+		bool cWebem::UpdateSession(const WebEmSession & session)
+		{
+			std::unique_lock<std::mutex> lock(m_sessionsMutex);
+			std::map<std::string, WebEmSession>::iterator itt = m_sessions.find(session.id);
+			if (itt == m_sessions.end())
+				return false;
+			itt->second = session;
+			return true;
+		}
+
+		// Extends a session that is still in memory, 'timeout' is kept in sync with 'expires'
+		bool cWebem::RenewSession(const std::string & ssid, const time_t expires)
+		{
+			std::unique_lock<std::mutex> lock(m_sessionsMutex);
+			std::map<std::string, WebEmSession>::iterator itt = m_sessions.find(ssid);
+			if (itt == m_sessions.end())
+				return false;
+			itt->second.expires = expires;
+			itt->second.timeout = expires;
+			return true;
+		}
+
 		void cWebem::RemoveSession(const WebEmSession & session)
 		{
 			RemoveSession(session.id);
@@ -1190,23 +1396,20 @@ namespace http {
 						uname = base64_decode(uname);
 						upass = GenerateMD5Hash(base64_decode(upass));
 
-						std::vector<_tWebUserPassword>::iterator itt;
-						for (itt = myWebem->m_userpasswords.begin(); itt != myWebem->m_userpasswords.end(); ++itt)
+						_tWebUserPassword user;
+						if (myWebem->FindUserPassword(uname, user))
 						{
-							if (itt->Username == uname)
+							if (user.Password != upass)
 							{
-								if (itt->Password != upass)
-								{
-									m_failcounter++;
-									return 0;
-								}
-								session.isnew = true;
-								session.username = itt->Username;
-								session.rights = itt->userrights;
-								session.rememberme = false;
-								m_failcounter = 0;
-								return 1;
+								m_failcounter++;
+								return 0;
 							}
+							session.isnew = true;
+							session.username = user.Username;
+							session.rights = user.userrights;
+							session.rememberme = false;
+							m_failcounter = 0;
+							return 1;
 						}
 					}
 				}
@@ -1214,24 +1417,21 @@ namespace http {
 				return 0;
 			}
 
-			std::vector<_tWebUserPassword>::iterator itt;
-			for (itt = myWebem->m_userpasswords.begin(); itt != myWebem->m_userpasswords.end(); ++itt)
+			_tWebUserPassword user;
+			if (myWebem->FindUserPassword(_ah.user, user))
 			{
-				if (itt->Username == _ah.user)
+				int bOK = check_password(&_ah, user.Password, myWebem->m_DigistRealm);
+				if (!bOK)
 				{
-					int bOK = check_password(&_ah, itt->Password, myWebem->m_DigistRealm);
-					if (!bOK)
-					{
-						m_failcounter++;
-						return 0;
-					}
-					session.isnew = true;
-					session.username = itt->Username;
-					session.rights = itt->userrights;
-					session.rememberme = false;
-					m_failcounter = 0;
-					return 1;
+					m_failcounter++;
+					return 0;
 				}
+				session.isnew = true;
+				session.username = user.Username;
+				session.rights = user.userrights;
+				session.rememberme = false;
+				m_failcounter = 0;
+				return 1;
 			}
 			m_failcounter++;
 			return 0;
@@ -1259,12 +1459,14 @@ namespace http {
 		//Returns true is the connected host is in the local network
 		bool cWebemRequestHandler::AreWeInLocalNetwork(const std::string &sHost, const request& req)
 		{
-			//check if in local network(s)
-			if (myWebem->m_localnetworks.size() == 0)
-				return false;
 			if (sHost.size() < 3)
 				return false;
 
+			//check if in local network(s), the list is replaced by storesettings while we read it
+			std::unique_lock<std::mutex> lock(myWebem->m_settingsMutex);
+			if (myWebem->m_localnetworks.size() == 0)
+				return false;
+
 			std::vector<_tIPNetwork>::const_iterator itt;
 
 			/* RK, this doesn't work with IPv6 addresses.
@@ -1291,9 +1493,9 @@ namespace http {
 			"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
 		};
 
-		char *make_web_time(const time_t rawtime)
+		std::string make_web_time(const time_t rawtime)
 		{
-			static char buffer[256];
+			char buffer[256];
 			struct tm gmt;
 #ifdef _WIN32
 			if (gmtime_r(&rawtime, &gmt)) //windows returns errno_t, which returns zero when successful
@@ -1404,6 +1606,9 @@ namespace http {
 		{
 			if (myWebem->m_gzipmode != WWW_USE_GZIP)
 				return false;
+			//small replies are sent faster than they are compressed
+			if (rep.content.size() < GZIP_MIN_REPLY_SIZE)
+				return false;
 
 			std::string request_path;
 			if (!url_decode(req.uri, request_path))
@@ -1442,6 +1647,38 @@ namespace http {
 			return false;
 		}
 
+		//Replaces the reply with a 304 when the page set an ETag the client already has
+		bool cWebemRequestHandler::IsNotModified(const request& req, reply& rep)
+		{
+			std::string etag;
+			for (const auto & itt : rep.headers)
+			{
+				if (boost::iequals(itt.name, "ETag"))
+				{
+					etag = itt.value;
+					break;
+				}
+			}
+			if (etag.empty())
+				return false;
+			const char *if_none_match = request::get_req_header(&req, "If-None-Match");
+			if (if_none_match == NULL)
+				return false;
+			std::vector<std::string> tags;
+			StringSplit(if_none_match, ",", tags);
+			for (auto & itt : tags)
+			{
+				stdstring_trim(itt);
+				if ((itt == etag) || (itt == "*"))
+				{
+					rep = reply::stock_reply(reply::not_modified);
+					reply::add_header(&rep, "ETag", etag);
+					return true;
+				}
+			}
+			return false;
+		}
+
 		std::string cWebemRequestHandler::compute_accept_header(const std::string &websocket_key)
 		{
 			// the length of an sha1 hash
@@ -1579,7 +1816,7 @@ namespace http {
 			session.rights = -1; // no rights
 			session.id = "";
 
-			if (myWebem->m_userpasswords.size() == 0)
+			if (!myWebem->HaveUserPasswords())
 			{
 				session.rights = 2;
 			}
@@ -1632,8 +1869,8 @@ namespace http {
 				{
 					if (!sSID.empty())
 					{
-						WebEmSession* oldSession = myWebem->GetSession(sSID);
-						if (oldSession == NULL)
+						WebEmSession oldSession;
+						if (!myWebem->GetSession(sSID, oldSession))
 						{
 							session.id = sSID;
 							session.auth_token = sAuthToken;
@@ -1641,8 +1878,8 @@ namespace http {
 						}
 						else
 						{
-							session = *oldSession;
-							expired = (oldSession->expires < now);
+							session = oldSession;
+							expired = (oldSession.expires < now);
 						}
 					}
 					if (sSID.empty() || expired)
@@ -1652,8 +1889,9 @@ namespace http {
 
 				if (!(sSID.empty() || sAuthToken.empty() || szTime.empty()))
 				{
-					WebEmSession* oldSession = myWebem->GetSession(sSID);
-					if ((oldSession != NULL) && (oldSession->expires < now))
+					WebEmSession oldSession;
+					bool bHaveSession = myWebem->GetSession(sSID, oldSession);
+					if ((bHaveSession) && (oldSession.expires < now))
 					{
 						// Check if session stored in memory is not expired (prevent from spoofing expiration time)
 						expired = true;
@@ -1662,7 +1900,7 @@ namespace http {
 					{
 						//expired session, remove session
 						m_failcounter = 0;
-						if (oldSession != NULL)
+						if (bHaveSession)
 						{
 							// session exists (delete it from memory and database)
 							myWebem->RemoveSession(sSID);
@@ -1671,10 +1909,10 @@ namespace http {
 						send_authorization_request(rep);
 						return false;
 					}
-					if (oldSession != NULL)
+					if (bHaveSession)
 					{
 						// session already exists
-						session = *oldSession;
+						session = oldSession;
 					}
 					else
 					{
@@ -1823,15 +2061,11 @@ namespace http {
 				bool sessionExpires = false;
 				session.username = storedSession.username;
 				session.expires = storedSession.expires;
-				std::vector<_tWebUserPassword>::iterator ittu;
-				for (ittu = myWebem->m_userpasswords.begin(); ittu != myWebem->m_userpasswords.end(); ++ittu)
+				_tWebUserPassword user;
+				if (myWebem->FindUserPassword(session.username, user)) // the user still exists
 				{
-					if (ittu->Username == session.username) // the user still exists
-					{
-						userExists = true;
-						session.rights = ittu->userrights;
-						break;
-					}
+					userExists = true;
+					session.rights = user.userrights;
 				}
 
 				time_t now = mytime(NULL);
@@ -1844,8 +2078,8 @@ namespace http {
 					return false;
 				}
 
-				WebEmSession* oldSession = myWebem->GetSession(session.id);
-				if (oldSession == NULL)
+				WebEmSession oldSession;
+				if (!myWebem->GetSession(session.id, oldSession))
 				{
 					_log.Debug(DEBUG_WEBSERVER, "[web:%s] CheckAuthToken(%s_%s_%s) : restore session", myWebem->GetPort().c_str(), session.id.c_str(), session.auth_token.c_str(), session.username.c_str());
 					myWebem->AddSession(session);
@@ -1864,15 +2098,25 @@ namespace http {
 			}
 		}
 
-		char *cWebemRequestHandler::strftime_t(const char *format, const time_t rawtime)
+		std::string cWebemRequestHandler::strftime_t(const char *format, const time_t rawtime)
 		{
-			static char buffer[1024];
+			char buffer[1024];
 			struct tm ltime;
 			localtime_r(&rawtime, &ltime);
 			strftime(buffer, sizeof(buffer), format, &ltime);
 			return buffer;
 		}
 
+		// pages and actions run application code (database queries, graphs, commands),
+		// static files are served from memory and stay on the network threads
+		bool cWebemRequestHandler::is_slow_request(const request& req) const
+		{
+			if (req.uri.find(".php") != std::string::npos)
+				return true;
+			reply rep;
+			return (myWebem->IsAction(req) || myWebem->IsPageOverride(req, rep));
+		}
+
 		void cWebemRequestHandler::handle_request(const request& req, reply& rep)
 		{
 			_log.Debug(DEBUG_WEBSERVER, "web: Host:%s Uri;%s", req.host_address.c_str(), req.uri.c_str());
@@ -1881,29 +2125,23 @@ namespace http {
 			WebEmSession session;
 			session.remote_host = req.host_address;
 
-			if (myWebem->myRemoteProxyIPs.size() > 0)
+			if (myWebem->IsRemoteProxyIP(session.remote_host))
 			{
-				for (std::vector<std::string>::size_type i = 0; i < myWebem->myRemoteProxyIPs.size(); ++i)
+				const char *host_header = request::get_req_header(&req, "X-Forwarded-For");
+				if (host_header != NULL)
 				{
-					if (session.remote_host == myWebem->myRemoteProxyIPs[i])
+					if (strstr(host_header, ",") != NULL)
 					{
-						const char *host_header = request::get_req_header(&req, "X-Forwarded-For");
-						if (host_header != NULL)
+						//Multiple proxies are used... this is not very common
+						host_header = request::get_req_header(&req, "X-Real-IP"); //try our NGINX header
+						if (!host_header)
 						{
-							if (strstr(host_header, ",") != NULL)
-							{
-								//Multiple proxies are used... this is not very common
-								host_header = request::get_req_header(&req, "X-Real-IP"); //try our NGINX header
-								if (!host_header)
-								{
-									_log.Log(LOG_ERROR, "Webserver: Multiple proxies are used (Or possible spoofing attempt), ignoring client request (remote address: %s)", session.remote_host.c_str());
-									rep = reply::stock_reply(reply::forbidden);
-									return;
-								}
-							}
-							session.remote_host = host_header;
+							_log.Log(LOG_ERROR, "Webserver: Multiple proxies are used (Or possible spoofing attempt), ignoring client request (remote address: %s)", session.remote_host.c_str());
+							rep = reply::stock_reply(reply::forbidden);
+							return;
 						}
 					}
+					session.remote_host = host_header;
 				}
 			}
 
@@ -2012,6 +2250,16 @@ namespace http {
 					rep = reply::stock_reply(static_cast<reply::status_type>(session.reply_status));
 					return;
 				}
+				if (rep.long_poll_ready)
+				{
+					// held by the connection, handled again later
+					return;
+				}
+				if (IsNotModified(req, rep))
+				{
+					_log.Debug(DEBUG_WEBSERVER, "[web:%s] %s not modified (etag).", myWebem->GetPort().c_str(), req.uri.c_str());
+					return;
+				}
 
 				if (!rep.bIsGZIP)
 				{
@@ -2035,7 +2283,7 @@ namespace http {
 				{
 					if (requestCopy.uri.find("/images/") == 0)
 					{
-						std::string theme_images_path = myWebem->m_actTheme + requestCopy.uri;
+						std::string theme_images_path = myWebem->GetWebTheme() + requestCopy.uri;
 						if (file_exist((doc_root_ + theme_images_path).c_str()))
 							requestCopy.uri = theme_images_path;
 					}
@@ -2126,26 +2374,24 @@ namespace http {
 				)
 			{
 				// client is possibly a script that does not send cookies - see if we have the IP address registered as a session ID
-				WebEmSession* memSession = myWebem->GetSession(session.remote_host);
+				WebEmSession memSession;
 				time_t now = mytime(NULL);
-				if (memSession != NULL)
+				if (myWebem->GetSession(session.remote_host, memSession))
 				{
-					if (memSession->expires < now)
+					if (memSession.expires < now)
 					{
 						myWebem->RemoveSession(session.remote_host);
 					}
 					else
 					{
 						session.isnew = false;
-						if (memSession->expires - (SHORT_SESSION_TIMEOUT / 2) < now)
+						if (memSession.expires - (SHORT_SESSION_TIMEOUT / 2) < now)
 						{
-							memSession->expires = now + SHORT_SESSION_TIMEOUT;
-
 							// unsure about the point of the forced removal of 'live' sessions and restore from
 							// database but these 'fake' sessions are memory only and can't be restored that way.
 							// Should I do a RemoveSession() followed by a AddSession()?
 							// For now: keep 'timeout' in sync with 'expires'
-							memSession->timeout = memSession->expires;
+							myWebem->RenewSession(session.remote_host, now + SHORT_SESSION_TIMEOUT);
 						}
 					}
 				}
@@ -2192,23 +2438,31 @@ namespace http {
 			else if (session.id.size() > 0)
 			{
 				// Renew session expiration and authentication token
-				WebEmSession* memSession = myWebem->GetSession(session.id);
-				if (memSession != NULL)
+				WebEmSession memSession;
+				if (myWebem->GetSession(session.id, memSession))
 				{
 					time_t now = mytime(NULL);
+					bool bRenew = false;
 					// Renew session expiration date if half of session duration has been exceeded ("dont remember me" sessions, 10 minutes)
-					if (memSession->expires - (SHORT_SESSION_TIMEOUT / 2) < now)
+					if (memSession.expires - (SHORT_SESSION_TIMEOUT / 2) < now)
 					{
-						memSession->expires = now + SHORT_SESSION_TIMEOUT;
-						memSession->auth_token = generateAuthToken(*memSession, req); // do it after expires to save it also
-						send_cookie(rep, *memSession);
+						memSession.expires = now + SHORT_SESSION_TIMEOUT;
+						bRenew = true;
 					}
 					// Renew session expiration date if half of session duration has been exceeded ("remember me" sessions, 30 days)
-					else if ((memSession->expires > SHORT_SESSION_TIMEOUT + now) && (memSession->expires - (LONG_SESSION_TIMEOUT / 2) < now))
+					else if ((memSession.expires > SHORT_SESSION_TIMEOUT + now) && (memSession.expires - (LONG_SESSION_TIMEOUT / 2) < now))
+					{
+						memSession.expires = now + LONG_SESSION_TIMEOUT;
+						bRenew = true;
+					}
+					if (bRenew)
 					{
-						memSession->expires = now + LONG_SESSION_TIMEOUT;
-						memSession->auth_token = generateAuthToken(*memSession, req); // do it after expires to save it also
-						send_cookie(rep, *memSession);
+						memSession.auth_token = generateAuthToken(memSession, req); // do it after expires to save it also
+						// the session can have been removed (logout) in the meantime, do not bring its token back
+						if (myWebem->UpdateSession(memSession))
+							send_cookie(rep, memSession);
+						else
+							removeAuthToken(memSession.id);
 					}
 				}
 			}
@@ -3,9 +3,15 @@
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <atomic>
 #include "server.hpp"
 #include "session_store.hpp"
 
+namespace Json
+{
+	class Value;
+}
+
 namespace http {
 	namespace server {
 		enum _eUserRights
@@ -122,9 +128,11 @@ namespace http {
 
 			/// Handle a request and produce a reply.
 			virtual void handle_request(const request& req, reply& rep) override;
+			virtual bool is_slow_request(const request& req) const override;
 		private:
-			char *strftime_t(const char *format, const time_t rawtime);
+			std::string strftime_t(const char *format, const time_t rawtime);
 			bool CompressWebOutput(const request& req, reply& rep);
+			bool IsNotModified(const request& req, reply& rep);
 			/// Websocket methods
 			bool is_upgrade_request(WebEmSession & session, const request& req, reply& rep);
 			std::string compute_accept_header(const std::string &websocket_key);
@@ -196,9 +204,12 @@ namespace http {
 			bool IsBadRequestPath(const std::string& original_request_path);
 
 			void ClearUserPasswords();
+			void SetUserPasswords(const std::vector<_tWebUserPassword> &userpasswords);
+			bool FindUserPassword(const std::string &username, _tWebUserPassword &user);
+			bool HaveUserPasswords();
 			std::vector<_tWebUserPassword> m_userpasswords;
-			void AddLocalNetworks(std::string network);
-			void ClearLocalNetworks();
+			std::mutex m_userpasswordsMutex;	// requests are authorized on several threads
+			void SetLocalNetworks(const std::vector<std::string> &networks);
 			std::vector<_tIPNetwork> m_localnetworks;
 			void SetDigistRealm(const std::string &realm);
 			std::string m_DigistRealm;
@@ -206,8 +217,8 @@ namespace http {
 
 			//IPs that are allowed to pass proxy headers
 			std::vector < std::string > myRemoteProxyIPs;
-			void AddRemoteProxyIPs(const std::string &ipaddr);
-			void ClearRemoteProxyIPs();
+			void SetRemoteProxyIPs(const std::vector<std::string> &ipaddrs);
+			bool IsRemoteProxyIP(const std::string &ipaddr);
 
 			// Session store manager
 			void SetSessionStore(session_store_impl_ptr sessionStore);
@@ -215,21 +226,30 @@ namespace http {
 
 			std::string m_zippassword;
 			const std::string GetPort();
-			WebEmSession * GetSession(const std::string & ssid);
+			//sessions are handed out as copies, change them with UpdateSession/RenewSession
+			bool GetSession(const std::string & ssid, WebEmSession & session);
 			void AddSession(const WebEmSession & session);
+			bool UpdateSession(const WebEmSession & session);
+			bool RenewSession(const std::string & ssid, const time_t expires);
 			void RemoveSession(const WebEmSession & session);
 			void RemoveSession(const std::string & ssid);
 			int CountSessions();
-			_eAuthenticationMethod m_authmethod;
+			std::atomic<_eAuthenticationMethod> m_authmethod;
 			//Whitelist url strings that bypass authentication checks (not used by basic-auth authentication)
 			std::vector < std::string > myWhitelistURLs;
 			std::map<std::string, WebEmSession> m_sessions;
 			server_settings m_settings;
 			// actual theme selected
 			std::string m_actTheme;
+			std::string GetWebTheme();
+			// guards the local networks, proxy IPs and theme, they are replaced while requests read them
+			std::mutex m_settingsMutex;
 
 			void SetWebCompressionMode(const _eWebCompressionMode gzmode);
 			_eWebCompressionMode m_gzipmode;
+
+			//Writes root as compact json straight into the reply, gzipped when the client accepts it
+			void SetJSonReply(const request& req, reply& rep, const Json::Value &root);
 		private:
 			/// store map between include codes and application functions
 			std::map < std::string, webem_include_function > myIncludes;
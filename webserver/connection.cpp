@@ -21,17 +21,21 @@ namespace server {
 
 // this is the constructor for plain connections
 connection::connection(boost::asio::io_service& io_service,
+		boost::asio::io_service* worker_service,
 		connection_manager& manager,
 		request_handler& handler,
 		int read_timeout) :
+				strand_(io_service),
+				worker_service_(worker_service),
 				connection_manager_(manager),
 				request_handler_(handler),
 				read_timeout_(read_timeout),
 				read_timer_(io_service, boost::posix_time::seconds(read_timeout)),
-				websocket_parser(boost::bind(&connection::MyWrite, this, _1), handler.Get_myWebem(), boost::bind(&connection::WS_Write, this, _1)),
+				websocket_parser(boost::bind(&connection::MyWrite, this, _1), handler.Get_myWebem(), boost::bind(&connection::WS_Write, this, _1), boost::bind(&connection::post_websocket_work, this, _1)),
 				status_(INITIALIZING),
 				default_abandoned_timeout_(20*60), // 20mn before stopping abandoned connection
 				abandoned_timer_(io_service, boost::posix_time::seconds(default_abandoned_timeout_)),
+				long_poll_timer_(io_service),
 				default_max_requests_(20)
 {
 	secure_ = false;
@@ -46,16 +50,19 @@ connection::connection(boost::asio::io_service& io_service,
 
 #ifdef WWW_ENABLE_SSL
 // this is the constructor for secure connections
-connection::connection(boost::asio::io_service& io_service,
+connection::connection(boost::asio::io_service& io_service, boost::asio::io_service* worker_service,
 	connection_manager& manager, request_handler& handler, int read_timeout, boost::asio::ssl::context& context) :
+				strand_(io_service),
+				worker_service_(worker_service),
 				connection_manager_(manager),
 				request_handler_(handler),
 				read_timeout_(read_timeout),
 				read_timer_(io_service, boost::posix_time::seconds(read_timeout)),
-				websocket_parser(boost::bind(&connection::MyWrite, this, _1), handler.Get_myWebem(), boost::bind(&connection::WS_Write, this, _1)),
+				websocket_parser(boost::bind(&connection::MyWrite, this, _1), handler.Get_myWebem(), boost::bind(&connection::WS_Write, this, _1), boost::bind(&connection::post_websocket_work, this, _1)),
 				status_(INITIALIZING),
 				default_abandoned_timeout_(20*60), // 20mn before stopping abandoned connection
 				abandoned_timer_(io_service, boost::posix_time::seconds(default_abandoned_timeout_)),
+				long_poll_timer_(io_service),
 				default_max_requests_(20)
 {
 	secure_ = true;
@@ -108,8 +115,8 @@ void connection::start()
 		status_ = WAITING_HANDSHAKE;
 		// with ssl, we first need to complete the handshake before reading
 		sslsocket_->async_handshake(boost::asio::ssl::stream_base::server,
-			boost::bind(&connection::handle_handshake, shared_from_this(),
-			boost::asio::placeholders::error));
+			strand_.wrap(boost::bind(&connection::handle_handshake, shared_from_this(),
+			boost::asio::placeholders::error)));
 #endif
 	}
 	else {
@@ -118,7 +125,13 @@ void connection::start()
 	}
 }
 
+// may be called from any thread, the connection is closed on its strand
 void connection::stop()
+{
+	strand_.dispatch(boost::bind(&connection::handle_stop, shared_from_this()));
+}
+
+void connection::handle_stop()
 {
 	switch (connection_type) {
 	case connection_websocket:
@@ -133,9 +146,11 @@ void connection::stop()
 	// Cancel timers
 	cancel_abandoned_timeout();
 	cancel_read_timeout();
+	boost::system::error_code ignored_ec;
+	long_poll_timer_.cancel(ignored_ec);
+	long_poll_ready_ = nullptr;
 
 	// Initiate graceful connection closure.
-	boost::system::error_code ignored_ec;
 	socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec); // @note For portable behaviour with respect to graceful closure of a
 																				// connected socket, call shutdown() before closing the socket.
 	socket().close();
@@ -201,17 +216,17 @@ void connection::read_more()
 #ifdef WWW_ENABLE_SSL
 		// Perform secure read
 		sslsocket_->async_read_some(buf,
-			boost::bind(&connection::handle_read, shared_from_this(),
+			strand_.wrap(boost::bind(&connection::handle_read, shared_from_this(),
 				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
+				boost::asio::placeholders::bytes_transferred)));
 #endif
 	}
 	else {
 		// Perform plain read
 		socket_->async_read_some(buf,
-			boost::bind(&connection::handle_read, shared_from_this(),
+			strand_.wrap(boost::bind(&connection::handle_read, shared_from_this(),
 				boost::asio::placeholders::error,
-				boost::asio::placeholders::bytes_transferred));
+				boost::asio::placeholders::bytes_transferred)));
 	}
 }
 
@@ -225,11 +240,11 @@ void connection::SocketWrite(const std::string &buf)
 	write_buffer = buf;
 	if (secure_) {
 #ifdef WWW_ENABLE_SSL
-		boost::asio::async_write(*sslsocket_, boost::asio::buffer(write_buffer), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		boost::asio::async_write(*sslsocket_, boost::asio::buffer(write_buffer), strand_.wrap(boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 #endif
 	}
 	else {
-		boost::asio::async_write(*socket_, boost::asio::buffer(write_buffer), boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		boost::asio::async_write(*socket_, boost::asio::buffer(write_buffer), strand_.wrap(boost::bind(&connection::handle_write, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 	}
 
 }
@@ -239,13 +254,18 @@ void connection::WS_Write(const std::string &packet_data)
 	MyWrite(CWebsocketFrame::Create(opcode_text, packet_data, false));
 }
 
+// may be called from any thread (websocket notifications), the write is done on the strand
 void connection::MyWrite(const std::string &buf)
+{
+	strand_.dispatch(boost::bind(&connection::handle_my_write, shared_from_this(), buf));
+}
+
+void connection::handle_my_write(const std::string &buf)
 {
 	switch (connection_type) {
 	case connection_http:
 	case connection_websocket:
 		// we dont send data anymore in websocket closing state
-		std::unique_lock<std::mutex>(writeMutex);
 		if (write_in_progress) {
 			// write in progress, add to queue
 			writeQ.push(buf);
@@ -271,8 +291,9 @@ void connection::handle_read(const boost::system::error_code& error, std::size_t
 		boost::tribool result;
 
 		// http variables
-		/// The incoming request.
-		request request_;
+		/// The incoming request, shared with the worker thread that may handle it
+		std::shared_ptr<request> request_ptr = std::make_shared<request>();
+		request &request_ = *request_ptr;
 		/// our response
 		reply reply_;
 		const char *begin;
@@ -297,7 +318,6 @@ void connection::handle_read(const boost::system::error_code& error, std::size_t
 			if (result) {
 				size_t sizeread = begin - boost::asio::buffer_cast<const char*>(_buf.data());
 				_buf.consume(sizeread);
-				reply_.reset();
 				const char *pConnection = request_.get_req_header(&request_, "Connection");
 				keepalive_ = pConnection != NULL && boost::iequals(pConnection, "Keep-Alive");
 				request_.keep_alive = keepalive_;
@@ -306,36 +326,7 @@ void connection::handle_read(const boost::system::error_code& error, std::size_t
 				if (request_.host_address.substr(0, 7) == "::ffff:") {
 					request_.host_address = request_.host_address.substr(7);
 				}
-				request_handler_.handle_request(request_, reply_);
-
-				if (reply_.status == reply::switching_protocols) {
-					// this was an upgrade request
-					connection_type = connection_websocket;
-					// from now on we are a persistant connection
-					keepalive_ = true;
-					websocket_parser.Start();
-					websocket_parser.GetHandler()->store_session_id(request_, reply_);
-					// todo: check if multiple connection from the same client in CONNECTING state?
-				}
-
-				if (request_.keep_alive && ((reply_.status == reply::ok) || (reply_.status == reply::no_content) || (reply_.status == reply::not_modified))) {
-					// Allows request handler to override the header (but it should not)
-					reply::add_header_if_absent(&reply_, "Connection", "Keep-Alive");
-					std::stringstream ss;
-					ss << "max=" << default_max_requests_ << ", timeout=" << read_timeout_;
-					reply::add_header_if_absent(&reply_, "Keep-Alive", ss.str());
-				}
-
-				MyWrite(reply_.to_string(request_.method));
-				if (reply_.status == reply::switching_protocols) {
-					// this was an upgrade request, set this value after MyWrite to allow the 101 response to go out
-					connection_type = connection_websocket;
-				}
-
-				if (keepalive_) {
-					read_more();
-				}
-				status_ = WAITING_WRITE;
+				process_request(request_ptr);
 			}
 			else if (!result)
 			{
@@ -380,9 +371,140 @@ void connection::handle_read(const boost::system::error_code& error, std::size_t
 	}
 }
 
+void connection::process_request(const std::shared_ptr<request> &req)
+{
+	if ((worker_service_ == NULL) || (!request_handler_.is_slow_request(*req))) {
+		std::shared_ptr<reply> rep = std::make_shared<reply>();
+		rep->reset();
+		request_handler_.handle_request(*req, *rep);
+		handle_request_done(req, rep);
+		return;
+	}
+	// nothing is read from the connection until the reply is sent
+	worker_service_->post(boost::bind(&connection::handle_request_worker, shared_from_this(), req));
+}
+
+void connection::handle_request_worker(const std::shared_ptr<request> &req)
+{
+	std::shared_ptr<reply> rep = std::make_shared<reply>();
+	rep->reset();
+	try {
+		request_handler_.handle_request(*req, *rep);
+	} catch (...) {
+		_log.Log(LOG_ERROR, "%s -> exception thrown while handling request '%s'", host_endpoint_address_.c_str(), req->uri.c_str());
+		*rep = reply::stock_reply(reply::internal_server_error);
+	}
+	strand_.post(boost::bind(&connection::handle_request_done, shared_from_this(), req, rep));
+}
+
+// the work holds on to the connection, its handler is a member
+void connection::post_websocket_work(const boost::function<void()> &work)
+{
+	if (worker_service_ == NULL) {
+		work();
+		return;
+	}
+	worker_service_->post(boost::bind(&connection::handle_websocket_work, shared_from_this(), work));
+}
+
+void connection::handle_websocket_work(const boost::function<void()> &work)
+{
+	// replies are written through MyWrite, so they end up on the strand
+	work();
+}
+
+void connection::handle_request_done(const std::shared_ptr<request> &req, const std::shared_ptr<reply> &rep)
+{
+	if (rep->long_poll_ready) {
+		// nothing is read or written until the held request is answered
+		start_long_poll(*req, *rep);
+		return;
+	}
+	send_reply(*req, *rep);
+}
+
+void connection::send_reply(request &req, reply &rep)
+{
+	if (rep.status == reply::switching_protocols) {
+		// this was an upgrade request
+		connection_type = connection_websocket;
+		// from now on we are a persistant connection
+		keepalive_ = true;
+		websocket_parser.Start();
+		websocket_parser.GetHandler()->store_session_id(req, rep);
+		// todo: check if multiple connection from the same client in CONNECTING state?
+	}
+
+	if (req.keep_alive && ((rep.status == reply::ok) || (rep.status == reply::no_content) || (rep.status == reply::not_modified))) {
+		// Allows request handler to override the header (but it should not)
+		reply::add_header_if_absent(&rep, "Connection", "Keep-Alive");
+		std::stringstream ss;
+		ss << "max=" << default_max_requests_ << ", timeout=" << read_timeout_;
+		reply::add_header_if_absent(&rep, "Keep-Alive", ss.str());
+	}
+
+	MyWrite(rep.to_string(req.method));
+	if (rep.status == reply::switching_protocols) {
+		// this was an upgrade request, set this value after MyWrite to allow the 101 response to go out
+		connection_type = connection_websocket;
+	}
+
+	if (keepalive_) {
+		read_more();
+	}
+	status_ = WAITING_WRITE;
+}
+
+// a held request does not occupy the io_service, the handler wakes it up or the condition is checked on a timer
+void connection::start_long_poll(const request &req, const reply &rep)
+{
+	long_poll_request_ = req;
+	long_poll_request_.long_poll_retry = true;
+	long_poll_ready_ = rep.long_poll_ready;
+	long_poll_deadline_ = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(rep.long_poll_timeout);
+	if (rep.long_poll_notify) {
+		long_poll_timer_.expires_at(long_poll_deadline_);
+		long_poll_timer_.async_wait(strand_.wrap(boost::bind(&connection::handle_long_poll, shared_from_this(), boost::asio::placeholders::error)));
+		// the wake-up can outlive the connection and arrive after the next long-poll started, wake_long_poll checks the current condition
+		std::weak_ptr<connection> weak_self(shared_from_this());
+		rep.long_poll_notify([weak_self]() {
+			std::shared_ptr<connection> self = weak_self.lock();
+			if (self)
+				self->strand_.post(boost::bind(&connection::wake_long_poll, self));
+		});
+		return;
+	}
+	long_poll_timer_.expires_from_now(boost::posix_time::milliseconds(250));
+	long_poll_timer_.async_wait(strand_.wrap(boost::bind(&connection::handle_long_poll, shared_from_this(), boost::asio::placeholders::error)));
+}
+
+void connection::handle_long_poll(const boost::system::error_code& error)
+{
+	if (error == boost::asio::error::operation_aborted)
+		return;
+	if (!long_poll_ready_)
+		return;
+	if ((!long_poll_ready_()) && (boost::posix_time::microsec_clock::universal_time() < long_poll_deadline_)) {
+		long_poll_timer_.expires_from_now(boost::posix_time::milliseconds(250));
+		long_poll_timer_.async_wait(strand_.wrap(boost::bind(&connection::handle_long_poll, shared_from_this(), boost::asio::placeholders::error)));
+		return;
+	}
+	long_poll_ready_ = nullptr;
+	process_request(std::make_shared<request>(long_poll_request_));
+}
+
+void connection::wake_long_poll()
+{
+	if ((!long_poll_ready_) || (!long_poll_ready_()))
+		return;
+	boost::system::error_code ignored_ec;
+	long_poll_timer_.cancel(ignored_ec);
+	long_poll_ready_ = nullptr;
+	process_request(std::make_shared<request>(long_poll_request_));
+}
+
 void connection::handle_write(const boost::system::error_code& error, size_t bytes_transferred)
 {
-	std::unique_lock<std::mutex>(writeMutex);
 	write_buffer.clear();
 	write_in_progress = false;
 	if (!error) {
@@ -416,7 +538,7 @@ connection::~connection()
 // schedule read timeout timer
 void connection::set_read_timeout() {
 	read_timer_.expires_from_now(boost::posix_time::seconds(read_timeout_));
-	read_timer_.async_wait(boost::bind(&connection::handle_read_timeout, shared_from_this(), boost::asio::placeholders::error));
+	read_timer_.async_wait(strand_.wrap(boost::bind(&connection::handle_read_timeout, shared_from_this(), boost::asio::placeholders::error)));
 }
 
 /// simply cancel read timeout timer
@@ -449,7 +571,7 @@ void connection::handle_read_timeout(const boost::system::error_code& error) {
 /// schedule abandoned timeout timer
 void connection::set_abandoned_timeout() {
 	abandoned_timer_.expires_from_now(boost::posix_time::seconds(default_abandoned_timeout_));
-	abandoned_timer_.async_wait(boost::bind(&connection::handle_abandoned_timeout, shared_from_this(), boost::asio::placeholders::error));
+	abandoned_timer_.async_wait(strand_.wrap(boost::bind(&connection::handle_abandoned_timeout, shared_from_this(), boost::asio::placeholders::error)));
 }
 
 /// simply cancel abandoned timeout timer
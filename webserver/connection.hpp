@@ -36,11 +36,11 @@ class connection
     private domoticz::noncopyable
 {
 public:
-  /// Construct a connection with the given io_service.
-  explicit connection(boost::asio::io_service& io_service,
+  /// Construct a connection with the given io_service, slow requests are handled on worker_service when given.
+  explicit connection(boost::asio::io_service& io_service, boost::asio::io_service* worker_service,
       connection_manager& manager, request_handler& handler, int timeout);
 #ifdef WWW_ENABLE_SSL
-  explicit connection(boost::asio::io_service& io_service,
+  explicit connection(boost::asio::io_service& io_service, boost::asio::io_service* worker_service,
       connection_manager& manager, request_handler& handler, int timeout, boost::asio::ssl::context& context);
 #endif
   ~connection();
@@ -70,20 +70,40 @@ public:
   void handle_abandoned_timeout(const boost::system::error_code& error);
 
 private:
+  void handle_stop();
   /// Handle completion of a read operation.
   void handle_read(const boost::system::error_code& e, std::size_t bytes_transferred);
   void read_more();
+  /// Handle a parsed request, on a worker thread when it may take long
+  void process_request(const std::shared_ptr<request> &req);
+  void handle_request_worker(const std::shared_ptr<request> &req);
+  void handle_request_done(const std::shared_ptr<request> &req, const std::shared_ptr<reply> &rep);
+  /// Run a websocket query on a worker thread
+  void post_websocket_work(const boost::function<void()> &work);
+  void handle_websocket_work(const boost::function<void()> &work);
+  /// Write the reply of a handled request and continue reading
+  void send_reply(request &req, reply &rep);
+
+  /// Hold a request that asked for a long-poll
+  void start_long_poll(const request &req, const reply &rep);
+  void handle_long_poll(const boost::system::error_code& error);
+  void wake_long_poll();
 
   /// Handle completion of a write operation.
   void handle_write(const boost::system::error_code& e, size_t bytes_transferred);
-  /// Protect the write queue
-  std::mutex writeMutex;
-  /// Is protected by writeMutex
+  /// Queue or write the buffer, runs on the strand
+  void handle_my_write(const std::string &buf);
+  /// Only used on the strand
   std::queue<std::string> writeQ;
   /// indicates if we are currently writing
   bool write_in_progress;
   void SocketWrite(const std::string &buf);
 
+  /// All handlers of this connection run through the strand, the io_service has several threads
+  boost::asio::io_service::strand strand_;
+  /// Runs the requests that may take long (can be NULL)
+  boost::asio::io_service* worker_service_;
+
 	/// Initialize read timeout timer
 	void set_read_timeout();
 	/// Stop read timeout timer
@@ -118,6 +138,13 @@ private:
   /// Abandoned timeout timer
   boost::asio::deadline_timer abandoned_timer_;
 
+  /// Long-poll timer, runs until the deadline when the handler wakes the connection, else checks the held request's condition periodically
+  boost::asio::deadline_timer long_poll_timer_;
+  /// The held request and its condition
+  request long_poll_request_;
+  std::function<bool()> long_poll_ready_;
+  boost::posix_time::ptime long_poll_deadline_;
+
   /// The manager for this connection.
   connection_manager& connection_manager_;
 
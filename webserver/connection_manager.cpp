@@ -21,6 +21,7 @@ namespace server {
 
 void connection_manager::start(connection_ptr c)
 {
+	std::unique_lock<std::mutex> lock(mutex_);
 	connections_.insert(c);
 
 	boost::system::error_code ec;
@@ -29,7 +30,9 @@ void connection_manager::start(connection_ptr c)
 		// Prevent the exception to be thrown to run to avoid the server to be locked (still listening but no more connection or stop).
 		// If the exception returns to WebServer to also create a exception loop.
 		_log.Log(LOG_ERROR,"Getting error '%s' while getting remote_endpoint in connection_manager::start", ec.message().c_str());
-		stop(c);
+		connections_.erase(c);
+		lock.unlock();
+		c->stop();
 		return;
 	}
 
@@ -43,21 +46,29 @@ void connection_manager::start(connection_ptr c)
 		connectedips_.insert(s);
 		//_log.Log(LOG_STATUS,"Incoming connection from: %s", s.c_str());
 	}
+	lock.unlock();
 
 	c->start();
 }
 
 void connection_manager::stop(connection_ptr c)
 {
-	connections_.erase(c);
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		connections_.erase(c);
+	}
 	c->stop();
 }
 
 void connection_manager::stop_all()
 {
-	std::for_each(connections_.begin(), connections_.end(),
+	std::set<connection_ptr> connections;
+	{
+		std::lock_guard<std::mutex> l(mutex_);
+		connections.swap(connections_);
+	}
+	std::for_each(connections.begin(), connections.end(),
 			boost::bind(&connection::stop, _1));
-	connections_.clear();
 }
 
 
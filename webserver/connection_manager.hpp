@@ -12,6 +12,7 @@
 #define HTTP_CONNECTION_MANAGER_HPP
 
 #include <set>
+#include <mutex>
 #include "../main/Noncopyable.h"
 #include "connection.hpp"
 
@@ -34,6 +35,8 @@ public:
   void stop_all();
 
 private:
+  /// Connections are started and stopped from several threads
+  std::mutex mutex_;
   /// The managed connections.
   std::set<connection_ptr> connections_;
   std::set<std::string> connectedips_;
@@ -324,6 +324,13 @@ namespace http {
 			{
 				request_.host_address = originatingip;
 				m_pWebEm->myRequestHandler.handle_request(request_, reply_);
+				if (reply_.long_poll_ready)
+				{
+					// no long-poll through the proxy, answer right away
+					request_.long_poll_retry = true;
+					reply_.reset();
+					m_pWebEm->myRequestHandler.handle_request(request_, reply_);
+				}
 			}
 			else if (!result)
 			{
@@ -133,6 +133,9 @@ void reply::reset()
 	headers.clear();
 	content = "";
 	bIsGZIP = false;
+	long_poll_ready = nullptr;
+	long_poll_timeout = 0;
+	long_poll_notify = nullptr;
 }
 
 namespace stock_replies {
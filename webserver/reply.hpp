@@ -13,6 +13,7 @@
 
 #include <string>
 #include <iterator>
+#include <functional>
 #include <boost/asio.hpp>
 #include "header.hpp"
 
@@ -51,6 +52,14 @@ struct reply
   std::string content;
   bool bIsGZIP;
 
+  /// Long-poll: when set the connection holds the request until this returns true
+  /// or long_poll_timeout seconds passed, and then handles the request again
+  std::function<bool()> long_poll_ready;
+  int long_poll_timeout = 0;
+  /// Optional: registers a wake-up that is called (from any thread) when long_poll_ready may have become true,
+  /// without it the connection checks long_poll_ready periodically
+  std::function<void(const std::function<void()>&)> long_poll_notify;
+
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
   /// not be changed until the write operation has completed.
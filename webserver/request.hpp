@@ -31,6 +31,7 @@ public:
 	int content_length;				// the expected length of the contents
 	std::string content;				// the contents
 	bool keep_alive;					// send Keep-Alive header
+	bool long_poll_retry = false;		// handled again after a long-poll wait, do not hold it a second time
 
 	/// store map between pages and application functions (wide char)
 	std::multimap<std::string, std::string> parameters;
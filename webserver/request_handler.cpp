@@ -12,6 +12,7 @@
 #include "fastcgi.hpp"
 #include <fstream>
 #include <sstream>
+#include <cinttypes>
 #ifdef WIN32
 #include <boost/date_time/local_time/local_time.hpp>
 #include <boost/date_time/date.hpp>
@@ -23,9 +24,13 @@
 #include "GZipHelper.h"
 
 #include "../main/Logger.h"
+#include "../main/localtime_r.h"
 
 #define ZIPREADBUFFERSIZE (8192)
 
+#define ASSET_CHECK_INTERVAL 5	//seconds between checks if a cached file changed on disk
+#define ASSET_CACHE_MAX_FILE_SIZE (4 * 1024 * 1024)	//bigger files are read for every request
+
 #define HTTP_DATE_RFC_1123 "%a, %d %b %Y %H:%M:%S %Z" // Sun, 06 Nov 1994 08:49:37 GMT
 #define HTTP_DATE_RFC_850  "%A, %d-%b-%y %H:%M:%S %Z" // Sunday, 06-Nov-94 08:49:37 GMT
 #define HTTP_DATE_ASCTIME  "%a %b %e %H:%M:%S %Y"     // Sun Nov  6 08:49:37 1994
@@ -157,7 +162,12 @@ static time_t last_write_time(const std::string &path)
 
 bool request_handler::not_modified(const std::string &full_path, const request &req, reply &rep, modify_info &mInfo)
 {
-	mInfo.last_written = last_write_time(full_path);
+	return not_modified(last_write_time(full_path), req, rep, mInfo);
+}
+
+bool request_handler::not_modified(const time_t last_written, const request &req, reply &rep, modify_info &mInfo)
+{
+	mInfo.last_written = last_written;
 	if (mInfo.last_written == 0) {
 		// file system doesn't support this, don't enable header
 		mInfo.mtime_support = false;
@@ -193,6 +203,222 @@ bool request_handler::not_modified(const std::string &full_path, const request &
 	return false;
 }
 
+static bool read_file(const std::string &path, std::string &content, time_t &mtime)
+{
+	struct stat st;
+	if ((stat(path.c_str(), &st) != 0) || ((st.st_mode & S_IFDIR) != 0))
+		return false;
+	std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+	if (!is.is_open())
+		return false;
+	content.assign((std::istreambuf_iterator<char>(is)), (std::istreambuf_iterator<char>()));
+	mtime = st.st_mtime;
+	return true;
+}
+
+// 64 bit FNV-1a, used as strong entity tag of the identity content
+static std::string make_etag(const std::string &content)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t ii = 0; ii < content.size(); ii++)
+	{
+		hash ^= (unsigned char)content[ii];
+		hash *= 1099511628211ULL;
+	}
+	char szTmp[20];
+	sprintf(szTmp, "%016" PRIx64, hash);
+	return szTmp;
+}
+
+static bool etag_matches(const char *if_none_match, const std::string &etag)
+{
+	std::string tags = if_none_match;
+	if (tags.find('*') != std::string::npos)
+		return true;
+	return (tags.find(etag) != std::string::npos);
+}
+
+bool request_handler::load_asset(const std::string &request_path, cached_asset &asset)
+{
+	std::string content, gzip, brotli;
+	asset.mtime = 0;
+	asset.files.clear();
+	asset.extension.clear();
+
+	std::string path = request_path;
+#ifndef WEBSERVER_DONT_USE_ZIP
+	if (m_bIsZIP)
+	{
+		std::lock_guard<std::mutex> l(m_zipMutex);
+		if ((m_uf == NULL) || (myWebem == NULL))
+			return false;
+		//remove first /
+		path = path.substr(1);
+		if (unzLocateFile(m_uf, path.c_str(), 0) == UNZ_OK)
+		{
+			if (do_extract_currentfile(m_uf, myWebem->m_zippassword.c_str(), content) != UNZ_OK)
+				content.clear();
+		}
+		std::string gzpath = path + ".gz";
+		if (unzLocateFile(m_uf, gzpath.c_str(), 0) == UNZ_OK)
+		{
+			if (do_extract_currentfile(m_uf, myWebem->m_zippassword.c_str(), gzip) != UNZ_OK)
+				gzip.clear();
+		}
+		std::string brpath = path + ".br";
+		if (unzLocateFile(m_uf, brpath.c_str(), 0) == UNZ_OK)
+		{
+			if (do_extract_currentfile(m_uf, myWebem->m_zippassword.c_str(), brotli) != UNZ_OK)
+				brotli.clear();
+		}
+	}
+	else
+#endif
+	{
+		for (int ii = 0; ii < 2; ii++)
+		{
+			std::string full_path = doc_root_ + path;
+			time_t mtime = 0;
+			if (read_file(full_path, content, mtime))
+			{
+				asset.files.push_back(std::make_pair(full_path, mtime));
+				asset.mtime = mtime;
+			}
+			if (read_file(full_path + ".gz", gzip, mtime))
+			{
+				asset.files.push_back(std::make_pair(full_path + ".gz", mtime));
+				if (mtime > asset.mtime)
+					asset.mtime = mtime;
+			}
+			if (read_file(full_path + ".br", brotli, mtime))
+			{
+				asset.files.push_back(std::make_pair(full_path + ".br", mtime));
+				if (mtime > asset.mtime)
+					asset.mtime = mtime;
+			}
+			if (!asset.files.empty() || (ii > 0) || (request_path.find('.') != std::string::npos))
+				break;
+			// maybe it is a folder, lets add the index file
+			path = request_path + "/index.html";
+			asset.extension = "html";
+		}
+	}
+
+	if (content.empty() && gzip.empty())
+		return false;
+
+	if (asset.extension.empty())
+	{
+		// Determine the file extension.
+		std::size_t last_slash_pos = request_path.find_last_of("/");
+		std::size_t last_dot_pos = request_path.find_last_of(".");
+		if (last_dot_pos != std::string::npos && last_dot_pos > last_slash_pos)
+		{
+			asset.extension = request_path.substr(last_dot_pos + 1);
+		}
+	}
+
+	// maybe its only available as gz file (and the client browser does not support compression)
+	if (content.empty())
+	{
+		CGZIP2AT<> decompress((LPGZIP)gzip.c_str(), gzip.size());
+		content.assign(decompress.psz, decompress.Length);
+	}
+	asset.has_embeds = (content.find("<!--#embed") != std::string::npos);
+
+	// compress once here instead of on every request, included content is filled in per request so can't be cached
+	// files too big for the cache would be compressed for every request, those are sent as they are
+	if (
+		gzip.empty()
+		&& (!asset.has_embeds)
+		&& (content.size() <= ASSET_CACHE_MAX_FILE_SIZE)
+		&& (myWebem->m_gzipmode == WWW_USE_GZIP)
+		&& ((request_path.find(".js") != std::string::npos)
+			|| (request_path.find(".htm") != std::string::npos)
+			|| (request_path.find(".css") != std::string::npos))
+		)
+	{
+		CA2GZIP compress((char*)content.c_str(), content.size());
+		if ((compress.Length > 0) && (compress.Length < (int)content.size()))
+			gzip.assign((char*)compress.pgzip, compress.Length);
+	}
+
+	asset.etag = make_etag(content);
+	asset.content = std::make_shared<const std::string>(content);
+	asset.gzip.reset();
+	asset.brotli.reset();
+	if (!gzip.empty())
+		asset.gzip = std::make_shared<const std::string>(gzip);
+	if (!brotli.empty())
+		asset.brotli = std::make_shared<const std::string>(brotli);
+	return true;
+}
+
+std::shared_ptr<const cached_asset> request_handler::get_asset(const std::string &request_path)
+{
+	time_t now = mytime(NULL);
+	std::shared_ptr<cached_asset> cached;
+	{
+		std::lock_guard<std::mutex> l(m_assetsMutex);
+		std::map<std::string, std::shared_ptr<cached_asset> >::iterator itt = m_assets.find(request_path);
+		if (itt != m_assets.end())
+		{
+			cached = itt->second;
+			if (cached->files.empty() || (now - cached->checked < ASSET_CHECK_INTERVAL))
+				return cached;
+		}
+	}
+
+	// the files are checked and read without the lock, other requests are served from the cache meanwhile
+	if (cached)
+	{
+		bool bChanged = false;
+		for (const auto &file : cached->files)
+		{
+			struct stat st;
+			time_t mtime = (stat(file.first.c_str(), &st) == 0) ? st.st_mtime : 0;
+			if (mtime != file.second)
+			{
+				bChanged = true;
+				break;
+			}
+		}
+		if (!bChanged)
+		{
+			std::lock_guard<std::mutex> l(m_assetsMutex);
+			cached->checked = now;
+			return cached;
+		}
+	}
+
+	std::shared_ptr<cached_asset> asset = std::make_shared<cached_asset>();
+	bool bLoaded = load_asset(request_path, *asset);
+	asset->checked = now;
+	size_t size = 0;
+	if (bLoaded)
+	{
+		size = asset->content->size();
+		if (asset->gzip)
+			size += asset->gzip->size();
+		if (asset->brotli)
+			size += asset->brotli->size();
+	}
+
+	// replace rather than modify, requests still sending the old one keep their copy
+	std::lock_guard<std::mutex> l(m_assetsMutex);
+	if ((bLoaded) && (size <= ASSET_CACHE_MAX_FILE_SIZE))
+		m_assets[request_path] = asset;
+	else if (cached)
+	{
+		std::map<std::string, std::shared_ptr<cached_asset> >::iterator itt = m_assets.find(request_path);
+		if ((itt != m_assets.end()) && (itt->second == cached))
+			m_assets.erase(itt);
+	}
+	if (!bLoaded)
+		return std::shared_ptr<const cached_asset>();
+	return asset;
+}
+
 void request_handler::handle_request(const request& req, reply& rep)
 {
 	modify_info mInfo;
@@ -228,6 +454,7 @@ void request_handler::handle_request(const request &req, reply &rep, modify_info
   }
 
   bool bHaveGZipSupport=false;
+  bool bHaveBrotliSupport=false;
 
   if (myWebem->m_gzipmode != WWW_FORCE_NO_GZIP_SUPPORT)
   {
@@ -243,11 +470,11 @@ void request_handler::handle_request(const request &req, reply &rep, modify_info
 		{
 			//see if we support gzip
 			bHaveGZipSupport=(strstr(encoding_header,"gzip")!=NULL);
+			bHaveBrotliSupport=(strstr(encoding_header,"br")!=NULL);
 		}
 	}
   }
 
-  bool bHaveLoadedgzip=false;
 #ifndef WEBSERVER_DONT_USE_ZIP
   if (!m_bIsZIP)
 #endif
@@ -266,161 +493,71 @@ void request_handler::handle_request(const request &req, reply &rep, modify_info
 		  fastcgi_parser::handlePHP(myWebem->m_settings, request_path, req, rep, mInfo);
 		  return;
 	  }
-	  else
-	  {
-		mInfo.delay_status = true;
-		std::string full_path = doc_root_ + request_path;
-		if (bHaveGZipSupport) // first try gzip version
-		{
-			full_path += ".gz";
-		}
-
-		std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-		if (is)
-		{
-			mInfo.delay_status = (!bHaveGZipSupport);
-			bHaveLoadedgzip = bHaveGZipSupport;
-			rep.bIsGZIP = bHaveGZipSupport;
-		}
-		else if (bHaveGZipSupport) // try uncompressed version
-		{
-			full_path = doc_root_ + request_path;
-			is.open(full_path.c_str(), std::ios::in | std::ios::binary);
-		}
-
-		// maybe it is a folder, lets add the index file
-		if (!is.is_open() && (full_path.find('.') == std::string::npos))
-		{
-			full_path = doc_root_ + request_path + "/index.html";
-			if (bHaveGZipSupport) // first try gzip version
-			{
-				full_path += ".gz";
-			}
-
-			is.open(full_path.c_str(), std::ios::in | std::ios::binary);
-			if (is.is_open())
-			{
-				mInfo.delay_status = (!bHaveGZipSupport);
-				bHaveLoadedgzip = bHaveGZipSupport;
-				rep.bIsGZIP = bHaveGZipSupport;
-			}
-			else if (bHaveGZipSupport) // try uncompressed version
-			{
-				full_path = doc_root_ + request_path + "/index.html";
-				is.open(full_path.c_str(), std::ios::in | std::ios::binary);
-			}
-
-			if (is.is_open())
-			{
-				extension = "html";
-			}
-		}
-
-		// maybe its a gz file (and clients browser does not support compression)
-		if (!is.is_open() && (!bHaveGZipSupport))
-		{
-			full_path += ".gz";
-			is.open(full_path.c_str(), std::ios::in | std::ios::binary);
-			if (is.is_open())
-			{
-				bHaveLoadedgzip = true;
-				mInfo.delay_status = false;
-			}
-		}
+  }
 
-		if (!is.is_open())
-		{
-			rep = reply::stock_reply(reply::not_found);
+  std::shared_ptr<const cached_asset> asset = get_asset(request_path);
+  if (!asset)
+  {
+	  rep = reply::stock_reply(reply::not_found);
 #ifdef _DEBUG
-			_log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d)  (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
+	  _log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d)  (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
 #endif
-			return;
-		}
-
-		if (request_path.find("styles/") != std::string::npos) 
-		{
-			mInfo.mtime_support = false; // ignore caching on theme files
-		}
-		else
-		{
-			if (not_modified(full_path, req, rep, mInfo))
-			{
-				return;
-			}
-		}
+	  return;
+  }
+  extension = asset->extension;
 
-		// fill out the reply to be sent to the client.
-		if (bHaveLoadedgzip && (!bHaveGZipSupport))
-		{
-			std::string gzcontent((std::istreambuf_iterator<char>(is)),
-				(std::istreambuf_iterator<char>()));
+  // pick the representation to send, each has its own entity tag
+  std::shared_ptr<const std::string> content = asset->content;
+  std::string encoding;
+  if (bHaveBrotliSupport && asset->brotli)
+  {
+	  content = asset->brotli;
+	  encoding = "br";
+  }
+  else if (bHaveGZipSupport && asset->gzip)
+  {
+	  content = asset->gzip;
+	  encoding = "gzip";
+  }
+  rep.bIsGZIP = !encoding.empty();
+  mInfo.delay_status = encoding.empty();
 
-			CGZIP2AT<> decompress((LPGZIP)gzcontent.c_str(), gzcontent.size());
+  // included content is filled in per request, so those pages can't be tagged
+  std::string etag;
+  if (!asset->has_embeds)
+  {
+	  etag = "\"" + asset->etag + (encoding.empty() ? "" : "-" + encoding) + "\"";
+  }
+  // urls are not versioned, so browsers revalidate every file (images too) with the entity tag
+  const char *cache_control = "no-cache";
 
-			rep.content.append(decompress.psz, decompress.Length);
-		}
-		else
-		{
-			rep.content.append((std::istreambuf_iterator<char>(is)),
-				(std::istreambuf_iterator<char>()));
-		}
-		rep.status = reply::ok;
-	}
+  if (request_path.find("styles/") != std::string::npos)
+  {
+	  mInfo.mtime_support = false; // ignore caching on theme files
+	  etag.clear();
   }
-#ifndef WEBSERVER_DONT_USE_ZIP
   else
   {
-	  if (m_uf==NULL)
+	  const char *if_none_match = request::get_req_header(&req, "If-None-Match");
+	  if ((!etag.empty()) && (if_none_match != NULL) && etag_matches(if_none_match, etag))
 	  {
-		  rep = reply::stock_reply(reply::not_found);
-#ifdef _DEBUG
-		  _log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d) (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
-
-#endif
+		  rep = reply::stock_reply(reply::not_modified);
+		  reply::add_header(&rep, "ETag", etag);
+		  reply::add_header(&rep, "Cache-Control", cache_control);
 		  return;
 	  }
-
-	  //remove first /
-	  request_path=request_path.substr(1);
-	  if (bHaveGZipSupport)
+	  if (asset->mtime != 0)
 	  {
-		  std::string gzpath = request_path + ".gz";
-		  if (unzLocateFile(m_uf,gzpath.c_str(),0)==UNZ_OK)
+		  if (not_modified(asset->mtime, req, rep, mInfo))
 		  {
-			  if (myWebem && do_extract_currentfile(m_uf,myWebem->m_zippassword.c_str(),rep.content)!=UNZ_OK)
-			  {
-				  rep = reply::stock_reply(reply::not_found);
-#ifdef _DEBUG
-				  _log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d) (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
-#endif
-				  return;
-			  }
-			  bHaveLoadedgzip=true;
-		  }
-	  }
-	  if (!bHaveLoadedgzip)
-	  {
-		  if (unzLocateFile(m_uf,request_path.c_str(),0)!=UNZ_OK)
-		  {
-			  rep = reply::stock_reply(reply::not_found);
-#ifdef _DEBUG
-			  _log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d) (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
-#endif
-			  return;
-		  }
-		  if (myWebem && do_extract_currentfile(m_uf,myWebem->m_zippassword.c_str(),rep.content)!=UNZ_OK)
-		  {
-			  rep = reply::stock_reply(reply::not_found);
-#ifdef _DEBUG
-			  _log.Log(LOG_ERROR, "Webserver: File '%s': %s (%d) (remote address: %s)", request_path.c_str(), strerror(errno), errno, req.host_address.c_str());
-#endif
 			  return;
 		  }
 	  }
-	  rep.status = reply::ok;
-
   }
-#endif
+
+  // fill out the reply to be sent to the client.
+  rep.content.append(*content);
+  rep.status = reply::ok;
 
   reply::add_header(&rep, "Content-Length", std::to_string(rep.content.size()));
   reply::add_header(&rep, "Content-Type", mime_types::extension_to_type(extension));
@@ -430,10 +567,19 @@ void request_handler::handle_request(const request &req, reply &rep, modify_info
   reply::add_header(&rep, "X-XSS-Protection", "1; mode=block");
   //reply::add_header(&rep, "X-Frame-Options", "SAMEORIGIN"); //this might brake custom pages that embed third party images (like used by weather channels)
 
-  if (bHaveGZipSupport && bHaveLoadedgzip)
+  if (!encoding.empty())
+  {
+	reply::add_header(&rep, "Content-Encoding", encoding);
+  }
+  if (asset->gzip || asset->brotli)
+  {
+	reply::add_header(&rep, "Vary", "Accept-Encoding");
+  }
+  if (!etag.empty())
   {
-	reply::add_header(&rep, "Content-Encoding", "gzip");
+	reply::add_header(&rep, "ETag", etag);
   }
+  reply::add_header(&rep, "Cache-Control", cache_control);
 }
 
 bool request_handler::url_decode(const std::string& in, std::string& out)
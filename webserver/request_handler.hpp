@@ -12,6 +12,10 @@
 #define HTTP_REQUEST_HANDLER_HPP
 
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "../main/Noncopyable.h"
 #ifndef WEBSERVER_DONT_USE_ZIP
 	#include <unzip.h>
@@ -33,6 +37,19 @@ struct modify_info {
 	time_t last_written;
 };
 
+/// A static file held in memory, with the encodings it can be sent in.
+struct cached_asset {
+	std::string extension;
+	time_t mtime;		// 0 when served from the zipped web root
+	bool has_embeds;	// contains <!--#embed--> tags, filled in per request
+	std::shared_ptr<const std::string> content;
+	std::shared_ptr<const std::string> gzip;
+	std::shared_ptr<const std::string> brotli;
+	std::string etag;
+	std::vector<std::pair<std::string, time_t> > files;	// files it was read from, to see if it changed
+	time_t checked;
+};
+
 /// The common handler for all incoming requests.
 class request_handler
   : private domoticz::noncopyable
@@ -46,6 +63,9 @@ public:
   virtual void handle_request(const request& req, reply& rep);
   virtual void handle_request(const request & req, reply & rep, modify_info & mInfo);
 
+  /// Requests that may take long to handle, these are run on the worker threads of the server.
+  virtual bool is_slow_request(const request& req) const { return false; }
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
@@ -62,10 +82,16 @@ protected:
 
 private:
 	bool not_modified(const std::string &full_path, const request &req, reply &rep, modify_info &mInfo);
+	bool not_modified(const time_t last_written, const request &req, reply &rep, modify_info &mInfo);
+	std::shared_ptr<const cached_asset> get_asset(const std::string &request_path);
+	bool load_asset(const std::string &request_path, cached_asset &asset);
+	std::mutex m_assetsMutex;	// only guards the map, assets are loaded without it
+	std::map<std::string, std::shared_ptr<cached_asset> > m_assets;
 	//zip support
 #ifndef WEBSERVER_DONT_USE_ZIP
 	  zlib_filefunc_def m_ffunc;
 	  unzFile m_uf;
+	  std::mutex m_zipMutex;	// the unzip handle keeps the current file position
 	  bool m_bIsZIP;
 	  void *m_pUnzipBuffer;
 	  int do_extract_currentfile(unzFile uf, const char* password, std::string &outputstr);
@@ -19,6 +19,8 @@ namespace server {
 
 server_base::server_base(const server_settings & settings, request_handler & user_request_handler) :
 		io_service_(),
+		accept_strand_(io_service_),
+		worker_service_(),
 		acceptor_(io_service_),
 		settings_(settings),
 		request_handler_(user_request_handler),
@@ -55,7 +57,7 @@ void server_base::init(init_connectionhandler_func init_connection_handler, acce
 	acceptor_.listen();
 
 	// start the accept thread
-	acceptor_.async_accept(new_connection_->socket(), accept_handler);
+	acceptor_.async_accept(new_connection_->socket(), accept_strand_.wrap(accept_handler));
 }
 
 void server_base::run() {
@@ -63,29 +65,81 @@ void server_base::run() {
 	// have finished. While the server is running, there is always at least one
 	// asynchronous operation outstanding: the asynchronous accept call waiting
 	// for new incoming connections.
+	// The io_service is run by io_threads threads (this one included), every connection
+	// has its own strand so its handlers still run one at a time.
+	exception_ = nullptr;
+	is_running = true;
+	// Don't enable heartbeat in WSL due to https://github.com/Microsoft/WSL/issues/3091 (Fixed in Windows 10 1809 / build 17686)
+	if (!g_bIsWSL) heart_beat(boost::system::error_code());
+
+	boost::asio::io_service::work worker_work(worker_service_);
+	for (int ii = 0; ii < settings_.worker_threads; ii++) {
+		worker_threads_.push_back(std::make_shared<std::thread>(&server_base::run_worker_service, this));
+		SetThreadName(worker_threads_.back()->native_handle(), "WebServerWork");
+	}
+	for (int ii = 1; ii < settings_.io_threads; ii++) {
+		io_threads_.push_back(std::make_shared<std::thread>(&server_base::run_io_service, this));
+		SetThreadName(io_threads_.back()->native_handle(), "WebServerIO");
+	}
+	run_io_service();
+
+	// the io_service is stopped for all threads as soon as one of them leaves
+	for (auto & thread : io_threads_) {
+		thread->join();
+	}
+	io_threads_.clear();
+	worker_service_.stop();
+	for (auto & thread : worker_threads_) {
+		thread->join();
+	}
+	worker_threads_.clear();
+	worker_service_.reset();
+	is_running = false;
+
+	if (exception_) {
+		// Note: if acceptor is up everything is OK, we can call run() again
+		//       but if the exception has broken the acceptor we cannot stop/start it and the next run() will exit immediatly.
+		io_service_.reset(); // this call is needed before calling run() again
+		std::rethrow_exception(exception_);
+	}
+}
+
+void server_base::run_io_service() {
 	try {
-		is_running = true;
-		// Don't enable heartbeat in WSL due to https://github.com/Microsoft/WSL/issues/3091 (Fixed in Windows 10 1809 / build 17686)
-		if (!g_bIsWSL) heart_beat(boost::system::error_code());
 		io_service_.run();
-		is_running = false;
 	} catch (std::exception& e) {
 		_log.Log(LOG_ERROR, "[web:%s] exception occurred : '%s' (need to run again)", settings_.listening_port.c_str(), e.what());
-		is_running = false;
-		// Note: if acceptor is up everything is OK, we can call run() again
-		//       but if the exception has broken the acceptor we cannot stop/start it and the next run() will exit immediatly.
-		io_service_.reset(); // this call is needed before calling run() again
-		throw;
+		std::lock_guard<std::mutex> l(exception_mutex_);
+		if (!exception_) {
+			exception_ = std::current_exception();
+		}
+		io_service_.stop();
 	} catch (...) {
 		_log.Log(LOG_ERROR, "[web:%s] unknown exception occurred (need to run again)", settings_.listening_port.c_str());
-		is_running = false;
-		// Note: if acceptor is up everything is OK, we can call run() again
-		//       but if the exception has broken the acceptor we cannot stop/start it and the next run() will exit immediatly.
-		io_service_.reset(); // this call is needed before calling run() again
-		throw;
+		std::lock_guard<std::mutex> l(exception_mutex_);
+		if (!exception_) {
+			exception_ = std::current_exception();
+		}
+		io_service_.stop();
 	}
 }
 
+void server_base::run_worker_service() {
+	while (!worker_service_.stopped()) {
+		try {
+			worker_service_.run();
+		} catch (std::exception& e) {
+			_log.Log(LOG_ERROR, "[web:%s] exception occurred in worker : '%s'", settings_.listening_port.c_str(), e.what());
+		} catch (...) {
+			_log.Log(LOG_ERROR, "[web:%s] unknown exception occurred in worker", settings_.listening_port.c_str());
+		}
+	}
+}
+
+boost::asio::io_service *server_base::worker_service() {
+	return (settings_.worker_threads > 0) ? &worker_service_ : NULL;
+}
+
 /// Ask the server to stop using asynchronous command
 void server_base::stop() {
 	if (is_running) {
@@ -93,7 +147,7 @@ void server_base::stop() {
 		// Rene, set is_running to false, because the following is an io_service call, which makes is_running
 		// never set to false whilst in the call itself
 		is_running = false;
-		io_service_.post(boost::bind(&server_base::handle_stop, this));
+		accept_strand_.post(boost::bind(&server_base::handle_stop, this));
 	} else {
 		// if io_service is not running then the post call will not be performed
 		handle_stop();
@@ -148,7 +202,7 @@ server::server(const server_settings & settings, request_handler & user_request_
 }
 
 void server::init_connection() {
-	new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_, timeout_));
+	new_connection_.reset(new connection(io_service_, worker_service(), connection_manager_, request_handler_, timeout_));
 }
 
 /**
@@ -157,12 +211,12 @@ void server::init_connection() {
 void server::handle_accept(const boost::system::error_code& e) {
 	if (!e) {
 		connection_manager_.start(new_connection_);
-		new_connection_.reset(new connection(io_service_,
+		new_connection_.reset(new connection(io_service_, worker_service(),
 				connection_manager_, request_handler_, timeout_));
 		// listen for a subsequent request
 		acceptor_.async_accept(new_connection_->socket(),
-				boost::bind(&server::handle_accept, this,
-						boost::asio::placeholders::error));
+				accept_strand_.wrap(boost::bind(&server::handle_accept, this,
+						boost::asio::placeholders::error)));
 	}
 }
 
@@ -187,7 +241,7 @@ ssl_server::ssl_server(const server_settings & settings, request_handler & user_
 
 void ssl_server::init_connection() {
 
-	new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_, timeout_, context_));
+	new_connection_.reset(new connection(io_service_, worker_service(), connection_manager_, request_handler_, timeout_, context_));
 
 	// the following line gets the passphrase for protected private server keys
 	context_.set_password_callback(boost::bind(&ssl_server::get_passphrase, this));
@@ -271,7 +325,7 @@ void ssl_server::init_connection() {
 
 void ssl_server::reinit_connection()
 {
-	new_connection_.reset(new connection(io_service_, connection_manager_, request_handler_, timeout_, context_));
+	new_connection_.reset(new connection(io_service_, worker_service(), connection_manager_, request_handler_, timeout_, context_));
 
 	struct stat st;
 
@@ -317,8 +371,8 @@ void ssl_server::handle_accept(const boost::system::error_code& e) {
 		reinit_connection();
 		// listen for a subsequent request
 		acceptor_.async_accept(new_connection_->socket(),
-				boost::bind(&ssl_server::handle_accept, this,
-						boost::asio::placeholders::error));
+				accept_strand_.wrap(boost::bind(&ssl_server::handle_accept, this,
+						boost::asio::placeholders::error)));
 	}
 }
 
@@ -9,6 +9,9 @@
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <exception>
 #include "../main/Noncopyable.h"
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
@@ -41,9 +44,18 @@ public:
 protected:
 	void init(init_connectionhandler_func init_connection_handler, accept_handler_func accept_handler);
 
+	/// The service new connections hand their long requests to, NULL without worker threads
+	boost::asio::io_service *worker_service();
+
 	/// The io_service used to perform asynchronous operations.
 	boost::asio::io_service io_service_;
 
+	/// Serializes the acceptor handlers, the io_service is run by several threads
+	boost::asio::io_service::strand accept_strand_;
+
+	/// Runs the requests that may take long, keeps them off the network threads
+	boost::asio::io_service worker_service_;
+
 	/// Acceptor used to listen for incoming connections.
 	boost::asio::ip::tcp::acceptor acceptor_;
 
@@ -70,6 +82,15 @@ private:
 	/// Handle a request to stop the server.
 	void handle_stop();
 
+	/// Thread function for the network and worker threads
+	void run_io_service();
+	void run_worker_service();
+	std::vector<std::shared_ptr<std::thread> > io_threads_;
+	std::vector<std::shared_ptr<std::thread> > worker_threads_;
+	/// First exception thrown by a network thread, rethrown by run()
+	std::mutex exception_mutex_;
+	std::exception_ptr exception_;
+
 	boost::asio::steady_timer m_heartbeat_timer;
 	void heart_beat(const boost::system::error_code& error);
 };
@@ -26,15 +26,22 @@ public:
 	//feature
 	//std::string fastcgi_php_server; (like nginx)
 
+	int io_threads; //threads running the network loop
+	int worker_threads; //threads handling the requests that may take long (json commands, php), 0 = handled by the network loop
+
 
 	server_settings() :
+		io_threads(2),
+		worker_threads(4),
 		is_secure_(false) {}
 	server_settings(const server_settings & s) :
 		is_secure_(s.is_secure_),
 		www_root(s.www_root),
 		listening_address(s.listening_address),
 		listening_port(s.listening_port),
-		php_cgi_path(s.php_cgi_path)
+		php_cgi_path(s.php_cgi_path),
+		io_threads(s.io_threads),
+		worker_threads(s.worker_threads)
 		{}
 	virtual ~server_settings() {}
 	server_settings & operator=(const server_settings & s) {
@@ -43,6 +50,8 @@ public:
 		listening_address = s.listening_address;
 		listening_port = s.listening_port;
 		php_cgi_path = s.php_cgi_path;
+		io_threads = s.io_threads;
+		worker_threads = s.worker_threads;
 		return *this;
 	}
 	bool is_secure() const {
@@ -62,6 +71,8 @@ public:
 		listening_address = get_valid_value(listening_address, settings.listening_address);
 		listening_port = get_valid_value(listening_port, settings.listening_port);
 		php_cgi_path = get_valid_value(php_cgi_path, settings.php_cgi_path);
+		io_threads = settings.io_threads;
+		worker_threads = settings.worker_threads;
 		if (listening_port == "0") {
 			listening_port.clear();// server NOT enabled
 		}
@@ -73,11 +84,15 @@ public:
 			", listening_address='" + listening_address + "'" +
 			", listening_port='" + listening_port + "'" +
 			", php_cgi_path='" + php_cgi_path + "'" +
+			", io_threads=" + std::to_string(io_threads) +
+			", worker_threads=" + std::to_string(worker_threads) +
 			"]'";
 	}
 
 protected:
 	explicit server_settings(bool is_secure) :
+		io_threads(2),
+		worker_threads(4),
 		is_secure_(is_secure) {}
 	std::string get_valid_value(const std::string & old_value, const std::string & new_value) {
 		if ((!new_value.empty()) && (new_value.compare(old_value) != 0)) {
@@ -483,6 +483,9 @@ define(['app'], function (app) {
 					if (typeof data.UseAutoBackup != 'undefined') {
 						$("#autobackuptable #enableautobackup").prop('checked', data.UseAutoBackup == 1);
 					}
+					if (typeof data.CompressAutoBackup != 'undefined') {
+						$("#autobackuptable #compressautobackup").prop('checked', data.CompressAutoBackup == 1);
+					}
 					if (typeof data.EmailEnabled != 'undefined') {
 						$("#emailtable #EmailEnabled").prop('checked', data.EmailEnabled == 1);
 					}